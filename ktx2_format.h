@@ -0,0 +1,99 @@
+#pragma once
+
+// KTX 2.0 container, the subset written by tools/texconv and read by the renderer
+//
+//   Ktx2Header
+//   Ktx2LevelIndex  x levelCount        level 0 (the largest) first
+//   data format descriptor              required by the spec, readers here ignore it
+//   key/value data                      KTXwriter only
+//   levels                              smallest level first, each with all its layers
+//
+// No supercompression, no cube maps, no 3D textures. Formats are identified by their VkFormat
+// value, KTX2_FORMATS lists the ones the renderer knows how to size.
+
+#include <cstdint>
+#include <cstring>
+
+const uint8_t KTX2_IDENTIFIER[12] = {0xab, 0x4b, 0x54, 0x58, 0x20, 0x32, 0x30, 0xbb, 0x0d, 0x0a, 0x1a, 0x0a};
+
+struct Ktx2Header {
+    uint8_t identifier[12];
+    uint32_t vkFormat;
+    uint32_t typeSize;          // 1 for block compressed formats
+    uint32_t pixelWidth;
+    uint32_t pixelHeight;
+    uint32_t pixelDepth;        // 0 for 2D textures
+    uint32_t layerCount;        // 0 for textures that aren't arrays
+    uint32_t faceCount;
+    uint32_t levelCount;        // 0 asks the reader to generate the levels
+    uint32_t supercompressionScheme;
+    uint32_t dfdByteOffset;
+    uint32_t dfdByteLength;
+    uint32_t kvdByteOffset;
+    uint32_t kvdByteLength;
+    uint64_t sgdByteOffset;
+    uint64_t sgdByteLength;
+};
+
+struct Ktx2LevelIndex {
+    uint64_t byteOffset;
+    uint64_t byteLength;
+    uint64_t uncompressedByteLength;
+};
+
+static_assert(sizeof(Ktx2Header) == 80, "Ktx2Header layout is part of the file format");
+static_assert(sizeof(Ktx2LevelIndex) == 24, "Ktx2LevelIndex layout is part of the file format");
+
+struct Ktx2FormatInfo {
+    uint32_t vkFormat;
+    uint32_t blockWidth;
+    uint32_t blockHeight;
+    uint32_t blockBytes;
+    uint8_t dfdColorModel;      // KHR_DF_MODEL_*
+    bool srgb;
+    const char* name;
+};
+
+// VkFormat values, the renderer checks each against what the device samples
+const Ktx2FormatInfo KTX2_FORMATS[] = {
+    {23,  1,  1,  3,  1,   false, "rgb8"},
+    {29,  1,  1,  3,  1,   true,  "rgb8"},
+    {37,  1,  1,  4,  1,   false, "rgba8"},
+    {43,  1,  1,  4,  1,   true,  "rgba8"},
+    {131, 4,  4,  8,  128, false, "bc1"},
+    {132, 4,  4,  8,  128, true,  "bc1"},
+    {133, 4,  4,  8,  128, false, "bc1a"},
+    {134, 4,  4,  8,  128, true,  "bc1a"},
+    {137, 4,  4,  16, 130, false, "bc3"},
+    {138, 4,  4,  16, 130, true,  "bc3"},
+    {145, 4,  4,  16, 134, false, "bc7"},
+    {146, 4,  4,  16, 134, true,  "bc7"},
+    {147, 4,  4,  8,  161, false, "etc2"},
+    {148, 4,  4,  8,  161, true,  "etc2"},
+    {151, 4,  4,  16, 161, false, "etc2a"},
+    {152, 4,  4,  16, 161, true,  "etc2a"},
+    {157, 4,  4,  16, 162, false, "astc4x4"},
+    {158, 4,  4,  16, 162, true,  "astc4x4"},
+    {171, 8,  8,  16, 162, false, "astc8x8"},
+    {172, 8,  8,  16, 162, true,  "astc8x8"},
+};
+
+inline const Ktx2FormatInfo* ktx2FormatInfo(uint32_t vkFormat) {
+    for(const Ktx2FormatInfo& info : KTX2_FORMATS) {
+        if(info.vkFormat == vkFormat) {
+            return &info;
+        }
+    }
+    return nullptr;
+}
+
+// Bytes of one layer of a level, blocks at the edges count whole
+inline uint64_t ktx2LayerSize(const Ktx2FormatInfo& format, uint32_t width, uint32_t height) {
+    uint64_t blocksX = (width + format.blockWidth - 1) / format.blockWidth;
+    uint64_t blocksY = (height + format.blockHeight - 1) / format.blockHeight;
+    return blocksX * blocksY * format.blockBytes;
+}
+
+inline bool ktx2HasIdentifier(const Ktx2Header& header) {
+    return std::memcmp(header.identifier, KTX2_IDENTIFIER, sizeof(KTX2_IDENTIFIER)) == 0;
+}
@@ -8,6 +8,7 @@
 #define GLFW_INCLUDE_VULKAN
 #define GLM_FORCE_RADIANS
 #include <GLFW/glfw3.h>
+#include <shaderc/shaderc.hpp>
 
 #include <iostream>
 #include <fstream>
@@ -23,6 +24,31 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <chrono>
+#include <string>
+#include <sstream>
+#include <cmath>
+#include <mutex>
+#include <memory>
+#include <deque>
+#include <cstdio>
+#include <functional>
+#include <iomanip>
+#include <thread>
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <random>
+#include <cerrno>
+#include <sys/mman.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "mesh_format.h"
+#include "vertex_layout.h"
+#include "texture_mips.h"
+#include "ktx2_format.h"
 
 
 
@@ -33,9 +59,157 @@
 // ------------------ CONSTANTS ----------------- //
 const uint32_t WIDTH  = 800;
 const uint32_t HEIGHT = 600;
-const int MAX_FRAMES_IN_FLIGHT = 2;
+const uint32_t MAX_FRAMES_IN_FLIGHT     = 4;    // upper bound of --frames-in-flight
+const uint32_t DEFAULT_FRAMES_IN_FLIGHT = 2;
+const uint32_t OFFSCREEN_IMAGE_COUNT = 3;
+const uint32_t DEFAULT_BENCH_FRAMES  = 300;
+const uint32_t BENCH_WARMUP_FRAMES   = 10;
+const uint32_t MAX_RECORD_THREADS    = 16;
+const uint32_t MAX_INIT_THREADS      = 8;      // initVulkan has about that many independent chains
+const uint32_t PIPELINE_COMPILE_THREADS = 2;    // create pipelines asked for after startup
+const uint32_t MAX_DRAW_VARIANTS     = 64;
+const uint32_t VARIANT_APPEAR_FRAMES = 25;      // another draw list variant enters the scene this often
+const uint32_t DEFAULT_SIM_HZ        = 240;     // simulation steps per second with a render thread
+const uint32_t ACQUIRE_POLL_US       = 100;     // acquire and present wait retry interval while other threads share the swapchain
+const uint64_t PRESENT_WAIT_TIMEOUT_NS = 100000000;  // give up on a present that never shows up, e.g. of a retired swapchain
+const double DEFAULT_HITCH_MS        = 16.7;
+const uint32_t MAX_PROFILER_SCOPES   = 8;       // GPU scopes per frame, the frame itself included
+const size_t MAX_TRACE_EVENTS        = 1u << 20;
+const uint32_t OVERDRAW_BINS         = 16;      // pixels drawn 0 to 14 times, the last bin holds the rest
+const uint32_t OVERDRAW_GROUP_SIZE   = 16;      // overdraw.comp's workgroups are this many pixels square
+const VkFormat OVERDRAW_FORMAT       = VK_FORMAT_R16_SFLOAT;    // blendable everywhere, counts are exact to 2048
+
+static_assert(OVERDRAW_GROUP_SIZE * OVERDRAW_GROUP_SIZE >= OVERDRAW_BINS, "overdraw.comp zeroes a bin per invocation");
+
+// Queried around the render pass with --pipeline-stats, results come back in bit order
+const VkQueryPipelineStatisticFlags PIPELINE_STATS = VK_QUERY_PIPELINE_STATISTIC_INPUT_ASSEMBLY_VERTICES_BIT
+                                                   | VK_QUERY_PIPELINE_STATISTIC_INPUT_ASSEMBLY_PRIMITIVES_BIT
+                                                   | VK_QUERY_PIPELINE_STATISTIC_VERTEX_SHADER_INVOCATIONS_BIT
+                                                   | VK_QUERY_PIPELINE_STATISTIC_CLIPPING_INVOCATIONS_BIT
+                                                   | VK_QUERY_PIPELINE_STATISTIC_CLIPPING_PRIMITIVES_BIT
+                                                   | VK_QUERY_PIPELINE_STATISTIC_FRAGMENT_SHADER_INVOCATIONS_BIT;
+const uint32_t PIPELINE_STAT_COUNT = 6;
+const char* const PIPELINE_STAT_NAMES[PIPELINE_STAT_COUNT] = {
+    "input_vertices", "input_primitives", "vertex_invocations", "clipping_invocations", "clipping_primitives", "fragment_invocations"
+};
+const uint32_t TEXTURE_LAYERS        = 4;
+const uint32_t INSTANCE_STRESS_START  = 1024;
+const uint32_t INSTANCE_STRESS_MAX    = 1u << 21;
+const uint32_t INSTANCE_STRESS_FRAMES = 60;
+const uint32_t CULL_GROUP_SIZE        = 64;     // cull.comp's workgroup size, a specialization constant
+const uint32_t MIP_TILE_SIZE          = 64;     // level 0 texels per workgroup and axis in mipgen.comp
+const uint32_t MIP_COMPUTE_MAX_LEVELS = 13;     // mipgen.comp stops at 4096x4096
+const uint32_t MAX_STREAM_TEXTURES    = 256;    // sampler array size in streamed.frag, passed as a define
+const uint32_t STREAM_TEXTURE_SIZE    = 1024;   // of every streamed texture, passed to streamed.frag too
+const uint32_t STREAM_TAIL_SIZE       = 64;     // streamed levels this size and smaller never leave memory
+const uint32_t STREAM_REQUEST_FRAMES  = 8;      // older feedback doesn't ask for uploads anymore
+const uint32_t STREAM_BUDGET_INTERVAL = 30;     // frames between memory budget queries
+const VkDeviceSize STREAM_UPLOAD_BYTES_PER_FRAME = 16ull * 1024 * 1024;
+
+// textures/texture.<variant>.ktx2 written by tools/texconv, tried in this order before decoding texture.jpg
+const char* const TEXTURE_VARIANTS[] = {"bc7", "astc4x4", "etc2", "bc1"};
 // ---------------------------------------------- //
 
+enum class VertexFormat {
+    Float,      // position float3, color float3, texcoord float2: 32 bytes
+    Packed,     // position snorm16x4 relative to the bounds, color unorm8x4, texcoord half2: 16 bytes
+    Half,       // position half4, color unorm8x4, texcoord half2: 16 bytes
+};
+
+// How levels past the first are made, falling back to the next one when the device can't
+enum class MipMode {
+    Compute,    // single pass downsampler, one dispatch
+    Blit,       // vkCmdBlitImage chain, one level at a time
+    Cpu,        // box filter on the CPU, every level uploaded
+    Off,        // level 0 only
+};
+
+// What a draw does while its pipeline variant is still being created
+enum class PipelineFallback {
+    Generic,    // draw with the base pipeline meanwhile
+    Skip,       // don't draw until it's ready
+    Sync,       // create it right there on the render thread, the old behavior
+};
+
+// Command line options, filled in main()
+struct AppOptions {
+    bool headless = false;          // render into offscreen images, no window/surface/swapchain
+    uint32_t benchFrames = 0;       // render this many frames and report timings (0 = run until closed)
+    uint32_t width  = WIDTH;
+    uint32_t height = HEIGHT;
+    std::string deviceFilter;       // pick the first device whose name contains this
+    std::string jsonPath;           // where to write the bench report, stdout if empty
+    std::string tracePath;          // Chrome trace of CPU and GPU scopes, none if empty
+    bool pipelineStats = false;     // pipeline statistics queries around the render pass
+    bool overdraw = false;          // draw the draw list again additively and histogram the layers
+    std::string pipelineCachePath = "pipeline_cache.bin";  // empty disables the on-disk cache
+    std::string shaderCacheDir = "shader_cache";            // compiled SPIR-V by source hash, empty disables it
+    bool watchShaders = false;      // rebuild pipelines whose shaders change on disk
+    uint32_t drawCount = 1;         // quads drawn per frame, laid out on a grid
+    uint32_t drawVariants = 1;      // pipeline variants the draw list spreads over, new ones appear while running
+    PipelineFallback pipelineFallback = PipelineFallback::Generic;
+    double hitchMs = DEFAULT_HITCH_MS;  // CPU frame time counted as a hitch
+    uint32_t framesInFlight = DEFAULT_FRAMES_IN_FLIGHT;  // frames the CPU may run ahead of the GPU
+    bool renderThread = false;      // simulate on the main thread, record and submit on a render thread
+    bool presentThread = false;     // present from a third thread, implies renderThread
+    uint32_t simHz = DEFAULT_SIM_HZ;    // simulation steps per second with a render thread, 0 = as fast as it can
+    VkPresentModeKHR presentMode = VK_PRESENT_MODE_MAILBOX_KHR;    // FIFO where the surface doesn't have it
+    uint32_t swapchainImages = 0;   // 0 = minImageCount + 1
+    bool lowLatency = false;        // start a frame only once the previous one is on screen
+    int recordThreads = -1;         // threads recording secondary command buffers, 0 = inline, -1 = one per core
+    uint32_t instanceCount = 0;     // draw this many instances in one instanced call instead of the draw list
+    double instanceStressMs = 0.0;  // search for the instance count that fits this frame time (0 = off)
+    uint32_t cullObjectCount = 0;   // GPU culled scene of this many objects drawn indirectly (0 = off)
+    std::string meshPath;           // .vmesh to draw instead of the built-in quad
+    VertexFormat vertexFormat = VertexFormat::Float;  // layout the mesh is repacked to before upload
+    bool positionOnly = false;      // draw list reads only the position stream, like a depth pass would
+    bool untextured = false;        // instanced and culled scenes skip texture sampling
+    MipMode mipMode = MipMode::Compute;
+    std::string texturePath;        // .ktx2 or image to load instead of the textures/ defaults
+    bool textureStaging = false;    // never write decoded textures straight into host visible device local memory
+    int initThreads = -1;           // helper threads running initVulkan's steps, 0 = all on the main thread
+    uint32_t streamTextureCount = 0;    // synthetic scene of this many streamed textures (0 = off)
+    uint32_t streamBudgetMB = 0;        // cap on their resident memory, 0 = what VK_EXT_memory_budget allows
+};
+
+static const char* vertexFormatName(VertexFormat format) {
+    switch(format) {
+        case VertexFormat::Float:  return "float";
+        case VertexFormat::Packed: return "packed";
+        case VertexFormat::Half:   return "half";
+    }
+    return "unknown";
+}
+
+static const char* pipelineFallbackName(PipelineFallback fallback) {
+    switch(fallback) {
+        case PipelineFallback::Generic: return "generic";
+        case PipelineFallback::Skip:    return "skip";
+        case PipelineFallback::Sync:    return "sync";
+    }
+    return "unknown";
+}
+
+static const char* presentModeName(VkPresentModeKHR mode) {
+    switch(mode) {
+        case VK_PRESENT_MODE_FIFO_KHR:         return "fifo";
+        case VK_PRESENT_MODE_FIFO_RELAXED_KHR: return "fifo-relaxed";
+        case VK_PRESENT_MODE_MAILBOX_KHR:      return "mailbox";
+        case VK_PRESENT_MODE_IMMEDIATE_KHR:    return "immediate";
+        default:                               return "unknown";
+    }
+}
+
+static const char* mipModeName(MipMode mode) {
+    switch(mode) {
+        case MipMode::Compute: return "compute";
+        case MipMode::Blit:    return "blit";
+        case MipMode::Cpu:     return "cpu";
+        case MipMode::Off:     return "off";
+    }
+    return "unknown";
+}
+
 const std::vector<const char*> validationLayers = {
     "VK_LAYER_KHRONOS_validation",
 };
@@ -52,34 +226,75 @@ const std::vector<const char*> deviceExtensions = {
 
 
 struct Vertex {
-    glm::vec2 pos;
+    glm::vec3 pos;
     glm::vec3 color;
+    glm::vec2 texCoord;
+};
 
-    static VkVertexInputBindingDescription getBindingDescription() {
-
-        VkVertexInputBindingDescription bindingDescription{};
-        bindingDescription.binding   = 0;
-        bindingDescription.stride    = sizeof(Vertex);
-        bindingDescription.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+// Per instance stream (binding 1) of the instanced pipeline
+struct InstanceData {
+    glm::vec4 transform[3];     // top three rows of the model matrix
+    uint32_t color;             // RGBA8 unorm
+    uint32_t textureIndex;      // layer of the texture array
+};
 
-        return bindingDescription;
-    }
+// Vertex input layouts, Vulkan's binding and attribute descriptions are generated from these
+using VertexFloatLayout    = VertexLayout<Attribute<0, Float3>, Attribute<1, Float3>, Attribute<2, Float2>>;
+using PackedVertexLayout   = VertexLayout<Attribute<0, Snorm16x4>, Attribute<1, Unorm8x4>, Attribute<2, Half2>>;
+using HalfVertexLayout     = VertexLayout<Attribute<0, Half4>, Attribute<1, Unorm8x4>, Attribute<2, Half2>>;
+using PositionStreamLayout = VertexLayout<Attribute<0, Snorm16x4>>;
+using InstanceLayout       = VertexLayout<Attribute<3, Float4>, Attribute<4, Float4>, Attribute<5, Float4>,
+                                          Attribute<6, Unorm8x4>, Attribute<7, Uint32>>;
+
+static_assert(VertexFloatLayout::stride == sizeof(Vertex) &&
+              VertexFloatLayout::offset<1>() == offsetof(Vertex, color) &&
+              VertexFloatLayout::offset<2>() == offsetof(Vertex, texCoord), "VertexFloatLayout has to match Vertex");
+static_assert(InstanceLayout::stride == sizeof(InstanceData) &&
+              InstanceLayout::offset<3>() == offsetof(InstanceData, color) &&
+              InstanceLayout::offset<4>() == offsetof(InstanceData, textureIndex), "InstanceLayout has to match InstanceData");
+static_assert(PackedVertexLayout::stride == 16 && HalfVertexLayout::stride == 16 && PositionStreamLayout::stride == 8,
+              "packed layouts are half and a quarter of the float one");
+
+// Push constants of mipgen.comp
+struct MipParams {
+    uint32_t width;
+    uint32_t height;
+    uint32_t levels;            // generated, not counting level 0
+    uint32_t workGroupsPerLayer;
+};
 
-    static std::array<VkVertexInputAttributeDescription, 2> getAttributeDescriptions() {
-        std::array<VkVertexInputAttributeDescription, 2> attributeDescriptions{};
+// Push constants of overdraw.comp
+struct OverdrawParams {
+    uint32_t width;
+    uint32_t height;
+};
 
-        attributeDescriptions[0].binding  = 0;
-        attributeDescriptions[0].location = 0;
-        attributeDescriptions[0].format   = VK_FORMAT_R32G32_SFLOAT;
-        attributeDescriptions[0].offset   = offsetof(Vertex, pos);
+// A texture whose levels past the first get generated on the graphics queue once its upload is acquired
+struct MipJob {
+    VkImage image = VK_NULL_HANDLE;
+    uint32_t width  = 0;
+    uint32_t height = 0;
+    uint32_t layers = 0;
+    uint32_t levels = 0;
+    uint64_t uploadId = 0;
+    uint64_t recordedFrame = 0;
+    std::vector<VkImageView> views;             // compute path: level 0 sampled, then every level as storage
+};
 
-        attributeDescriptions[1].binding  = 0;
-        attributeDescriptions[1].location = 1;
-        attributeDescriptions[1].format   = VK_FORMAT_R32G32B32_SFLOAT;
-        attributeDescriptions[1].offset   = offsetof(Vertex, color);
+// Push constants of cull.comp
+struct CullParams {
+    uint32_t objectCount;
+    uint32_t indexCount;
+    uint32_t compact;
+};
 
-        return attributeDescriptions;
-    }
+// CPU side of an instance, turned into InstanceData every frame
+struct InstanceState {
+    glm::vec3 position;
+    float scale;
+    float phase;                // rotation offset so instances don't all spin in lockstep
+    uint32_t color;
+    uint32_t textureIndex;
 };
 
 struct UniformBufferObject {
@@ -88,11 +303,29 @@ struct UniformBufferObject {
     alignas(16) glm::mat4 proj;
 };
 
+// One entry of the per-frame draw list
+struct DrawItem {
+    glm::mat4 transform;
+    uint32_t variant;       // index into the draw list's pipeline variants
+};
+
+// What one simulation step hands the renderer, never changed once published
+struct FramePacket {
+    uint64_t step = 0;                      // simulation step that built it, from 1
+    float time = 0.0f;                      // scene time in seconds
+    UniformBufferObject uniforms{};         // camera, the model matrix is the scene's rotation
+    std::vector<DrawItem> drawList;
+    std::vector<InstanceData> instances;    // copied into the frame's instance buffer as is
+    VkExtent2D framebuffer{};               // window size at that step, GLFW can't be asked from other threads
+    std::chrono::high_resolution_clock::time_point inputTime;     // when the step polled input
+};
+
+// Built-in quad, drawn when no --mesh is given
 const std::vector<Vertex> vertices = {
-    {{-0.5f, -0.5f}, {1.0f, 0.0f, 0.0f}},
-    {{0.5f, -0.5f}, {0.0f, 1.0f, 0.0f}},
-    {{0.5f, 0.5f}, {0.0f, 0.0f, 1.0f}},
-    {{-0.5f, 0.5f}, {1.0f, 1.0f, 1.0f}}
+    {{-0.5f, -0.5f, 0.0f}, {1.0f, 0.0f, 0.0f}, {1.0f, 0.0f}},
+    {{0.5f, -0.5f, 0.0f}, {0.0f, 1.0f, 0.0f}, {0.0f, 0.0f}},
+    {{0.5f, 0.5f, 0.0f}, {0.0f, 0.0f, 1.0f}, {0.0f, 1.0f}},
+    {{-0.5f, 0.5f, 0.0f}, {1.0f, 1.0f, 1.0f}, {1.0f, 1.0f}}
 };
 
 const std::vector<uint16_t> indices = {
@@ -103,6 +336,7 @@ const std::vector<uint16_t> indices = {
 struct QueueFamilyIndices {
     std::optional<uint32_t> graphicsFamily;
     std::optional<uint32_t> presentFamily;
+    std::optional<uint32_t> transferFamily;     // transfer only family if there is one, else the graphics family
 
     bool isComplete() {
         return graphicsFamily.has_value() && presentFamily.has_value();
@@ -141,1464 +375,8136 @@ void DestroyDebugUtilsMessengerEXT(VkInstance instance, VkDebugUtilsMessengerEXT
 
 }
 
-static std::vector<char> readFile(const std::string& filename) {
-    std::ifstream file(filename, std::ios::ate | std::ios::binary);
-
-    if(!file.is_open()) {
-        throw std::runtime_error("failed to open file!");
+// min/p50/p99/max of a set of frame times as a JSON object, null if there are none
+static std::string frameTimeStatsJson(std::vector<double> samples) {
+    if(samples.empty()) {
+        return "null";
     }
 
-    size_t fileSize = (size_t) file.tellg();
-    std::vector<char> buffer(fileSize);
+    std::sort(samples.begin(), samples.end());
 
-    file.seekg(0);
-    file.read(buffer.data(), fileSize);
-
-    file.close();
-    return buffer;
-}
+    auto percentile = [&samples](double p) {
+        size_t rank = static_cast<size_t>(std::ceil(p * samples.size()));
+        return samples[std::min(samples.size() - 1, rank > 0 ? rank - 1 : 0)];
+    };
 
+    std::ostringstream json;
+    json << "{\"min\": " << samples.front()
+         << ", \"p50\": " << percentile(0.50)
+         << ", \"p99\": " << percentile(0.99)
+         << ", \"max\": " << samples.back() << "}";
 
-class HelloTriangleApplication {
-public:
-    void run() {
-        initWindow();
-        initVulkan();
-        mainLoop();
-        cleanup();
-    }
+    return json.str();
+}
 
-private:
-    GLFWwindow* _window;
-    VkInstance  _instance;
-    VkDebugUtilsMessengerEXT _debugMessenger;
-    VkSurfaceKHR _surface;
-    VkPhysicalDevice _physicalDevice = VK_NULL_HANDLE;
-    VkDevice _device;
-    VkQueue _graphicsQueue;
-    VkQueue _presentQueue;
-    VkSwapchainKHR _swapChain;
-    std::vector<VkImage> _swapChainImages;
-    VkFormat _swapChainImageFormat;
-    VkExtent2D _swapChainExtent;
-    std::vector<VkImageView> _swapChainImageViews;
-    VkRenderPass _renderPass;
 
-    VkDescriptorSetLayout _descriptorSetLayout;
-    VkPipelineLayout _pipelineLayout;
+// ------------------------------------------------------------------------------------- //
+// Device memory allocator
+//
+// vkAllocateMemory is slow and limited to maxMemoryAllocationCount allocations, so
+// resources are carved out of large per-memory-type blocks instead. Each block is a
+// buddy allocator: sizes are rounded up to a power of two, which keeps every
+// sub-allocation aligned to its own size and makes freeing a cheap merge with its buddy.
+//
+// Buffers/linear images and optimal images must not share a bufferImageGranularity
+// "page". When the granularity is bigger than the smallest buddy they get separate
+// blocks, otherwise buddy alignment already keeps them apart.
+//
+// Short lived staging buffers come from separate linear blocks. Each block is rewound as
+// soon as its own last allocation is freed, so a steady stream of upload batches cycles
+// through a few blocks instead of waiting for a moment with no staging alive at all.
+// ------------------------------------------------------------------------------------- //
+
+const VkDeviceSize MIN_BUDDY_SIZE         = 256;
+const VkDeviceSize DEFAULT_BLOCK_SIZE     = 64ull * 1024 * 1024;
+const VkDeviceSize DEFAULT_STAGING_SIZE   = 16ull * 1024 * 1024;
+
+enum class ResourceKind {
+    Linear,     // buffers and linear tiled images
+    Optimal,    // optimal tiled images
+};
 
-    VkPipeline _graphicsPipeline;
-    std::vector<VkFramebuffer> _swapChainFramebuffers;
-    VkCommandPool _commandPool;
-    std::vector<VkCommandBuffer> _commandBuffers;
-    std::vector<VkSemaphore> _imageAvailableSemaphores;
-    std::vector<VkSemaphore> _renderFinishedSemaphores;
-    std::vector<VkFence> _inFlightFences;
-    std::vector<VkFence> _imagesInFlight;
-    size_t currentFrame = 0;
-    bool framebufferResized = false;
-    VkBuffer _vertexBuffer;
-    VkDeviceMemory _vertexBufferMemory;
-    VkBuffer _indexBuffer;
-    VkDeviceMemory _indexBufferMemory;
+struct MemoryBlock {
+    VkDeviceMemory memory = VK_NULL_HANDLE;
+    VkDeviceSize size = 0;
+    uint32_t memoryType = 0;
+    ResourceKind kind = ResourceKind::Linear;
+    char* mapped = nullptr;
 
-    std::vector<VkBuffer> _uniformBuffers;
-    std::vector<VkDeviceMemory> _uniformBuffersMemory;
+    // Free buddies, freeLists[order] holds offsets of free ranges of MIN_BUDDY_SIZE << order bytes
+    std::vector<std::set<VkDeviceSize>> freeLists;
+    VkDeviceSize reserved = 0;
+    uint32_t allocationCount = 0;
 
-    VkDescriptorPool _descriptorPool;
-    std::vector<VkDescriptorSet> _descriptorSets;
+    // Linear (staging) blocks just bump this
+    VkDeviceSize linearOffset = 0;
+};
 
-    VkImage _textureImage;
-    VkDeviceMemory _textureImageMemory;
+struct Allocation {
+    VkDeviceMemory memory = VK_NULL_HANDLE;
+    VkDeviceSize offset = 0;
+    VkDeviceSize size = 0;
+    void* mapped = nullptr;     // persistently mapped pointer if the memory is host visible
 
+    enum class Type { None, Block, Dedicated, Staging } type = Type::None;
+    MemoryBlock* block = nullptr;
+    uint32_t order = 0;
+};
 
+class DeviceAllocator {
+public:
+    void init(VkPhysicalDevice physicalDevice, VkDevice device) {
+        _device = device;
 
+        vkGetPhysicalDeviceMemoryProperties(physicalDevice, &_memProperties);
 
-    static VKAPI_ATTR VkBool32 VKAPI_CALL debugCallback(
-        VkDebugUtilsMessageSeverityFlagBitsEXT messageSeverity,
-        VkDebugUtilsMessageTypeFlagsEXT messageType,
-        const VkDebugUtilsMessengerCallbackDataEXT* pCallbackData,
-        void *pUserData) {
+        VkPhysicalDeviceProperties deviceProperties;
+        vkGetPhysicalDeviceProperties(physicalDevice, &deviceProperties);
+        _bufferImageGranularity   = deviceProperties.limits.bufferImageGranularity;
+        _maxMemoryAllocationCount = deviceProperties.limits.maxMemoryAllocationCount;
 
-            /* TODO: CAN BE USED IF NEEDED!
-                if (messageSeverity >= VK_DEBUG_UTILS_MESSAGE_SEVERITY_WARNING_BIT_EXT) {
-                    // Message is important enough to show
-                }
-            */
+        _stats.assign(_memProperties.memoryTypeCount, TypeStats{});
+    }
 
-            std::cerr << "validation layer: " << pCallbackData->pMessage << std::endl;
+    void destroy() {
+        std::lock_guard<std::mutex> lock(_mutex);
 
-            return VK_FALSE;
+        for(auto& block : _blocks) {
+            releaseBlock(*block);
+        }
+        for(auto& block : _stagingBlocks) {
+            releaseBlock(*block);
+        }
+        _blocks.clear();
+        _stagingBlocks.clear();
     }
 
-    void initWindow() {
-        glfwInit();
-        glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
-
-        _window = glfwCreateWindow(WIDTH, HEIGHT, "Vulkan", nullptr, nullptr);
-        glfwSetWindowUserPointer(_window, this);
-        glfwSetFramebufferSizeCallback(_window, framebufferResizeCallback);
+    const VkPhysicalDeviceMemoryProperties& memoryProperties() const {
+        return _memProperties;
     }
 
-    static void framebufferResizeCallback(GLFWwindow* window, int width, int height) {
-        auto app = reinterpret_cast<HelloTriangleApplication*>(glfwGetWindowUserPointer(window));
-        app->framebufferResized = true;
+    uint32_t findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties) const {
+        for(uint32_t i = 0; i < _memProperties.memoryTypeCount; i++) {
+            if(typeFilter & (1 << i) && (_memProperties.memoryTypes[i].propertyFlags & properties) == properties) {
+                return i;
+            }
+        }
+
+        throw std::runtime_error("failed to find suitable memory type!");
     }
 
-    bool checkValidationLayerSupport() {
+    Allocation allocate(const VkMemoryRequirements& requirements, VkMemoryPropertyFlags properties, ResourceKind kind) {
+        std::lock_guard<std::mutex> lock(_mutex);
 
-        uint32_t layerCount;
-        vkEnumerateInstanceLayerProperties(&layerCount, nullptr);
+        uint32_t memoryType = findMemoryType(requirements.memoryTypeBits, properties);
+        VkDeviceSize blockSize = preferredBlockSize(memoryType);
 
-        std::vector<VkLayerProperties> availableLayers(layerCount);
-        vkEnumerateInstanceLayerProperties(&layerCount, availableLayers.data());
+        // Resources that would take up most of a block get their own VkDeviceMemory
+        if(requirements.size > blockSize / 2) {
+            return allocateDedicated(requirements.size, memoryType);
+        }
 
+        if(_bufferImageGranularity <= MIN_BUDDY_SIZE) {
+            kind = ResourceKind::Linear;
+        }
 
-        for(const char* layerName : validationLayers) {
-            bool layerFound = false;
+        uint32_t order = orderForSize(std::max(requirements.size, requirements.alignment));
 
-            for(const auto& layerProperties : availableLayers) {
-                if(strcmp(layerName, layerProperties.layerName) == 0) {
-                    layerFound = true;
-                    break;
-                }
+        for(auto& block : _blocks) {
+            VkDeviceSize offset;
+            if(block->memoryType == memoryType && block->kind == kind && allocateFromBlock(*block, order, offset)) {
+                return makeBlockAllocation(*block, offset, order, requirements.size);
             }
+        }
 
-            if(!layerFound) {
-                return false;
-            }
+        MemoryBlock& block = createBlock(memoryType, blockSize, kind, BlockUse::Buddy);
 
+        VkDeviceSize offset;
+        if(!allocateFromBlock(block, order, offset)) {
+            throw std::runtime_error("failed to sub-allocate from a new memory block!");
         }
-        return true;
+
+        return makeBlockAllocation(block, offset, order, requirements.size);
     }
 
-    bool areAllExtensionsIncluded(const char **glfwExtensions, uint32_t& glfwExtensionCount) {
+    // Bytes an allocation keeps out of its heap, a block allocation holds its whole power of two buddy
+    static VkDeviceSize reservedSize(const Allocation& allocation) {
+        return allocation.type == Allocation::Type::Block ? MIN_BUDDY_SIZE << allocation.order : allocation.size;
+    }
 
-        uint32_t extensionCount = 0;
-        vkEnumerateInstanceExtensionProperties(nullptr, &extensionCount, nullptr);
-        std::vector<VkExtensionProperties> extensions(extensionCount);
-        vkEnumerateInstanceExtensionProperties(nullptr, &extensionCount, extensions.data());
+    // Bytes allocate() would reserve for these requirements, without allocating
+    VkDeviceSize reservedSize(const VkMemoryRequirements& requirements, VkMemoryPropertyFlags properties) const {
+        uint32_t memoryType = findMemoryType(requirements.memoryTypeBits, properties);
+        if(requirements.size > preferredBlockSize(memoryType) / 2) {
+            return requirements.size;
+        }
+        return MIN_BUDDY_SIZE << orderForSize(std::max(requirements.size, requirements.alignment));
+    }
 
-        int counter = 0;
+    // Host visible, coherent memory for data that only lives until its upload has finished
+    Allocation allocateStaging(const VkMemoryRequirements& requirements) {
+        std::lock_guard<std::mutex> lock(_mutex);
 
-        for(int i=0; i<glfwExtensionCount; i++) {
-            for(int j=0; j<extensions.size(); j++) {
-                if(strcmp(glfwExtensions[i],extensions[j].extensionName) == 0)
-                    counter++;
+        uint32_t memoryType = findMemoryType(requirements.memoryTypeBits,
+                                             VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                                             VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+
+        for(auto& block : _stagingBlocks) {
+            VkDeviceSize offset = alignUp(block->linearOffset, requirements.alignment);
+            if(block->memoryType == memoryType && offset + requirements.size <= block->size) {
+                return makeStagingAllocation(*block, offset, requirements.size);
             }
         }
 
-        if(counter != glfwExtensionCount)
-            return false;
-
-        return true;
-
+        MemoryBlock& block = createBlock(memoryType, std::max(DEFAULT_STAGING_SIZE, requirements.size),
+                                         ResourceKind::Linear, BlockUse::Staging);
+        _stagingBlockPeak = std::max(_stagingBlockPeak, _stagingBlocks.size());
+        return makeStagingAllocation(block, 0, requirements.size);
     }
 
-    std::vector<const char*> getRequiredExtensions() {
-        uint32_t glfwExtensionCount = 0;
-        const char** glfwExtensions;
-        glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
-
-        std::vector<const char*> extensions(glfwExtensions, glfwExtensions + glfwExtensionCount);
+    VkDeviceSize stagingPeak() {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _stagingPeak;
+    }
 
-        if(enableValidationLayers) {
-            extensions.push_back(VK_EXT_DEBUG_UTILS_EXTENSION_NAME);
-        }
+    size_t stagingBlockPeak() {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _stagingBlockPeak;
+    }
 
-        return extensions;
+    void free(Allocation& allocation) {
+        std::lock_guard<std::mutex> lock(_mutex);
 
-    }
+        TypeStats* stats = nullptr;
+        switch(allocation.type) {
+            case Allocation::Type::None:
+                return;
 
-    QueueFamilyIndices findQueueFamilies(VkPhysicalDevice device) {
-        QueueFamilyIndices indices;
+            case Allocation::Type::Dedicated:
+                stats = &_stats[allocation.block->memoryType];
+                stats->dedicatedCount--;
+                stats->dedicatedBytes -= allocation.block->size;
+                releaseBlock(*allocation.block);
+                eraseBlock(_blocks, allocation.block);
+                break;
 
-        uint32_t queueFamilyCount = 0;
-        vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount, nullptr);
+            case Allocation::Type::Block:
+                stats = &_stats[allocation.block->memoryType];
+                stats->usedBytes -= allocation.size;
+                stats->allocationCount--;
+                allocation.block->reserved -= MIN_BUDDY_SIZE << allocation.order;
+                allocation.block->allocationCount--;
+                freeToBlock(*allocation.block, allocation.offset, allocation.order);
+                releaseIfSpare(allocation.block);
+                break;
 
-        std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
-        vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount, queueFamilies.data());
+            case Allocation::Type::Staging:
+                _stagingUsed -= allocation.size;
+                if(--allocation.block->allocationCount == 0) {
+                    recycleStaging(allocation.block);
+                }
+                break;
+        }
 
-        int i = 0;
-        for(const auto& queueFamily : queueFamilies) {
+        allocation = Allocation{};
+    }
 
+    void dumpStats(std::ostream& out) {
+        std::lock_guard<std::mutex> lock(_mutex);
 
-            VkBool32 presentSupport = false;
-            vkGetPhysicalDeviceSurfaceSupportKHR(device, i, _surface, &presentSupport);
-            if(presentSupport) {
-                indices.presentFamily = i;
+        out << "device memory allocator:\n";
+        for(uint32_t type = 0; type < _memProperties.memoryTypeCount; type++) {
+            const TypeStats& stats = _stats[type];
+            if(stats.blockCount == 0 && stats.dedicatedCount == 0) {
+                continue;
             }
 
-            if(queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT) {
-                indices.graphicsFamily = i;
+            VkDeviceSize reserved = 0;
+            VkDeviceSize largestFree = 0;
+            for(const auto& block : _blocks) {
+                if(block->memoryType != type || block->freeLists.empty()) {
+                    continue;
+                }
+                reserved += block->reserved;
+                for(size_t order = block->freeLists.size(); order-- > 0;) {
+                    if(!block->freeLists[order].empty()) {
+                        largestFree = std::max(largestFree, MIN_BUDDY_SIZE << order);
+                        break;
+                    }
+                }
             }
 
-            if(indices.isComplete()) {
-                break;
-            }
+            // 0 when all free space is one contiguous range, towards 1 the more it is scattered
+            VkDeviceSize freeBytes = stats.blockBytes - reserved;
+            double fragmentation = freeBytes > 0 ? 1.0 - double(largestFree) / double(freeBytes) : 0.0;
 
-            i++;
+            out << "  memory type " << type
+                << " (flags 0x" << std::hex << _memProperties.memoryTypes[type].propertyFlags << std::dec << "): "
+                << stats.blockCount << " blocks / " << stats.blockBytes << " bytes, "
+                << stats.allocationCount << " allocations using " << stats.usedBytes
+                << " bytes (" << reserved << " reserved), fragmentation " << fragmentation << ", "
+                << stats.dedicatedCount << " dedicated / " << stats.dedicatedBytes << " bytes\n";
         }
 
-        // Assign index to queue families that could be found
-        return indices;
+        out << "  staging: peak " << _stagingPeak << " bytes in at most " << _stagingBlockPeak << " blocks\n";
+        out << "  vkAllocateMemory calls: " << _allocateCalls << ", peak live " << _peakDeviceAllocations
+            << " of " << _maxMemoryAllocationCount << " allowed\n";
     }
 
-    VkShaderModule createShaderModule(const std::vector<char>& code) {
-        VkShaderModuleCreateInfo createInfo{};
-        createInfo.sType    = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
-        createInfo.codeSize = code.size();
-        createInfo.pCode    = reinterpret_cast<const uint32_t*>(code.data());
+private:
+    enum class BlockUse { Buddy, Dedicated, Staging };
+
+    struct TypeStats {
+        uint32_t blockCount = 0;
+        VkDeviceSize blockBytes = 0;
+        uint32_t allocationCount = 0;
+        VkDeviceSize usedBytes = 0;
+        uint32_t dedicatedCount = 0;
+        VkDeviceSize dedicatedBytes = 0;
+    };
+
+    VkDevice _device = VK_NULL_HANDLE;
+    VkPhysicalDeviceMemoryProperties _memProperties{};
+    VkDeviceSize _bufferImageGranularity = 1;
+    uint32_t _maxMemoryAllocationCount = 0;
+
+    std::mutex _mutex;
+    std::vector<std::unique_ptr<MemoryBlock>> _blocks;
+    std::vector<std::unique_ptr<MemoryBlock>> _stagingBlocks;
+    VkDeviceSize _stagingUsed = 0;
+    VkDeviceSize _stagingPeak = 0;
+    size_t _stagingBlockPeak = 0;
+
+    std::vector<TypeStats> _stats;
+    uint32_t _allocateCalls = 0;
+    uint32_t _deviceAllocations = 0;
+    uint32_t _peakDeviceAllocations = 0;
+
+    static VkDeviceSize alignUp(VkDeviceSize value, VkDeviceSize alignment) {
+        return alignment > 1 ? (value + alignment - 1) / alignment * alignment : value;
+    }
 
-        VkShaderModule shaderModule;
-        if (vkCreateShaderModule(_device, &createInfo, nullptr, &shaderModule) != VK_SUCCESS) {
-            throw std::runtime_error("failed to create shader model!");
+    static uint32_t orderForSize(VkDeviceSize size) {
+        uint32_t order = 0;
+        while((MIN_BUDDY_SIZE << order) < size) {
+            order++;
         }
+        return order;
+    }
 
-        return shaderModule;
+    VkDeviceSize preferredBlockSize(uint32_t memoryType) const {
+        // Small heaps (e.g. the 256MB BAR window) shouldn't be eaten by a couple of blocks
+        VkDeviceSize heapSize = _memProperties.memoryHeaps[_memProperties.memoryTypes[memoryType].heapIndex].size;
+        VkDeviceSize blockSize = DEFAULT_BLOCK_SIZE;
+        while(blockSize > MIN_BUDDY_SIZE * 1024 && blockSize > heapSize / 8) {
+            blockSize /= 2;
+        }
+        return blockSize;
     }
 
-    void createInstance() {
+    MemoryBlock& createBlock(uint32_t memoryType, VkDeviceSize size, ResourceKind kind, BlockUse use) {
+        auto block = std::make_unique<MemoryBlock>();
+        block->memoryType = memoryType;
+        block->size = size;
+        block->kind = kind;
 
-        if(enableValidationLayers && !checkValidationLayerSupport()) {
-            throw std::runtime_error("Validation layers requested, but not available!");
+        VkMemoryAllocateInfo allocInfo{};
+        allocInfo.sType           = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+        allocInfo.allocationSize  = size;
+        allocInfo.memoryTypeIndex = memoryType;
+
+        if(vkAllocateMemory(_device, &allocInfo, nullptr, &block->memory) != VK_SUCCESS) {
+            throw std::runtime_error("failed to allocate device memory block!");
         }
-        
 
-        VkApplicationInfo appInfo{};
-        appInfo.sType              = VK_STRUCTURE_TYPE_APPLICATION_INFO;
-        appInfo.pApplicationName   = "Hello Triangle";
-        appInfo.applicationVersion = VK_MAKE_VERSION(1, 0, 0);
-        appInfo.pEngineName        = "No Engine";
-        appInfo.engineVersion      = VK_MAKE_VERSION(1, 0, 0);
-        appInfo.apiVersion         = VK_API_VERSION_1_0;
+        _allocateCalls++;
+        _peakDeviceAllocations = std::max(_peakDeviceAllocations, ++_deviceAllocations);
 
+        if(_memProperties.memoryTypes[memoryType].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) {
+            void* data;
+            if(vkMapMemory(_device, block->memory, 0, VK_WHOLE_SIZE, 0, &data) != VK_SUCCESS) {
+                throw std::runtime_error("failed to map device memory block!");
+            }
+            block->mapped = static_cast<char*>(data);
+        }
 
-        VkInstanceCreateInfo createInfo{};
-        createInfo.sType            = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
-        createInfo.pApplicationInfo = &appInfo;
+        // The whole block starts out as one free buddy of the highest order
+        if(use == BlockUse::Buddy) {
+            block->freeLists.resize(orderForSize(size) + 1);
+            block->freeLists.back().insert(0);
 
-        uint32_t glfwExtensionCount = 0;
-        const char** glfwExtensions;
+            _stats[memoryType].blockCount++;
+            _stats[memoryType].blockBytes += size;
+        }
 
+        auto& list = use == BlockUse::Staging ? _stagingBlocks : _blocks;
+        list.push_back(std::move(block));
+        return *list.back();
+    }
 
-        auto extensions = getRequiredExtensions();
-        createInfo.enabledExtensionCount   = static_cast<uint32_t>(extensions.size());
-        createInfo.ppEnabledExtensionNames = extensions.data();
+    void releaseBlock(MemoryBlock& block) {
+        if(block.mapped) {
+            vkUnmapMemory(_device, block.memory);
+        }
+        vkFreeMemory(_device, block.memory, nullptr);
+        _deviceAllocations--;
 
+        if(!block.freeLists.empty()) {
+            _stats[block.memoryType].blockCount--;
+            _stats[block.memoryType].blockBytes -= block.size;
+        }
+    }
 
-        VkDebugUtilsMessengerCreateInfoEXT debugCreateInfo;
-        if (enableValidationLayers) {
+    static void eraseBlock(std::vector<std::unique_ptr<MemoryBlock>>& list, MemoryBlock* block) {
+        list.erase(std::find_if(list.begin(), list.end(),
+                                [block](const std::unique_ptr<MemoryBlock>& b) { return b.get() == block; }));
+    }
 
-            createInfo.enabledLayerCount   = static_cast<uint32_t>(validationLayers.size());
-            createInfo.ppEnabledLayerNames =  validationLayers.data();
+    // Empty blocks are given back, unless it is the only one left for its memory type
+    void releaseIfSpare(MemoryBlock* block) {
+        if(block->allocationCount > 0) {
+            return;
+        }
 
-            populateDebugMessengerCreateInfo(debugCreateInfo);
-            createInfo.pNext = (VkDebugUtilsMessengerCreateInfoEXT*) &debugCreateInfo;
+        for(const auto& other : _blocks) {
+            if(other.get() != block && other->memoryType == block->memoryType &&
+               other->kind == block->kind && !other->freeLists.empty()) {
+                releaseBlock(*block);
+                eraseBlock(_blocks, block);
+                return;
+            }
+        }
+    }
 
-        } else {
+    bool allocateFromBlock(MemoryBlock& block, uint32_t order, VkDeviceSize& offset) {
+        // Dedicated blocks have no free lists
+        if(block.freeLists.empty()) {
+            return false;
+        }
 
-            createInfo.enabledLayerCount = 0;
-            createInfo.pNext = nullptr;
+        uint32_t found = order;
+        while(found < block.freeLists.size() && block.freeLists[found].empty()) {
+            found++;
+        }
+        if(found >= block.freeLists.size()) {
+            return false;
         }
 
-        std::cout << "AreAllExtensionsIncluded: " << areAllExtensionsIncluded(glfwExtensions, glfwExtensionCount) << '\n';
+        offset = *block.freeLists[found].begin();
+        block.freeLists[found].erase(block.freeLists[found].begin());
 
+        // Split down to the requested size, the upper halves become free buddies
+        while(found > order) {
+            found--;
+            block.freeLists[found].insert(offset + (MIN_BUDDY_SIZE << found));
+        }
 
-        if(vkCreateInstance(&createInfo, nullptr, &_instance) != VK_SUCCESS) {
-            throw std::runtime_error("failed to create instance!");
+        return true;
+    }
+
+    void freeToBlock(MemoryBlock& block, VkDeviceSize offset, uint32_t order) {
+        while(order + 1 < block.freeLists.size()) {
+            VkDeviceSize buddy = offset ^ (MIN_BUDDY_SIZE << order);
+            auto it = block.freeLists[order].find(buddy);
+            if(it == block.freeLists[order].end()) {
+                break;
+            }
+
+            block.freeLists[order].erase(it);
+            offset = std::min(offset, buddy);
+            order++;
         }
 
+        block.freeLists[order].insert(offset);
+    }
 
+    Allocation makeBlockAllocation(MemoryBlock& block, VkDeviceSize offset, uint32_t order, VkDeviceSize size) {
+        block.reserved += MIN_BUDDY_SIZE << order;
+        block.allocationCount++;
+        _stats[block.memoryType].allocationCount++;
+        _stats[block.memoryType].usedBytes += size;
+
+        Allocation allocation;
+        allocation.memory = block.memory;
+        allocation.offset = offset;
+        allocation.size   = size;
+        allocation.mapped = block.mapped ? block.mapped + offset : nullptr;
+        allocation.type   = Allocation::Type::Block;
+        allocation.block  = &block;
+        allocation.order  = order;
+        return allocation;
     }
 
-    void populateDebugMessengerCreateInfo(VkDebugUtilsMessengerCreateInfoEXT& createInfo) {
+    Allocation allocateDedicated(VkDeviceSize size, uint32_t memoryType) {
+        MemoryBlock& block = createBlock(memoryType, size, ResourceKind::Linear, BlockUse::Dedicated);
+        block.allocationCount = 1;
 
-        createInfo = {};
-        createInfo.sType           = VK_STRUCTURE_TYPE_DEBUG_UTILS_MESSENGER_CREATE_INFO_EXT;
+        _stats[memoryType].dedicatedCount++;
+        _stats[memoryType].dedicatedBytes += size;
 
-        createInfo.messageSeverity = VK_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT;
+        Allocation allocation;
+        allocation.memory = block.memory;
+        allocation.size   = size;
+        allocation.mapped = block.mapped;
+        allocation.type   = Allocation::Type::Dedicated;
+        allocation.block  = &block;
+        return allocation;
+    }
 
-        createInfo.messageType     = VK_DEBUG_UTILS_MESSAGE_TYPE_GENERAL_BIT_EXT | 
-                                     VK_DEBUG_UTILS_MESSAGE_TYPE_VALIDATION_BIT_EXT | 
-                                     VK_DEBUG_UTILS_MESSAGE_TYPE_PERFORMANCE_BIT_EXT;
+    Allocation makeStagingAllocation(MemoryBlock& block, VkDeviceSize offset, VkDeviceSize size) {
+        block.linearOffset = offset + size;
+        block.allocationCount++;
+        _stagingUsed += size;
+        _stagingPeak = std::max(_stagingPeak, _stagingUsed);
+
+        Allocation allocation;
+        allocation.memory = block.memory;
+        allocation.offset = offset;
+        allocation.size   = size;
+        allocation.mapped = block.mapped + offset;
+        allocation.type   = Allocation::Type::Staging;
+        allocation.block  = &block;
+        return allocation;
+    }
 
-        createInfo.pfnUserCallback = debugCallback;
-        createInfo.pUserData       = nullptr;  
+    // Nothing references the block anymore. It is rewound for the next uploads, unless another
+    // empty one of its memory type is already waiting for them.
+    void recycleStaging(MemoryBlock* block) {
+        for(const auto& other : _stagingBlocks) {
+            if(other.get() != block && other->memoryType == block->memoryType && other->allocationCount == 0) {
+                releaseBlock(*block);
+                eraseBlock(_stagingBlocks, block);
+                return;
+            }
+        }
+        block->linearOffset = 0;
     }
+};
 
-    void setupDebugMessenger() {
 
-        if(!enableValidationLayers) return;
+// ------------------------------------------------------------------------------------- //
+// Uniform ring buffer
+//
+// One persistently mapped buffer split into a slice per frame in flight. Uniform data is
+// appended to the current frame's slice and bound with a dynamic offset, so per-object
+// uniforms cost a memcpy instead of a buffer and a map each. A slice is only rewound in
+// beginFrame, which must be called after the fence of the frame that last used it has
+// signaled; running out of space throws instead of wrapping into a slice the GPU may
+// still be reading. push() may be called from several recording threads at once.
+// ------------------------------------------------------------------------------------- //
 
-        VkDebugUtilsMessengerCreateInfoEXT createInfo;
-        populateDebugMessengerCreateInfo(createInfo);
+const VkDeviceSize UNIFORM_RING_FRAME_SIZE = 256 * 1024;
 
-        if(CreateDebugUtilsMessengerEXT(_instance, &createInfo, nullptr, &_debugMessenger) != VK_SUCCESS) {
-            throw std::runtime_error("failed to set up debug messenger");
-        }                               
+class UniformRing {
+public:
+    void init(VkDevice device, DeviceAllocator& allocator, VkDeviceSize minAlignment,
+              VkDeviceSize frameSize, uint32_t frameCount) {
+        _device     = device;
+        _alignment  = std::max<VkDeviceSize>(minAlignment, 1);
+        _frameSize  = (frameSize + _alignment - 1) / _alignment * _alignment;
+        _frameCount = frameCount;
 
-    }
+        VkBufferCreateInfo bufferInfo{};
+        bufferInfo.sType       = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+        bufferInfo.size        = _frameSize * _frameCount;
+        bufferInfo.usage       = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT;
+        bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
 
-    bool isDeviceSuitable(VkPhysicalDevice device) {
+        if(vkCreateBuffer(_device, &bufferInfo, nullptr, &_buffer) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create uniform ring buffer!");
+        }
 
-        VkPhysicalDeviceProperties deviceProperties;
-        VkPhysicalDeviceFeatures deviceFeatures;
-        vkGetPhysicalDeviceProperties(device, &deviceProperties);
-        vkGetPhysicalDeviceFeatures(device, &deviceFeatures);
-        
-        return deviceProperties.deviceType == VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU &&
-               deviceFeatures.geometryShader;
+        VkMemoryRequirements memRequirements;
+        vkGetBufferMemoryRequirements(_device, _buffer, &memRequirements);
 
+        _allocation = allocator.allocate(memRequirements,
+                                         VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                                         VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, ResourceKind::Linear);
 
+        vkBindBufferMemory(_device, _buffer, _allocation.memory, _allocation.offset);
     }
 
-    int rateDeviceSuitability(VkPhysicalDevice device) {
+    void destroy(DeviceAllocator& allocator) {
+        vkDestroyBuffer(_device, _buffer, nullptr);
+        allocator.free(_allocation);
+        _buffer = VK_NULL_HANDLE;
+    }
 
-        VkPhysicalDeviceProperties deviceProperties;
-        VkPhysicalDeviceFeatures deviceFeatures;
-        vkGetPhysicalDeviceProperties(device, &deviceProperties);
-        vkGetPhysicalDeviceFeatures(device, &deviceFeatures);
-    
+    VkBuffer buffer() const {
+        return _buffer;
+    }
 
-        int score = 0;
+    // The GPU must be done with everything previously pushed for this frame
+    void beginFrame(uint32_t frame) {
+        if(_frameEnd > 0) {
+            _peakFrameUsage = std::max(_peakFrameUsage, std::min(_head.load(), _frameEnd) - (_frameEnd - _frameSize));
+        }
+        _head     = frame * _frameSize;
+        _frameEnd = frame * _frameSize + _frameSize;
+    }
 
-        // Discrete GPUS have a significant performance advantage
-        if(deviceProperties.deviceType == VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU) {
-            score += 1000;
+    // Copies data into the current slice and returns the dynamic offset to bind it with
+    uint32_t push(const void* data, VkDeviceSize size) {
+        VkDeviceSize alignedSize = (size + _alignment - 1) / _alignment * _alignment;
+        VkDeviceSize offset = _head.fetch_add(alignedSize);
+        if(offset + size > _frameEnd) {
+            throw std::runtime_error("uniform ring buffer frame slice is full!");
         }
 
-        // Maximum possible size of textures affects graphics quality
-        score += deviceProperties.limits.maxImageDimension2D;
+        memcpy(static_cast<char*>(_allocation.mapped) + offset, data, static_cast<size_t>(size));
+        return static_cast<uint32_t>(offset);
+    }
 
+    VkDeviceSize alignment() const {
+        return _alignment;
+    }
 
-        if(!deviceFeatures.geometryShader) {
-            return 0;
-        }
+    template<typename T>
+    uint32_t push(const T& value) {
+        return push(&value, sizeof(T));
+    }
 
-        QueueFamilyIndices indices = findQueueFamilies(device);
-        if(!indices.isComplete()) {
-            return 0;
-        }
+    void dumpStats(std::ostream& out) const {
+        out << "uniform ring: " << _frameCount << " x " << _frameSize << " bytes, peak "
+            << _peakFrameUsage << " bytes per frame, alignment " << _alignment << "\n";
+    }
 
-        bool extensionsSupported = checkDeviceExtensionSupport(device);
-        if(!extensionsSupported) {
-            return 0;
-        }
+private:
+    VkDevice _device = VK_NULL_HANDLE;
+    VkBuffer _buffer = VK_NULL_HANDLE;
+    Allocation _allocation;
+
+    VkDeviceSize _alignment  = 1;
+    VkDeviceSize _frameSize  = 0;
+    uint32_t _frameCount     = 0;
+    std::atomic<VkDeviceSize> _head{0};
+    VkDeviceSize _frameEnd   = 0;
+    VkDeviceSize _peakFrameUsage = 0;
+};
 
-        bool swapChainAdequate = false;
-        if(extensionsSupported) {
-            SwapChainSupportDetails swapChainSupport = querySwapChainSupport(device);
-            swapChainAdequate = !swapChainSupport.formats.empty() &&
-                                !swapChainSupport.presentModes.empty();
 
-            if(!swapChainAdequate) {
-                return 0;
-            }
-        }
+// ------------------------------------------------------------------------------------- //
+// Upload engine
+//
+// Copies are recorded into a batch on the transfer queue and submitted together, nothing
+// waits on the CPU. Every batch signals a fence (polled each frame) and a semaphore. Once
+// the fence has signaled, the next graphics submit waits on the semaphore and its command
+// buffer acquires ownership of the uploaded resources; acquiredId() then tells which
+// batches can be used. When the transfer queue is in a separate family the batch ends
+// with queue family release barriers, otherwise it does the final transitions itself.
+// ------------------------------------------------------------------------------------- //
 
-        return score;
+class UploadEngine {
+public:
+    void init(VkDevice device, DeviceAllocator& allocator, VkQueue transferQueue,
+              uint32_t transferFamily, uint32_t graphicsFamily, uint32_t frameCount) {
+        _device         = device;
+        _allocator      = &allocator;
+        _transferQueue  = transferQueue;
+        _transferFamily = transferFamily;
+        _graphicsFamily = graphicsFamily;
+        _ownershipTransfer = transferFamily != graphicsFamily;
+        _acquiredPerFrame.resize(frameCount);
+
+        VkCommandPoolCreateInfo poolInfo{};
+        poolInfo.sType            = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+        poolInfo.queueFamilyIndex = transferFamily;
+        poolInfo.flags            = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT |
+                                    VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
 
+        if(vkCreateCommandPool(_device, &poolInfo, nullptr, &_commandPool) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create upload command pool!");
+        }
     }
 
-    void pickPhysicalDevice() {
-        uint32_t deviceCount = 0;
-        vkEnumeratePhysicalDevices(_instance, &deviceCount, nullptr);
+    // The device must be idle
+    void destroy() {
+        std::lock_guard<std::mutex> lock(_mutex);
 
-        if(deviceCount == 0) {
-            throw std::runtime_error("failed to find GPU's with Vulkan Support!");
+        if(_recording) {
+            vkEndCommandBuffer(_recording->commandBuffer);
+            releaseStaging(*_recording);
+            _free.push_back(std::move(_recording));
         }
+        for(auto& batch : _inFlight) {
+            releaseStaging(*batch);
+            _free.push_back(std::move(batch));
+        }
+        for(auto& batches : _acquiredPerFrame) {
+            for(auto& batch : batches) {
+                _free.push_back(std::move(batch));
+            }
+            batches.clear();
+        }
+        _inFlight.clear();
 
+        for(auto& batch : _free) {
+            vkDestroyFence(_device, batch->fence, nullptr);
+            vkDestroySemaphore(_device, batch->semaphore, nullptr);
+        }
+        _free.clear();
 
-        std::vector<VkPhysicalDevice> devices(deviceCount);
-        vkEnumeratePhysicalDevices(_instance, &deviceCount, devices.data());
+        vkDestroyCommandPool(_device, _commandPool, nullptr);
+    }
 
-        std::multimap<int, VkPhysicalDevice> candidates;
+    void uploadBuffer(VkBuffer buffer, VkDeviceSize offset, const void* data, VkDeviceSize size,
+                      VkAccessFlags dstAccess, VkPipelineStageFlags dstStage) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        UploadBatch& batch = recordingBatch();
 
-        for(const auto& device : devices) {
-            int score = rateDeviceSuitability(device);
-            candidates.insert(std::make_pair(score, device));
-        }
+        VkBuffer stagingBuffer = stage(batch, data, size);
 
-        // Check if best candidate is suitable or not
-        if(true) {
-            _physicalDevice = candidates.rbegin()-> second;
+        VkBufferCopy copyRegion{};
+        copyRegion.dstOffset = offset;
+        copyRegion.size      = size;
+        vkCmdCopyBuffer(batch.commandBuffer, stagingBuffer, buffer, 1, &copyRegion);
+
+        VkBufferMemoryBarrier barrier{};
+        barrier.sType  = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+        barrier.buffer = buffer;
+        barrier.offset = offset;
+        barrier.size   = size;
+        batch.bufferBarriers.push_back(barrier);
+        batch.bufferDstAccess.push_back(dstAccess);
+        batch.dstStages |= dstStage;
+    }
+
+    // One level of an image upload with all its layers, in the image format's own layout
+    // (block compressed levels are whole blocks)
+    struct ImageLevel {
+        const void* data;
+        VkDeviceSize size;
+    };
+
+    // Leaves the uploaded levels in finalLayout, by default readable from the fragment shader. data holds the
+    // levels one after the other, each with its layers tightly packed. Levels past the given ones stay undefined.
+    void uploadImage(VkImage image, uint32_t width, uint32_t height, const void* data, VkDeviceSize size,
+                     uint32_t layers = 1, uint32_t levels = 1,
+                     VkImageLayout finalLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+                     VkAccessFlags dstAccess = VK_ACCESS_SHADER_READ_BIT,
+                     VkPipelineStageFlags dstStage = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT) {
+
+        // Texel size from the total, so any uncompressed format works
+        VkDeviceSize texels = 0;
+        for(uint32_t level = 0; level < levels; level++) {
+            texels += VkDeviceSize(std::max(width >> level, 1u)) * std::max(height >> level, 1u) * layers;
         }
-        else {
-            throw std::runtime_error("failed to find a suitable GPU");
+        VkDeviceSize texelSize = size / texels;
+
+        std::vector<ImageLevel> levelData(levels);
+        VkDeviceSize offset = 0;
+        for(uint32_t level = 0; level < levels; level++) {
+            levelData[level].data = static_cast<const uint8_t*>(data) + offset;
+            levelData[level].size = texelSize * std::max(width >> level, 1u) * std::max(height >> level, 1u) * layers;
+            offset += levelData[level].size;
         }
 
+        uploadImage(image, width, height, levelData, layers, finalLayout, dstAccess, dstStage);
     }
 
-    void createLogicalDevice() {
-        QueueFamilyIndices indices = findQueueFamilies(_physicalDevice);
-        
-
-        std::vector<VkDeviceQueueCreateInfo> queueCreateInfos;
-        std::set<uint32_t> uniqueQueueFamilies = {indices.graphicsFamily.value(),
-                                                  indices.presentFamily.value()};
-
-        float queuePriority = 1.0f;
-        for(uint32_t queueFamily : uniqueQueueFamilies) {
-            VkDeviceQueueCreateInfo queueCreateInfo{};
-            queueCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
-            queueCreateInfo.queueFamilyIndex = queueFamily;
-            queueCreateInfo.queueCount = 1;
-            queueCreateInfo.pQueuePriorities = &queuePriority;
-            queueCreateInfos.push_back(queueCreateInfo);
+    // Same with every level given separately, each gets its own staging copy so the levels can
+    // come straight out of a mapped file
+    void uploadImage(VkImage image, uint32_t width, uint32_t height, const std::vector<ImageLevel>& levels,
+                     uint32_t layers = 1,
+                     VkImageLayout finalLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+                     VkAccessFlags dstAccess = VK_ACCESS_SHADER_READ_BIT,
+                     VkPipelineStageFlags dstStage = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        UploadBatch& batch = recordingBatch();
+
+        std::vector<VkBuffer> levelBuffers;
+        for(const ImageLevel& level : levels) {
+            levelBuffers.push_back(stage(batch, level.data, level.size));
         }
 
+        recordImageCopies(batch, image, width, height, layers, levelBuffers, finalLayout, dstAccess, dstStage);
+    }
 
-        VkPhysicalDeviceFeatures deviceFeatures{};
+    // Level 0 with its layers tightly packed, written by fill() straight into the mapped staging
+    // memory rather than built elsewhere and copied in. fill() runs under the engine's lock.
+    void uploadImageInPlace(VkImage image, uint32_t width, uint32_t height, uint32_t texelSize, uint32_t layers,
+                            const std::function<void(uint8_t* staging)>& fill,
+                            VkImageLayout finalLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+                            VkAccessFlags dstAccess = VK_ACCESS_SHADER_READ_BIT,
+                            VkPipelineStageFlags dstStage = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        UploadBatch& batch = recordingBatch();
+
+        void* mapped;
+        VkBuffer stagingBuffer = stage(batch, VkDeviceSize(width) * height * texelSize * layers, mapped);
+        fill(static_cast<uint8_t*>(mapped));
+
+        recordImageCopies(batch, image, width, height, layers, {stagingBuffer}, finalLayout, dstAccess, dstStage);
+    }
 
-        VkDeviceCreateInfo createInfo{};
-        createInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
-        createInfo.pQueueCreateInfos = queueCreateInfos.data();
-        createInfo.queueCreateInfoCount = static_cast<uint32_t>(queueCreateInfos.size());
-        createInfo.pEnabledFeatures = &deviceFeatures;
+    // Linear images the host has already written in PREINITIALIZED layout only need their final
+    // transition, it goes through a batch so the queue family handling matches the other uploads
+    void finishHostImage(VkImage image, uint32_t layers, uint32_t levels,
+                         VkImageLayout finalLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+                         VkAccessFlags dstAccess = VK_ACCESS_SHADER_READ_BIT,
+                         VkPipelineStageFlags dstStage = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        UploadBatch& batch = recordingBatch();
 
+        VkImageMemoryBarrier barrier{};
+        barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+        barrier.oldLayout = VK_IMAGE_LAYOUT_PREINITIALIZED;
+        barrier.newLayout = finalLayout;
+        barrier.image = image;
+        barrier.subresourceRange.aspectMask     = VK_IMAGE_ASPECT_COLOR_BIT;
+        barrier.subresourceRange.baseMipLevel   = 0;
+        barrier.subresourceRange.levelCount     = levels;
+        barrier.subresourceRange.baseArrayLayer = 0;
+        barrier.subresourceRange.layerCount     = layers;
+        batch.imageBarriers.push_back(barrier);
+        batch.imageDstAccess.push_back(dstAccess);
+        batch.dstStages |= dstStage;
+    }
 
-        createInfo.enabledExtensionCount = static_cast<uint32_t>(deviceExtensions.size());
-        createInfo.ppEnabledExtensionNames = deviceExtensions.data();
+    // The id submit() will return for what is being recorded now
+    uint64_t recordingId() {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _submittedId + 1;
+    }
 
-        if(enableValidationLayers) {
-            createInfo.enabledLayerCount = static_cast<uint32_t>(validationLayers.size());
-            createInfo.ppEnabledLayerNames = validationLayers.data();
-        }
-        else {
-            createInfo.enabledLayerCount = 0;
+    // Submits everything recorded so far, returns the id to compare against acquiredId()
+    uint64_t submit() {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if(!_recording) {
+            return _submittedId;
         }
 
-        if(vkCreateDevice(_physicalDevice, &createInfo, nullptr, &_device) != VK_SUCCESS) {
-            throw std::runtime_error("failed to create logical device!");
+        UploadBatch& batch = *_recording;
+        recordRelease(batch);
+
+        if(vkEndCommandBuffer(batch.commandBuffer) != VK_SUCCESS) {
+            throw std::runtime_error("failed to record upload command buffer!");
         }
 
-        vkGetDeviceQueue(_device, indices.graphicsFamily.value(), 0, &_graphicsQueue);
-        vkGetDeviceQueue(_device, indices.presentFamily.value(), 0, &_presentQueue);
+        VkSubmitInfo submitInfo{};
+        submitInfo.sType                = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+        submitInfo.commandBufferCount   = 1;
+        submitInfo.pCommandBuffers      = &batch.commandBuffer;
+        submitInfo.signalSemaphoreCount = 1;
+        submitInfo.pSignalSemaphores    = &batch.semaphore;
+
+        if(vkQueueSubmit(_transferQueue, 1, &submitInfo, batch.fence) != VK_SUCCESS) {
+            throw std::runtime_error("failed to submit upload batch!");
+        }
 
+        batch.id = ++_submittedId;
+        _batchCount++;
+        _inFlight.push_back(std::move(_recording));
+        return batch.id;
     }
 
-    void createSurface() {
-        if(glfwCreateWindowSurface(_instance, _window, nullptr, &_surface) != VK_SUCCESS) {
-            throw std::runtime_error("failed to create window surface!");
+    // Called while recording a graphics command buffer for the given frame in flight. Acquires
+    // every finished batch and adds its semaphore to the frame's wait list, never blocks.
+    void acquireCompleted(uint32_t frame, VkCommandBuffer commandBuffer,
+                          std::vector<VkSemaphore>& waitSemaphores,
+                          std::vector<VkPipelineStageFlags>& waitStages) {
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        // Batches on one queue finish in order, stopping at the first pending one keeps acquiredId monotonic
+        while(!_inFlight.empty() && vkGetFenceStatus(_device, _inFlight.front()->fence) == VK_SUCCESS) {
+            std::unique_ptr<UploadBatch> batch = std::move(_inFlight.front());
+            _inFlight.pop_front();
+
+            releaseStaging(*batch);
+            recordAcquire(*batch, commandBuffer);
+
+            waitSemaphores.push_back(batch->semaphore);
+            waitStages.push_back(batch->dstStages);
+
+            _acquiredId = batch->id;
+            _acquiredPerFrame[frame].push_back(std::move(batch));
         }
     }
 
-    bool checkDeviceExtensionSupport(VkPhysicalDevice device) {
+    // The fence of the given frame in flight has signaled, so its semaphore waits are done too
+    void retireFrame(uint32_t frame) {
+        std::lock_guard<std::mutex> lock(_mutex);
 
-        uint32_t extensionCount;
-        vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, nullptr);
+        for(auto& batch : _acquiredPerFrame[frame]) {
+            _free.push_back(std::move(batch));
+        }
+        _acquiredPerFrame[frame].clear();
+    }
 
-        std::vector<VkExtensionProperties> availableExtensions(extensionCount);
-        vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, availableExtensions.data());
+    uint64_t acquiredId() {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _acquiredId;
+    }
 
-        std::set<std::string> requiredExtensions(deviceExtensions.begin(), deviceExtensions.end());
+    void dumpStats(std::ostream& out) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        out << "upload engine: " << _batchCount << " batches, " << _copyCount << " copies, "
+            << _uploadedBytes << " bytes" << (_ownershipTransfer ? " on a dedicated transfer queue\n" : "\n");
+    }
 
-        for(const auto& extension : availableExtensions) {
-            requiredExtensions.erase(extension.extensionName);
+private:
+    struct UploadBatch {
+        VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+        VkFence fence = VK_NULL_HANDLE;
+        VkSemaphore semaphore = VK_NULL_HANDLE;
+        uint64_t id = 0;
+
+        std::vector<std::pair<VkBuffer, Allocation>> staging;
+
+        // Final transitions, recorded as release/acquire pairs when the queue family changes
+        std::vector<VkBufferMemoryBarrier> bufferBarriers;
+        std::vector<VkAccessFlags> bufferDstAccess;
+        std::vector<VkImageMemoryBarrier> imageBarriers;
+        std::vector<VkAccessFlags> imageDstAccess;
+        VkPipelineStageFlags dstStages = 0;
+    };
+
+    VkDevice _device = VK_NULL_HANDLE;
+    DeviceAllocator* _allocator = nullptr;
+    VkQueue _transferQueue = VK_NULL_HANDLE;
+    uint32_t _transferFamily = 0;
+    uint32_t _graphicsFamily = 0;
+    bool _ownershipTransfer = false;
+    VkCommandPool _commandPool = VK_NULL_HANDLE;
+
+    std::unique_ptr<UploadBatch> _recording;
+    std::deque<std::unique_ptr<UploadBatch>> _inFlight;
+    std::vector<std::vector<std::unique_ptr<UploadBatch>>> _acquiredPerFrame;
+    std::vector<std::unique_ptr<UploadBatch>> _free;
+
+    uint64_t _submittedId = 0;
+    uint64_t _acquiredId  = 0;
+    uint64_t _batchCount  = 0;
+    uint64_t _copyCount   = 0;
+    VkDeviceSize _uploadedBytes = 0;
+
+    std::mutex _mutex;
+
+    UploadBatch& recordingBatch() {
+        if(_recording) {
+            return *_recording;
         }
 
-        return requiredExtensions.empty();
-    }
+        if(!_free.empty()) {
+            _recording = std::move(_free.back());
+            _free.pop_back();
+
+            vkResetFences(_device, 1, &_recording->fence);
+            vkResetCommandBuffer(_recording->commandBuffer, 0);
+            _recording->bufferBarriers.clear();
+            _recording->bufferDstAccess.clear();
+            _recording->imageBarriers.clear();
+            _recording->imageDstAccess.clear();
+            _recording->dstStages = 0;
+        }
+        else {
+            _recording = std::make_unique<UploadBatch>();
 
-    SwapChainSupportDetails querySwapChainSupport(VkPhysicalDevice device) {
+            VkCommandBufferAllocateInfo allocInfo{};
+            allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+            allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+            allocInfo.commandPool        = _commandPool;
+            allocInfo.commandBufferCount = 1;
 
-        SwapChainSupportDetails details;
+            VkFenceCreateInfo fenceInfo{};
+            fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
 
-        vkGetPhysicalDeviceSurfaceCapabilitiesKHR(device, _surface, &details.capabilities);
+            VkSemaphoreCreateInfo semaphoreInfo{};
+            semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
 
-        uint32_t formatCount;
-        vkGetPhysicalDeviceSurfaceFormatsKHR(device, _surface, &formatCount, nullptr);
+            if(vkAllocateCommandBuffers(_device, &allocInfo, &_recording->commandBuffer) != VK_SUCCESS
+            || vkCreateFence(_device, &fenceInfo, nullptr, &_recording->fence) != VK_SUCCESS
+            || vkCreateSemaphore(_device, &semaphoreInfo, nullptr, &_recording->semaphore) != VK_SUCCESS) {
+                throw std::runtime_error("failed to create upload batch!");
+            }
+        }
 
-        if(formatCount != 0) {
-            details.formats.resize(formatCount);
-            vkGetPhysicalDeviceSurfaceFormatsKHR(device, _surface, &formatCount, details.formats.data());
+        VkCommandBufferBeginInfo beginInfo{};
+        beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+        if(vkBeginCommandBuffer(_recording->commandBuffer, &beginInfo) != VK_SUCCESS) {
+            throw std::runtime_error("failed to begin recording upload command buffer!");
         }
 
-        uint presentModeCount;
-        vkGetPhysicalDeviceSurfacePresentModesKHR(device, _surface, &presentModeCount, nullptr);
+        return *_recording;
+    }
 
-        if(presentModeCount != 0) {
-            details.presentModes.resize(presentModeCount);
-            vkGetPhysicalDeviceSurfacePresentModesKHR(device, _surface, &presentModeCount, details.presentModes.data());
+    // levelBuffers[i] holds level i with all its layers
+    void recordImageCopies(UploadBatch& batch, VkImage image, uint32_t width, uint32_t height, uint32_t layers,
+                           const std::vector<VkBuffer>& levelBuffers, VkImageLayout finalLayout,
+                           VkAccessFlags dstAccess, VkPipelineStageFlags dstStage) {
+        VkImageMemoryBarrier barrier{};
+        barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+        barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+        barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.image = image;
+        barrier.subresourceRange.aspectMask     = VK_IMAGE_ASPECT_COLOR_BIT;
+        barrier.subresourceRange.baseMipLevel   = 0;
+        barrier.subresourceRange.levelCount     = static_cast<uint32_t>(levelBuffers.size());
+        barrier.subresourceRange.baseArrayLayer = 0;
+        barrier.subresourceRange.layerCount     = layers;
+        barrier.srcAccessMask = 0;
+        barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+
+        vkCmdPipelineBarrier(batch.commandBuffer,
+                             VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                             0,
+                             0, nullptr,
+                             0, nullptr,
+                             1, &barrier);
+
+        for(uint32_t level = 0; level < levelBuffers.size(); level++) {
+            VkBufferImageCopy region{};
+            region.bufferOffset      = 0;
+            region.bufferRowLength   = 0;
+            region.bufferImageHeight = 0;
+
+            region.imageSubresource.aspectMask     = VK_IMAGE_ASPECT_COLOR_BIT;
+            region.imageSubresource.mipLevel       = level;
+            region.imageSubresource.baseArrayLayer = 0;
+            region.imageSubresource.layerCount     = layers;
+
+            region.imageOffset = {0,0,0};
+            region.imageExtent = {std::max(width >> level, 1u), std::max(height >> level, 1u), 1};
+
+            vkCmdCopyBufferToImage(batch.commandBuffer, levelBuffers[level], image,
+                                   VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
         }
 
-        
+        barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+        barrier.newLayout = finalLayout;
+        batch.imageBarriers.push_back(barrier);
+        batch.imageDstAccess.push_back(dstAccess);
+        batch.dstStages |= dstStage;
+    }
 
-        return details;
+    VkBuffer stage(UploadBatch& batch, const void* data, VkDeviceSize size) {
+        void* mapped;
+        VkBuffer buffer = stage(batch, size, mapped);
+        memcpy(mapped, data, static_cast<size_t>(size));
+        return buffer;
     }
 
-    VkSurfaceFormatKHR chooseSwapSurfaceFormat(const std::vector<VkSurfaceFormatKHR>& availableFormats) {
+    // Staging buffer of size bytes for the caller to fill through mapped
+    VkBuffer stage(UploadBatch& batch, VkDeviceSize size, void*& mapped) {
+        VkBufferCreateInfo bufferInfo{};
+        bufferInfo.sType       = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+        bufferInfo.size        = size;
+        bufferInfo.usage       = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+        bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
 
-        for(const auto& availableFormat : availableFormats) {
-            if(availableFormat.format == VK_FORMAT_B8G8R8A8_SRGB && 
-               availableFormat.colorSpace == VK_COLOR_SPACE_SRGB_NONLINEAR_KHR) {
-                   return availableFormat;
-               }
+        VkBuffer buffer;
+        if(vkCreateBuffer(_device, &bufferInfo, nullptr, &buffer) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create staging buffer!");
         }
 
-        return availableFormats[0];
+        VkMemoryRequirements memRequirements;
+        vkGetBufferMemoryRequirements(_device, buffer, &memRequirements);
+
+        Allocation allocation = _allocator->allocateStaging(memRequirements);
+        vkBindBufferMemory(_device, buffer, allocation.memory, allocation.offset);
+
+        mapped = allocation.mapped;
+        batch.staging.emplace_back(buffer, allocation);
+
+        _copyCount++;
+        _uploadedBytes += size;
+        return buffer;
     }
 
-    VkPresentModeKHR chooseSwapPresentMode(const std::vector<VkPresentModeKHR>& availablePresentModes) {
-        
-        for(const auto& availablePresentMode : availablePresentModes) {
-            if(availablePresentMode == VK_PRESENT_MODE_MAILBOX_KHR) {
-                return availablePresentMode;
-            }
+    void releaseStaging(UploadBatch& batch) {
+        for(auto& staging : batch.staging) {
+            vkDestroyBuffer(_device, staging.first, nullptr);
+            _allocator->free(staging.second);
         }
-
-        return VK_PRESENT_MODE_FIFO_KHR;
+        batch.staging.clear();
     }
 
-    VkExtent2D chooseSwapExtent(const VkSurfaceCapabilitiesKHR& capabilities) {
-        if(capabilities.currentExtent.width != UINT32_MAX) {
-            return capabilities.currentExtent;
+    void recordRelease(UploadBatch& batch) {
+        for(size_t i = 0; i < batch.bufferBarriers.size(); i++) {
+            VkBufferMemoryBarrier& barrier = batch.bufferBarriers[i];
+            barrier.srcAccessMask       = VK_ACCESS_TRANSFER_WRITE_BIT;
+            barrier.dstAccessMask       = _ownershipTransfer ? 0 : batch.bufferDstAccess[i];
+            barrier.srcQueueFamilyIndex = _ownershipTransfer ? _transferFamily : VK_QUEUE_FAMILY_IGNORED;
+            barrier.dstQueueFamilyIndex = _ownershipTransfer ? _graphicsFamily : VK_QUEUE_FAMILY_IGNORED;
+        }
+        for(size_t i = 0; i < batch.imageBarriers.size(); i++) {
+            VkImageMemoryBarrier& barrier = batch.imageBarriers[i];
+            barrier.srcAccessMask       = VK_ACCESS_TRANSFER_WRITE_BIT;
+            barrier.dstAccessMask       = _ownershipTransfer ? 0 : batch.imageDstAccess[i];
+            barrier.srcQueueFamilyIndex = _ownershipTransfer ? _transferFamily : VK_QUEUE_FAMILY_IGNORED;
+            barrier.dstQueueFamilyIndex = _ownershipTransfer ? _graphicsFamily : VK_QUEUE_FAMILY_IGNORED;
         }
-        else {
-            int width, height;
-            glfwGetFramebufferSize(_window, &width, &height);
 
-            VkExtent2D actualExtent = {
-                static_cast<uint32_t>(width),
-                static_cast<uint32_t>(height)
-            };
+        // Without a family change this is the whole transition, the semaphore orders it before the graphics work
+        vkCmdPipelineBarrier(batch.commandBuffer,
+                             VK_PIPELINE_STAGE_TRANSFER_BIT,
+                             _ownershipTransfer ? VkPipelineStageFlags(VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT) : VkPipelineStageFlags(batch.dstStages),
+                             0,
+                             0, nullptr,
+                             static_cast<uint32_t>(batch.bufferBarriers.size()), batch.bufferBarriers.data(),
+                             static_cast<uint32_t>(batch.imageBarriers.size()), batch.imageBarriers.data());
+    }
 
-            actualExtent.width = std::max(capabilities.minImageExtent.width, std::min(capabilities.maxImageExtent.width, actualExtent.width));
-            actualExtent.height = std::max(capabilities.minImageExtent.height, std::min(capabilities.maxImageExtent.height, actualExtent.height));
+    void recordAcquire(UploadBatch& batch, VkCommandBuffer commandBuffer) {
+        if(!_ownershipTransfer) {
+            return;
+        }
 
-            return actualExtent;
+        // Same layouts and families as the release, only the destination side of the access
+        for(size_t i = 0; i < batch.bufferBarriers.size(); i++) {
+            batch.bufferBarriers[i].srcAccessMask = 0;
+            batch.bufferBarriers[i].dstAccessMask = batch.bufferDstAccess[i];
         }
+        for(size_t i = 0; i < batch.imageBarriers.size(); i++) {
+            batch.imageBarriers[i].srcAccessMask = 0;
+            batch.imageBarriers[i].dstAccessMask = batch.imageDstAccess[i];
+        }
+
+        vkCmdPipelineBarrier(commandBuffer,
+                             VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, batch.dstStages,
+                             0,
+                             0, nullptr,
+                             static_cast<uint32_t>(batch.bufferBarriers.size()), batch.bufferBarriers.data(),
+                             static_cast<uint32_t>(batch.imageBarriers.size()), batch.imageBarriers.data());
     }
+};
 
-    void createSwapChain() {
-        SwapChainSupportDetails swapChainSupport = querySwapChainSupport(_physicalDevice);
 
-        VkSurfaceFormatKHR surfaceFormat = chooseSwapSurfaceFormat(swapChainSupport.formats);
-        VkPresentModeKHR presentMode = chooseSwapPresentMode(swapChainSupport.presentModes);
-        VkExtent2D extent = chooseSwapExtent(swapChainSupport.capabilities);
+// ------------------------------------------------------------------------------------- //
+// Worker threads for command recording
+//
+// A fixed set of threads that all run the same task, each with its own index, while the
+// caller waits. Each worker records into its own command pool, so nothing is shared.
+// ------------------------------------------------------------------------------------- //
 
-        uint32_t imageCount = swapChainSupport.capabilities.minImageCount + 1;
+class WorkerPool {
+public:
+    void start(uint32_t count) {
+        for(uint32_t i = 0; i < count; i++) {
+            _threads.emplace_back(&WorkerPool::workerLoop, this, i);
+        }
+    }
 
-        if(swapChainSupport.capabilities.maxImageCount > 0 && imageCount > swapChainSupport.capabilities.maxImageCount) {
-            imageCount = swapChainSupport.capabilities.maxImageCount;
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _stopping = true;
         }
+        _wake.notify_all();
 
-        VkSwapchainCreateInfoKHR createInfo{};
-        createInfo.sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR;
-        createInfo.surface = _surface;
-        createInfo.minImageCount = imageCount;
-        createInfo.imageFormat = surfaceFormat.format;
-        createInfo.imageColorSpace = surfaceFormat.colorSpace;
-        createInfo.imageExtent = extent;
-        createInfo.imageArrayLayers = 1;
-        createInfo.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+        for(auto& thread : _threads) {
+            thread.join();
+        }
+        _threads.clear();
+    }
 
-        QueueFamilyIndices indices = findQueueFamilies(_physicalDevice);
-        uint32_t queueFamilyIndices[] = {indices.graphicsFamily.value(),
-                                         indices.presentFamily.value()};
+    uint32_t size() const {
+        return static_cast<uint32_t>(_threads.size());
+    }
 
-        if(indices.graphicsFamily != indices.presentFamily) {
-            createInfo.imageSharingMode = VK_SHARING_MODE_CONCURRENT;
-            createInfo.queueFamilyIndexCount = 2;
-            createInfo.pQueueFamilyIndices = queueFamilyIndices;
-        }
-        else {
-            createInfo.imageSharingMode = VK_SHARING_MODE_EXCLUSIVE;
-            createInfo.queueFamilyIndexCount = 0;
-            createInfo.pQueueFamilyIndices = nullptr;
-        }
+    // Runs task(workerIndex) on every worker and returns when all are done
+    void run(const std::function<void(uint32_t)>& task) {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _task    = &task;
+        _pending = size();
+        _error   = nullptr;
+        _generation++;
+        _wake.notify_all();
 
-        createInfo.preTransform = swapChainSupport.capabilities.currentTransform;
-        createInfo.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
-        createInfo.clipped = VK_TRUE;
-        createInfo.oldSwapchain = VK_NULL_HANDLE;
+        _done.wait(lock, [this]() { return _pending == 0; });
+        _task = nullptr;
 
-        if(vkCreateSwapchainKHR(_device,&createInfo, nullptr, &_swapChain) != VK_SUCCESS) {
-            throw std::runtime_error("failed to create swap chain!");
+        if(_error) {
+            std::rethrow_exception(_error);
         }
+    }
 
-        vkGetSwapchainImagesKHR(_device, _swapChain, &imageCount, nullptr);
-        _swapChainImages.resize(imageCount);
-        vkGetSwapchainImagesKHR(_device, _swapChain, &imageCount, _swapChainImages.data());
+private:
+    std::vector<std::thread> _threads;
+    std::mutex _mutex;
+    std::condition_variable _wake;
+    std::condition_variable _done;
+
+    const std::function<void(uint32_t)>* _task = nullptr;
+    uint64_t _generation = 0;
+    uint32_t _pending = 0;
+    bool _stopping = false;
+    std::exception_ptr _error;
+
+    void workerLoop(uint32_t index) {
+        uint64_t seenGeneration = 0;
+
+        while(true) {
+            const std::function<void(uint32_t)>* task;
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                _wake.wait(lock, [&]() { return _stopping || _generation != seenGeneration; });
+                if(_stopping) {
+                    return;
+                }
+                seenGeneration = _generation;
+                task = _task;
+            }
 
-        _swapChainImageFormat = surfaceFormat.format;
-        _swapChainExtent = extent;
+            std::exception_ptr error;
+            try {
+                (*task)(index);
+            } catch(...) {
+                error = std::current_exception();
+            }
 
+            std::lock_guard<std::mutex> lock(_mutex);
+            if(error && !_error) {
+                _error = error;
+            }
+            if(--_pending == 0) {
+                _done.notify_one();
+            }
+        }
     }
+};
 
-    void createImageViews() {
-        _swapChainImageViews.resize(_swapChainImages.size());
 
-        for(size_t i=0; i<_swapChainImages.size(); i++) {
-            VkImageViewCreateInfo createInfo{};
-            createInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
-            createInfo.image = _swapChainImages[i];
-            createInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
-            createInfo.format = _swapChainImageFormat;
-            createInfo.components.r = VK_COMPONENT_SWIZZLE_IDENTITY;
-            createInfo.components.g = VK_COMPONENT_SWIZZLE_IDENTITY;
-            createInfo.components.b = VK_COMPONENT_SWIZZLE_IDENTITY;
-            createInfo.components.a = VK_COMPONENT_SWIZZLE_IDENTITY;
+// ------------------------------------------------------------------------------------- //
+// Triple buffer
+//
+// Hands the newest of a stream of values from one producer thread to one consumer thread
+// without locks. The producer fills back() and publishes it, which swaps it with the middle
+// slot. update() swaps the middle slot with front() if something newer was published since.
+// Values the consumer never got to are overwritten, a renderer only wants the latest.
+// ------------------------------------------------------------------------------------- //
 
-            createInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-            createInfo.subresourceRange.baseMipLevel = 0;
-            createInfo.subresourceRange.levelCount = 1;
-            createInfo.subresourceRange.baseArrayLayer = 0;
-            createInfo.subresourceRange.layerCount = 1;
+template<typename T>
+class TripleBuffer {
+public:
+    // Producer side, stays the producer's until the next publish()
+    T& back() {
+        return _slots[_back];
+    }
 
-            if(vkCreateImageView(_device, &createInfo, nullptr, &_swapChainImageViews[i]) != VK_SUCCESS) {
-                throw std::runtime_error("failed to create image views!");
-            }
+    void publish() {
+        _back = _middle.exchange(_back | FRESH, std::memory_order_acq_rel) & INDEX;
+    }
 
+    // Consumer side, returns whether front() changed
+    bool update() {
+        if(!(_middle.load(std::memory_order_acquire) & FRESH)) {
+            return false;
         }
+        _front = _middle.exchange(_front, std::memory_order_acq_rel) & INDEX;
+        return true;
     }
 
-    void createGraphicsPipeline() {
-        auto vertShaderCode = readFile("../shaders/vert.spv");
-        auto fragShaderCode = readFile("../shaders/frag.spv");
+    const T& front() const {
+        return _slots[_front];
+    }
 
-        auto bindingDescription    = Vertex::getBindingDescription();
-        auto attributeDescriptions = Vertex::getAttributeDescriptions();
+private:
+    static const uint32_t INDEX = 3;
+    static const uint32_t FRESH = 4;    // set in _middle while it holds a value the consumer hasn't seen
 
-        VkShaderModule vertShaderModule = createShaderModule(vertShaderCode);
-        VkShaderModule fragShaderModule = createShaderModule(fragShaderCode);
+    std::array<T, 3> _slots;
+    uint32_t _back  = 0;
+    uint32_t _front = 1;
+    std::atomic<uint32_t> _middle{2};
+};
 
+// ------------------------------------------------------------------------------------- //
+// Background task queue
+//
+// First in, first out on a few long running threads, for work no frame may wait for, such
+// as creating pipelines. Unlike WorkerPool nobody waits for a particular task, tasks publish
+// their own results. wait() returns once everything queued so far has run.
+// ------------------------------------------------------------------------------------- //
 
-        VkPipelineShaderStageCreateInfo vertShaderStageInfo{};
-        vertShaderStageInfo.sType  = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-        vertShaderStageInfo.stage  = VK_SHADER_STAGE_VERTEX_BIT;
-        vertShaderStageInfo.module = vertShaderModule;
-        vertShaderStageInfo.pName  = "main";
+class TaskQueue {
+public:
+    void start(uint32_t count) {
+        for(uint32_t i = 0; i < count; i++) {
+            _threads.emplace_back(&TaskQueue::workerLoop, this);
+        }
+    }
 
-        VkPipelineShaderStageCreateInfo fragShaderStageInfo{};
-        fragShaderStageInfo.sType  = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-        fragShaderStageInfo.stage  = VK_SHADER_STAGE_FRAGMENT_BIT;
-        fragShaderStageInfo.module = fragShaderModule;
-        fragShaderStageInfo.pName  = "main";
+    // Runs what is still queued, then joins
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _stopping = true;
+        }
+        _wake.notify_all();
 
-        VkPipelineShaderStageCreateInfo shaderStages[] = {vertShaderStageInfo, fragShaderStageInfo};
+        for(auto& thread : _threads) {
+            thread.join();
+        }
+        _threads.clear();
+    }
 
-        VkPipelineVertexInputStateCreateInfo vertexInputInfo{};
-        vertexInputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
-        vertexInputInfo.vertexBindingDescriptionCount   = 1;
-        vertexInputInfo.pVertexBindingDescriptions      = &bindingDescription;
-        vertexInputInfo.vertexAttributeDescriptionCount = static_cast<uint32_t>(attributeDescriptions.size());
-        vertexInputInfo.pVertexAttributeDescriptions    = attributeDescriptions.data();
+    void push(std::function<void()> task) {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _tasks.push_back(std::move(task));
+        }
+        _wake.notify_one();
+    }
 
-        VkPipelineInputAssemblyStateCreateInfo inputAssembly{};
-        inputAssembly.sType    = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
-        inputAssembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
-        inputAssembly.primitiveRestartEnable = VK_FALSE;
+    void wait() {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _idle.wait(lock, [this]() { return _tasks.empty() && _running == 0; });
+    }
 
-        VkViewport viewport{};
-        viewport.x = 0.0f;
-        viewport.y = 0.0f;
-        viewport.width  = (float) _swapChainExtent.width;
-        viewport.height = (float) _swapChainExtent.height;
-        viewport.minDepth = 0.0f;
-        viewport.maxDepth = 1.0f;
+private:
+    std::vector<std::thread> _threads;
+    std::mutex _mutex;
+    std::condition_variable _wake;
+    std::condition_variable _idle;
+    std::deque<std::function<void()>> _tasks;
+    uint32_t _running = 0;
+    bool _stopping = false;
+
+    void workerLoop() {
+        while(true) {
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                _wake.wait(lock, [this]() { return _stopping || !_tasks.empty(); });
+                if(_tasks.empty()) {
+                    return;
+                }
+                task = std::move(_tasks.front());
+                _tasks.pop_front();
+                _running++;
+            }
 
-        VkRect2D scissor{};
-        scissor.offset = {0, 0};
-        scissor.extent = _swapChainExtent;
+            // Tasks report their own failures, nothing to hand back
+            try {
+                task();
+            } catch(const std::exception& e) {
+                std::cerr << "background task failed: " << e.what() << "\n";
+            }
 
-        VkPipelineViewportStateCreateInfo viewportState{};
-        viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
-        viewportState.viewportCount = 1;
-        viewportState.pViewports    = &viewport;
-        viewportState.scissorCount  = 1;
-        viewportState.pScissors     = &scissor;
+            std::lock_guard<std::mutex> lock(_mutex);
+            if(--_running == 0 && _tasks.empty()) {
+                _idle.notify_all();
+            }
+        }
+    }
+};
 
-        VkPipelineRasterizationStateCreateInfo rasterizer{};
-        rasterizer.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
-        rasterizer.depthClampEnable        = VK_FALSE;
-        rasterizer.rasterizerDiscardEnable = VK_FALSE;
-        rasterizer.polygonMode             = VK_POLYGON_MODE_FILL;
-        rasterizer.lineWidth               = 1.0f;
-        rasterizer.cullMode                = VK_CULL_MODE_BACK_BIT;
-        rasterizer.frontFace               = VK_FRONT_FACE_COUNTER_CLOCKWISE;
-        rasterizer.depthBiasEnable         = VK_FALSE;
-        rasterizer.depthBiasConstantFactor = 0.0f;
-        rasterizer.depthBiasClamp          = 0.0f;
-        rasterizer.depthBiasSlopeFactor    = 0.0f;
+// ------------------------------------------------------------------------------------- //
+// Frame profiler
+//
+// Named GPU scopes are timestamp pairs in one query pool per frame in flight. A frame's
+// results are read once the frame timeline says it is done, a full round of frames in flight
+// late, so the readback never stalls. CPU scopes time themselves on whatever thread they run on. With a
+// trace path both end up in a chrome://tracing / Perfetto JSON file.
+//
+// The GPU clock is put on the CPU timeline by its first frame starting when it was
+// submitted, and moved later whenever a frame would have started before its submit.
+// ------------------------------------------------------------------------------------- //
+
+class FrameProfiler {
+public:
+    static const uint32_t NO_SCOPE = ~0u;
+
+    // Times its own lifetime as a CPU scope. Names have to outlive the profiler, use literals.
+    class CpuScope {
+    public:
+        CpuScope(FrameProfiler& profiler, const char* name)
+            : _profiler(profiler), _name(name), _start(std::chrono::high_resolution_clock::now()) {}
+        ~CpuScope() {
+            if(_profiler._tracing) {
+                _profiler.addCpuEvent(_name, _start, std::chrono::high_resolution_clock::now());
+            }
+        }
 
-        VkPipelineMultisampleStateCreateInfo multisampling{};
-        multisampling.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
-        multisampling.sampleShadingEnable   = VK_FALSE;
-        multisampling.rasterizationSamples  = VK_SAMPLE_COUNT_1_BIT;
-        multisampling.minSampleShading      = 1.0f;
-        multisampling.pSampleMask           = nullptr;
-        multisampling.alphaToCoverageEnable = VK_FALSE;
-        multisampling.alphaToOneEnable      = VK_FALSE;
+    private:
+        FrameProfiler& _profiler;
+        const char* _name;
+        std::chrono::high_resolution_clock::time_point _start;
+    };
+
+    // timestampValidBits 0 leaves out the GPU side, tracePath empty the trace
+    void create(VkDevice device, uint32_t framesInFlight, uint32_t timestampValidBits, float timestampPeriod,
+                const std::string& tracePath) {
+        _device    = device;
+        _frames.resize(framesInFlight);
+        _tracePath = tracePath;
+        _tracing   = !tracePath.empty();
+        _origin    = std::chrono::high_resolution_clock::now();
+        _period    = timestampPeriod;
+        _mask      = timestampValidBits >= 64 ? ~0ULL : ((1ULL << timestampValidBits) - 1);
+
+        if(timestampValidBits == 0) {
+            return;
+        }
 
+        for(FrameQueries& frame : _frames) {
+            VkQueryPoolCreateInfo queryPoolInfo{};
+            queryPoolInfo.sType      = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+            queryPoolInfo.queryType  = VK_QUERY_TYPE_TIMESTAMP;
+            queryPoolInfo.queryCount = 2 * MAX_PROFILER_SCOPES;
 
-        // Depth and stencil testing are left here
+            if(vkCreateQueryPool(device, &queryPoolInfo, nullptr, &frame.pool) != VK_SUCCESS) {
+                throw std::runtime_error("failed to create profiler query pool!");
+            }
+        }
+    }
 
+    void destroy() {
+        for(FrameQueries& frame : _frames) {
+            if(frame.pool != VK_NULL_HANDLE) {
+                vkDestroyQueryPool(_device, frame.pool, nullptr);
+                frame.pool = VK_NULL_HANDLE;
+            }
+        }
+    }
 
-        VkPipelineColorBlendAttachmentState colorBlendAttachment{};
-        colorBlendAttachment.colorWriteMask = VK_COLOR_COMPONENT_R_BIT |
-                                              VK_COLOR_COMPONENT_G_BIT |
-                                              VK_COLOR_COMPONENT_B_BIT |
-                                              VK_COLOR_COMPONENT_A_BIT;
-        colorBlendAttachment.blendEnable         = VK_FALSE;
-        colorBlendAttachment.srcColorBlendFactor = VK_BLEND_FACTOR_ONE;
-        colorBlendAttachment.dstColorBlendFactor = VK_BLEND_FACTOR_ZERO;
-        colorBlendAttachment.colorBlendOp        = VK_BLEND_OP_ADD;
-        colorBlendAttachment.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
-        colorBlendAttachment.dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO;
-        colorBlendAttachment.alphaBlendOp        = VK_BLEND_OP_ADD;
+    bool tracing() const {
+        return _tracing;
+    }
 
+    // First thing in a frame's command buffer, outside any render pass. Opens the "frame"
+    // scope that cmdEndFrame closes, it's what gpuMs reports.
+    void cmdBeginFrame(VkCommandBuffer commandBuffer, uint32_t frame) {
+        FrameQueries& queries = _frames[frame];
+        queries.scopes.clear();
+        if(queries.pool == VK_NULL_HANDLE) {
+            return;
+        }
 
-        VkPipelineColorBlendStateCreateInfo colorBlending{};
-        colorBlending.sType             = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
-        colorBlending.logicOpEnable     = VK_FALSE;
-        colorBlending.logicOp           = VK_LOGIC_OP_COPY;
-        colorBlending.attachmentCount   = 1;
-        colorBlending.pAttachments      = &colorBlendAttachment;
-        colorBlending.blendConstants[0] = 0.0f;
-        colorBlending.blendConstants[1] = 0.0f;
-        colorBlending.blendConstants[2] = 0.0f;
-        colorBlending.blendConstants[3] = 0.0f;
+        vkCmdResetQueryPool(commandBuffer, queries.pool, 0, 2 * MAX_PROFILER_SCOPES);
+        cmdBeginScope(commandBuffer, frame, "frame");
+    }
 
-        VkDynamicState dynamicStates[] = {
-            VK_DYNAMIC_STATE_VIEWPORT,
-            VK_DYNAMIC_STATE_LINE_WIDTH
-        };
+    void cmdEndFrame(VkCommandBuffer commandBuffer, uint32_t frame) {
+        cmdEndScope(commandBuffer, frame, 0);
+    }
 
-        VkPipelineDynamicStateCreateInfo dynamicState{};
-        dynamicState.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
-        dynamicState.dynamicStateCount = 2;
-        dynamicState.pDynamicStates    = dynamicStates;
+    // NO_SCOPE once the frame has MAX_PROFILER_SCOPES, ending that is fine
+    uint32_t cmdBeginScope(VkCommandBuffer commandBuffer, uint32_t frame, const char* name) {
+        FrameQueries& queries = _frames[frame];
+        if(queries.pool == VK_NULL_HANDLE || queries.scopes.size() == MAX_PROFILER_SCOPES) {
+            return NO_SCOPE;
+        }
 
-        VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
-        pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-        pipelineLayoutInfo.setLayoutCount         = 1;
-        pipelineLayoutInfo.pSetLayouts            = &_descriptorSetLayout;
-        pipelineLayoutInfo.pushConstantRangeCount = 0;
-        pipelineLayoutInfo.pPushConstantRanges    = nullptr;
+        uint32_t scope = static_cast<uint32_t>(queries.scopes.size());
+        queries.scopes.push_back(name);
+        vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, queries.pool, 2 * scope);
+        return scope;
+    }
 
-        if (vkCreatePipelineLayout(_device, &pipelineLayoutInfo, nullptr, &_pipelineLayout) != VK_SUCCESS) {
-            throw std::runtime_error("failed to create pipeline layout!");
+    void cmdEndScope(VkCommandBuffer commandBuffer, uint32_t frame, uint32_t scope) {
+        FrameQueries& queries = _frames[frame];
+        if(queries.pool == VK_NULL_HANDLE || scope >= queries.scopes.size()) {
+            return;
         }
+        vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, queries.pool, 2 * scope + 1);
+    }
 
+    void submitted(uint32_t frame, uint64_t frameNumber) {
+        FrameQueries& queries = _frames[frame];
+        queries.pending     = queries.pool != VK_NULL_HANDLE && !queries.scopes.empty();
+        queries.frameNumber = frameNumber;
+        queries.submitUs    = microsecondsSince(std::chrono::high_resolution_clock::now());
+    }
 
-        VkGraphicsPipelineCreateInfo pipelineInfo{};
-        pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
-        pipelineInfo.stageCount          = 2;
-        pipelineInfo.pStages             = shaderStages;
-        pipelineInfo.pVertexInputState   = &vertexInputInfo;
-        pipelineInfo.pInputAssemblyState = &inputAssembly;
-        pipelineInfo.pViewportState      = &viewportState;
-        pipelineInfo.pRasterizationState = &rasterizer;
-        pipelineInfo.pMultisampleState   = &multisampling;
-        pipelineInfo.pDepthStencilState  = nullptr;
-        pipelineInfo.pColorBlendState    = &colorBlending;
-        pipelineInfo.pDynamicState       = nullptr;
-        pipelineInfo.layout              = _pipelineLayout;
-        pipelineInfo.renderPass          = _renderPass;
-        pipelineInfo.subpass             = 0;
-        pipelineInfo.basePipelineHandle  = VK_NULL_HANDLE;
-        pipelineInfo.basePipelineIndex   = -1;
+    // Only once the fence of the frame's last submit has signaled. False when there was
+    // nothing to read, otherwise frameNumber and gpuMs are the frame's.
+    bool collect(uint32_t frame, uint64_t& frameNumber, double& gpuMs) {
+        FrameQueries& queries = _frames[frame];
+        if(!queries.pending) {
+            return false;
+        }
+        queries.pending = false;
 
-        if(vkCreateGraphicsPipelines(_device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &_graphicsPipeline) != VK_SUCCESS) {
-            throw std::runtime_error("failed to create graphics pipeline!");
+        uint32_t queryCount = static_cast<uint32_t>(2 * queries.scopes.size());
+        std::array<uint64_t, 2 * MAX_PROFILER_SCOPES> timestamps;
+        VkResult result = vkGetQueryPoolResults(_device, queries.pool, 0, queryCount, queryCount * sizeof(uint64_t), timestamps.data(),
+                                                sizeof(uint64_t), VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT);
+        if(result != VK_SUCCESS) {
+            return false;
         }
 
+        frameNumber = queries.frameNumber;
+        gpuMs       = ticksToUs(timestamps[1] - timestamps[0]) / 1000.0;
+        if(!_tracing) {
+            return true;
+        }
+
+        // Whole ticks stay exact in a double for about a hundred days of uptime
+        double frameStartUs = static_cast<double>(timestamps[0] & _mask) * _period / 1000.0;
+        if(!_gpuAligned || frameStartUs + _gpuOffsetUs < queries.submitUs) {
+            _gpuOffsetUs = queries.submitUs - frameStartUs;
+            _gpuAligned  = true;
+        }
 
-        vkDestroyShaderModule(_device, fragShaderModule, nullptr);
-        vkDestroyShaderModule(_device, vertShaderModule, nullptr);
+        std::lock_guard<std::mutex> lock(_eventsMutex);
+        for(size_t scope = 0; scope < queries.scopes.size(); scope++) {
+            double startUs = frameStartUs + _gpuOffsetUs + ticksToUs(timestamps[2 * scope] - timestamps[0]);
+            addEvent({queries.scopes[scope], GPU_THREAD, startUs, ticksToUs(timestamps[2 * scope + 1] - timestamps[2 * scope]), false});
+        }
+        return true;
     }
 
-    void createRenderPass() {
-        VkAttachmentDescription colorAttachment{};
-        colorAttachment.format  = _swapChainImageFormat;
-        colorAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
-        colorAttachment.loadOp  = VK_ATTACHMENT_LOAD_OP_CLEAR;
-        colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
-        colorAttachment.stencilLoadOp  = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
-        colorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-        colorAttachment.initialLayout  = VK_IMAGE_LAYOUT_UNDEFINED;
-        colorAttachment.finalLayout    = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+    // A value over time, its own track in the trace
+    void counter(const char* name, double value) {
+        if(!_tracing) {
+            return;
+        }
+        double nowUs = microsecondsSince(std::chrono::high_resolution_clock::now());
 
-        VkAttachmentReference colorAttachmentRef{};
-        colorAttachmentRef.attachment = 0;
-        colorAttachmentRef.layout     = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+        std::lock_guard<std::mutex> lock(_eventsMutex);
+        addEvent({name, GPU_THREAD, nowUs, value, true});
+    }
 
-        VkSubpassDescription subpass{};
-        subpass.pipelineBindPoint    = VK_PIPELINE_BIND_POINT_GRAPHICS;
-        subpass.colorAttachmentCount = 1;
-        subpass.pColorAttachments    = &colorAttachmentRef;
+    void writeTrace() {
+        if(!_tracing) {
+            return;
+        }
 
-        VkSubpassDependency dependency{};
-        dependency.srcSubpass = VK_SUBPASS_EXTERNAL;
-        dependency.dstSubpass = 0;
-        dependency.srcStageMask  = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-        dependency.srcAccessMask = 0;
-        dependency.dstStageMask  = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-        dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+        std::ofstream file(_tracePath);
+        if(!file.is_open()) {
+            throw std::runtime_error("failed to open " + _tracePath);
+        }
 
-        VkRenderPassCreateInfo renderPassInfo{};
-        renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
-        renderPassInfo.attachmentCount = 1;
-        renderPassInfo.pAttachments    = &colorAttachment;
-        renderPassInfo.subpassCount    = 1;
-        renderPassInfo.pSubpasses      = &subpass;
-        renderPassInfo.dependencyCount = 1;
-        renderPassInfo.pDependencies   = &dependency;
+        std::lock_guard<std::mutex> lock(_eventsMutex);
+        file << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+        file << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " << GPU_THREAD << ", \"args\": {\"name\": \"GPU\"}}";
+        for(const auto& [id, thread] : _threads) {
+            file << ",\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " << thread
+                 << ", \"args\": {\"name\": \"" << "CPU " << thread << "\"}}";
+        }
+        file << std::fixed << std::setprecision(3);
+        for(const Event& event : _events) {
+            if(event.counter) {
+                file << ",\n{\"name\": \"" << event.name << "\", \"ph\": \"C\", \"pid\": 1, \"ts\": " << event.startUs
+                     << ", \"args\": {\"value\": " << event.value << "}}";
+                continue;
+            }
+            file << ",\n{\"name\": \"" << event.name << "\", \"ph\": \"X\", \"pid\": 1, \"tid\": " << event.thread
+                 << ", \"ts\": " << event.startUs << ", \"dur\": " << event.value << "}";
+        }
+        file << "\n]}\n";
 
-        if(vkCreateRenderPass(_device, &renderPassInfo, nullptr, &_renderPass) != VK_SUCCESS) {
-            throw std::runtime_error("failed to create render pass!");
+        std::cerr << "trace: " << _events.size() << " events written to " << _tracePath;
+        if(_droppedEvents > 0) {
+            std::cerr << ", " << _droppedEvents << " dropped past " << MAX_TRACE_EVENTS;
         }
+        std::cerr << "\n";
     }
 
-    void createFramebuffers() {
-        _swapChainFramebuffers.resize(_swapChainImageViews.size());
+private:
+    static const uint32_t GPU_THREAD = 0;       // CPU threads count from 1 in order of their first scope
+
+    struct FrameQueries {
+        VkQueryPool pool = VK_NULL_HANDLE;
+        std::vector<const char*> scopes;        // names, scope i is queries 2i and 2i + 1
+        bool pending = false;
+        uint64_t frameNumber = 0;
+        double submitUs = 0.0;
+    };
+
+    struct Event {
+        const char* name;
+        uint32_t thread;
+        double startUs;
+        double value;           // the duration in microseconds, or the counter's value
+        bool counter;
+    };
+
+    VkDevice _device = VK_NULL_HANDLE;
+    std::vector<FrameQueries> _frames;      // one per frame in flight
+    float _period = 1.0f;
+    uint64_t _mask = 0;
+    bool _gpuAligned = false;
+    double _gpuOffsetUs = 0.0;
+
+    bool _tracing = false;
+    std::string _tracePath;
+    std::chrono::high_resolution_clock::time_point _origin;
+    std::mutex _eventsMutex;
+    std::vector<Event> _events;
+    uint64_t _droppedEvents = 0;
+    std::map<std::thread::id, uint32_t> _threads;
+
+    double ticksToUs(uint64_t ticks) const {
+        return (ticks & _mask) * _period / 1000.0;
+    }
 
-        for(size_t i=0; i<_swapChainImageViews.size(); i++) {
-            VkImageView attachments[] = {
-                _swapChainImageViews[i]
-            };
+    double microsecondsSince(std::chrono::high_resolution_clock::time_point time) const {
+        return std::chrono::duration<double, std::micro>(time - _origin).count();
+    }
 
-            VkFramebufferCreateInfo framebufferInfo{};
-            framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
-            framebufferInfo.renderPass      = _renderPass;
-            framebufferInfo.attachmentCount = 1;
+    void addCpuEvent(const char* name, std::chrono::high_resolution_clock::time_point start,
+                     std::chrono::high_resolution_clock::time_point end) {
+        double startUs = microsecondsSince(start);
+        double endUs   = microsecondsSince(end);
+
+        std::lock_guard<std::mutex> lock(_eventsMutex);
+        auto thread = _threads.emplace(std::this_thread::get_id(), static_cast<uint32_t>(_threads.size() + 1)).first;
+        addEvent({name, thread->second, startUs, endUs - startUs, false});
+    }
+
+    // Called with _eventsMutex held
+    void addEvent(const Event& event) {
+        if(_events.size() == MAX_TRACE_EVENTS) {
+            _droppedEvents++;
+            return;
+        }
+        _events.push_back(event);
+    }
+};
+
+// ------------------------------------------------------------------------------------- //
+// Work-stealing job graph
+//
+// Jobs name the jobs they depend on and count down how many are still unfinished. The
+// thread that finishes a job's last dependency pushes it onto its own deque. Threads pop
+// their own deque from the back, so they keep working on what they just unblocked, and
+// steal from the front of the others when theirs runs dry. The calling thread works too.
+// Jobs are coarse (whole init steps), so mutex guarded deques are plenty.
+// Every job records which thread ran it and when, for the startup timeline.
+// ------------------------------------------------------------------------------------- //
+
+class JobGraph {
+public:
+    typedef uint32_t JobId;
+
+    // Dependencies must have been added before, which keeps the graph acyclic
+    JobId add(const char* name, std::function<void()> work, std::initializer_list<JobId> dependencies = {}) {
+        JobId id = static_cast<JobId>(_jobs.size());
+        auto job = std::make_unique<Job>();
+        job->name    = name;
+        job->work    = std::move(work);
+        job->pending = static_cast<uint32_t>(dependencies.size());
+        for(JobId dependency : dependencies) {
+            _jobs[dependency]->dependents.push_back(id);
+        }
+        _jobs.push_back(std::move(job));
+        return id;
+    }
+
+    // Runs every job on the calling thread plus helperCount new threads and returns once all
+    // are done. After a failure the remaining jobs are skipped and the first exception is rethrown.
+    void run(uint32_t helperCount) {
+        _queues.clear();
+        for(uint32_t i = 0; i <= helperCount; i++) {
+            _queues.push_back(std::make_unique<WorkQueue>());
+        }
+        _remaining = static_cast<uint32_t>(_jobs.size());
+        _queued    = 0;
+        _failed    = false;
+        _start     = std::chrono::high_resolution_clock::now();
+
+        // Roots are dealt out so every thread has something to start with
+        uint32_t next = 0;
+        for(JobId id = 0; id < _jobs.size(); id++) {
+            if(_jobs[id]->pending == 0) {
+                push(next++ % (helperCount + 1), id);
+            }
+        }
+
+        std::vector<std::thread> helpers;
+        for(uint32_t i = 1; i <= helperCount; i++) {
+            helpers.emplace_back(&JobGraph::workerLoop, this, i);
+        }
+        workerLoop(0);
+        for(std::thread& helper : helpers) {
+            helper.join();
+        }
+
+        std::chrono::duration<double, std::milli> wall = std::chrono::high_resolution_clock::now() - _start;
+        _wallMs = wall.count();
+
+        if(_error) {
+            std::rethrow_exception(_error);
+        }
+    }
+
+    double wallMs() const {
+        return _wallMs;
+    }
+
+    // Sum of all job durations, wallMs() of a single threaded run is about the same
+    double busyMs() const {
+        double busy = 0.0;
+        for(const auto& job : _jobs) {
+            busy += job->endMs - job->startMs;
+        }
+        return busy;
+    }
+
+    void printTimeline(std::ostream& out) const {
+        std::vector<const Job*> order;
+        for(const auto& job : _jobs) {
+            order.push_back(job.get());
+        }
+        std::sort(order.begin(), order.end(), [](const Job* a, const Job* b) { return a->startMs < b->startMs; });
+
+        out << "init timeline: " << _wallMs << " ms wall, " << busyMs() << " ms of work on "
+            << _queues.size() << " threads\n";
+        for(const Job* job : order) {
+            char line[128];
+            snprintf(line, sizeof(line), "  %-26s thread %u %9.2f - %9.2f ms %9.2f ms\n", job->name, job->thread,
+                     job->startMs, job->endMs, job->endMs - job->startMs);
+            out << line;
+        }
+    }
+
+private:
+    struct Job {
+        const char* name = "";
+        std::function<void()> work;
+        std::vector<JobId> dependents;
+        std::atomic<uint32_t> pending{0};
+
+        uint32_t thread = 0;
+        double startMs = 0.0;
+        double endMs   = 0.0;
+    };
+
+    struct WorkQueue {
+        std::mutex mutex;
+        std::deque<JobId> jobs;
+    };
+
+    std::vector<std::unique_ptr<Job>> _jobs;
+    std::vector<std::unique_ptr<WorkQueue>> _queues;
+
+    // _queued only changes under _sleepMutex so a thread going to sleep can't miss a push
+    std::mutex _sleepMutex;
+    std::condition_variable _wake;
+    uint32_t _queued = 0;
+    std::atomic<uint32_t> _remaining{0};
+
+    std::atomic<bool> _failed{false};
+    std::exception_ptr _error;
+
+    std::chrono::high_resolution_clock::time_point _start;
+    double _wallMs = 0.0;
+
+    void push(uint32_t thread, JobId id) {
+        {
+            std::lock_guard<std::mutex> lock(_queues[thread]->mutex);
+            _queues[thread]->jobs.push_back(id);
+        }
+        {
+            std::lock_guard<std::mutex> lock(_sleepMutex);
+            _queued++;
+        }
+        _wake.notify_one();
+    }
+
+    bool pop(uint32_t thread, JobId& id) {
+        for(size_t i = 0; i < _queues.size(); i++) {
+            WorkQueue& queue = *_queues[(thread + i) % _queues.size()];
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            if(queue.jobs.empty()) {
+                continue;
+            }
+
+            if(i == 0) {
+                id = queue.jobs.back();
+                queue.jobs.pop_back();
+            }
+            else {
+                id = queue.jobs.front();
+                queue.jobs.pop_front();
+            }
+            return true;
+        }
+        return false;
+    }
+
+    void workerLoop(uint32_t thread) {
+        while(true) {
+            {
+                std::unique_lock<std::mutex> lock(_sleepMutex);
+                _wake.wait(lock, [this]() { return _queued > 0 || _remaining == 0; });
+                if(_queued == 0) {
+                    return;
+                }
+                _queued--;
+            }
+
+            // A queued job is reserved for us, it may just not be visible in any deque yet
+            JobId id;
+            while(!pop(thread, id)) {
+                std::this_thread::yield();
+            }
+            execute(thread, id);
+        }
+    }
+
+    void execute(uint32_t thread, JobId id) {
+        Job& job = *_jobs[id];
+        job.thread  = thread;
+        job.startMs = elapsedMs();
+        if(!_failed) {
+            try {
+                job.work();
+            } catch(...) {
+                std::lock_guard<std::mutex> lock(_sleepMutex);
+                if(!_error) {
+                    _error = std::current_exception();
+                }
+                _failed = true;
+            }
+        }
+        job.endMs = elapsedMs();
+
+        for(JobId dependent : job.dependents) {
+            if(--_jobs[dependent]->pending == 0) {
+                push(thread, dependent);
+            }
+        }
+
+        if(--_remaining == 0) {
+            std::lock_guard<std::mutex> lock(_sleepMutex);
+            _wake.notify_all();
+        }
+    }
+
+    double elapsedMs() const {
+        std::chrono::duration<double, std::milli> elapsed = std::chrono::high_resolution_clock::now() - _start;
+        return elapsed.count();
+    }
+};
+
+
+// ------------------------------------------------------------------------------------- //
+// Pipeline cache persisted between runs
+//
+// The driver blob is wrapped in our own header keyed on everything that invalidates it:
+// pipelineCacheUUID, vendor/device ID and driver version, plus the size and a checksum of
+// the blob. Anything that doesn't match is ignored and we start from an empty cache.
+// Saving goes through a temporary file and a rename so a crash never leaves half a file.
+// ------------------------------------------------------------------------------------- //
+
+const uint32_t PIPELINE_CACHE_MAGIC   = 0x43505456;     // "VTPC"
+const uint32_t PIPELINE_CACHE_VERSION = 1;
+
+struct PipelineCacheFileHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t vendorID;
+    uint32_t deviceID;
+    uint32_t driverVersion;
+    uint8_t  pipelineCacheUUID[VK_UUID_SIZE];
+    uint64_t dataSize;
+    uint64_t checksum;
+};
+
+static uint64_t fnv1a64(const void* data, size_t size, uint64_t hash = 14695981039346656037ull) {
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    for(size_t i = 0; i < size; i++) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+class PersistentPipelineCache {
+public:
+    void create(VkPhysicalDevice physicalDevice, VkDevice device, const std::string& path) {
+        _device = device;
+        _path   = path;
+        vkGetPhysicalDeviceProperties(physicalDevice, &_deviceProperties);
+
+        std::vector<char> data;
+        if(!_path.empty()) {
+            data = load();
+        }
+
+        VkPipelineCacheCreateInfo cacheInfo{};
+        cacheInfo.sType           = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+        cacheInfo.initialDataSize = data.size();
+        cacheInfo.pInitialData    = data.empty() ? nullptr : data.data();
+
+        // A driver may still refuse data that passed our checks, retry empty instead of failing
+        if(vkCreatePipelineCache(_device, &cacheInfo, nullptr, &_cache) != VK_SUCCESS) {
+            cacheInfo.initialDataSize = 0;
+            cacheInfo.pInitialData    = nullptr;
+            data.clear();
+
+            if(vkCreatePipelineCache(_device, &cacheInfo, nullptr, &_cache) != VK_SUCCESS) {
+                throw std::runtime_error("failed to create pipeline cache!");
+            }
+        }
+
+        _warm = !data.empty();
+    }
+
+    void save() {
+        if(_path.empty()) {
+            return;
+        }
+
+        size_t dataSize = 0;
+        if(vkGetPipelineCacheData(_device, _cache, &dataSize, nullptr) != VK_SUCCESS || dataSize == 0) {
+            return;
+        }
+        std::vector<char> data(dataSize);
+        if(vkGetPipelineCacheData(_device, _cache, &dataSize, data.data()) != VK_SUCCESS) {
+            std::cerr << "pipeline cache: failed to read cache data, not saving\n";
+            return;
+        }
+        data.resize(dataSize);
+
+        PipelineCacheFileHeader header = makeHeader();
+        header.dataSize = data.size();
+        header.checksum = fnv1a64(data.data(), data.size());
+
+        std::string tmpPath = _path + ".tmp";
+        {
+            std::ofstream file(tmpPath, std::ios::binary | std::ios::trunc);
+            file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+            file.write(data.data(), data.size());
+            if(!file.good()) {
+                std::cerr << "pipeline cache: failed to write " << tmpPath << "\n";
+                std::remove(tmpPath.c_str());
+                return;
+            }
+        }
+
+        if(std::rename(tmpPath.c_str(), _path.c_str()) != 0) {
+            std::cerr << "pipeline cache: failed to replace " << _path << "\n";
+            std::remove(tmpPath.c_str());
+        }
+    }
+
+    void destroy() {
+        vkDestroyPipelineCache(_device, _cache, nullptr);
+    }
+
+    VkPipelineCache handle() const {
+        return _cache;
+    }
+
+    // Whether creation started from a cache saved by a previous run
+    bool warm() const {
+        return _warm;
+    }
+
+private:
+    VkDevice _device = VK_NULL_HANDLE;
+    VkPipelineCache _cache = VK_NULL_HANDLE;
+    VkPhysicalDeviceProperties _deviceProperties;
+    std::string _path;
+    bool _warm = false;
+
+    PipelineCacheFileHeader makeHeader() const {
+        PipelineCacheFileHeader header{};
+        header.magic         = PIPELINE_CACHE_MAGIC;
+        header.version       = PIPELINE_CACHE_VERSION;
+        header.vendorID      = _deviceProperties.vendorID;
+        header.deviceID      = _deviceProperties.deviceID;
+        header.driverVersion = _deviceProperties.driverVersion;
+        memcpy(header.pipelineCacheUUID, _deviceProperties.pipelineCacheUUID, VK_UUID_SIZE);
+        return header;
+    }
+
+    std::vector<char> load() const {
+        std::ifstream file(_path, std::ios::ate | std::ios::binary);
+        if(!file.is_open()) {
+            return {};
+        }
+
+        size_t fileSize = (size_t) file.tellg();
+        file.seekg(0);
+
+        PipelineCacheFileHeader header{};
+        if(fileSize < sizeof(header) || !file.read(reinterpret_cast<char*>(&header), sizeof(header))) {
+            std::cerr << "pipeline cache: " << _path << " is truncated, ignoring it\n";
+            return {};
+        }
+
+        PipelineCacheFileHeader expected = makeHeader();
+        if(header.magic != expected.magic || header.version != expected.version) {
+            std::cerr << "pipeline cache: " << _path << " is not a pipeline cache, ignoring it\n";
+            return {};
+        }
+        if(header.vendorID != expected.vendorID || header.deviceID != expected.deviceID
+        || header.driverVersion != expected.driverVersion
+        || memcmp(header.pipelineCacheUUID, expected.pipelineCacheUUID, VK_UUID_SIZE) != 0) {
+            std::cerr << "pipeline cache: " << _path << " was saved by another device or driver, ignoring it\n";
+            return {};
+        }
+        if(header.dataSize != fileSize - sizeof(header)) {
+            std::cerr << "pipeline cache: " << _path << " has the wrong size, ignoring it\n";
+            return {};
+        }
+
+        std::vector<char> data(static_cast<size_t>(header.dataSize));
+        if(!file.read(data.data(), data.size()) || fnv1a64(data.data(), data.size()) != header.checksum) {
+            std::cerr << "pipeline cache: " << _path << " is corrupted, ignoring it\n";
+            return {};
+        }
+
+        // The driver's own header has to agree with ours as well
+        VkPipelineCacheHeaderVersionOne driverHeader{};
+        if(data.size() < sizeof(driverHeader)) {
+            return {};
+        }
+        memcpy(&driverHeader, data.data(), sizeof(driverHeader));
+        if(driverHeader.headerVersion != VK_PIPELINE_CACHE_HEADER_VERSION_ONE
+        || driverHeader.vendorID != expected.vendorID || driverHeader.deviceID != expected.deviceID
+        || memcmp(driverHeader.pipelineCacheUUID, expected.pipelineCacheUUID, VK_UUID_SIZE) != 0) {
+            std::cerr << "pipeline cache: " << _path << " has a mismatching driver header, ignoring it\n";
+            return {};
+        }
+
+        return data;
+    }
+};
+
+// ------------------------------------------------------------------------------------- //
+// Runtime shader compilation
+//
+// GLSL sources are compiled in process with shaderc, the stage comes from the extension.
+// SPIR-V is cached on disk under a hash of everything that goes into it: the source, the
+// defines, the file name and the compiler's SPIR-V version. Shaders don't #include anything,
+// so the source is all there is to hash. A hit skips the compiler entirely, misses are
+// written through a temporary file and a rename like the pipeline cache.
+//
+// With watching on, an inotify watch on the source directory reports the shaders written or
+// moved in since the last call, the renderer rebuilds whichever pipelines use them.
+// ------------------------------------------------------------------------------------- //
+
+const uint32_t SHADER_CACHE_VERSION = 1;    // bump when the compile options change
+const uint32_t SPIRV_MAGIC = 0x07230203;
+
+class ShaderLibrary {
+public:
+    ~ShaderLibrary() {
+        if(_watch >= 0) {
+            ::close(_watch);
+        }
+    }
+
+    // An empty cacheDir disables the on-disk cache
+    void create(const std::string& sourceDir, const std::string& cacheDir, bool watch) {
+        _sourceDir = sourceDir;
+        _cacheDir  = cacheDir;
+
+        if(!_cacheDir.empty() && mkdir(_cacheDir.c_str(), 0755) != 0 && errno != EEXIST) {
+            std::cerr << "shader cache: failed to create " << _cacheDir << ", not caching\n";
+            _cacheDir.clear();
+        }
+
+        if(watch) {
+            _watch = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+            if(_watch < 0 || inotify_add_watch(_watch, _sourceDir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+                throw std::runtime_error("failed to watch " + _sourceDir + " for shader changes!");
+            }
+        }
+    }
+
+    // SPIR-V of sourceDir/name compiled with defines ("NAME" or "NAME=VALUE"). Thread safe, throws
+    // with the compiler's messages when the source doesn't compile.
+    std::vector<uint32_t> load(const std::string& name, const std::vector<std::string>& defines = {}) {
+        std::string key = name;
+        for(const std::string& define : defines) {
+            key += " -D" + define;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            auto loaded = _loaded.find(key);
+            if(loaded != _loaded.end()) {
+                return loaded->second;
+            }
+        }
+
+        std::string source = readSource(name);
+        uint32_t versions[2] = {SHADER_CACHE_VERSION, spirvVersion()};
+        uint64_t hash = fnv1a64(source.data(), source.size());
+        hash = fnv1a64(key.data(), key.size(), hash);
+        hash = fnv1a64(versions, sizeof(versions), hash);
+
+        std::vector<uint32_t> spirv = readCache(hash);
+        bool hit = !spirv.empty();
+        double compileMs = 0.0;
+        if(!hit) {
+            auto start = std::chrono::high_resolution_clock::now();
+            spirv = compile(name, source, defines);
+            compileMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+            writeCache(hash, spirv);
+        }
+
+        // Two threads loading the same shader both compile it, the result is the same either way
+        std::lock_guard<std::mutex> lock(_mutex);
+        if(hit) {
+            _cacheHits++;
+        }
+        else {
+            _compiles++;
+            _compileMs += compileMs;
+        }
+        _loaded[key] = spirv;
+        return spirv;
+    }
+
+    // Shaders changed on disk since the last call, each forgotten so the next load reads it again.
+    // Never blocks, returns nothing when not watching.
+    std::vector<std::string> changedFiles() {
+        std::vector<std::string> changed;
+        if(_watch < 0) {
+            return changed;
+        }
+
+        alignas(inotify_event) char buffer[4096];
+        ssize_t size;
+        while((size = read(_watch, buffer, sizeof(buffer))) > 0) {
+            for(ssize_t offset = 0; offset < size; ) {
+                const inotify_event* event = reinterpret_cast<const inotify_event*>(buffer + offset);
+                offset += sizeof(inotify_event) + event->len;
+
+                // Editors write temporaries and backups next to the file, only sources count
+                std::string name = event->len > 0 ? event->name : "";
+                if(isShaderSource(name) && std::find(changed.begin(), changed.end(), name) == changed.end()) {
+                    changed.push_back(name);
+                }
+            }
+        }
+
+        std::lock_guard<std::mutex> lock(_mutex);
+        for(const std::string& name : changed) {
+            for(auto loaded = _loaded.begin(); loaded != _loaded.end(); ) {
+                bool sameFile = loaded->first.compare(0, name.size(), name) == 0
+                             && (loaded->first.size() == name.size() || loaded->first[name.size()] == ' ');
+                loaded = sameFile ? _loaded.erase(loaded) : std::next(loaded);
+            }
+        }
+        return changed;
+    }
+
+    uint32_t cacheHits() const {
+        return _cacheHits;
+    }
+
+    uint32_t compiles() const {
+        return _compiles;
+    }
+
+    // Spent in the compiler, summed over threads
+    double compileMs() const {
+        return _compileMs;
+    }
+
+private:
+    std::string _sourceDir;
+    std::string _cacheDir;
+    int _watch = -1;
+    std::mutex _mutex;
+    std::map<std::string, std::vector<uint32_t>> _loaded;   // by name and defines
+    uint32_t _cacheHits = 0;
+    uint32_t _compiles  = 0;
+    double _compileMs   = 0.0;
+
+    static bool endsWith(const std::string& name, const char* suffix) {
+        size_t length = strlen(suffix);
+        return name.size() > length && name.compare(name.size() - length, length, suffix) == 0;
+    }
+
+    static bool isShaderSource(const std::string& name) {
+        return endsWith(name, ".vert") || endsWith(name, ".frag") || endsWith(name, ".comp");
+    }
+
+    static shaderc_shader_kind shaderKind(const std::string& name) {
+        if(endsWith(name, ".vert")) {
+            return shaderc_vertex_shader;
+        }
+        if(endsWith(name, ".frag")) {
+            return shaderc_fragment_shader;
+        }
+        if(endsWith(name, ".comp")) {
+            return shaderc_compute_shader;
+        }
+        throw std::runtime_error("no shader stage for " + name + "!");
+    }
+
+    static uint32_t spirvVersion() {
+        unsigned int version  = 0;
+        unsigned int revision = 0;
+        shaderc_get_spv_version(&version, &revision);
+        return (version << 8) ^ revision;
+    }
+
+    std::string readSource(const std::string& name) const {
+        std::string path = _sourceDir + "/" + name;
+        std::ifstream file(path, std::ios::binary);
+        if(!file.is_open()) {
+            throw std::runtime_error("failed to open shader " + path + "!");
+        }
+        std::ostringstream source;
+        source << file.rdbuf();
+        return source.str();
+    }
+
+    std::vector<uint32_t> compile(const std::string& name, const std::string& source, const std::vector<std::string>& defines) const {
+        shaderc::CompileOptions options;
+        options.SetTargetEnvironment(shaderc_target_env_vulkan, shaderc_env_version_vulkan_1_0);
+        for(const std::string& define : defines) {
+            size_t equals = define.find('=');
+            options.AddMacroDefinition(define.substr(0, equals), equals == std::string::npos ? "" : define.substr(equals + 1));
+        }
+
+        // One compiler per call, they are cheap and the loads run on several threads
+        shaderc::Compiler compiler;
+        shaderc::SpvCompilationResult result = compiler.CompileGlslToSpv(source, shaderKind(name), name.c_str(), options);
+        if(result.GetCompilationStatus() != shaderc_compilation_status_success) {
+            throw std::runtime_error("failed to compile shader " + name + "!\n" + result.GetErrorMessages());
+        }
+        return {result.cbegin(), result.cend()};
+    }
+
+    std::string cachePath(uint64_t hash) const {
+        char name[32];
+        snprintf(name, sizeof(name), "%016llx.spv", static_cast<unsigned long long>(hash));
+        return _cacheDir + "/" + name;
+    }
+
+    // Empty on a miss, anything that isn't SPIR-V counts as one
+    std::vector<uint32_t> readCache(uint64_t hash) const {
+        if(_cacheDir.empty()) {
+            return {};
+        }
+
+        std::ifstream file(cachePath(hash), std::ios::ate | std::ios::binary);
+        if(!file.is_open()) {
+            return {};
+        }
+        size_t fileSize = (size_t) file.tellg();
+        if(fileSize == 0 || fileSize % sizeof(uint32_t) != 0) {
+            return {};
+        }
+
+        std::vector<uint32_t> spirv(fileSize / sizeof(uint32_t));
+        file.seekg(0);
+        if(!file.read(reinterpret_cast<char*>(spirv.data()), fileSize) || spirv[0] != SPIRV_MAGIC) {
+            return {};
+        }
+        return spirv;
+    }
+
+    void writeCache(uint64_t hash, const std::vector<uint32_t>& spirv) const {
+        if(_cacheDir.empty()) {
+            return;
+        }
+
+        // Per thread temporaries, two threads may write the same entry
+        std::ostringstream tmpPath;
+        tmpPath << cachePath(hash) << ".tmp" << std::this_thread::get_id();
+        {
+            std::ofstream file(tmpPath.str(), std::ios::binary | std::ios::trunc);
+            file.write(reinterpret_cast<const char*>(spirv.data()), spirv.size() * sizeof(uint32_t));
+            if(!file.good()) {
+                std::cerr << "shader cache: failed to write " << tmpPath.str() << "\n";
+                std::remove(tmpPath.str().c_str());
+                return;
+            }
+        }
+
+        if(std::rename(tmpPath.str().c_str(), cachePath(hash).c_str()) != 0) {
+            std::cerr << "shader cache: failed to replace " << cachePath(hash) << "\n";
+            std::remove(tmpPath.str().c_str());
+        }
+    }
+};
+
+// ------------------------------------------------------------------------------------- //
+// Pipeline variants
+//
+// Feature toggles pick a pipeline variant. Toggles changing a shader's interface are defines,
+// everything else is a specialization constant, so one SPIR-V module serves every value and
+// the driver still folds the untaken branches away. A PipelineDesc holds everything a pipeline
+// is created from and its hash is the key pipelines are shared under, so however many places
+// ask for a variant it is only created once.
+// ------------------------------------------------------------------------------------- //
+
+// One stage of a pipeline, the stage follows from the file's extension. constant_id i takes constants[i].
+struct ShaderVariant {
+    std::string name;
+    std::vector<std::string> defines = {};
+    std::vector<uint32_t> constants = {};
+
+    bool operator==(const ShaderVariant& other) const {
+        return name == other.name && defines == other.defines && constants == other.constants;
+    }
+};
+
+enum class BlendMode {
+    Opaque,
+    Alpha,
+    Additive,   // counts layers, see --overdraw
+};
+
+struct PipelineDesc {
+    std::vector<ShaderVariant> stages;
+    bool compute = false;
+    std::vector<VkVertexInputBindingDescription> bindings;
+    std::vector<VkVertexInputAttributeDescription> attributes;
+    VkPipelineLayout layout = VK_NULL_HANDLE;
+    VkCullModeFlags cullMode = VK_CULL_MODE_BACK_BIT;
+    BlendMode blend = BlendMode::Opaque;
+    VkFormat colorFormat = VK_FORMAT_UNDEFINED;     // stands for render pass compatibility
+    VkRenderPass renderPass = VK_NULL_HANDLE;       // _renderPass if null
+
+    bool usesShader(const std::string& name) const {
+        return std::any_of(stages.begin(), stages.end(), [&](const ShaderVariant& stage) { return stage.name == name; });
+    }
+
+    // Field by field, the Vulkan structs involved have no padding
+    uint64_t hash() const {
+        uint64_t hash = fnv1a64(&compute, sizeof(compute));
+        for(const ShaderVariant& stage : stages) {
+            hash = fnv1a64(stage.name.data(), stage.name.size() + 1, hash);
+            for(const std::string& define : stage.defines) {
+                hash = fnv1a64(define.data(), define.size() + 1, hash);
+            }
+            hash = fnv1a64(stage.constants.data(), stage.constants.size() * sizeof(uint32_t), hash);
+        }
+        hash = fnv1a64(bindings.data(), bindings.size() * sizeof(VkVertexInputBindingDescription), hash);
+        hash = fnv1a64(attributes.data(), attributes.size() * sizeof(VkVertexInputAttributeDescription), hash);
+        hash = fnv1a64(&layout, sizeof(layout), hash);
+        hash = fnv1a64(&cullMode, sizeof(cullMode), hash);
+        hash = fnv1a64(&blend, sizeof(blend), hash);
+        hash = fnv1a64(&colorFormat, sizeof(colorFormat), hash);
+        hash = fnv1a64(&renderPass, sizeof(renderPass), hash);
+        return hash;
+    }
+
+    bool operator==(const PipelineDesc& other) const {
+        auto sameBinding = [](const VkVertexInputBindingDescription& a, const VkVertexInputBindingDescription& b) {
+            return a.binding == b.binding && a.stride == b.stride && a.inputRate == b.inputRate;
+        };
+        auto sameAttribute = [](const VkVertexInputAttributeDescription& a, const VkVertexInputAttributeDescription& b) {
+            return a.location == b.location && a.binding == b.binding && a.format == b.format && a.offset == b.offset;
+        };
+        return stages == other.stages && compute == other.compute &&
+               std::equal(bindings.begin(), bindings.end(), other.bindings.begin(), other.bindings.end(), sameBinding) &&
+               std::equal(attributes.begin(), attributes.end(), other.attributes.begin(), other.attributes.end(), sameAttribute) &&
+               layout == other.layout && cullMode == other.cullMode && blend == other.blend &&
+               colorFormat == other.colorFormat && renderPass == other.renderPass;
+    }
+};
+
+// ------------------------------------------------------------------------------------- //
+// Descriptor allocation
+//
+// DescriptorAllocator hands out sets from a chain of pools that aren't sized for any layout
+// in particular. Each pool counts what it has left of every descriptor type, a set that
+// doesn't fit goes to the next pool in the chain, created twice as large (and at least
+// large enough for the set) if there is none yet. Overflowing a pool is never left to the
+// driver to report, without VK_KHR_maintenance1 that is invalid usage. reset() rewinds the
+// whole chain at once: per-frame allocators use it to drop all of a frame's transient sets
+// once the GPU is done with the frame, the pools stay around.
+//
+// DescriptorCache creates every set layout, keyed by its bindings, so a layout is created
+// once however many places ask for it. Long lived sets come from its own allocator, which
+// is never reset. Sets written once and never changed are also keyed by layout and
+// contents, asking for an identical one returns the set already written. That is only
+// safe for sets whose buffers and views live as long as the cache. Hashes only pick the
+// bucket, a hit is compared with what was actually asked for.
+// ------------------------------------------------------------------------------------- //
+
+const uint32_t DESCRIPTOR_POOL_SETS     = 64;      // of the first pool of a chain
+const uint32_t DESCRIPTOR_POOL_MAX_SETS = 4096;
+
+// Descriptors of each type a pool holds per set, roughly what the renderer's layouts use
+const std::array<std::pair<VkDescriptorType, uint32_t>, 5> DESCRIPTOR_POOL_RATIOS = {{
+    {VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 1},
+    {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 4},
+    {VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE,          1},
+    {VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,          4},
+    {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,         2},
+}};
+
+// Descriptors of each type of DESCRIPTOR_POOL_RATIOS, in that order
+typedef std::array<uint32_t, DESCRIPTOR_POOL_RATIOS.size()> DescriptorCounts;
+
+// Not thread safe, DescriptorCache guards its own
+class DescriptorAllocator {
+public:
+    void init(VkDevice device) {
+        _device = device;
+    }
+
+    // What a set of the layout takes from a pool, layouts must only use DESCRIPTOR_POOL_RATIOS' types
+    void addLayout(VkDescriptorSetLayout layout, const std::vector<VkDescriptorSetLayoutBinding>& bindings) {
+        DescriptorCounts counts{};
+        for(const VkDescriptorSetLayoutBinding& binding : bindings) {
+            auto ratio = std::find_if(DESCRIPTOR_POOL_RATIOS.begin(), DESCRIPTOR_POOL_RATIOS.end(),
+                                      [&](const std::pair<VkDescriptorType, uint32_t>& r) { return r.first == binding.descriptorType; });
+            if(ratio == DESCRIPTOR_POOL_RATIOS.end()) {
+                throw std::runtime_error("descriptor type has no descriptor pool ratio!");
+            }
+            counts[ratio - DESCRIPTOR_POOL_RATIOS.begin()] += binding.descriptorCount;
+        }
+        _layoutCounts[layout] = counts;
+    }
+
+    void destroy() {
+        for(const Pool& pool : _pools) {
+            vkDestroyDescriptorPool(_device, pool.pool, nullptr);
+        }
+        _pools.clear();
+        _current = 0;
+    }
+
+    VkDescriptorSet allocate(VkDescriptorSetLayout layout) {
+        auto counts = _layoutCounts.find(layout);
+        if(counts == _layoutCounts.end()) {
+            throw std::runtime_error("descriptor set layout wasn't added to the allocator!");
+        }
+
+        while(_current < _pools.size() && !fits(_pools[_current], counts->second)) {
+            _current++;
+        }
+        if(_current == _pools.size()) {
+            uint32_t sets = _pools.empty() ? DESCRIPTOR_POOL_SETS : std::min(_pools.back().sets * 2, DESCRIPTOR_POOL_MAX_SETS);
+            for(size_t i = 0; i < counts->second.size(); i++) {
+                uint32_t ratio = DESCRIPTOR_POOL_RATIOS[i].second;
+                sets = std::max(sets, (counts->second[i] + ratio - 1) / ratio);
+            }
+            _pools.push_back(createPool(sets));
+        }
+
+        Pool& pool = _pools[_current];
+
+        VkDescriptorSetAllocateInfo allocInfo{};
+        allocInfo.sType              = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+        allocInfo.descriptorPool     = pool.pool;
+        allocInfo.descriptorSetCount = 1;
+        allocInfo.pSetLayouts        = &layout;
+
+        VkDescriptorSet set;
+        if(vkAllocateDescriptorSets(_device, &allocInfo, &set) != VK_SUCCESS) {
+            throw std::runtime_error("failed to allocate descriptor set!");
+        }
+
+        pool.used++;
+        for(size_t i = 0; i < pool.remaining.size(); i++) {
+            pool.remaining[i] -= counts->second[i];
+        }
+        _allocated++;
+        _liveSets++;
+        _peakLiveSets = std::max(_peakLiveSets, _liveSets);
+        return set;
+    }
+
+    // Every set allocated since the last reset must be unused by the GPU
+    void reset() {
+        for(uint32_t i = 0; i <= _current && i < _pools.size(); i++) {
+            if(_pools[i].used > 0) {
+                vkResetDescriptorPool(_device, _pools[i].pool, 0);
+                _pools[i].used      = 0;
+                _pools[i].remaining = capacity(_pools[i].sets);
+            }
+        }
+        _current  = 0;
+        _liveSets = 0;
+    }
+
+    uint32_t poolCount() const {
+        return static_cast<uint32_t>(_pools.size());
+    }
+
+    uint64_t allocatedSets() const {
+        return _allocated;
+    }
+
+    void dumpStats(std::ostream& out, const char* name) const {
+        out << name << ": " << _allocated << " sets in " << _pools.size() << " pools, peak "
+            << _peakLiveSets << " between resets\n";
+    }
+
+private:
+    struct Pool {
+        VkDescriptorPool pool = VK_NULL_HANDLE;
+        uint32_t sets = 0;
+        uint32_t used = 0;
+        DescriptorCounts remaining{};
+    };
+
+    static DescriptorCounts capacity(uint32_t sets) {
+        DescriptorCounts counts{};
+        for(size_t i = 0; i < counts.size(); i++) {
+            counts[i] = DESCRIPTOR_POOL_RATIOS[i].second * sets;
+        }
+        return counts;
+    }
+
+    static bool fits(const Pool& pool, const DescriptorCounts& counts) {
+        if(pool.used == pool.sets) {
+            return false;
+        }
+        for(size_t i = 0; i < counts.size(); i++) {
+            if(counts[i] > pool.remaining[i]) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    Pool createPool(uint32_t sets) {
+        DescriptorCounts counts = capacity(sets);
+        std::array<VkDescriptorPoolSize, DESCRIPTOR_POOL_RATIOS.size()> poolSizes{};
+        for(size_t i = 0; i < poolSizes.size(); i++) {
+            poolSizes[i].type            = DESCRIPTOR_POOL_RATIOS[i].first;
+            poolSizes[i].descriptorCount = counts[i];
+        }
+
+        VkDescriptorPoolCreateInfo poolInfo{};
+        poolInfo.sType         = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+        poolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
+        poolInfo.pPoolSizes    = poolSizes.data();
+        poolInfo.maxSets       = sets;
+
+        Pool pool;
+        pool.sets      = sets;
+        pool.remaining = counts;
+        if(vkCreateDescriptorPool(_device, &poolInfo, nullptr, &pool.pool) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create descriptor pool!");
+        }
+        return pool;
+    }
+
+    VkDevice _device = VK_NULL_HANDLE;
+    std::vector<Pool> _pools;
+    std::map<VkDescriptorSetLayout, DescriptorCounts> _layoutCounts;
+    uint32_t _current = 0;                      // pool allocations are tried in first
+    uint64_t _allocated = 0;                    // over the allocator's lifetime
+    uint32_t _liveSets = 0;                     // since the last reset
+    uint32_t _peakLiveSets = 0;
+};
+
+// One binding of a set that is written once, images or buffers depending on the type
+struct DescriptorWrite {
+    uint32_t binding;
+    VkDescriptorType type;
+    std::vector<VkDescriptorImageInfo> images;
+    std::vector<VkDescriptorBufferInfo> buffers;
+};
+
+class DescriptorCache {
+public:
+    void init(VkDevice device) {
+        _device = device;
+        _sets.init(device);
+    }
+
+    void destroy() {
+        _sets.destroy();
+        for(const auto& layout : _layouts) {
+            vkDestroyDescriptorSetLayout(_device, layout.second.layout, nullptr);
+        }
+        _layouts.clear();
+        _immutableSets.clear();
+    }
+
+    // Field by field, VkDescriptorSetLayoutBinding has padding
+    VkDescriptorSetLayout layout(const std::vector<VkDescriptorSetLayoutBinding>& bindings) {
+        size_t count = bindings.size();
+        uint64_t hash = fnv1a64(&count, sizeof(count));
+        for(const VkDescriptorSetLayoutBinding& binding : bindings) {
+            hash = fnv1a64(&binding.binding, sizeof(binding.binding), hash);
+            hash = fnv1a64(&binding.descriptorType, sizeof(binding.descriptorType), hash);
+            hash = fnv1a64(&binding.descriptorCount, sizeof(binding.descriptorCount), hash);
+            hash = fnv1a64(&binding.stageFlags, sizeof(binding.stageFlags), hash);
+            if(binding.pImmutableSamplers != nullptr) {
+                hash = fnv1a64(binding.pImmutableSamplers, binding.descriptorCount * sizeof(VkSampler), hash);
+            }
+        }
+
+        std::lock_guard<std::mutex> lock(_mutex);
+        auto range = _layouts.equal_range(hash);
+        for(auto cached = range.first; cached != range.second; ++cached) {
+            if(sameBindings(cached->second, bindings)) {
+                _layoutHits++;
+                return cached->second.layout;
+            }
+        }
+
+        VkDescriptorSetLayoutCreateInfo layoutInfo{};
+        layoutInfo.sType        = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+        layoutInfo.bindingCount = static_cast<uint32_t>(bindings.size());
+        layoutInfo.pBindings    = bindings.data();
+
+        CachedLayout cached;
+        if(vkCreateDescriptorSetLayout(_device, &layoutInfo, nullptr, &cached.layout) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create descriptor set layout!");
+        }
+        _sets.addLayout(cached.layout, bindings);
+
+        // The caller's sampler arrays don't outlive the call, keep copies
+        cached.bindings = bindings;
+        for(VkDescriptorSetLayoutBinding& binding : cached.bindings) {
+            if(binding.pImmutableSamplers != nullptr) {
+                cached.samplers.insert(cached.samplers.end(), binding.pImmutableSamplers,
+                                       binding.pImmutableSamplers + binding.descriptorCount);
+                binding.pImmutableSamplers = nullptr;
+            }
+        }
+
+        VkDescriptorSetLayout layout = cached.layout;
+        _layouts.emplace(hash, std::move(cached));
+        return layout;
+    }
+
+    // A long lived set, the caller writes it and may update it later
+    VkDescriptorSet allocate(VkDescriptorSetLayout layout) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _sets.allocate(layout);
+    }
+
+    VkDescriptorSet immutableSet(VkDescriptorSetLayout layout, const std::vector<DescriptorWrite>& writes) {
+        uint64_t hash = fnv1a64(&layout, sizeof(layout));
+        for(const DescriptorWrite& write : writes) {
+            hash = fnv1a64(&write.binding, sizeof(write.binding), hash);
+            hash = fnv1a64(&write.type, sizeof(write.type), hash);
+            for(const VkDescriptorImageInfo& image : write.images) {
+                hash = fnv1a64(&image.sampler, sizeof(image.sampler), hash);
+                hash = fnv1a64(&image.imageView, sizeof(image.imageView), hash);
+                hash = fnv1a64(&image.imageLayout, sizeof(image.imageLayout), hash);
+            }
+            hash = fnv1a64(write.buffers.data(), write.buffers.size() * sizeof(VkDescriptorBufferInfo), hash);
+        }
+
+        std::lock_guard<std::mutex> lock(_mutex);
+        auto range = _immutableSets.equal_range(hash);
+        for(auto cached = range.first; cached != range.second; ++cached) {
+            if(cached->second.layout == layout && sameWrites(cached->second.writes, writes)) {
+                _setHits++;
+                return cached->second.set;
+            }
+        }
+
+        VkDescriptorSet set = _sets.allocate(layout);
+
+        std::vector<VkWriteDescriptorSet> descriptorWrites(writes.size());
+        for(size_t i = 0; i < writes.size(); i++) {
+            descriptorWrites[i].sType           = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+            descriptorWrites[i].dstSet          = set;
+            descriptorWrites[i].dstBinding      = writes[i].binding;
+            descriptorWrites[i].dstArrayElement = 0;
+            descriptorWrites[i].descriptorType  = writes[i].type;
+            if(!writes[i].images.empty()) {
+                descriptorWrites[i].descriptorCount = static_cast<uint32_t>(writes[i].images.size());
+                descriptorWrites[i].pImageInfo      = writes[i].images.data();
+            }
+            else {
+                descriptorWrites[i].descriptorCount = static_cast<uint32_t>(writes[i].buffers.size());
+                descriptorWrites[i].pBufferInfo     = writes[i].buffers.data();
+            }
+        }
+        vkUpdateDescriptorSets(_device, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
+
+        _immutableSets.emplace(hash, CachedSet{layout, writes, set});
+        return set;
+    }
+
+    void dumpStats(std::ostream& out) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        out << "descriptors: " << _layouts.size() << " layouts (" << _layoutHits << " reused), "
+            << _sets.allocatedSets() << " sets in " << _sets.poolCount() << " pools, "
+            << _immutableSets.size() << " immutable (" << _setHits << " reused)\n";
+    }
+
+private:
+    struct CachedLayout {
+        std::vector<VkDescriptorSetLayoutBinding> bindings;     // pImmutableSamplers cleared
+        std::vector<VkSampler> samplers;                        // every binding's immutable samplers in order
+        VkDescriptorSetLayout layout = VK_NULL_HANDLE;
+    };
+
+    struct CachedSet {
+        VkDescriptorSetLayout layout;
+        std::vector<DescriptorWrite> writes;
+        VkDescriptorSet set;
+    };
+
+    static bool sameBindings(const CachedLayout& cached, const std::vector<VkDescriptorSetLayoutBinding>& bindings) {
+        if(cached.bindings.size() != bindings.size()) {
+            return false;
+        }
+        const VkSampler* samplers = cached.samplers.data();
+        for(size_t i = 0; i < bindings.size(); i++) {
+            const VkDescriptorSetLayoutBinding& a = cached.bindings[i];
+            const VkDescriptorSetLayoutBinding& b = bindings[i];
+            if(a.binding != b.binding || a.descriptorType != b.descriptorType ||
+               a.descriptorCount != b.descriptorCount || a.stageFlags != b.stageFlags) {
+                return false;
+            }
+            if(b.pImmutableSamplers != nullptr) {
+                if(samplers + b.descriptorCount > cached.samplers.data() + cached.samplers.size() ||
+                   !std::equal(b.pImmutableSamplers, b.pImmutableSamplers + b.descriptorCount, samplers)) {
+                    return false;
+                }
+                samplers += b.descriptorCount;
+            }
+        }
+        return samplers == cached.samplers.data() + cached.samplers.size();
+    }
+
+    static bool sameWrites(const std::vector<DescriptorWrite>& a, const std::vector<DescriptorWrite>& b) {
+        auto sameImage = [](const VkDescriptorImageInfo& x, const VkDescriptorImageInfo& y) {
+            return x.sampler == y.sampler && x.imageView == y.imageView && x.imageLayout == y.imageLayout;
+        };
+        auto sameBuffer = [](const VkDescriptorBufferInfo& x, const VkDescriptorBufferInfo& y) {
+            return x.buffer == y.buffer && x.offset == y.offset && x.range == y.range;
+        };
+        return std::equal(a.begin(), a.end(), b.begin(), b.end(), [&](const DescriptorWrite& x, const DescriptorWrite& y) {
+            return x.binding == y.binding && x.type == y.type &&
+                   std::equal(x.images.begin(), x.images.end(), y.images.begin(), y.images.end(), sameImage) &&
+                   std::equal(x.buffers.begin(), x.buffers.end(), y.buffers.begin(), y.buffers.end(), sameBuffer);
+        });
+    }
+
+    VkDevice _device = VK_NULL_HANDLE;
+    std::mutex _mutex;                          // init jobs create layouts and sets in parallel
+    DescriptorAllocator _sets;
+    std::multimap<uint64_t, CachedLayout> _layouts;
+    std::multimap<uint64_t, CachedSet> _immutableSets;
+    uint64_t _layoutHits = 0;
+    uint64_t _setHits = 0;
+};
+
+// ------------------------------------------------------------------------------------- //
+// Mapped asset files
+//
+// MappedFile maps a whole file read only. MeshFile (.vmesh, mesh_format.h) and Ktx2File
+// (.ktx2, ktx2_format.h) validate a mapping, nothing is parsed or copied: vertex, index and
+// texel data are uploaded straight from it. Mesh is what the renderer draws, pointing
+// either into a mapping or at the built-in quad.
+// ------------------------------------------------------------------------------------- //
+
+class MappedFile {
+public:
+    ~MappedFile() {
+        close();
+    }
+
+    // kind names the file in error messages
+    void open(const std::string& path, const std::string& kind) {
+        close();
+
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if(fd < 0) {
+            throw std::runtime_error("failed to open " + kind + " " + path);
+        }
+
+        struct stat fileStat;
+        if(fstat(fd, &fileStat) != 0 || fileStat.st_size == 0) {
+            ::close(fd);
+            throw std::runtime_error(kind + " " + path + " is empty");
+        }
+
+        _size = static_cast<size_t>(fileStat.st_size);
+        _mapping = mmap(nullptr, _size, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if(_mapping == MAP_FAILED) {
+            _mapping = nullptr;
+            throw std::runtime_error("failed to map " + kind + " " + path);
+        }
+
+        // Read front to back once by the uploads, let the kernel read ahead
+        madvise(_mapping, _size, MADV_SEQUENTIAL);
+        madvise(_mapping, _size, MADV_WILLNEED);
+    }
+
+    void close() {
+        if(_mapping) {
+            munmap(_mapping, _size);
+            _mapping = nullptr;
+            _size    = 0;
+        }
+    }
+
+    bool isOpen() const {
+        return _mapping != nullptr;
+    }
+
+    const uint8_t* bytes() const {
+        return static_cast<const uint8_t*>(_mapping);
+    }
+
+    size_t size() const {
+        return _size;
+    }
+
+    bool inFile(uint64_t offset, uint64_t size) const {
+        return offset <= _size && size <= _size - offset;
+    }
+
+private:
+    void* _mapping = nullptr;
+    size_t _size = 0;
+};
+
+class MeshFile {
+public:
+    void open(const std::string& path) {
+        _file.open(path, "mesh");
+
+        try {
+            validate(path);
+        } catch(...) {
+            close();
+            throw;
+        }
+    }
+
+    void close() {
+        _file.close();
+    }
+
+    const MeshFileHeader& header() const {
+        return *reinterpret_cast<const MeshFileHeader*>(bytes());
+    }
+
+    const MeshAttribute* attributes() const {
+        return reinterpret_cast<const MeshAttribute*>(bytes() + header().attributesOffset);
+    }
+
+    const MeshSubmesh* submeshes() const {
+        return reinterpret_cast<const MeshSubmesh*>(bytes() + header().submeshesOffset);
+    }
+
+    const void* vertexData() const {
+        return bytes() + header().vertexDataOffset;
+    }
+
+    const void* indexData() const {
+        return bytes() + header().indexDataOffset;
+    }
+
+private:
+    MappedFile _file;
+
+    const uint8_t* bytes() const {
+        return _file.bytes();
+    }
+
+    bool inFile(uint64_t offset, uint64_t size) const {
+        return _file.inFile(offset, size);
+    }
+
+    void validate(const std::string& path) const {
+        if(_file.size() < sizeof(MeshFileHeader)) {
+            throw std::runtime_error("mesh " + path + " is too small to be a mesh file");
+        }
+
+        const MeshFileHeader& h = header();
+
+        if(h.magic != MESH_FILE_MAGIC) {
+            throw std::runtime_error("mesh " + path + " is not a mesh file");
+        }
+        if(h.version != MESH_FILE_VERSION || h.headerSize != sizeof(MeshFileHeader)) {
+            throw std::runtime_error("mesh " + path + " has version " + std::to_string(h.version) +
+                                     ", expected " + std::to_string(MESH_FILE_VERSION) + ", reconvert it");
+        }
+        if(h.indexSize != 2 && h.indexSize != 4) {
+            throw std::runtime_error("mesh " + path + " has an invalid index size");
+        }
+        if(h.vertexCount == 0 || h.indexCount == 0 || h.submeshCount == 0) {
+            throw std::runtime_error("mesh " + path + " is empty");
+        }
+
+        if(!inFile(h.attributesOffset, uint64_t(h.attributeCount) * sizeof(MeshAttribute))
+        || !inFile(h.submeshesOffset, uint64_t(h.submeshCount) * sizeof(MeshSubmesh))
+        || !inFile(h.vertexDataOffset, uint64_t(h.vertexCount) * h.vertexStride)
+        || !inFile(h.indexDataOffset, uint64_t(h.indexCount) * h.indexSize)
+        || h.attributesOffset % alignof(MeshAttribute) != 0 || h.submeshesOffset % alignof(MeshSubmesh) != 0) {
+            throw std::runtime_error("mesh " + path + " is truncated or corrupt");
+        }
+
+        for(uint32_t i = 0; i < h.attributeCount; i++) {
+            const MeshAttribute& attribute = attributes()[i];
+            uint32_t size = meshAttributeFormatSize(attribute.format);
+            if(size == 0 || attribute.offset + size > h.vertexStride) {
+                throw std::runtime_error("mesh " + path + " has an invalid vertex layout");
+            }
+        }
+
+        for(uint32_t i = 0; i < h.submeshCount; i++) {
+            const MeshSubmesh& submesh = submeshes()[i];
+            if(submesh.firstIndex > h.indexCount || submesh.indexCount > h.indexCount - submesh.firstIndex) {
+                throw std::runtime_error("mesh " + path + " has a submesh outside its index data");
+            }
+        }
+    }
+};
+
+class Ktx2File {
+public:
+    void open(const std::string& path) {
+        _file.open(path, "texture");
+
+        try {
+            validate(path);
+        } catch(...) {
+            close();
+            throw;
+        }
+    }
+
+    void close() {
+        _file.close();
+    }
+
+    const Ktx2Header& header() const {
+        return *reinterpret_cast<const Ktx2Header*>(_file.bytes());
+    }
+
+    const Ktx2FormatInfo& format() const {
+        return *ktx2FormatInfo(header().vkFormat);
+    }
+
+    uint32_t layers() const {
+        return std::max(header().layerCount, 1u);
+    }
+
+    uint32_t levels() const {
+        return std::max(header().levelCount, 1u);
+    }
+
+    // All layers of one level, level 0 is the largest
+    const void* levelData(uint32_t level) const {
+        return _file.bytes() + levelIndex()[level].byteOffset;
+    }
+
+    VkDeviceSize levelSize(uint32_t level) const {
+        return levelIndex()[level].byteLength;
+    }
+
+private:
+    MappedFile _file;
+
+    const Ktx2LevelIndex* levelIndex() const {
+        return reinterpret_cast<const Ktx2LevelIndex*>(_file.bytes() + sizeof(Ktx2Header));
+    }
+
+    void validate(const std::string& path) const {
+        if(_file.size() < sizeof(Ktx2Header) || !ktx2HasIdentifier(header())) {
+            throw std::runtime_error("texture " + path + " is not a KTX2 file");
+        }
+
+        const Ktx2Header& h = header();
+        if(h.supercompressionScheme != 0) {
+            throw std::runtime_error("texture " + path + " is supercompressed, only plain KTX2 is supported");
+        }
+        if(h.pixelDepth > 1 || h.faceCount != 1 || h.pixelWidth == 0 || h.pixelHeight == 0) {
+            throw std::runtime_error("texture " + path + " is not a 2D texture");
+        }
+        if(!ktx2FormatInfo(h.vkFormat)) {
+            throw std::runtime_error("texture " + path + " has unsupported format " + std::to_string(h.vkFormat));
+        }
+        if(levels() > 1 && (std::max(h.pixelWidth, h.pixelHeight) >> (levels() - 1)) == 0) {
+            throw std::runtime_error("texture " + path + " has more levels than its size allows");
+        }
+        if(!_file.inFile(sizeof(Ktx2Header), uint64_t(levels()) * sizeof(Ktx2LevelIndex))) {
+            throw std::runtime_error("texture " + path + " is truncated or corrupt");
+        }
+
+        for(uint32_t level = 0; level < levels(); level++) {
+            const Ktx2LevelIndex& index = levelIndex()[level];
+            uint64_t expected = ktx2LayerSize(format(), std::max(h.pixelWidth >> level, 1u),
+                                              std::max(h.pixelHeight >> level, 1u)) * layers();
+            if(index.byteLength != expected || !_file.inFile(index.byteOffset, index.byteLength)) {
+                throw std::runtime_error("texture " + path + " has a level outside its data or of the wrong size");
+            }
+        }
+    }
+};
+
+// One texture of the streaming scene. The mip tail is always resident, finer levels live in a second
+// image holding residentLevel and everything coarser, so either image can be sampled on its own.
+struct StreamedTexture {
+    VkImage tailImage = VK_NULL_HANDLE;
+    Allocation tailAllocation;
+    VkImageView tailView = VK_NULL_HANDLE;
+
+    VkImage image = VK_NULL_HANDLE;             // none while only the tail is resident
+    Allocation allocation;
+    VkImageView view = VK_NULL_HANDLE;
+    uint32_t residentLevel = 0;                 // finest level in memory
+
+    VkImage pendingImage = VK_NULL_HANDLE;      // replaces image once its upload has been acquired
+    Allocation pendingAllocation;
+    VkImageView pendingView = VK_NULL_HANDLE;
+    uint32_t pendingLevel = 0;
+    uint64_t uploadId = 0;
+
+    uint32_t requestedLevel = ~0u;              // finest level the feedback asked for
+    uint64_t lastUsedFrame = 0;                 // frame that feedback was read in
+};
+
+// Vertex data is interleaved in binding 0, attributes are already mapped to shader locations
+struct Mesh {
+    const void* vertexData = nullptr;
+    uint32_t vertexCount   = 0;
+    uint32_t vertexStride  = 0;
+    const void* indexData  = nullptr;
+    uint32_t indexCount    = 0;
+    VkIndexType indexType  = VK_INDEX_TYPE_UINT16;
+    std::vector<MeshAttribute> layout;                          // what the vertex data holds
+    std::vector<VkVertexInputAttributeDescription> attributes;  // how the shaders read it
+    std::vector<MeshSubmesh> submeshes;
+    glm::vec3 boundsMin;
+    glm::vec3 boundsMax;
+    glm::vec3 decodeScale  = glm::vec3(1.0f);  // stored position * decodeScale + decodeOffset = object space
+    glm::vec3 decodeOffset = glm::vec3(0.0f);
+
+    VkDeviceSize vertexDataSize() const {
+        return VkDeviceSize(vertexCount) * vertexStride;
+    }
+
+    VkDeviceSize indexDataSize() const {
+        return VkDeviceSize(indexCount) * (indexType == VK_INDEX_TYPE_UINT32 ? 4 : 2);
+    }
+
+    VkVertexInputBindingDescription bindingDescription() const {
+
+        VkVertexInputBindingDescription bindingDescription{};
+        bindingDescription.binding   = 0;
+        bindingDescription.stride    = vertexStride;
+        bindingDescription.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+
+        return bindingDescription;
+    }
+
+    const MeshAttribute* findAttribute(uint32_t semantic) const {
+        for(const MeshAttribute& attribute : layout) {
+            if(attribute.semantic == semantic) {
+                return &attribute;
+            }
+        }
+        return nullptr;
+    }
+
+    glm::vec3 position(uint32_t vertex) const {
+        const MeshAttribute* attribute = findAttribute(MESH_ATTRIBUTE_POSITION);
+        float value[4];
+        decodeMeshAttribute(attribute->format, static_cast<const uint8_t*>(vertexData) + size_t(vertex) * vertexStride + attribute->offset, value);
+        return glm::vec3(value[0], value[1], value[2]) * decodeScale + decodeOffset;
+    }
+};
+
+
+class HelloTriangleApplication {
+public:
+    explicit HelloTriangleApplication(const AppOptions& options) : _options(options), _framesInFlight(options.framesInFlight) {}
+
+    void run() {
+        if(!_options.headless) {
+            initWindow();
+        }
+        initVulkan();
+        mainLoop();
+        cleanup();
+    }
+
+private:
+    AppOptions _options;
+    GLFWwindow* _window = nullptr;
+    VkInstance  _instance;
+    VkDebugUtilsMessengerEXT _debugMessenger;
+    VkSurfaceKHR _surface;
+    VkPhysicalDevice _physicalDevice = VK_NULL_HANDLE;
+    VkPhysicalDeviceFeatures _enabledFeatures{};
+    VkDevice _device;
+    VkQueue _graphicsQueue;
+    VkQueue _presentQueue;
+    VkQueue _transferQueue;
+    VkSwapchainKHR _swapChain = VK_NULL_HANDLE;
+    std::vector<VkImage> _swapChainImages;
+    VkFormat _swapChainImageFormat;
+    VkExtent2D _swapChainExtent;
+    std::vector<VkImageView> _swapChainImageViews;
+    VkRenderPass _renderPass;
+
+    VkDescriptorSetLayout _descriptorSetLayout;
+    VkPipelineLayout _pipelineLayout;
+
+    VkPipeline _graphicsPipeline;
+    VkPipeline _instancedPipeline;
+    VkPipeline _positionPipeline = VK_NULL_HANDLE;
+    PersistentPipelineCache _pipelineCache;
+    double _pipelineCreateMs = -1.0;
+
+    // Every pipeline by the key of its PipelineDesc (see variantKey), and the members pointing at
+    // each, which follow it when it is rebuilt for a shader reload
+    struct PipelineVariant {
+        PipelineDesc desc;
+        VkPipeline pipeline;
+    };
+    ShaderLibrary _shaders;
+    std::map<uint64_t, PipelineVariant> _pipelines;
+    std::map<VkPipeline*, uint64_t> _pipelineUsers;
+    std::map<uint64_t, PipelineDesc> _pipelinesPending;     // being created in the background
+    std::map<uint64_t, PipelineDesc> _pipelinesFailed;      // background creation threw, requested again once a shader they use reloads
+    std::mutex _pipelinesMutex;
+    TaskQueue _pipelineCompiler;
+    bool _pipelineCacheControl = false;             // VK_EXT_pipeline_creation_cache_control
+    uint32_t _pipelineRequests = 0;
+    uint32_t _pipelineCacheProbeHits = 0;           // requests the driver's cache served without compiling
+    uint32_t _pipelineBackgroundCreates = 0;
+    double _pipelineBackgroundMs = 0.0;
+    uint32_t _shaderReloads = 0;
+    double _initMs     = 0.0;           // initVulkan wall time
+    double _initBusyMs = 0.0;           // sum of its steps, about what a single thread would take
+    uint32_t _initThreads = 1;
+    std::vector<VkFramebuffer> _swapChainFramebuffers;
+
+    // Everything one frame in flight records into, the pools are reset as a whole every frame
+    struct FrameCommands {
+        VkCommandPool pool = VK_NULL_HANDLE;
+        VkCommandBuffer primary = VK_NULL_HANDLE;
+        std::vector<VkCommandPool> workerPools;
+        std::vector<VkCommandBuffer> workerBuffers;     // secondary, one per recording thread
+    };
+    std::vector<FrameCommands> _frameCommands;
+    WorkerPool _recordWorkers;
+
+    std::vector<DrawItem> _drawList;
+    PipelineDesc _drawDesc;                         // variant 0, the others differ in shader.frag's VARIANT
+    std::vector<VkPipeline> _drawVariantPipelines;  // each variant's own pipeline once it exists
+    std::vector<VkPipeline> _drawPipelines;         // what each variant records with this frame, null to skip
+    uint64_t _variantWaitFrames = 0;                // summed over variants, frames past warm-up drawn with a fallback or skipped
+    UniformBufferObject _frameUniforms{};
+
+    // Simulation to render handoff. With --render-thread the main thread simulates and the render
+    // thread sleeps until the next packet, the packets themselves never pass through a lock.
+    TripleBuffer<FramePacket> _packets;
+    const FramePacket* _framePacket = nullptr;      // the one drawFrame renders, the consumer's slot
+    std::mutex _packetMutex;                        // only for the render thread to sleep on
+    std::condition_variable _packetPublished;
+    bool _stopRendering = false;                    // under _packetMutex
+    std::atomic<bool> _renderDone{false};
+    std::exception_ptr _renderError;
+    uint64_t _simSteps = 0;
+    uint64_t _lastPacketStep = 0;
+    uint64_t _packetsSkipped = 0;                   // published, then replaced before the renderer got to them
+    std::vector<double> _simTimes;
+    VkExtent2D _windowExtent{};                     // simulation side, last non-zero framebuffer size
+    VkExtent2D _framebufferExtent{};                // render side, from the packet being rendered
+
+    // With --present-thread the render thread hands every frame's present to _presenter
+    TaskQueue _presenter;
+    std::mutex _queueMutex;                         // the queue and swapchain the present thread shares
+    std::mutex _presentMutex;
+    std::condition_variable _presentDone;
+    uint64_t _framesPresented = 0;                  // under _presentMutex
+    std::atomic<bool> _swapChainStale{false};
+    std::atomic<bool> _presentFailed{false};
+
+    // Present pacing and input to photon latency. With VK_KHR_present_wait every present carries its
+    // frame number + 1 as present id and _presentWaiter timestamps when each one reaches the screen.
+    VkPresentModeKHR _presentMode = VK_PRESENT_MODE_FIFO_KHR;
+    bool _presentWait = false;
+    PFN_vkWaitForPresentKHR _vkWaitForPresent = nullptr;
+    TaskQueue _presentWaiter;
+    bool _presentWaiterRunning = false;             // its polls share the swapchain, see queuesShared()
+    VkSwapchainKHR _lastPresentSwapChain = VK_NULL_HANDLE;  // carried present id _frameCount
+    double _pacingWaitMs = 0.0;                     // --low-latency wait before the inline simulation step
+    std::vector<double> _inputToSubmitTimes;
+    std::vector<double> _inputToPresentTimes;       // written by _presentWaiter
+    // Frame N signals _frameTimeline to N + 1 when the GPU is done with it. Per frame resources
+    // live in _framesInFlight slots, frame N uses slot N % _framesInFlight.
+    uint32_t _framesInFlight = DEFAULT_FRAMES_IN_FLIGHT;
+    VkSemaphore _frameTimeline = VK_NULL_HANDLE;
+    PFN_vkWaitSemaphoresKHR _vkWaitSemaphores = nullptr;
+    PFN_vkGetSemaphoreCounterValueKHR _vkGetSemaphoreCounterValue = nullptr;
+    std::vector<VkSemaphore> _imageAvailableSemaphores;     // binary, the swapchain can't signal a timeline
+    std::vector<VkSemaphore> _renderFinishedSemaphores;     // binary, present can't wait on a timeline
+    std::vector<uint64_t> _imageFrameValues;                // timeline value of the last frame that rendered each image, 0 = none
+    size_t currentFrame = 0;
+    std::atomic<bool> framebufferResized{false};
+
+    // Objects replaced while frames were in flight, destroyed once every frame submitted before is done
+    std::deque<std::pair<uint64_t, std::function<void()>>> _deferredDestroys;
+    DeviceAllocator _allocator;
+    UploadEngine _uploads;
+    uint64_t _sceneUploadId = 0;
+
+    // Semaphores of finished uploads the current frame's submit has to wait on
+    std::vector<VkSemaphore> _uploadWaitSemaphores;
+    std::vector<VkPipelineStageFlags> _uploadWaitStages;
+
+    MeshFile _meshFile;
+    Mesh _mesh;
+    std::vector<uint8_t> _meshVertexStorage;    // the mesh repacked for --vertex-format, until it's uploaded
+    glm::vec3 _meshScale  = glm::vec3(1.0f);    // vertex data to the size of the built-in quad, per axis
+    glm::vec3 _meshOffset = glm::vec3(0.0f);
+    glm::mat4 _meshFitTransform = glm::mat4(1.0f);  // the same for the stream the draw list reads
+
+    // --position-only: snorm16 positions relative to the bounds, 8 bytes a vertex
+    std::vector<uint8_t> _positionStorage;
+    glm::vec3 _positionScale  = glm::vec3(1.0f);
+    glm::vec3 _positionOffset = glm::vec3(0.0f);
+    VkBuffer _positionBuffer = VK_NULL_HANDLE;
+    Allocation _positionBufferAllocation;
+
+    VkBuffer _vertexBuffer;
+    Allocation _vertexBufferAllocation;
+    VkBuffer _indexBuffer;
+    Allocation _indexBufferAllocation;
+
+    UniformRing _uniformRing;
+
+    // Every set layout and long lived set, plus an allocator per frame in flight for sets only
+    // that frame's commands use, reset once the frame is done
+    DescriptorCache _descriptors;
+    std::vector<DescriptorAllocator> _frameDescriptors;
+    VkDescriptorSet _descriptorSet;
+
+    VkImage _textureImage;
+    Allocation _textureImageAllocation;
+    VkImageView _textureImageView;
+    VkSampler _textureSampler;
+    uint32_t _textureMipLevels = 1;
+    VkFormat _textureFormat = VK_FORMAT_R8G8B8A8_SRGB;     // of the view, the image may be UNORM for mip generation
+    uint32_t _textureLayers = TEXTURE_LAYERS;
+    Ktx2File _textureFile;                      // mapped until the scene upload is submitted
+    std::string _textureSource;
+    VkDeviceSize _textureBytes = 0;             // uploaded, every level and layer
+    double _textureLoadMs = 0.0;                // file to staging, GPU mip generation not included
+    bool _textureDirect = false;                // written by the host into a linear image, no staging copy
+
+    // Mip generation, _mipMode is what the device supports of what was asked for
+    MipMode _mipMode = MipMode::Off;
+    std::vector<MipJob> _mipJobs;               // waiting for their upload to be acquired
+    std::vector<MipJob> _mipJobsInFlight;       // recorded, resources freed once their frame is done
+    VkDescriptorSetLayout _mipDescriptorSetLayout = VK_NULL_HANDLE;
+    VkPipelineLayout _mipPipelineLayout = VK_NULL_HANDLE;
+    VkPipeline _mipPipeline = VK_NULL_HANDLE;
+    VkBuffer _mipCounterBuffer = VK_NULL_HANDLE;
+    Allocation _mipCounterBufferAllocation;
+    VkQueryPool _mipQueryPool = VK_NULL_HANDLE;
+    int _mipTimingFrame = -1;                   // frame in flight whose timestamps are pending
+    double _mipMs = -1.0;                       // GPU time of the generated chain, CPU time of the cpu mode
+
+    // Texture streaming, see createStreamedTextures. _streamAllocated counts the reserved size of every
+    // streamed image including those waiting for their deferred destroy (_streamReleasing), it stays within _streamBudget.
+    std::vector<StreamedTexture> _streamTextures;
+    uint32_t _streamLevels = 0;                 // of a whole texture
+    uint32_t _streamTailLevel = 0;              // first level of the always resident tail
+    std::vector<VkDeviceSize> _streamImageBytes;    // per first level, 0 until asked
+    VkSampler _streamSampler = VK_NULL_HANDLE;
+    VkDescriptorSetLayout _streamSetLayout = VK_NULL_HANDLE;
+    VkPipelineLayout _streamPipelineLayout = VK_NULL_HANDLE;
+    VkPipeline _streamPipeline = VK_NULL_HANDLE;
+    std::vector<VkDescriptorSet> _streamDescriptorSets;     // one per frame in flight
+    std::vector<std::vector<uint32_t>> _streamDirty;        // textures whose view changed, per frame's set
+    std::vector<VkBuffer> _streamFeedbackBuffers;
+    std::vector<Allocation> _streamFeedbackAllocations;
+    std::vector<bool> _streamFeedbackPending;
+    PFN_vkGetPhysicalDeviceMemoryProperties2KHR _vkGetPhysicalDeviceMemoryProperties2 = nullptr;
+    PFN_vkGetPhysicalDeviceFeatures2KHR _vkGetPhysicalDeviceFeatures2 = nullptr;
+    bool _memoryBudgetSupported = false;
+    uint32_t _streamHeap = 0;
+    VkDeviceSize _streamBudget    = 0;
+    VkDeviceSize _streamAllocated = 0;
+    VkDeviceSize _streamReleasing = 0;
+    VkDeviceSize _streamPeak      = 0;
+    uint64_t _streamUploads   = 0;
+    VkDeviceSize _streamUploadBytes = 0;
+    uint64_t _streamEvictions = 0;
+    uint64_t _streamDeferred  = 0;              // uploads that had to wait for evicted memory
+    double _streamDeficitTotal = 0.0;           // levels missing per visible texture, summed over frames
+    uint64_t _streamDeficitFrames = 0;
+
+    // Instanced path: CPU instance array, expanded each frame into that frame's mapped instance buffer
+    std::vector<InstanceState> _instances;
+    std::vector<VkBuffer> _instanceBuffers;
+    std::vector<Allocation> _instanceBuffersAllocation;
+    std::vector<uint32_t> _instanceBufferCapacity;
+
+    // GPU culled scene: objects live on the GPU, cull.comp writes this frame's draw commands and their count
+    VkBuffer _cullObjectBuffer = VK_NULL_HANDLE;
+    Allocation _cullObjectBufferAllocation;
+    VkBuffer _cullBoundsBuffer = VK_NULL_HANDLE;
+    Allocation _cullBoundsBufferAllocation;
+    std::vector<glm::vec4> _cullBounds;             // kept for the CPU reference count
+    std::vector<VkBuffer> _cullCommandBuffers;
+    std::vector<Allocation> _cullCommandBuffersAllocation;
+    std::vector<VkBuffer> _cullCountBuffers;
+    std::vector<Allocation> _cullCountBuffersAllocation;
+    std::vector<bool> _cullPending;
+    VkDescriptorSetLayout _cullDescriptorSetLayout = VK_NULL_HANDLE;
+    std::vector<VkDescriptorSet> _cullDescriptorSets;
+    VkPipelineLayout _cullPipelineLayout = VK_NULL_HANDLE;
+    VkPipeline _cullPipeline = VK_NULL_HANDLE;
+    uint32_t _cullUniformOffset = 0;
+    PFN_vkCmdDrawIndexedIndirectCountKHR _vkCmdDrawIndexedIndirectCount = nullptr;
+    uint64_t _cullVisibleTotal = 0;
+    uint64_t _cullFrames = 0;
+    uint32_t _cullVisibleLast = 0;
+
+    // --pipeline-stats, one query per frame in flight around the render pass
+    VkQueryPool _statsQueryPool = VK_NULL_HANDLE;
+    std::vector<std::optional<uint64_t>> _statsPending;    // frame whose query a slot holds
+    std::array<uint64_t, PIPELINE_STAT_COUNT> _statsTotals{};
+    uint64_t _statsFrames = 0;
+
+    // --overdraw, the draw list drawn again into an additive target, reduced to a histogram per frame in flight
+    VkImage _overdrawImage = VK_NULL_HANDLE;
+    Allocation _overdrawImageAllocation;
+    VkImageView _overdrawImageView = VK_NULL_HANDLE;
+    VkExtent2D _overdrawExtent{};
+    VkRenderPass _overdrawRenderPass = VK_NULL_HANDLE;
+    VkFramebuffer _overdrawFramebuffer = VK_NULL_HANDLE;
+    VkPipeline _overdrawPipeline = VK_NULL_HANDLE;
+    std::vector<VkBuffer> _overdrawHistogramBuffers;
+    std::vector<Allocation> _overdrawHistogramAllocations;
+    std::vector<std::optional<uint64_t>> _overdrawPending; // frame whose histogram a slot holds
+    VkDescriptorSetLayout _overdrawSetLayout = VK_NULL_HANDLE;
+    VkPipelineLayout _overdrawPipelineLayout = VK_NULL_HANDLE;
+    std::vector<VkDescriptorSet> _overdrawDescriptorSets;
+    VkPipeline _overdrawReducePipeline = VK_NULL_HANDLE;
+    std::array<uint64_t, OVERDRAW_BINS> _overdrawTotals{};
+    uint64_t _overdrawFrames = 0;
+
+    // Headless mode renders into these instead of swap chain images
+    std::vector<Allocation> _offscreenImagesAllocation;
+    uint32_t _offscreenImageIndex = 0;
+
+    // Frame timing, the GPU side is the profiler's "frame" scope
+    FrameProfiler _profiler;
+    float _timestampPeriod = 1.0f;
+    uint64_t _timestampMask = 0;
+    std::vector<double> _cpuFrameTimes;
+    std::vector<double> _recordTimes;
+    std::vector<double> _gpuFrameTimes;
+    std::vector<double> _waitTimes;         // CPU blocked in vkWaitSemaphores per frame
+    uint32_t _frameCount = 0;
+
+
+
+
+    static VKAPI_ATTR VkBool32 VKAPI_CALL debugCallback(
+        VkDebugUtilsMessageSeverityFlagBitsEXT messageSeverity,
+        VkDebugUtilsMessageTypeFlagsEXT messageType,
+        const VkDebugUtilsMessengerCallbackDataEXT* pCallbackData,
+        void *pUserData) {
+
+            /* TODO: CAN BE USED IF NEEDED!
+                if (messageSeverity >= VK_DEBUG_UTILS_MESSAGE_SEVERITY_WARNING_BIT_EXT) {
+                    // Message is important enough to show
+                }
+            */
+
+            std::cerr << "validation layer: " << pCallbackData->pMessage << std::endl;
+
+            return VK_FALSE;
+    }
+
+    void initWindow() {
+        glfwInit();
+        glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
+
+        _window = glfwCreateWindow(WIDTH, HEIGHT, "Vulkan", nullptr, nullptr);
+        glfwSetWindowUserPointer(_window, this);
+        glfwSetFramebufferSizeCallback(_window, framebufferResizeCallback);
+
+        int width = 0, height = 0;
+        glfwGetFramebufferSize(_window, &width, &height);
+        _windowExtent      = {static_cast<uint32_t>(width), static_cast<uint32_t>(height)};
+        _framebufferExtent = _windowExtent;
+    }
+
+    static void framebufferResizeCallback(GLFWwindow* window, int width, int height) {
+        auto app = reinterpret_cast<HelloTriangleApplication*>(glfwGetWindowUserPointer(window));
+        app->framebufferResized = true;
+    }
+
+    bool checkValidationLayerSupport() {
+
+        uint32_t layerCount;
+        vkEnumerateInstanceLayerProperties(&layerCount, nullptr);
+
+        std::vector<VkLayerProperties> availableLayers(layerCount);
+        vkEnumerateInstanceLayerProperties(&layerCount, availableLayers.data());
+
+
+        for(const char* layerName : validationLayers) {
+            bool layerFound = false;
+
+            for(const auto& layerProperties : availableLayers) {
+                if(strcmp(layerName, layerProperties.layerName) == 0) {
+                    layerFound = true;
+                    break;
+                }
+            }
+
+            if(!layerFound) {
+                return false;
+            }
+
+        }
+        return true;
+    }
+
+    bool hasInstanceExtension(const char* name) {
+        uint32_t extensionCount = 0;
+        vkEnumerateInstanceExtensionProperties(nullptr, &extensionCount, nullptr);
+        std::vector<VkExtensionProperties> extensions(extensionCount);
+        vkEnumerateInstanceExtensionProperties(nullptr, &extensionCount, extensions.data());
+
+        for(const auto& extension : extensions) {
+            if(strcmp(extension.extensionName, name) == 0) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool areAllExtensionsIncluded(const char **glfwExtensions, uint32_t& glfwExtensionCount) {
+
+        uint32_t extensionCount = 0;
+        vkEnumerateInstanceExtensionProperties(nullptr, &extensionCount, nullptr);
+        std::vector<VkExtensionProperties> extensions(extensionCount);
+        vkEnumerateInstanceExtensionProperties(nullptr, &extensionCount, extensions.data());
+
+        int counter = 0;
+
+        for(int i=0; i<glfwExtensionCount; i++) {
+            for(int j=0; j<extensions.size(); j++) {
+                if(strcmp(glfwExtensions[i],extensions[j].extensionName) == 0)
+                    counter++;
+            }
+        }
+
+        if(counter != glfwExtensionCount)
+            return false;
+
+        return true;
+
+    }
+
+    std::vector<const char*> getRequiredExtensions() {
+        std::vector<const char*> extensions;
+
+        // Without a window there is no surface, so GLFW doesn't need anything
+        if(!_options.headless) {
+            uint32_t glfwExtensionCount = 0;
+            const char** glfwExtensions;
+            glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
+
+            extensions.assign(glfwExtensions, glfwExtensions + glfwExtensionCount);
+        }
+
+        if(enableValidationLayers) {
+            extensions.push_back(VK_EXT_DEBUG_UTILS_EXTENSION_NAME);
+        }
+
+        // Feature queries and the memory budget of texture streaming, core only from 1.1 on
+        if(hasInstanceExtension(VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME)) {
+            extensions.push_back(VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME);
+        }
+
+        return extensions;
+
+    }
+
+    QueueFamilyIndices findQueueFamilies(VkPhysicalDevice device) {
+        QueueFamilyIndices indices;
+
+        uint32_t queueFamilyCount = 0;
+        vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount, nullptr);
+
+        std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
+        vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount, queueFamilies.data());
+
+        int i = 0;
+        for(const auto& queueFamily : queueFamilies) {
+
+            if(queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT) {
+                indices.graphicsFamily = i;
+            }
+
+            // Nothing is presented in headless mode, the graphics queue stands in for present
+            if(_options.headless) {
+                if(indices.graphicsFamily.has_value()) {
+                    indices.presentFamily = indices.graphicsFamily;
+                }
+            }
+            else {
+                VkBool32 presentSupport = false;
+                vkGetPhysicalDeviceSurfaceSupportKHR(device, i, _surface, &presentSupport);
+                if(presentSupport) {
+                    indices.presentFamily = i;
+                }
+            }
+
+            if(indices.isComplete()) {
+                break;
+            }
+
+            i++;
+        }
+
+        // Prefer a family without graphics/compute, those are usually backed by dedicated DMA engines
+        for(uint32_t family = 0; family < queueFamilyCount; family++) {
+            VkQueueFlags flags = queueFamilies[family].queueFlags;
+            if(!(flags & VK_QUEUE_TRANSFER_BIT) || (flags & VK_QUEUE_GRAPHICS_BIT)) {
+                continue;
+            }
+            if(!indices.transferFamily.has_value() || !(flags & VK_QUEUE_COMPUTE_BIT)) {
+                indices.transferFamily = family;
+            }
+        }
+        if(!indices.transferFamily.has_value()) {
+            indices.transferFamily = indices.graphicsFamily;
+        }
+
+        // Assign index to queue families that could be found
+        return indices;
+    }
+
+    VkShaderModule createShaderModule(const std::vector<uint32_t>& code) {
+        VkShaderModuleCreateInfo createInfo{};
+        createInfo.sType    = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+        createInfo.codeSize = code.size() * sizeof(uint32_t);
+        createInfo.pCode    = code.data();
+
+        VkShaderModule shaderModule;
+        if (vkCreateShaderModule(_device, &createInfo, nullptr, &shaderModule) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create shader model!");
+        }
+
+        return shaderModule;
+    }
+
+    void createInstance() {
+
+        if(enableValidationLayers && !checkValidationLayerSupport()) {
+            throw std::runtime_error("Validation layers requested, but not available!");
+        }
+        
+
+        VkApplicationInfo appInfo{};
+        appInfo.sType              = VK_STRUCTURE_TYPE_APPLICATION_INFO;
+        appInfo.pApplicationName   = "Hello Triangle";
+        appInfo.applicationVersion = VK_MAKE_VERSION(1, 0, 0);
+        appInfo.pEngineName        = "No Engine";
+        appInfo.engineVersion      = VK_MAKE_VERSION(1, 0, 0);
+        appInfo.apiVersion         = VK_API_VERSION_1_0;
+
+
+        VkInstanceCreateInfo createInfo{};
+        createInfo.sType            = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
+        createInfo.pApplicationInfo = &appInfo;
+
+        uint32_t glfwExtensionCount = 0;
+        const char** glfwExtensions;
+
+
+        auto extensions = getRequiredExtensions();
+        createInfo.enabledExtensionCount   = static_cast<uint32_t>(extensions.size());
+        createInfo.ppEnabledExtensionNames = extensions.data();
+
+
+        VkDebugUtilsMessengerCreateInfoEXT debugCreateInfo;
+        if (enableValidationLayers) {
+
+            createInfo.enabledLayerCount   = static_cast<uint32_t>(validationLayers.size());
+            createInfo.ppEnabledLayerNames =  validationLayers.data();
+
+            populateDebugMessengerCreateInfo(debugCreateInfo);
+            createInfo.pNext = (VkDebugUtilsMessengerCreateInfoEXT*) &debugCreateInfo;
+
+        } else {
+
+            createInfo.enabledLayerCount = 0;
+            createInfo.pNext = nullptr;
+        }
+
+        if(!_options.headless) {
+            std::cout << "AreAllExtensionsIncluded: " << areAllExtensionsIncluded(glfwExtensions, glfwExtensionCount) << '\n';
+        }
+
+
+        if(vkCreateInstance(&createInfo, nullptr, &_instance) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create instance!");
+        }
+
+        for(const char* extension : extensions) {
+            if(strcmp(extension, VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME) == 0) {
+                _vkGetPhysicalDeviceMemoryProperties2 = (PFN_vkGetPhysicalDeviceMemoryProperties2KHR) vkGetInstanceProcAddr(_instance, "vkGetPhysicalDeviceMemoryProperties2KHR");
+                _vkGetPhysicalDeviceFeatures2 = (PFN_vkGetPhysicalDeviceFeatures2KHR) vkGetInstanceProcAddr(_instance, "vkGetPhysicalDeviceFeatures2KHR");
+            }
+        }
+
+    }
+
+    void populateDebugMessengerCreateInfo(VkDebugUtilsMessengerCreateInfoEXT& createInfo) {
+
+        createInfo = {};
+        createInfo.sType           = VK_STRUCTURE_TYPE_DEBUG_UTILS_MESSENGER_CREATE_INFO_EXT;
+
+        createInfo.messageSeverity = VK_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT;
+
+        createInfo.messageType     = VK_DEBUG_UTILS_MESSAGE_TYPE_GENERAL_BIT_EXT | 
+                                     VK_DEBUG_UTILS_MESSAGE_TYPE_VALIDATION_BIT_EXT | 
+                                     VK_DEBUG_UTILS_MESSAGE_TYPE_PERFORMANCE_BIT_EXT;
+
+        createInfo.pfnUserCallback = debugCallback;
+        createInfo.pUserData       = nullptr;  
+    }
+
+    void setupDebugMessenger() {
+
+        if(!enableValidationLayers) return;
+
+        VkDebugUtilsMessengerCreateInfoEXT createInfo;
+        populateDebugMessengerCreateInfo(createInfo);
+
+        if(CreateDebugUtilsMessengerEXT(_instance, &createInfo, nullptr, &_debugMessenger) != VK_SUCCESS) {
+            throw std::runtime_error("failed to set up debug messenger");
+        }                               
+
+    }
+
+    bool isDeviceSuitable(VkPhysicalDevice device) {
+
+        VkPhysicalDeviceProperties deviceProperties;
+        VkPhysicalDeviceFeatures deviceFeatures;
+        vkGetPhysicalDeviceProperties(device, &deviceProperties);
+        vkGetPhysicalDeviceFeatures(device, &deviceFeatures);
+        
+        return deviceProperties.deviceType == VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU &&
+               deviceFeatures.geometryShader;
+
+
+    }
+
+    int rateDeviceSuitability(VkPhysicalDevice device) {
+
+        VkPhysicalDeviceProperties deviceProperties;
+        VkPhysicalDeviceFeatures deviceFeatures;
+        vkGetPhysicalDeviceProperties(device, &deviceProperties);
+        vkGetPhysicalDeviceFeatures(device, &deviceFeatures);
+    
+
+        int score = 0;
+
+        // Discrete GPUS have a significant performance advantage
+        if(deviceProperties.deviceType == VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU) {
+            score += 1000;
+        }
+
+        // Maximum possible size of textures affects graphics quality
+        score += deviceProperties.limits.maxImageDimension2D;
+
+
+        if(!deviceFeatures.geometryShader) {
+            return 0;
+        }
+
+        QueueFamilyIndices indices = findQueueFamilies(device);
+        if(!indices.isComplete()) {
+            return 0;
+        }
+
+        bool extensionsSupported = checkDeviceExtensionSupport(device);
+        if(!extensionsSupported) {
+            return 0;
+        }
+
+        bool swapChainAdequate = false;
+        if(extensionsSupported && !_options.headless) {
+            SwapChainSupportDetails swapChainSupport = querySwapChainSupport(device);
+            swapChainAdequate = !swapChainSupport.formats.empty() &&
+                                !swapChainSupport.presentModes.empty();
+
+            if(!swapChainAdequate) {
+                return 0;
+            }
+        }
+
+        return score;
+
+    }
+
+    void pickPhysicalDevice() {
+        uint32_t deviceCount = 0;
+        vkEnumeratePhysicalDevices(_instance, &deviceCount, nullptr);
+
+        if(deviceCount == 0) {
+            throw std::runtime_error("failed to find GPU's with Vulkan Support!");
+        }
+
+
+        std::vector<VkPhysicalDevice> devices(deviceCount);
+        vkEnumeratePhysicalDevices(_instance, &deviceCount, devices.data());
+
+        std::multimap<int, VkPhysicalDevice> candidates;
+
+        for(const auto& device : devices) {
+            int score = rateDeviceSuitability(device);
+
+            // --device lets the bench target a specific driver, e.g. "llvmpipe" for lavapipe
+            if(!_options.deviceFilter.empty()) {
+                VkPhysicalDeviceProperties deviceProperties;
+                vkGetPhysicalDeviceProperties(device, &deviceProperties);
+                if(std::string(deviceProperties.deviceName).find(_options.deviceFilter) == std::string::npos) {
+                    continue;
+                }
+            }
+
+            candidates.insert(std::make_pair(score, device));
+        }
+
+        if(candidates.empty()) {
+            throw std::runtime_error("failed to find a GPU matching " + _options.deviceFilter);
+        }
+
+        // Check if best candidate is suitable or not
+        if(true) {
+            _physicalDevice = candidates.rbegin()-> second;
+        }
+        else {
+            throw std::runtime_error("failed to find a suitable GPU");
+        }
+
+    }
+
+    void createLogicalDevice() {
+        QueueFamilyIndices indices = findQueueFamilies(_physicalDevice);
+        
+
+        std::vector<VkDeviceQueueCreateInfo> queueCreateInfos;
+        std::set<uint32_t> uniqueQueueFamilies = {indices.graphicsFamily.value(),
+                                                  indices.presentFamily.value(),
+                                                  indices.transferFamily.value()};
+
+        float queuePriority = 1.0f;
+        for(uint32_t queueFamily : uniqueQueueFamilies) {
+            VkDeviceQueueCreateInfo queueCreateInfo{};
+            queueCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+            queueCreateInfo.queueFamilyIndex = queueFamily;
+            queueCreateInfo.queueCount = 1;
+            queueCreateInfo.pQueuePriorities = &queuePriority;
+            queueCreateInfos.push_back(queueCreateInfo);
+        }
+
+
+        VkPhysicalDeviceFeatures supportedFeatures;
+        vkGetPhysicalDeviceFeatures(_physicalDevice, &supportedFeatures);
+
+        VkPhysicalDeviceFeatures deviceFeatures{};
+        auto extensions = getRequiredDeviceExtensions();
+
+        if(_options.cullObjectCount > 0) {
+            // One indirect command per visible object, each pointing at its object's instance data via firstInstance
+            if(!supportedFeatures.multiDrawIndirect || !supportedFeatures.drawIndirectFirstInstance) {
+                throw std::runtime_error("GPU culling needs multiDrawIndirect and drawIndirectFirstInstance!");
+            }
+            deviceFeatures.multiDrawIndirect         = VK_TRUE;
+            deviceFeatures.drawIndirectFirstInstance = VK_TRUE;
+
+            VkPhysicalDeviceProperties deviceProperties;
+            vkGetPhysicalDeviceProperties(_physicalDevice, &deviceProperties);
+            if(deviceProperties.limits.maxDrawIndirectCount < _options.cullObjectCount) {
+                throw std::runtime_error("GPU culling: object count exceeds maxDrawIndirectCount!");
+            }
+
+            // Without the count extension every object keeps a command slot and culled ones draw zero instances
+            if(hasDeviceExtension(_physicalDevice, VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME)) {
+                extensions.push_back(VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME);
+            }
+        }
+
+        if(_options.streamTextureCount > 0) {
+            // Feedback is written from the fragment shader, which indexes the texture array per draw
+            if(!supportedFeatures.fragmentStoresAndAtomics || !supportedFeatures.shaderSampledImageArrayDynamicIndexing) {
+                throw std::runtime_error("texture streaming needs fragmentStoresAndAtomics and shaderSampledImageArrayDynamicIndexing!");
+            }
+            deviceFeatures.fragmentStoresAndAtomics               = VK_TRUE;
+            deviceFeatures.shaderSampledImageArrayDynamicIndexing = VK_TRUE;
+
+            VkPhysicalDeviceProperties deviceProperties;
+            vkGetPhysicalDeviceProperties(_physicalDevice, &deviceProperties);
+            if(deviceProperties.limits.maxPerStageDescriptorSamplers < MAX_STREAM_TEXTURES
+            || deviceProperties.limits.maxPerStageDescriptorSampledImages < MAX_STREAM_TEXTURES) {
+                throw std::runtime_error("texture streaming: the device can't bind MAX_STREAM_TEXTURES textures!");
+            }
+
+            // Without it the budget is a fixed share of the heap
+            if(_vkGetPhysicalDeviceMemoryProperties2 && hasDeviceExtension(_physicalDevice, VK_EXT_MEMORY_BUDGET_EXTENSION_NAME)) {
+                extensions.push_back(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+                _memoryBudgetSupported = true;
+            }
+        }
+
+        if(_options.pipelineStats) {
+            if(!supportedFeatures.pipelineStatisticsQuery) {
+                throw std::runtime_error("--pipeline-stats needs pipelineStatisticsQuery!");
+            }
+            deviceFeatures.pipelineStatisticsQuery = VK_TRUE;
+
+            // Worker secondaries run inside the query, without this the draws are recorded inline
+            deviceFeatures.inheritedQueries = supportedFeatures.inheritedQueries;
+        }
+
+        // Lets pipeline requests look into the pipeline cache without compiling on a miss
+        VkPhysicalDevicePipelineCreationCacheControlFeaturesEXT cacheControlFeatures{};
+        cacheControlFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PIPELINE_CREATION_CACHE_CONTROL_FEATURES_EXT;
+        if(_vkGetPhysicalDeviceFeatures2 && hasDeviceExtension(_physicalDevice, VK_EXT_PIPELINE_CREATION_CACHE_CONTROL_EXTENSION_NAME)) {
+            VkPhysicalDeviceFeatures2 features2{};
+            features2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+            features2.pNext = &cacheControlFeatures;
+            _vkGetPhysicalDeviceFeatures2(_physicalDevice, &features2);
+
+            if(cacheControlFeatures.pipelineCreationCacheControl) {
+                extensions.push_back(VK_EXT_PIPELINE_CREATION_CACHE_CONTROL_EXTENSION_NAME);
+                _pipelineCacheControl = true;
+            }
+        }
+
+        // The extension alone doesn't enable timeline semaphores, the feature has to be asked for too
+        VkPhysicalDeviceTimelineSemaphoreFeaturesKHR timelineFeatures{};
+        timelineFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES_KHR;
+        if(_vkGetPhysicalDeviceFeatures2) {
+            VkPhysicalDeviceFeatures2 features2{};
+            features2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+            features2.pNext = &timelineFeatures;
+            _vkGetPhysicalDeviceFeatures2(_physicalDevice, &features2);
+        }
+        if(!timelineFeatures.timelineSemaphore) {
+            throw std::runtime_error("frame pacing needs the timelineSemaphore feature!");
+        }
+
+        // Timestamps presents as they reach the screen, for latency reports and --low-latency
+        VkPhysicalDevicePresentIdFeaturesKHR presentIdFeatures{};
+        presentIdFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_ID_FEATURES_KHR;
+        VkPhysicalDevicePresentWaitFeaturesKHR presentWaitFeatures{};
+        presentWaitFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_WAIT_FEATURES_KHR;
+        if(!_options.headless && _vkGetPhysicalDeviceFeatures2
+        && hasDeviceExtension(_physicalDevice, VK_KHR_PRESENT_ID_EXTENSION_NAME)
+        && hasDeviceExtension(_physicalDevice, VK_KHR_PRESENT_WAIT_EXTENSION_NAME)) {
+            VkPhysicalDeviceFeatures2 features2{};
+            features2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+            features2.pNext = &presentIdFeatures;
+            presentIdFeatures.pNext = &presentWaitFeatures;
+            _vkGetPhysicalDeviceFeatures2(_physicalDevice, &features2);
+
+            if(presentIdFeatures.presentId && presentWaitFeatures.presentWait) {
+                extensions.push_back(VK_KHR_PRESENT_ID_EXTENSION_NAME);
+                extensions.push_back(VK_KHR_PRESENT_WAIT_EXTENSION_NAME);
+                _presentWait = true;
+            }
+        }
+
+        // Every optional feature struct goes on the chain after the timeline one
+        void* featureChain = _pipelineCacheControl ? &cacheControlFeatures : nullptr;
+        if(_presentWait) {
+            presentWaitFeatures.pNext = featureChain;
+            presentIdFeatures.pNext   = &presentWaitFeatures;
+            featureChain = &presentIdFeatures;
+        }
+        timelineFeatures.pNext = featureChain;
+
+        // Whichever compressed texture families exist, createTextureImage picks among them
+        deviceFeatures.textureCompressionBC       = supportedFeatures.textureCompressionBC;
+        deviceFeatures.textureCompressionETC2     = supportedFeatures.textureCompressionETC2;
+        deviceFeatures.textureCompressionASTC_LDR = supportedFeatures.textureCompressionASTC_LDR;
+        _enabledFeatures = deviceFeatures;
+
+        VkDeviceCreateInfo createInfo{};
+        createInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+        createInfo.pQueueCreateInfos = queueCreateInfos.data();
+        createInfo.queueCreateInfoCount = static_cast<uint32_t>(queueCreateInfos.size());
+        createInfo.pEnabledFeatures = &deviceFeatures;
+        createInfo.pNext = &timelineFeatures;
+
+
+        createInfo.enabledExtensionCount = static_cast<uint32_t>(extensions.size());
+        createInfo.ppEnabledExtensionNames = extensions.data();
+
+        if(enableValidationLayers) {
+            createInfo.enabledLayerCount = static_cast<uint32_t>(validationLayers.size());
+            createInfo.ppEnabledLayerNames = validationLayers.data();
+        }
+        else {
+            createInfo.enabledLayerCount = 0;
+        }
+
+        if(vkCreateDevice(_physicalDevice, &createInfo, nullptr, &_device) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create logical device!");
+        }
+
+        vkGetDeviceQueue(_device, indices.graphicsFamily.value(), 0, &_graphicsQueue);
+        vkGetDeviceQueue(_device, indices.presentFamily.value(), 0, &_presentQueue);
+        vkGetDeviceQueue(_device, indices.transferFamily.value(), 0, &_transferQueue);
+
+        for(const char* extension : extensions) {
+            if(strcmp(extension, VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME) == 0) {
+                _vkCmdDrawIndexedIndirectCount = (PFN_vkCmdDrawIndexedIndirectCountKHR) vkGetDeviceProcAddr(_device, "vkCmdDrawIndexedIndirectCountKHR");
+            }
+            else if(strcmp(extension, VK_KHR_PRESENT_WAIT_EXTENSION_NAME) == 0) {
+                _vkWaitForPresent = (PFN_vkWaitForPresentKHR) vkGetDeviceProcAddr(_device, "vkWaitForPresentKHR");
+            }
+            else if(strcmp(extension, VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME) == 0) {
+                _vkWaitSemaphores           = (PFN_vkWaitSemaphoresKHR) vkGetDeviceProcAddr(_device, "vkWaitSemaphoresKHR");
+                _vkGetSemaphoreCounterValue = (PFN_vkGetSemaphoreCounterValueKHR) vkGetDeviceProcAddr(_device, "vkGetSemaphoreCounterValueKHR");
+            }
+        }
+
+    }
+
+    void createPipelineCache() {
+        _pipelineCache.create(_physicalDevice, _device, _options.pipelineCachePath);
+        _pipelineCompiler.start(PIPELINE_COMPILE_THREADS);
+    }
+
+    void createAllocator() {
+        _allocator.init(_physicalDevice, _device);
+    }
+
+    void createSurface() {
+        if(_options.headless) {
+            return;
+        }
+
+        if(glfwCreateWindowSurface(_instance, _window, nullptr, &_surface) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create window surface!");
+        }
+    }
+
+    std::vector<const char*> getRequiredDeviceExtensions() {
+        // Frame pacing runs on a timeline semaphore, it is core in 1.2 but the instance asks for 1.0
+        std::vector<const char*> extensions = {VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME};
+
+        // The swap chain extension is only needed when there is something to present to
+        if(!_options.headless) {
+            extensions.insert(extensions.end(), deviceExtensions.begin(), deviceExtensions.end());
+        }
+        return extensions;
+    }
+
+    bool hasDeviceExtension(VkPhysicalDevice device, const char* name) {
+        uint32_t extensionCount;
+        vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, nullptr);
+
+        std::vector<VkExtensionProperties> availableExtensions(extensionCount);
+        vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, availableExtensions.data());
+
+        for(const auto& extension : availableExtensions) {
+            if(strcmp(extension.extensionName, name) == 0) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool checkDeviceExtensionSupport(VkPhysicalDevice device) {
+
+        uint32_t extensionCount;
+        vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, nullptr);
+
+        std::vector<VkExtensionProperties> availableExtensions(extensionCount);
+        vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, availableExtensions.data());
+
+        auto deviceExtensions = getRequiredDeviceExtensions();
+        std::set<std::string> requiredExtensions(deviceExtensions.begin(), deviceExtensions.end());
+
+        for(const auto& extension : availableExtensions) {
+            requiredExtensions.erase(extension.extensionName);
+        }
+
+        return requiredExtensions.empty();
+    }
+
+    SwapChainSupportDetails querySwapChainSupport(VkPhysicalDevice device) {
+
+        SwapChainSupportDetails details;
+
+        vkGetPhysicalDeviceSurfaceCapabilitiesKHR(device, _surface, &details.capabilities);
+
+        uint32_t formatCount;
+        vkGetPhysicalDeviceSurfaceFormatsKHR(device, _surface, &formatCount, nullptr);
+
+        if(formatCount != 0) {
+            details.formats.resize(formatCount);
+            vkGetPhysicalDeviceSurfaceFormatsKHR(device, _surface, &formatCount, details.formats.data());
+        }
+
+        uint presentModeCount;
+        vkGetPhysicalDeviceSurfacePresentModesKHR(device, _surface, &presentModeCount, nullptr);
+
+        if(presentModeCount != 0) {
+            details.presentModes.resize(presentModeCount);
+            vkGetPhysicalDeviceSurfacePresentModesKHR(device, _surface, &presentModeCount, details.presentModes.data());
+        }
+
+        
+
+        return details;
+    }
+
+    VkSurfaceFormatKHR chooseSwapSurfaceFormat(const std::vector<VkSurfaceFormatKHR>& availableFormats) {
+
+        for(const auto& availableFormat : availableFormats) {
+            if(availableFormat.format == VK_FORMAT_B8G8R8A8_SRGB && 
+               availableFormat.colorSpace == VK_COLOR_SPACE_SRGB_NONLINEAR_KHR) {
+                   return availableFormat;
+               }
+        }
+
+        return availableFormats[0];
+    }
+
+    // The one asked for with --present-mode if the surface has it, else FIFO, which every surface has
+    VkPresentModeKHR chooseSwapPresentMode(const std::vector<VkPresentModeKHR>& availablePresentModes) {
+        
+        for(const auto& availablePresentMode : availablePresentModes) {
+            if(availablePresentMode == _options.presentMode) {
+                return availablePresentMode;
+            }
+        }
+
+        if(_swapChain == VK_NULL_HANDLE) {
+            std::cerr << "present mode " << presentModeName(_options.presentMode) << " not supported, using fifo\n";
+        }
+        return VK_PRESENT_MODE_FIFO_KHR;
+    }
+
+    VkExtent2D chooseSwapExtent(const VkSurfaceCapabilitiesKHR& capabilities) {
+        if(capabilities.currentExtent.width != UINT32_MAX) {
+            return capabilities.currentExtent;
+        }
+        else {
+            // Not from GLFW, this can run on the render thread
+            VkExtent2D actualExtent = _framebufferExtent;
+
+            actualExtent.width = std::max(capabilities.minImageExtent.width, std::min(capabilities.maxImageExtent.width, actualExtent.width));
+            actualExtent.height = std::max(capabilities.minImageExtent.height, std::min(capabilities.maxImageExtent.height, actualExtent.height));
+
+            return actualExtent;
+        }
+    }
+
+    void createOffscreenImages() {
+        // Same role as the swap chain images, but owned by us and never presented
+        _swapChainImageFormat = VK_FORMAT_B8G8R8A8_SRGB;
+
+        VkFormatProperties formatProperties;
+        vkGetPhysicalDeviceFormatProperties(_physicalDevice, _swapChainImageFormat, &formatProperties);
+        if(!(formatProperties.optimalTilingFeatures & VK_FORMAT_FEATURE_COLOR_ATTACHMENT_BIT)) {
+            _swapChainImageFormat = VK_FORMAT_R8G8B8A8_SRGB;
+        }
+
+        _swapChainExtent = {_options.width, _options.height};
+
+        _swapChainImages.resize(OFFSCREEN_IMAGE_COUNT);
+        _offscreenImagesAllocation.resize(OFFSCREEN_IMAGE_COUNT);
+
+        for(uint32_t i=0; i<OFFSCREEN_IMAGE_COUNT; i++) {
+            createImage(_swapChainExtent.width, _swapChainExtent.height, _swapChainImageFormat,
+                        VK_IMAGE_TILING_OPTIMAL,
+                        VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT |
+                        VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+                        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                        _swapChainImages[i],
+                        _offscreenImagesAllocation[i]);
+        }
+
+        _offscreenImageIndex = 0;
+    }
+
+    void createSwapChain() {
+        if(_options.headless) {
+            createOffscreenImages();
+            return;
+        }
+
+        SwapChainSupportDetails swapChainSupport = querySwapChainSupport(_physicalDevice);
+
+        VkSurfaceFormatKHR surfaceFormat = chooseSwapSurfaceFormat(swapChainSupport.formats);
+        VkPresentModeKHR presentMode = chooseSwapPresentMode(swapChainSupport.presentModes);
+        VkExtent2D extent = chooseSwapExtent(swapChainSupport.capabilities);
+
+        // One more than the presentation engine may hold on to, so acquire doesn't have to wait for it
+        uint32_t imageCount = _options.swapchainImages > 0 ? _options.swapchainImages : swapChainSupport.capabilities.minImageCount + 1;
+        imageCount = std::max(imageCount, swapChainSupport.capabilities.minImageCount);
+
+        if(swapChainSupport.capabilities.maxImageCount > 0 && imageCount > swapChainSupport.capabilities.maxImageCount) {
+            imageCount = swapChainSupport.capabilities.maxImageCount;
+        }
+
+        VkSwapchainCreateInfoKHR createInfo{};
+        createInfo.sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR;
+        createInfo.surface = _surface;
+        createInfo.minImageCount = imageCount;
+        createInfo.imageFormat = surfaceFormat.format;
+        createInfo.imageColorSpace = surfaceFormat.colorSpace;
+        createInfo.imageExtent = extent;
+        createInfo.imageArrayLayers = 1;
+        createInfo.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+
+        QueueFamilyIndices indices = findQueueFamilies(_physicalDevice);
+        uint32_t queueFamilyIndices[] = {indices.graphicsFamily.value(),
+                                         indices.presentFamily.value()};
+
+        if(indices.graphicsFamily != indices.presentFamily) {
+            createInfo.imageSharingMode = VK_SHARING_MODE_CONCURRENT;
+            createInfo.queueFamilyIndexCount = 2;
+            createInfo.pQueueFamilyIndices = queueFamilyIndices;
+        }
+        else {
+            createInfo.imageSharingMode = VK_SHARING_MODE_EXCLUSIVE;
+            createInfo.queueFamilyIndexCount = 0;
+            createInfo.pQueueFamilyIndices = nullptr;
+        }
+
+        createInfo.preTransform = swapChainSupport.capabilities.currentTransform;
+        createInfo.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
+        createInfo.presentMode = presentMode;
+        createInfo.clipped = VK_TRUE;
+        // Lets the presentation engine hand over resources, the old swapchain is retired by the caller
+        createInfo.oldSwapchain = _swapChain;
+
+        if(vkCreateSwapchainKHR(_device,&createInfo, nullptr, &_swapChain) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create swap chain!");
+        }
+
+        vkGetSwapchainImagesKHR(_device, _swapChain, &imageCount, nullptr);
+        _swapChainImages.resize(imageCount);
+        vkGetSwapchainImagesKHR(_device, _swapChain, &imageCount, _swapChainImages.data());
+
+        _swapChainImageFormat = surfaceFormat.format;
+        _swapChainExtent = extent;
+        _presentMode = presentMode;
+
+    }
+
+    void createImageViews() {
+        _swapChainImageViews.resize(_swapChainImages.size());
+
+        for(size_t i=0; i<_swapChainImages.size(); i++) {
+            VkImageViewCreateInfo createInfo{};
+            createInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+            createInfo.image = _swapChainImages[i];
+            createInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+            createInfo.format = _swapChainImageFormat;
+            createInfo.components.r = VK_COMPONENT_SWIZZLE_IDENTITY;
+            createInfo.components.g = VK_COMPONENT_SWIZZLE_IDENTITY;
+            createInfo.components.b = VK_COMPONENT_SWIZZLE_IDENTITY;
+            createInfo.components.a = VK_COMPONENT_SWIZZLE_IDENTITY;
+
+            createInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+            createInfo.subresourceRange.baseMipLevel = 0;
+            createInfo.subresourceRange.levelCount = 1;
+            createInfo.subresourceRange.baseArrayLayer = 0;
+            createInfo.subresourceRange.layerCount = 1;
+
+            if(vkCreateImageView(_device, &createInfo, nullptr, &_swapChainImageViews[i]) != VK_SUCCESS) {
+                throw std::runtime_error("failed to create image views!");
+            }
+
+        }
+    }
+
+    void createGraphicsPipeline() {
+        VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+        pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+        pipelineLayoutInfo.setLayoutCount         = 1;
+        pipelineLayoutInfo.pSetLayouts            = &_descriptorSetLayout;
+        pipelineLayoutInfo.pushConstantRangeCount = 0;
+        pipelineLayoutInfo.pPushConstantRanges    = nullptr;
+
+        if (vkCreatePipelineLayout(_device, &pipelineLayoutInfo, nullptr, &_pipelineLayout) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create pipeline layout!");
+        }
+
+        if(_options.streamTextureCount > 0) {
+            std::array<VkDescriptorSetLayout, 2> setLayouts = {_descriptorSetLayout, _streamSetLayout};
+
+            VkPipelineLayoutCreateInfo streamLayoutInfo{};
+            streamLayoutInfo.sType          = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+            streamLayoutInfo.setLayoutCount = static_cast<uint32_t>(setLayouts.size());
+            streamLayoutInfo.pSetLayouts    = setLayouts.data();
+
+            if(vkCreatePipelineLayout(_device, &streamLayoutInfo, nullptr, &_streamPipelineLayout) != VK_SUCCESS) {
+                throw std::runtime_error("failed to create streaming pipeline layout!");
+            }
+        }
+
+        auto createStart = std::chrono::high_resolution_clock::now();
+
+        PipelineDesc desc;
+        desc.stages      = {{"shader.vert"}, {"shader.frag"}};
+        desc.bindings    = {_mesh.bindingDescription()};
+        desc.attributes  = _mesh.attributes;
+        desc.layout      = _pipelineLayout;
+        desc.colorFormat = _swapChainImageFormat;
+        usePipeline(_graphicsPipeline, desc);
+        _drawDesc = desc;
+
+        PipelineDesc instancedDesc = desc;
+        instancedDesc.stages   = {{"instanced.vert"}, {"instanced.frag", {}, {_options.untextured ? 0u : 1u}}};
+        instancedDesc.bindings = {_mesh.bindingDescription(), InstanceLayout::bindingDescription(1, VK_VERTEX_INPUT_RATE_INSTANCE)};
+        for(const auto& attribute : InstanceLayout::attributeDescriptions(1)) {
+            instancedDesc.attributes.push_back(attribute);
+        }
+        usePipeline(_instancedPipeline, instancedDesc);
+
+        if(_options.streamTextureCount > 0) {
+            PipelineDesc streamDesc = instancedDesc;
+            streamDesc.stages = {{"instanced.vert"}, {"streamed.frag", streamShaderDefines()}};
+            streamDesc.layout = _streamPipelineLayout;
+            usePipeline(_streamPipeline, streamDesc);
+        }
+
+        if(_options.positionOnly) {
+            auto positionAttributes = PositionStreamLayout::attributeDescriptions(0);
+            PipelineDesc positionDesc = desc;
+            positionDesc.stages     = {{"shader.vert", {"POSITION_ONLY"}}, {"shader.frag", {"POSITION_ONLY"}}};
+            positionDesc.bindings   = {PositionStreamLayout::bindingDescription(0)};
+            positionDesc.attributes = {positionAttributes.begin(), positionAttributes.end()};
+            usePipeline(_positionPipeline, positionDesc);
+        }
+
+        if(_options.overdraw) {
+            PipelineDesc overdrawDesc = desc;
+            if(_options.positionOnly) {
+                auto positionAttributes = PositionStreamLayout::attributeDescriptions(0);
+                overdrawDesc.stages[0]  = {"shader.vert", {"POSITION_ONLY"}};
+                overdrawDesc.bindings   = {PositionStreamLayout::bindingDescription(0)};
+                overdrawDesc.attributes = {positionAttributes.begin(), positionAttributes.end()};
+            }
+            overdrawDesc.stages[1]   = {"shader.frag", {"OVERDRAW"}};
+            overdrawDesc.blend       = BlendMode::Additive;
+            overdrawDesc.colorFormat = OVERDRAW_FORMAT;
+            overdrawDesc.renderPass  = _overdrawRenderPass;
+            usePipeline(_overdrawPipeline, overdrawDesc);
+        }
+
+        std::chrono::duration<double, std::milli> createTime = std::chrono::high_resolution_clock::now() - createStart;
+        if(_pipelineCreateMs < 0.0) {
+            // Only the first creation says something about the cache we started with
+            _pipelineCreateMs = createTime.count();
+            std::cerr << "graphics pipelines created in " << _pipelineCreateMs << " ms ("
+                      << (_pipelineCache.warm() ? "warm" : "cold") << " pipeline cache)\n";
+        }
+    }
+
+    // Points member at desc's pipeline, creating it unless an equal desc was asked for before.
+    // Thread safe, the creation itself runs outside the lock.
+    void usePipeline(VkPipeline& member, const PipelineDesc& desc) {
+        {
+            std::lock_guard<std::mutex> lock(_pipelinesMutex);
+            _pipelineRequests++;
+            uint64_t key = variantKey(desc);
+            auto variant = _pipelines.find(key);
+            if(variant != _pipelines.end()) {
+                member = variant->second.pipeline;
+                _pipelineUsers[&member] = key;
+                return;
+            }
+        }
+
+        VkPipeline pipeline = desc.compute ? createComputePipeline(desc) : createPipeline(desc);
+
+        std::lock_guard<std::mutex> lock(_pipelinesMutex);
+        uint64_t key = variantKey(desc);
+        auto inserted = _pipelines.insert({key, {desc, pipeline}});
+        if(!inserted.second) {
+            // Another thread created the same variant meanwhile
+            vkDestroyPipeline(_device, pipeline, nullptr);
+        }
+        member = inserted.first->second.pipeline;
+        _pipelineUsers[&member] = key;
+    }
+
+    // Like usePipeline but never blocks on the compiler. Returns false while desc's pipeline is
+    // created on a background thread, asking again later picks it up. With cache control the
+    // background task first asks for it with compilation forbidden, a pipeline the driver's
+    // cache already holds then skips the compile. Even that builds shader modules, so it stays
+    // off the render thread too.
+    bool requestPipeline(VkPipeline& member, const PipelineDesc& desc) {
+        // Lookup and queueing under one lock, so a variant is only ever queued once
+        std::lock_guard<std::mutex> lock(_pipelinesMutex);
+        _pipelineRequests++;
+        uint64_t key = variantKey(desc);
+        auto variant = _pipelines.find(key);
+        if(variant != _pipelines.end()) {
+            member = variant->second.pipeline;
+            _pipelineUsers[&member] = key;
+            return true;
+        }
+        if(_pipelinesPending.count(key) > 0 || _pipelinesFailed.count(key) > 0) {
+            return false;
+        }
+
+        _pipelinesPending.emplace(key, desc);
+        _pipelineCompiler.push([this, key, desc]() {
+            auto start = std::chrono::high_resolution_clock::now();
+            VkPipeline pipeline = VK_NULL_HANDLE;
+            try {
+                if(_pipelineCacheControl) {
+                    pipeline = createPipeline(desc, VK_PIPELINE_CREATE_FAIL_ON_PIPELINE_COMPILE_REQUIRED_BIT_EXT);
+                }
+                if(pipeline != VK_NULL_HANDLE) {
+                    std::lock_guard<std::mutex> lock(_pipelinesMutex);
+                    _pipelinesPending.erase(key);
+                    _pipelines.insert({key, {desc, pipeline}});
+                    _pipelineCacheProbeHits++;
+                    return;
+                }
+                pipeline = createPipeline(desc);
+            }
+            catch(const std::exception& e) {
+                // Its draws keep falling back until a shader reload gives it another chance
+                std::cerr << "background pipeline creation: " << e.what() << "\n";
+                std::lock_guard<std::mutex> lock(_pipelinesMutex);
+                _pipelinesPending.erase(key);
+                _pipelinesFailed.emplace(key, desc);
+                return;
+            }
+            std::chrono::duration<double, std::milli> createTime = std::chrono::high_resolution_clock::now() - start;
+
+            std::lock_guard<std::mutex> lock(_pipelinesMutex);
+            _pipelinesPending.erase(key);
+            _pipelines.insert({key, {desc, pipeline}});
+            _pipelineBackgroundCreates++;
+            _pipelineBackgroundMs += createTime.count();
+        });
+        return false;
+    }
+
+    // desc's hash, moved on past variants of other descs that happen to hash the same.
+    // _pipelinesMutex must be held.
+    uint64_t variantKey(const PipelineDesc& desc) const {
+        uint64_t key = desc.hash();
+        for(;;) {
+            auto variant = _pipelines.find(key);
+            auto pending = _pipelinesPending.find(key);
+            auto failed  = _pipelinesFailed.find(key);
+            if((variant == _pipelines.end() || variant->second.desc == desc) &&
+               (pending == _pipelinesPending.end() || pending->second == desc) &&
+               (failed == _pipelinesFailed.end() || failed->second == desc)) {
+                return key;
+            }
+            key++;
+        }
+    }
+
+    static VkShaderStageFlagBits shaderStage(const std::string& name) {
+        if(name.size() > 5 && name.compare(name.size() - 5, 5, ".vert") == 0) {
+            return VK_SHADER_STAGE_VERTEX_BIT;
+        }
+        if(name.size() > 5 && name.compare(name.size() - 5, 5, ".frag") == 0) {
+            return VK_SHADER_STAGE_FRAGMENT_BIT;
+        }
+        return VK_SHADER_STAGE_COMPUTE_BIT;
+    }
+
+    // Modules and specialization of every stage in desc, destroyModules releases the modules again
+    struct PipelineStages {
+        std::vector<VkShaderModule> modules;
+        std::vector<VkPipelineShaderStageCreateInfo> stages;
+        std::vector<std::vector<VkSpecializationMapEntry>> mapEntries;
+        std::vector<VkSpecializationInfo> specializations;
+    };
+
+    PipelineStages createPipelineStages(const PipelineDesc& desc) {
+        PipelineStages result;
+        result.mapEntries.resize(desc.stages.size());
+        result.specializations.resize(desc.stages.size());
+
+        for(size_t i = 0; i < desc.stages.size(); i++) {
+            const ShaderVariant& variant = desc.stages[i];
+            result.modules.push_back(createShaderModule(_shaders.load(variant.name, variant.defines)));
+
+            for(uint32_t id = 0; id < variant.constants.size(); id++) {
+                result.mapEntries[i].push_back({id, id * static_cast<uint32_t>(sizeof(uint32_t)), sizeof(uint32_t)});
+            }
+            VkSpecializationInfo& specialization = result.specializations[i];
+            specialization.mapEntryCount = static_cast<uint32_t>(result.mapEntries[i].size());
+            specialization.pMapEntries   = result.mapEntries[i].data();
+            specialization.dataSize      = variant.constants.size() * sizeof(uint32_t);
+            specialization.pData         = variant.constants.data();
+
+            VkPipelineShaderStageCreateInfo stageInfo{};
+            stageInfo.sType  = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+            stageInfo.stage  = shaderStage(variant.name);
+            stageInfo.module = result.modules.back();
+            stageInfo.pName  = "main";
+            stageInfo.pSpecializationInfo = variant.constants.empty() ? nullptr : &specialization;
+            result.stages.push_back(stageInfo);
+        }
+        return result;
+    }
+
+    void destroyModules(PipelineStages& stages) {
+        for(VkShaderModule module : stages.modules) {
+            vkDestroyShaderModule(_device, module, nullptr);
+        }
+    }
+
+    // The constants streamed.frag shares with us
+    static std::vector<std::string> streamShaderDefines() {
+        return {"MAX_STREAM_TEXTURES=" + std::to_string(MAX_STREAM_TEXTURES),
+                "STREAM_TEXTURE_SIZE=" + std::to_string(STREAM_TEXTURE_SIZE) + ".0"};
+    }
+
+    // With VK_PIPELINE_CREATE_FAIL_ON_PIPELINE_COMPILE_REQUIRED_BIT_EXT in flags a pipeline that
+    // would need compiling comes back as VK_NULL_HANDLE
+    VkPipeline createPipeline(const PipelineDesc& desc, VkPipelineCreateFlags flags = 0) {
+        PipelineStages stages = createPipelineStages(desc);
+
+        VkPipelineVertexInputStateCreateInfo vertexInputInfo{};
+        vertexInputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+        vertexInputInfo.vertexBindingDescriptionCount   = static_cast<uint32_t>(desc.bindings.size());
+        vertexInputInfo.pVertexBindingDescriptions      = desc.bindings.data();
+        vertexInputInfo.vertexAttributeDescriptionCount = static_cast<uint32_t>(desc.attributes.size());
+        vertexInputInfo.pVertexAttributeDescriptions    = desc.attributes.data();
+
+        VkPipelineInputAssemblyStateCreateInfo inputAssembly{};
+        inputAssembly.sType    = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+        inputAssembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+        inputAssembly.primitiveRestartEnable = VK_FALSE;
+
+        // Viewport and scissor are dynamic so the pipeline survives resizes
+        VkPipelineViewportStateCreateInfo viewportState{};
+        viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+        viewportState.viewportCount = 1;
+        viewportState.pViewports    = nullptr;
+        viewportState.scissorCount  = 1;
+        viewportState.pScissors     = nullptr;
+
+        VkPipelineRasterizationStateCreateInfo rasterizer{};
+        rasterizer.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+        rasterizer.depthClampEnable        = VK_FALSE;
+        rasterizer.rasterizerDiscardEnable = VK_FALSE;
+        rasterizer.polygonMode             = VK_POLYGON_MODE_FILL;
+        rasterizer.lineWidth               = 1.0f;
+        rasterizer.cullMode                = desc.cullMode;
+        rasterizer.frontFace               = VK_FRONT_FACE_COUNTER_CLOCKWISE;
+        rasterizer.depthBiasEnable         = VK_FALSE;
+        rasterizer.depthBiasConstantFactor = 0.0f;
+        rasterizer.depthBiasClamp          = 0.0f;
+        rasterizer.depthBiasSlopeFactor    = 0.0f;
+
+        VkPipelineMultisampleStateCreateInfo multisampling{};
+        multisampling.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+        multisampling.sampleShadingEnable   = VK_FALSE;
+        multisampling.rasterizationSamples  = VK_SAMPLE_COUNT_1_BIT;
+        multisampling.minSampleShading      = 1.0f;
+        multisampling.pSampleMask           = nullptr;
+        multisampling.alphaToCoverageEnable = VK_FALSE;
+        multisampling.alphaToOneEnable      = VK_FALSE;
+
+
+        // Depth and stencil testing are left here
+
+
+        VkPipelineColorBlendAttachmentState colorBlendAttachment{};
+        colorBlendAttachment.colorWriteMask = VK_COLOR_COMPONENT_R_BIT |
+                                              VK_COLOR_COMPONENT_G_BIT |
+                                              VK_COLOR_COMPONENT_B_BIT |
+                                              VK_COLOR_COMPONENT_A_BIT;
+        colorBlendAttachment.blendEnable         = desc.blend != BlendMode::Opaque ? VK_TRUE : VK_FALSE;
+        colorBlendAttachment.srcColorBlendFactor = desc.blend == BlendMode::Alpha ? VK_BLEND_FACTOR_SRC_ALPHA : VK_BLEND_FACTOR_ONE;
+        colorBlendAttachment.dstColorBlendFactor = desc.blend == BlendMode::Alpha    ? VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA
+                                                 : desc.blend == BlendMode::Additive ? VK_BLEND_FACTOR_ONE
+                                                                                     : VK_BLEND_FACTOR_ZERO;
+        colorBlendAttachment.colorBlendOp        = VK_BLEND_OP_ADD;
+        colorBlendAttachment.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
+        colorBlendAttachment.dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO;
+        colorBlendAttachment.alphaBlendOp        = VK_BLEND_OP_ADD;
+
+
+        VkPipelineColorBlendStateCreateInfo colorBlending{};
+        colorBlending.sType             = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+        colorBlending.logicOpEnable     = VK_FALSE;
+        colorBlending.logicOp           = VK_LOGIC_OP_COPY;
+        colorBlending.attachmentCount   = 1;
+        colorBlending.pAttachments      = &colorBlendAttachment;
+        colorBlending.blendConstants[0] = 0.0f;
+        colorBlending.blendConstants[1] = 0.0f;
+        colorBlending.blendConstants[2] = 0.0f;
+        colorBlending.blendConstants[3] = 0.0f;
+
+        VkDynamicState dynamicStates[] = {
+            VK_DYNAMIC_STATE_VIEWPORT,
+            VK_DYNAMIC_STATE_SCISSOR
+        };
+
+        VkPipelineDynamicStateCreateInfo dynamicState{};
+        dynamicState.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+        dynamicState.dynamicStateCount = 2;
+        dynamicState.pDynamicStates    = dynamicStates;
+
+        VkGraphicsPipelineCreateInfo pipelineInfo{};
+        pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+        pipelineInfo.flags               = flags;
+        pipelineInfo.stageCount          = static_cast<uint32_t>(stages.stages.size());
+        pipelineInfo.pStages             = stages.stages.data();
+        pipelineInfo.pVertexInputState   = &vertexInputInfo;
+        pipelineInfo.pInputAssemblyState = &inputAssembly;
+        pipelineInfo.pViewportState      = &viewportState;
+        pipelineInfo.pRasterizationState = &rasterizer;
+        pipelineInfo.pMultisampleState   = &multisampling;
+        pipelineInfo.pDepthStencilState  = nullptr;
+        pipelineInfo.pColorBlendState    = &colorBlending;
+        pipelineInfo.pDynamicState       = &dynamicState;
+        pipelineInfo.layout              = desc.layout;
+        pipelineInfo.renderPass          = desc.renderPass != VK_NULL_HANDLE ? desc.renderPass : _renderPass;
+        pipelineInfo.subpass             = 0;
+        pipelineInfo.basePipelineHandle  = VK_NULL_HANDLE;
+        pipelineInfo.basePipelineIndex   = -1;
+
+        VkPipeline pipeline;
+        VkResult result = vkCreateGraphicsPipelines(_device, _pipelineCache.handle(), 1, &pipelineInfo, nullptr, &pipeline);
+
+        destroyModules(stages);
+
+        if(result == VK_PIPELINE_COMPILE_REQUIRED_EXT) {
+            return VK_NULL_HANDLE;
+        }
+        if(result != VK_SUCCESS) {
+            throw std::runtime_error("failed to create graphics pipeline!");
+        }
+        return pipeline;
+    }
+
+    void createRenderPass() {
+        VkAttachmentDescription colorAttachment{};
+        colorAttachment.format  = _swapChainImageFormat;
+        colorAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
+        colorAttachment.loadOp  = VK_ATTACHMENT_LOAD_OP_CLEAR;
+        colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+        colorAttachment.stencilLoadOp  = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+        colorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+        colorAttachment.initialLayout  = VK_IMAGE_LAYOUT_UNDEFINED;
+        colorAttachment.finalLayout    = _options.headless ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL
+                                                           : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+
+        VkAttachmentReference colorAttachmentRef{};
+        colorAttachmentRef.attachment = 0;
+        colorAttachmentRef.layout     = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+
+        VkSubpassDescription subpass{};
+        subpass.pipelineBindPoint    = VK_PIPELINE_BIND_POINT_GRAPHICS;
+        subpass.colorAttachmentCount = 1;
+        subpass.pColorAttachments    = &colorAttachmentRef;
+
+        VkSubpassDependency dependency{};
+        dependency.srcSubpass = VK_SUBPASS_EXTERNAL;
+        dependency.dstSubpass = 0;
+        dependency.srcStageMask  = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+        dependency.srcAccessMask = 0;
+        dependency.dstStageMask  = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+        dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+
+        VkRenderPassCreateInfo renderPassInfo{};
+        renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+        renderPassInfo.attachmentCount = 1;
+        renderPassInfo.pAttachments    = &colorAttachment;
+        renderPassInfo.subpassCount    = 1;
+        renderPassInfo.pSubpasses      = &subpass;
+        renderPassInfo.dependencyCount = 1;
+        renderPassInfo.pDependencies   = &dependency;
+
+        if(vkCreateRenderPass(_device, &renderPassInfo, nullptr, &_renderPass) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create render pass!");
+        }
+    }
+
+    void createFramebuffers() {
+        _swapChainFramebuffers.resize(_swapChainImageViews.size());
+
+        for(size_t i=0; i<_swapChainImageViews.size(); i++) {
+            VkImageView attachments[] = {
+                _swapChainImageViews[i]
+            };
+
+            VkFramebufferCreateInfo framebufferInfo{};
+            framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+            framebufferInfo.renderPass      = _renderPass;
+            framebufferInfo.attachmentCount = 1;
             framebufferInfo.pAttachments    = attachments;
             framebufferInfo.width           = _swapChainExtent.width;
             framebufferInfo.height          = _swapChainExtent.height;
             framebufferInfo.layers          = 1;
 
-            if(vkCreateFramebuffer(_device, &framebufferInfo, nullptr, &_swapChainFramebuffers[i]) != VK_SUCCESS) {
-                throw std::runtime_error("failed to create framebuffer!");
+            if(vkCreateFramebuffer(_device, &framebufferInfo, nullptr, &_swapChainFramebuffers[i]) != VK_SUCCESS) {
+                throw std::runtime_error("failed to create framebuffer!");
+            }
+
+        }
+    }
+
+    void createCommandPool() {
+        QueueFamilyIndices queueFamilyIndices = findQueueFamilies(_physicalDevice);
+
+        uint32_t threadCount = _options.recordThreads >= 0 ? static_cast<uint32_t>(_options.recordThreads)
+                                                           : std::max(1u, std::thread::hardware_concurrency());
+        threadCount = std::min(threadCount, MAX_RECORD_THREADS);
+
+        // Transient pools, one per frame in flight and thread, reset in one go instead of per buffer
+        VkCommandPoolCreateInfo poolInfo{};
+        poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+        poolInfo.queueFamilyIndex = queueFamilyIndices.graphicsFamily.value();
+        poolInfo.flags            = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+
+        _frameCommands.resize(_framesInFlight);
+        for(FrameCommands& frame : _frameCommands) {
+            frame.workerPools.resize(threadCount);
+
+            if(vkCreateCommandPool(_device, &poolInfo, nullptr, &frame.pool) != VK_SUCCESS) {
+                throw std::runtime_error("failed to create command pool!");
+            }
+            for(VkCommandPool& workerPool : frame.workerPools) {
+                if(vkCreateCommandPool(_device, &poolInfo, nullptr, &workerPool) != VK_SUCCESS) {
+                    throw std::runtime_error("failed to create command pool!");
+                }
+            }
+        }
+
+        _recordWorkers.start(threadCount);
+    }
+
+    // Static objects scattered around the camera's target, a good share of them ends up outside the frustum
+    void createCullScene() {
+        uint32_t count = _options.cullObjectCount;
+        if(count == 0) {
+            return;
+        }
+
+        // One indirect command covers the whole index range, so indices must not depend on a per submesh offset
+        for(const MeshSubmesh& submesh : _mesh.submeshes) {
+            if(submesh.vertexOffset != 0) {
+                throw std::runtime_error("GPU culling draws the mesh as one range, submeshes must have vertexOffset 0!");
+            }
+        }
+
+        std::mt19937 random(1234);
+        std::uniform_real_distribution<float> position(-4.0f, 4.0f);
+        std::uniform_real_distribution<float> size(0.02f, 0.1f);
+        std::uniform_real_distribution<float> rotation(0.0f, glm::radians(360.0f));
+
+        std::vector<InstanceData> objects(count);
+        _cullBounds.resize(count);
+        for(uint32_t i = 0; i < count; i++) {
+            glm::vec3 center(position(random), position(random), position(random));
+            float scale = size(random);
+
+            InstanceData& object = objects[i];
+            writeInstanceTransform(object, center, rotation(random), scale);
+            object.color        = ((i * 2654435761u) >> 8) | 0xff404040u;
+            object.textureIndex = i % TEXTURE_LAYERS;
+
+            // The mesh fit gives every mesh the quad's bounding sphere, sqrt(0.5) around the origin
+            _cullBounds[i] = glm::vec4(center, scale * std::sqrt(0.5f));
+        }
+
+        VkDeviceSize objectsSize = sizeof(InstanceData) * count;
+        createBuffer(objectsSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+                     VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, _cullObjectBuffer, _cullObjectBufferAllocation);
+        _uploads.uploadBuffer(_cullObjectBuffer, 0, objects.data(), objectsSize,
+                              VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT);
+
+        VkDeviceSize boundsSize = sizeof(glm::vec4) * count;
+        createBuffer(boundsSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                     VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, _cullBoundsBuffer, _cullBoundsBufferAllocation);
+        _uploads.uploadBuffer(_cullBoundsBuffer, 0, _cullBounds.data(), boundsSize,
+                              VK_ACCESS_SHADER_READ_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+
+        _cullCommandBuffers.resize(_framesInFlight);
+        _cullCommandBuffersAllocation.resize(_framesInFlight);
+        _cullCountBuffers.resize(_framesInFlight);
+        _cullCountBuffersAllocation.resize(_framesInFlight);
+        _cullPending.assign(_framesInFlight, false);
+
+        for(size_t i = 0; i < _framesInFlight; i++) {
+            createBuffer(sizeof(VkDrawIndexedIndirectCommand) * count,
+                         VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+                         VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, _cullCommandBuffers[i], _cullCommandBuffersAllocation[i]);
+
+            // Four bytes, host visible so the visible count can be read back once the frame's fence signaled
+            createBuffer(sizeof(uint32_t),
+                         VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                         VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                         _cullCountBuffers[i], _cullCountBuffersAllocation[i]);
+        }
+
+        std::cerr << "gpu cull: " << count << " objects, "
+                  << (_vkCmdDrawIndexedIndirectCount ? "vkCmdDrawIndexedIndirectCount" : "vkCmdDrawIndexedIndirect without count") << "\n";
+    }
+
+    void createCullPipeline() {
+        if(_options.cullObjectCount == 0) {
+            return;
+        }
+
+        std::vector<VkDescriptorSetLayoutBinding> bindings(4);
+        bindings[0].binding         = 0;
+        bindings[0].descriptorType  = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+        bindings[0].descriptorCount = 1;
+        bindings[0].stageFlags      = VK_SHADER_STAGE_COMPUTE_BIT;
+        for(uint32_t i = 1; i < bindings.size(); i++) {
+            bindings[i].binding         = i;
+            bindings[i].descriptorType  = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+            bindings[i].descriptorCount = 1;
+            bindings[i].stageFlags      = VK_SHADER_STAGE_COMPUTE_BIT;
+        }
+        _cullDescriptorSetLayout = _descriptors.layout(bindings);
+
+        VkPushConstantRange pushConstantRange{};
+        pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+        pushConstantRange.offset     = 0;
+        pushConstantRange.size       = sizeof(CullParams);
+
+        VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+        pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+        pipelineLayoutInfo.setLayoutCount         = 1;
+        pipelineLayoutInfo.pSetLayouts            = &_cullDescriptorSetLayout;
+        pipelineLayoutInfo.pushConstantRangeCount = 1;
+        pipelineLayoutInfo.pPushConstantRanges    = &pushConstantRange;
+
+        if(vkCreatePipelineLayout(_device, &pipelineLayoutInfo, nullptr, &_cullPipelineLayout) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create cull pipeline layout!");
+        }
+
+        PipelineDesc desc;
+        desc.stages  = {{"cull.comp", {}, {CULL_GROUP_SIZE}}};
+        desc.compute = true;
+        desc.layout  = _cullPipelineLayout;
+        usePipeline(_cullPipeline, desc);
+    }
+
+    VkPipeline createComputePipeline(const PipelineDesc& desc) {
+        PipelineStages stages = createPipelineStages(desc);
+
+        VkComputePipelineCreateInfo pipelineInfo{};
+        pipelineInfo.sType  = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+        pipelineInfo.stage  = stages.stages[0];
+        pipelineInfo.layout = desc.layout;
+
+        VkPipeline pipeline;
+        VkResult result = vkCreateComputePipelines(_device, _pipelineCache.handle(), 1, &pipelineInfo, nullptr, &pipeline);
+
+        destroyModules(stages);
+
+        if(result != VK_SUCCESS) {
+            throw std::runtime_error("failed to create compute pipeline for " + desc.stages[0].name + "!");
+        }
+        return pipeline;
+    }
+
+    void createCullDescriptorSets() {
+        if(_options.cullObjectCount == 0) {
+            return;
+        }
+
+        _cullDescriptorSets.resize(_framesInFlight);
+        for(size_t i = 0; i < _framesInFlight; i++) {
+            std::vector<DescriptorWrite> writes = {
+                {0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, {}, {{_uniformRing.buffer(), 0, sizeof(UniformBufferObject)}}},
+                {1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, {}, {{_cullBoundsBuffer, 0, VK_WHOLE_SIZE}}},
+                {2, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, {}, {{_cullCommandBuffers[i], 0, VK_WHOLE_SIZE}}},
+                {3, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, {}, {{_cullCountBuffers[i], 0, VK_WHOLE_SIZE}}},
+            };
+            _cullDescriptorSets[i] = _descriptors.immutableSet(_cullDescriptorSetLayout, writes);
+        }
+    }
+
+    // Called once the frame's fence signaled, the count is the one its cull pass wrote
+    void collectCullStats(uint32_t frame) {
+        if(_cullPending.empty() || !_cullPending[frame]) {
+            return;
+        }
+        _cullPending[frame] = false;
+
+        _cullVisibleLast = *static_cast<const uint32_t*>(_cullCountBuffersAllocation[frame].mapped);
+        if(_options.benchFrames == 0 || _frameCount >= BENCH_WARMUP_FRAMES) {
+            _cullVisibleTotal += _cullVisibleLast;
+            _cullFrames++;
+        }
+    }
+
+    // Same sphere/plane test as cull.comp on the CPU, to check the GPU's counts against
+    uint32_t countVisibleCpu(const UniformBufferObject& ubo) {
+        glm::mat4 clip = ubo.proj * ubo.view * ubo.model;
+        glm::vec4 rows[4];
+        for(int i = 0; i < 4; i++) {
+            rows[i] = glm::vec4(clip[0][i], clip[1][i], clip[2][i], clip[3][i]);
+        }
+        glm::vec4 planes[6] = {rows[3] + rows[0], rows[3] - rows[0],
+                               rows[3] + rows[1], rows[3] - rows[1],
+                               rows[2],           rows[3] - rows[2]};
+
+        uint32_t visible = 0;
+        for(const glm::vec4& sphere : _cullBounds) {
+            bool inside = true;
+            for(const glm::vec4& plane : planes) {
+                glm::vec3 normal(plane);
+                if(glm::dot(normal, glm::vec3(sphere)) + plane.w < -sphere.w * glm::length(normal)) {
+                    inside = false;
+                }
+            }
+            visible += inside ? 1 : 0;
+        }
+        return visible;
+    }
+
+    void dumpCullStats(std::ostream& out) {
+        if(_options.cullObjectCount == 0) {
+            return;
+        }
+
+        // The camera doesn't move, so the last frame's uniforms hold for every frame
+        uint32_t reference = countVisibleCpu(_frameUniforms);
+        out << "gpu cull: " << _options.cullObjectCount << " objects, last frame "
+            << _cullVisibleLast << " visible / " << (_options.cullObjectCount - _cullVisibleLast) << " culled"
+            << " (cpu reference " << reference << " visible)\n";
+    }
+
+    void createPipelineStatsQueries() {
+        if(!_options.pipelineStats) {
+            return;
+        }
+
+        VkQueryPoolCreateInfo queryPoolInfo{};
+        queryPoolInfo.sType              = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+        queryPoolInfo.queryType          = VK_QUERY_TYPE_PIPELINE_STATISTICS;
+        queryPoolInfo.queryCount         = _framesInFlight;
+        queryPoolInfo.pipelineStatistics = PIPELINE_STATS;
+
+        if(vkCreateQueryPool(_device, &queryPoolInfo, nullptr, &_statsQueryPool) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create pipeline statistics query pool!");
+        }
+        _statsPending.assign(_framesInFlight, std::nullopt);
+    }
+
+    // Called once the frame's fence signaled, like collectCullStats
+    void collectPipelineStats(uint32_t frame) {
+        if(_statsPending.empty() || !_statsPending[frame]) {
+            return;
+        }
+        uint64_t sourceFrame = *_statsPending[frame];
+        _statsPending[frame] = std::nullopt;
+
+        std::array<uint64_t, PIPELINE_STAT_COUNT> stats;
+        VkResult result = vkGetQueryPoolResults(_device, _statsQueryPool, frame, 1, sizeof(stats), stats.data(),
+                                                sizeof(stats), VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT);
+        if(result != VK_SUCCESS) {
+            return;
+        }
+
+        if(_options.benchFrames == 0 || sourceFrame >= BENCH_WARMUP_FRAMES) {
+            for(uint32_t i = 0; i < PIPELINE_STAT_COUNT; i++) {
+                _statsTotals[i] += stats[i];
+            }
+            _statsFrames++;
+        }
+        for(uint32_t i = 0; i < PIPELINE_STAT_COUNT; i++) {
+            _profiler.counter(PIPELINE_STAT_NAMES[i], static_cast<double>(stats[i]));
+        }
+    }
+
+    static std::vector<std::string> overdrawShaderDefines() {
+        return {"OVERDRAW_BINS=" + std::to_string(OVERDRAW_BINS)};
+    }
+
+    // Sized from the swap chain at startup and kept, after a resize the frame is squeezed into it.
+    // The histogram is reported as shares of the target's pixels, so that hardly matters.
+    void createOverdrawTarget() {
+        if(!_options.overdraw) {
+            return;
+        }
+
+        _overdrawExtent = _swapChainExtent;
+        createImage(_overdrawExtent.width, _overdrawExtent.height, OVERDRAW_FORMAT, VK_IMAGE_TILING_OPTIMAL,
+                    VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                    _overdrawImage, _overdrawImageAllocation);
+
+        VkImageViewCreateInfo viewInfo{};
+        viewInfo.sType    = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+        viewInfo.image    = _overdrawImage;
+        viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+        viewInfo.format   = OVERDRAW_FORMAT;
+        viewInfo.subresourceRange.aspectMask     = VK_IMAGE_ASPECT_COLOR_BIT;
+        viewInfo.subresourceRange.baseMipLevel   = 0;
+        viewInfo.subresourceRange.levelCount     = 1;
+        viewInfo.subresourceRange.baseArrayLayer = 0;
+        viewInfo.subresourceRange.layerCount     = 1;
+
+        if(vkCreateImageView(_device, &viewInfo, nullptr, &_overdrawImageView) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create overdraw image view!");
+        }
+
+        VkAttachmentDescription colorAttachment{};
+        colorAttachment.format  = OVERDRAW_FORMAT;
+        colorAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
+        colorAttachment.loadOp  = VK_ATTACHMENT_LOAD_OP_CLEAR;
+        colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+        colorAttachment.stencilLoadOp  = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+        colorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+        colorAttachment.initialLayout  = VK_IMAGE_LAYOUT_UNDEFINED;
+        colorAttachment.finalLayout    = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+        VkAttachmentReference colorAttachmentRef{};
+        colorAttachmentRef.attachment = 0;
+        colorAttachmentRef.layout     = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+
+        VkSubpassDescription subpass{};
+        subpass.pipelineBindPoint    = VK_PIPELINE_BIND_POINT_GRAPHICS;
+        subpass.colorAttachmentCount = 1;
+        subpass.pColorAttachments    = &colorAttachmentRef;
+
+        // Frames in flight share the target: the previous frame's reduction reads it before this
+        // one clears it, and the reduction waits for the draws
+        std::array<VkSubpassDependency, 2> dependencies{};
+        dependencies[0].srcSubpass    = VK_SUBPASS_EXTERNAL;
+        dependencies[0].dstSubpass    = 0;
+        dependencies[0].srcStageMask  = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+        dependencies[0].srcAccessMask = 0;
+        dependencies[0].dstStageMask  = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+        dependencies[0].dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+        dependencies[1].srcSubpass    = 0;
+        dependencies[1].dstSubpass    = VK_SUBPASS_EXTERNAL;
+        dependencies[1].srcStageMask  = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+        dependencies[1].srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+        dependencies[1].dstStageMask  = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+        dependencies[1].dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+        VkRenderPassCreateInfo renderPassInfo{};
+        renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+        renderPassInfo.attachmentCount = 1;
+        renderPassInfo.pAttachments    = &colorAttachment;
+        renderPassInfo.subpassCount    = 1;
+        renderPassInfo.pSubpasses      = &subpass;
+        renderPassInfo.dependencyCount = static_cast<uint32_t>(dependencies.size());
+        renderPassInfo.pDependencies   = dependencies.data();
+
+        if(vkCreateRenderPass(_device, &renderPassInfo, nullptr, &_overdrawRenderPass) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create overdraw render pass!");
+        }
+
+        VkFramebufferCreateInfo framebufferInfo{};
+        framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+        framebufferInfo.renderPass      = _overdrawRenderPass;
+        framebufferInfo.attachmentCount = 1;
+        framebufferInfo.pAttachments    = &_overdrawImageView;
+        framebufferInfo.width           = _overdrawExtent.width;
+        framebufferInfo.height          = _overdrawExtent.height;
+        framebufferInfo.layers          = 1;
+
+        if(vkCreateFramebuffer(_device, &framebufferInfo, nullptr, &_overdrawFramebuffer) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create overdraw framebuffer!");
+        }
+
+        _overdrawHistogramBuffers.resize(_framesInFlight);
+        _overdrawHistogramAllocations.resize(_framesInFlight);
+        _overdrawPending.assign(_framesInFlight, std::nullopt);
+        for(size_t i = 0; i < _framesInFlight; i++) {
+            createBuffer(OVERDRAW_BINS * sizeof(uint32_t),
+                         VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                         VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                         _overdrawHistogramBuffers[i], _overdrawHistogramAllocations[i]);
+        }
+    }
+
+    void createOverdrawReduction() {
+        if(!_options.overdraw) {
+            return;
+        }
+
+        std::vector<VkDescriptorSetLayoutBinding> bindings(2);
+        bindings[0].binding         = 0;
+        bindings[0].descriptorType  = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+        bindings[0].descriptorCount = 1;
+        bindings[0].stageFlags      = VK_SHADER_STAGE_COMPUTE_BIT;
+        bindings[1].binding         = 1;
+        bindings[1].descriptorType  = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        bindings[1].descriptorCount = 1;
+        bindings[1].stageFlags      = VK_SHADER_STAGE_COMPUTE_BIT;
+        _overdrawSetLayout = _descriptors.layout(bindings);
+
+        VkPushConstantRange pushConstantRange{};
+        pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+        pushConstantRange.offset     = 0;
+        pushConstantRange.size       = sizeof(OverdrawParams);
+
+        VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+        pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+        pipelineLayoutInfo.setLayoutCount         = 1;
+        pipelineLayoutInfo.pSetLayouts            = &_overdrawSetLayout;
+        pipelineLayoutInfo.pushConstantRangeCount = 1;
+        pipelineLayoutInfo.pPushConstantRanges    = &pushConstantRange;
+
+        if(vkCreatePipelineLayout(_device, &pipelineLayoutInfo, nullptr, &_overdrawPipelineLayout) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create overdraw pipeline layout!");
+        }
+
+        PipelineDesc desc;
+        desc.stages  = {{"overdraw.comp", overdrawShaderDefines(), {OVERDRAW_GROUP_SIZE, OVERDRAW_GROUP_SIZE}}};
+        desc.compute = true;
+        desc.layout  = _overdrawPipelineLayout;
+        usePipeline(_overdrawReducePipeline, desc);
+
+        _overdrawDescriptorSets.resize(_framesInFlight);
+        for(size_t i = 0; i < _framesInFlight; i++) {
+            std::vector<DescriptorWrite> writes = {
+                {0, VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE, {{VK_NULL_HANDLE, _overdrawImageView, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL}}, {}},
+                {1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, {}, {{_overdrawHistogramBuffers[i], 0, VK_WHOLE_SIZE}}},
+            };
+            _overdrawDescriptorSets[i] = _descriptors.immutableSet(_overdrawSetLayout, writes);
+        }
+    }
+
+    // The frame's draws once more, each layer adding one to its pixels, then counted into this
+    // frame's histogram
+    void recordOverdraw(VkCommandBuffer commandBuffer) {
+        VkBuffer histogram = _overdrawHistogramBuffers[currentFrame];
+        vkCmdFillBuffer(commandBuffer, histogram, 0, OVERDRAW_BINS * sizeof(uint32_t), 0);
+
+        VkRenderPassBeginInfo renderPassInfo{};
+        renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+        renderPassInfo.renderPass  = _overdrawRenderPass;
+        renderPassInfo.framebuffer = _overdrawFramebuffer;
+        renderPassInfo.renderArea.offset = {0,0};
+        renderPassInfo.renderArea.extent = _overdrawExtent;
+
+        VkClearValue clearValue = {0.0f, 0.0f, 0.0f, 0.0f};
+        renderPassInfo.clearValueCount = 1;
+        renderPassInfo.pClearValues    = &clearValue;
+
+        vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+        recordDraws(commandBuffer, 0, _framePacket->drawList.size(), _overdrawExtent, _overdrawPipeline);
+        vkCmdEndRenderPass(commandBuffer);
+
+        VkMemoryBarrier fillBarrier{};
+        fillBarrier.sType         = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+        fillBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        fillBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0,
+                             1, &fillBarrier, 0, nullptr, 0, nullptr);
+
+        OverdrawParams params{};
+        params.width  = _overdrawExtent.width;
+        params.height = _overdrawExtent.height;
+
+        vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, _overdrawReducePipeline);
+        vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, _overdrawPipelineLayout, 0, 1,
+                                &_overdrawDescriptorSets[currentFrame], 0, nullptr);
+        vkCmdPushConstants(commandBuffer, _overdrawPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(params), &params);
+        vkCmdDispatch(commandBuffer, (params.width + OVERDRAW_GROUP_SIZE - 1) / OVERDRAW_GROUP_SIZE,
+                      (params.height + OVERDRAW_GROUP_SIZE - 1) / OVERDRAW_GROUP_SIZE, 1);
+
+        VkMemoryBarrier histogramBarrier{};
+        histogramBarrier.sType         = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+        histogramBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+        histogramBarrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0,
+                             1, &histogramBarrier, 0, nullptr, 0, nullptr);
+
+        _overdrawPending[currentFrame] = _frameCount;
+    }
+
+    void collectOverdraw(uint32_t frame) {
+        if(_overdrawPending.empty() || !_overdrawPending[frame]) {
+            return;
+        }
+        uint64_t sourceFrame = *_overdrawPending[frame];
+        _overdrawPending[frame] = std::nullopt;
+        bool counted = _options.benchFrames == 0 || sourceFrame >= BENCH_WARMUP_FRAMES;
+
+        const uint32_t* bins = static_cast<const uint32_t*>(_overdrawHistogramAllocations[frame].mapped);
+        uint64_t covered = 0;
+        uint64_t layers  = 0;
+        for(uint32_t bin = 0; bin < OVERDRAW_BINS; bin++) {
+            if(counted) {
+                _overdrawTotals[bin] += bins[bin];
+            }
+            covered += bin > 0 ? bins[bin] : 0;
+            layers  += static_cast<uint64_t>(bin) * bins[bin];
+        }
+        if(counted) {
+            _overdrawFrames++;
+        }
+        _profiler.counter("overdraw", covered > 0 ? static_cast<double>(layers) / covered : 0.0);
+    }
+
+    // Shares of the target's pixels per bin averaged over the frames, and the layers per covered
+    // pixel. The last bin counts as OVERDRAW_BINS - 1 layers, a lower bound.
+    std::string overdrawJson() {
+        uint64_t pixels  = 0;
+        uint64_t covered = 0;
+        uint64_t layers  = 0;
+        for(uint32_t bin = 0; bin < OVERDRAW_BINS; bin++) {
+            pixels  += _overdrawTotals[bin];
+            covered += bin > 0 ? _overdrawTotals[bin] : 0;
+            layers  += bin * _overdrawTotals[bin];
+        }
+
+        std::ostringstream json;
+        json << "{\"covered\": " << (pixels > 0 ? static_cast<double>(covered) / pixels : 0.0)
+             << ", \"layers_per_covered_pixel\": " << (covered > 0 ? static_cast<double>(layers) / covered : 0.0)
+             << ", \"histogram\": [";
+        for(uint32_t bin = 0; bin < OVERDRAW_BINS; bin++) {
+            json << (bin > 0 ? ", " : "") << (pixels > 0 ? static_cast<double>(_overdrawTotals[bin]) / pixels : 0.0);
+        }
+        json << "]}";
+        return json.str();
+    }
+
+    void dumpFrameAnalysis(std::ostream& out) {
+        if(_statsFrames > 0) {
+            auto perFrame = [this](uint32_t stat) { return static_cast<double>(_statsTotals[stat]) / _statsFrames; };
+            out << "pipeline stats per frame: " << perFrame(2) << " vertex invocations, " << perFrame(4) << " primitives after clipping, "
+                << perFrame(5) << " fragment invocations";
+            if(perFrame(2) > 0.0) {
+                out << " (" << perFrame(5) / perFrame(2) << " per vertex)";
+            }
+            out << "\n";
+        }
+        if(_overdrawFrames > 0) {
+            out << "overdraw: " << overdrawJson() << "\n";
+        }
+    }
+
+    void createInstances(uint32_t count) {
+        uint32_t columns = static_cast<uint32_t>(std::ceil(std::sqrt(static_cast<double>(std::max(count, 1u)))));
+        float scale = 1.0f / columns;
+
+        _instances.resize(count);
+        for(uint32_t i = 0; i < count; i++) {
+            InstanceState& instance = _instances[i];
+            instance.position = glm::vec3(((i % columns) - (columns - 1) * 0.5f) * scale,
+                                          ((i / columns) - (columns - 1) * 0.5f) * scale, 0.0f);
+            instance.scale    = scale;
+            instance.phase    = static_cast<float>(i % 360) * glm::radians(1.0f);
+
+            // Cheap integer hash for a stable per-instance tint, alpha fixed to opaque
+            uint32_t hash = i * 2654435761u;
+            instance.color        = (hash >> 8) | 0xff000000u | 0x00404040u;
+            instance.textureIndex = _options.streamTextureCount > 0 ? i % _options.streamTextureCount : i % TEXTURE_LAYERS;
+        }
+
+        _instanceBuffers.resize(_framesInFlight, VK_NULL_HANDLE);
+        _instanceBuffersAllocation.resize(_framesInFlight);
+        _instanceBufferCapacity.resize(_framesInFlight, 0);
+    }
+
+    // Only called for a frame whose fence has been waited on, so its old buffer is free to go
+    void ensureInstanceCapacity(uint32_t frame, uint32_t count) {
+        if(_instanceBufferCapacity[frame] >= count) {
+            return;
+        }
+
+        if(_instanceBuffers[frame] != VK_NULL_HANDLE) {
+            destroyBuffer(_instanceBuffers[frame], _instanceBuffersAllocation[frame]);
+        }
+
+        uint32_t capacity = std::max(count, _instanceBufferCapacity[frame] * 2);
+        createBuffer(sizeof(InstanceData) * capacity, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+                     VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                     VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                     _instanceBuffers[frame], _instanceBuffersAllocation[frame]);
+        _instanceBufferCapacity[frame] = capacity;
+    }
+
+    // Render side, the packet's instances go into this frame's instance buffer in one sequential pass
+    void updateInstances(uint32_t frame) {
+        const std::vector<InstanceData>& instances = _framePacket->instances;
+        if(instances.empty()) {
+            return;
+        }
+
+        ensureInstanceCapacity(frame, static_cast<uint32_t>(instances.size()));
+        memcpy(_instanceBuffersAllocation[frame].mapped, instances.data(), instances.size() * sizeof(InstanceData));
+    }
+
+    // Simulation side, every instance's transform at the packet's time
+    void updateInstanceData(FramePacket& packet) {
+        packet.instances.resize(_instances.size());
+
+        auto fill = [&](size_t begin, size_t end) {
+            for(size_t i = begin; i < end; i++) {
+                const InstanceState& instance = _instances[i];
+                float angle = packet.time * glm::radians(90.0f) + instance.phase;
+
+                InstanceData& data = packet.instances[i];
+                writeInstanceTransform(data, instance.position, angle, instance.scale);
+                data.color        = instance.color;
+                data.textureIndex = instance.textureIndex;
+            }
+        };
+
+        // The record workers belong to the render thread once it has its own
+        size_t workerCount = _options.renderThread ? 0 : _recordWorkers.size();
+        if(workerCount == 0) {
+            fill(0, _instances.size());
+            return;
+        }
+        _recordWorkers.run([&](uint32_t worker) {
+            fill(_instances.size() * worker / workerCount, _instances.size() * (worker + 1) / workerCount);
+        });
+    }
+
+    void createDrawList() {
+        // Square grid of quads scaled down to cover the same area as the single original quad
+        uint32_t columns = static_cast<uint32_t>(std::ceil(std::sqrt(static_cast<double>(_options.drawCount))));
+        float scale = 1.0f / columns;
+
+        _drawList.resize(_options.drawCount);
+        for(uint32_t i = 0; i < _options.drawCount; i++) {
+            glm::vec3 center((i % columns) - (columns - 1) * 0.5f, (i / columns) - (columns - 1) * 0.5f, 0.0f);
+            _drawList[i].transform = glm::translate(glm::scale(glm::mat4(1.0f), glm::vec3(scale)), center);
+            _drawList[i].variant   = i % _options.drawVariants;
+        }
+
+        _drawVariantPipelines.assign(_options.drawVariants, VK_NULL_HANDLE);
+        _drawPipelines.assign(_options.drawVariants, VK_NULL_HANDLE);
+    }
+
+    // Variant v joins the scene VARIANT_APPEAR_FRAMES * v frames in, the way a new material
+    // would. Until its pipeline exists its quads fall back as configured.
+    void updateDrawVariants() {
+        _drawPipelines[0] = _options.positionOnly ? _positionPipeline : _graphicsPipeline;
+
+        for(uint32_t variant = 1; variant < _drawPipelines.size(); variant++) {
+            if(_frameCount < variant * VARIANT_APPEAR_FRAMES) {
+                _drawPipelines[variant] = VK_NULL_HANDLE;
+                continue;
+            }
+
+            if(_drawVariantPipelines[variant] == VK_NULL_HANDLE) {
+                PipelineDesc desc = _drawDesc;
+                desc.stages[1].constants = {variant};
+                if(_options.pipelineFallback == PipelineFallback::Sync) {
+                    usePipeline(_drawVariantPipelines[variant], desc);
+                }
+                else {
+                    requestPipeline(_drawVariantPipelines[variant], desc);
+                }
+            }
+
+            if(_drawVariantPipelines[variant] != VK_NULL_HANDLE) {
+                _drawPipelines[variant] = _drawVariantPipelines[variant];
+                continue;
+            }
+            _drawPipelines[variant] = _options.pipelineFallback == PipelineFallback::Generic ? _drawPipelines[0] : VK_NULL_HANDLE;
+            if(_frameCount >= BENCH_WARMUP_FRAMES) {
+                _variantWaitFrames++;
+            }
+        }
+    }
+
+    void createUploadEngine() {
+        QueueFamilyIndices queueFamilyIndices = findQueueFamilies(_physicalDevice);
+
+        _uploads.init(_device, _allocator, _transferQueue, queueFamilyIndices.transferFamily.value(),
+                      queueFamilyIndices.graphicsFamily.value(), _framesInFlight);
+    }
+
+    void createCommandBuffers() {
+        for(FrameCommands& frame : _frameCommands) {
+            VkCommandBufferAllocateInfo allocInfo{};
+            allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+            allocInfo.commandPool         = frame.pool;
+            allocInfo.level               = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+            allocInfo.commandBufferCount  = 1;
+
+            if(vkAllocateCommandBuffers(_device, &allocInfo, &frame.primary) != VK_SUCCESS) {
+                throw std::runtime_error("failed to allocate command buffers!");
+            }
+
+            frame.workerBuffers.resize(frame.workerPools.size());
+            for(size_t i=0; i<frame.workerPools.size(); i++) {
+                allocInfo.commandPool = frame.workerPools[i];
+                allocInfo.level       = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+
+                if(vkAllocateCommandBuffers(_device, &allocInfo, &frame.workerBuffers[i]) != VK_SUCCESS) {
+                    throw std::runtime_error("failed to allocate command buffers!");
+                }
+            }
+        }
+    }
+
+    void recordCommandBuffer(FrameCommands& frame, uint32_t imageIndex) {
+        VkCommandBuffer commandBuffer = frame.primary;
+
+        VkCommandBufferBeginInfo beginInfo{};
+        beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+        beginInfo.pInheritanceInfo = nullptr;
+
+        if(vkBeginCommandBuffer(commandBuffer, &beginInfo) != VK_SUCCESS) {
+            throw std::runtime_error("failed to begin recording command buffer!");
+        }
+
+        uint32_t profilerFrame = static_cast<uint32_t>(currentFrame);
+        _profiler.cmdBeginFrame(commandBuffer, profilerFrame);
+        if(_statsQueryPool != VK_NULL_HANDLE) {
+            vkCmdResetQueryPool(commandBuffer, _statsQueryPool, static_cast<uint32_t>(currentFrame), 1);
+        }
+
+        _uploadWaitSemaphores.clear();
+        _uploadWaitStages.clear();
+        _uploads.acquireCompleted(static_cast<uint32_t>(currentFrame), commandBuffer,
+                                  _uploadWaitSemaphores, _uploadWaitStages);
+
+        uint32_t mipScope = _profiler.cmdBeginScope(commandBuffer, profilerFrame, "mip generation");
+        recordMipGeneration(commandBuffer);
+        _profiler.cmdEndScope(commandBuffer, profilerFrame, mipScope);
+
+        // Until the scene's uploads have landed the frame is just cleared
+        bool drawScene = _uploads.acquiredId() >= _sceneUploadId;
+        bool culled    = _cullPipeline != VK_NULL_HANDLE;
+        bool streamed  = _streamPipeline != VK_NULL_HANDLE;
+        bool instanced = !_instances.empty();
+        bool threaded  = !frame.workerBuffers.empty() && !instanced && !culled &&
+                         (_statsQueryPool == VK_NULL_HANDLE || _enabledFeatures.inheritedQueries);
+
+        if(drawScene && culled) {
+            uint32_t cullScope = _profiler.cmdBeginScope(commandBuffer, profilerFrame, "cull");
+            recordCullDispatch(commandBuffer);
+            _profiler.cmdEndScope(commandBuffer, profilerFrame, cullScope);
+        }
+        else if(drawScene && threaded) {
+            recordSecondaryBuffers(frame, imageIndex);
+        }
+
+        VkRenderPassBeginInfo renderPassInfo{};
+        renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+        renderPassInfo.renderPass  = _renderPass;
+        renderPassInfo.framebuffer = _swapChainFramebuffers[imageIndex];
+        renderPassInfo.renderArea.offset = {0,0};
+        renderPassInfo.renderArea.extent = _swapChainExtent;
+
+        VkClearValue clearColor = {0.0f, 0.0f, 0.0f, 1.0f};
+        renderPassInfo.clearValueCount = 1;
+        renderPassInfo.pClearValues    = &clearColor;
+
+        uint32_t renderPassScope = _profiler.cmdBeginScope(commandBuffer, profilerFrame, "render pass");
+        if(_statsQueryPool != VK_NULL_HANDLE) {
+            vkCmdBeginQuery(commandBuffer, _statsQueryPool, static_cast<uint32_t>(currentFrame), 0);
+        }
+        vkCmdBeginRenderPass(commandBuffer, &renderPassInfo,
+                             threaded ? VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS : VK_SUBPASS_CONTENTS_INLINE);
+
+        if(drawScene && culled) {
+            recordCulledDraw(commandBuffer);
+        }
+        else if(drawScene && streamed) {
+            recordStreamedDraw(commandBuffer);
+        }
+        else if(drawScene && instanced) {
+            recordInstancedDraw(commandBuffer);
+        }
+        else if(drawScene && threaded) {
+            vkCmdExecuteCommands(commandBuffer, static_cast<uint32_t>(frame.workerBuffers.size()), frame.workerBuffers.data());
+        }
+        else if(drawScene) {
+            recordDraws(commandBuffer, 0, _framePacket->drawList.size(), _swapChainExtent);
+        }
+
+        vkCmdEndRenderPass(commandBuffer);
+        if(_statsQueryPool != VK_NULL_HANDLE) {
+            vkCmdEndQuery(commandBuffer, _statsQueryPool, static_cast<uint32_t>(currentFrame));
+            _statsPending[currentFrame] = _frameCount;
+        }
+        _profiler.cmdEndScope(commandBuffer, profilerFrame, renderPassScope);
+
+        if(drawScene && _overdrawPipeline != VK_NULL_HANDLE) {
+            uint32_t overdrawScope = _profiler.cmdBeginScope(commandBuffer, profilerFrame, "overdraw");
+            recordOverdraw(commandBuffer);
+            _profiler.cmdEndScope(commandBuffer, profilerFrame, overdrawScope);
+        }
+
+        if(drawScene && streamed) {
+            // Read on the host once this frame's fence has signaled
+            VkMemoryBarrier feedbackBarrier{};
+            feedbackBarrier.sType         = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+            feedbackBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+            feedbackBarrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+            vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0,
+                                 1, &feedbackBarrier, 0, nullptr, 0, nullptr);
+            _streamFeedbackPending[currentFrame] = true;
+        }
+
+        _profiler.cmdEndFrame(commandBuffer, profilerFrame);
+
+        if(vkEndCommandBuffer(commandBuffer) != VK_SUCCESS) {
+            throw std::runtime_error("failed to record command buffer");
+        }
+    }
+
+    void recordSecondaryBuffers(FrameCommands& frame, uint32_t imageIndex) {
+        size_t workerCount = frame.workerBuffers.size();
+
+        _recordWorkers.run([&](uint32_t worker) {
+            FrameProfiler::CpuScope scope(_profiler, "record worker");
+
+            VkCommandBufferInheritanceInfo inheritanceInfo{};
+            inheritanceInfo.sType       = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+            inheritanceInfo.renderPass  = _renderPass;
+            inheritanceInfo.subpass     = 0;
+            inheritanceInfo.framebuffer = _swapChainFramebuffers[imageIndex];
+            // Without these bits draws recorded here wouldn't count towards --pipeline-stats
+            inheritanceInfo.pipelineStatistics = _statsQueryPool != VK_NULL_HANDLE ? PIPELINE_STATS : 0;
+
+            VkCommandBufferBeginInfo beginInfo{};
+            beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+            beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT |
+                              VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+            beginInfo.pInheritanceInfo = &inheritanceInfo;
+
+            VkCommandBuffer commandBuffer = frame.workerBuffers[worker];
+            if(vkBeginCommandBuffer(commandBuffer, &beginInfo) != VK_SUCCESS) {
+                throw std::runtime_error("failed to begin recording secondary command buffer!");
+            }
+
+            // Contiguous slice of the draw list per worker
+            size_t begin = _framePacket->drawList.size() * worker / workerCount;
+            size_t end   = _framePacket->drawList.size() * (worker + 1) / workerCount;
+            recordDraws(commandBuffer, begin, end, _swapChainExtent);
+
+            if(vkEndCommandBuffer(commandBuffer) != VK_SUCCESS) {
+                throw std::runtime_error("failed to record secondary command buffer!");
+            }
+        });
+    }
+
+    // Outside the render pass: reset the count, cull every object, make the commands visible to the indirect draw
+    void recordCullDispatch(VkCommandBuffer commandBuffer) {
+        VkBuffer countBuffer = _cullCountBuffers[currentFrame];
+        vkCmdFillBuffer(commandBuffer, countBuffer, 0, sizeof(uint32_t), 0);
+
+        VkMemoryBarrier fillBarrier{};
+        fillBarrier.sType         = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+        fillBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        fillBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0,
+                             1, &fillBarrier, 0, nullptr, 0, nullptr);
+
+        UniformBufferObject ubo = _frameUniforms;
+        ubo.model = glm::mat4(1.0f);
+        _cullUniformOffset = _uniformRing.push(ubo);
+
+        CullParams params{};
+        params.objectCount = _options.cullObjectCount;
+        params.indexCount  = _mesh.indexCount;
+        params.compact     = _vkCmdDrawIndexedIndirectCount ? 1 : 0;
+
+        vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, _cullPipeline);
+        vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, _cullPipelineLayout, 0, 1,
+                                &_cullDescriptorSets[currentFrame], 1, &_cullUniformOffset);
+        vkCmdPushConstants(commandBuffer, _cullPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(params), &params);
+        vkCmdDispatch(commandBuffer, (params.objectCount + CULL_GROUP_SIZE - 1) / CULL_GROUP_SIZE, 1, 1);
+
+        VkMemoryBarrier cullBarrier{};
+        cullBarrier.sType         = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+        cullBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+        cullBarrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_HOST_READ_BIT;
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                             VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_HOST_BIT, 0,
+                             1, &cullBarrier, 0, nullptr, 0, nullptr);
+
+        _cullPending[currentFrame] = true;
+    }
+
+    // Viewport and scissor covering the whole extent, every pipeline leaves both dynamic
+    static void setViewportScissor(VkCommandBuffer commandBuffer, VkExtent2D extent) {
+        VkViewport viewport{};
+        viewport.x = 0.0f;
+        viewport.y = 0.0f;
+        viewport.width  = (float) extent.width;
+        viewport.height = (float) extent.height;
+        viewport.minDepth = 0.0f;
+        viewport.maxDepth = 1.0f;
+        vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+
+        VkRect2D scissor{};
+        scissor.offset = {0, 0};
+        scissor.extent = extent;
+        vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+    }
+
+    // The same few commands no matter how many objects there are, the GPU decides what gets drawn
+    void recordCulledDraw(VkCommandBuffer commandBuffer) {
+        vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, _instancedPipeline);
+
+        setViewportScissor(commandBuffer, _swapChainExtent);
+
+        // firstInstance of each command is the object index, so instance data is read straight from the object buffer
+        VkBuffer vertexBuffers[] = {_vertexBuffer, _cullObjectBuffer};
+        VkDeviceSize offsets[]   = {0, 0};
+        vkCmdBindVertexBuffers(commandBuffer, 0, 2, vertexBuffers, offsets);
+        vkCmdBindIndexBuffer(commandBuffer, _indexBuffer, 0, _mesh.indexType);
+
+        vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, _pipelineLayout, 0, 1, &_descriptorSet, 1, &_cullUniformOffset);
+
+        if(_vkCmdDrawIndexedIndirectCount) {
+            _vkCmdDrawIndexedIndirectCount(commandBuffer, _cullCommandBuffers[currentFrame], 0,
+                                           _cullCountBuffers[currentFrame], 0,
+                                           _options.cullObjectCount, sizeof(VkDrawIndexedIndirectCommand));
+        }
+        else {
+            vkCmdDrawIndexedIndirect(commandBuffer, _cullCommandBuffers[currentFrame], 0,
+                                     _options.cullObjectCount, sizeof(VkDrawIndexedIndirectCommand));
+        }
+    }
+
+    // Every instance in one call, per-instance data comes from this frame's instance buffer
+    void recordInstancedDraw(VkCommandBuffer commandBuffer) {
+        vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, _instancedPipeline);
+
+        setViewportScissor(commandBuffer, _swapChainExtent);
+
+        VkBuffer vertexBuffers[] = {_vertexBuffer, _instanceBuffers[currentFrame]};
+        VkDeviceSize offsets[]   = {0, 0};
+        vkCmdBindVertexBuffers(commandBuffer, 0, 2, vertexBuffers, offsets);
+        vkCmdBindIndexBuffer(commandBuffer, _indexBuffer, 0, _mesh.indexType);
+
+        // Instances carry their whole transform, the shared model matrix stays identity
+        UniformBufferObject ubo = _frameUniforms;
+        ubo.model = glm::mat4(1.0f);
+        uint32_t uniformOffset = _uniformRing.push(ubo);
+
+        vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, _pipelineLayout, 0, 1, &_descriptorSet, 1, &uniformOffset);
+        for(const MeshSubmesh& submesh : _mesh.submeshes) {
+            vkCmdDrawIndexed(commandBuffer, submesh.indexCount, static_cast<uint32_t>(_instances.size()),
+                             submesh.firstIndex, submesh.vertexOffset, 0);
+        }
+    }
+
+    // One draw per instance, so the texture index streamed.frag reads from the instance is uniform within a draw
+    void recordStreamedDraw(VkCommandBuffer commandBuffer) {
+        vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, _streamPipeline);
+
+        setViewportScissor(commandBuffer, _swapChainExtent);
+
+        VkBuffer vertexBuffers[] = {_vertexBuffer, _instanceBuffers[currentFrame]};
+        VkDeviceSize offsets[]   = {0, 0};
+        vkCmdBindVertexBuffers(commandBuffer, 0, 2, vertexBuffers, offsets);
+        vkCmdBindIndexBuffer(commandBuffer, _indexBuffer, 0, _mesh.indexType);
+
+        UniformBufferObject ubo = _frameUniforms;
+        ubo.model = glm::mat4(1.0f);
+        uint32_t uniformOffset = _uniformRing.push(ubo);
+
+        VkDescriptorSet descriptorSets[] = {_descriptorSet, _streamDescriptorSets[currentFrame]};
+        vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, _streamPipelineLayout, 0, 2, descriptorSets, 1, &uniformOffset);
+        for(uint32_t instance = 0; instance < _instances.size(); instance++) {
+            for(const MeshSubmesh& submesh : _mesh.submeshes) {
+                vkCmdDrawIndexed(commandBuffer, submesh.indexCount, 1, submesh.firstIndex, submesh.vertexOffset, instance);
+            }
+        }
+    }
+
+    // Records draw list entries [begin, end) with all state they need, safe to call from worker threads
+    // With overridePipeline every draw the frame makes is drawn with that instead
+    void recordDraws(VkCommandBuffer commandBuffer, size_t begin, size_t end, VkExtent2D extent,
+                     VkPipeline overridePipeline = VK_NULL_HANDLE) {
+        setViewportScissor(commandBuffer, extent);
+
+        VkBuffer vertexBuffers[] = {_options.positionOnly ? _positionBuffer : _vertexBuffer};
+        VkDeviceSize offsets[]   = {0};
+        vkCmdBindVertexBuffers(commandBuffer, 0, 1, vertexBuffers, offsets);
+        vkCmdBindIndexBuffer(commandBuffer, _indexBuffer, 0, _mesh.indexType);
+
+        const std::vector<DrawItem>& drawList = _framePacket->drawList;
+        UniformBufferObject ubo = _frameUniforms;
+        VkPipeline boundPipeline = VK_NULL_HANDLE;
+        for(size_t i = begin; i < end; i++) {
+            VkPipeline pipeline = _drawPipelines[drawList[i].variant];
+            if(pipeline == VK_NULL_HANDLE) {
+                continue;
+            }
+            if(overridePipeline != VK_NULL_HANDLE) {
+                pipeline = overridePipeline;
+            }
+            if(pipeline != boundPipeline) {
+                vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+                boundPipeline = pipeline;
+            }
+
+            ubo.model = drawList[i].transform * _frameUniforms.model;
+            uint32_t uniformOffset = _uniformRing.push(ubo);
+
+            vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, _pipelineLayout, 0, 1, &_descriptorSet, 1, &uniformOffset);
+            for(const MeshSubmesh& submesh : _mesh.submeshes) {
+                vkCmdDrawIndexed(commandBuffer, submesh.indexCount, 1, submesh.firstIndex, submesh.vertexOffset, 0);
+            }
+        }
+    }
+
+    uint32_t timestampValidBits() {
+        QueueFamilyIndices queueFamilyIndices = findQueueFamilies(_physicalDevice);
+
+        uint32_t queueFamilyCount = 0;
+        vkGetPhysicalDeviceQueueFamilyProperties(_physicalDevice, &queueFamilyCount, nullptr);
+
+        std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
+        vkGetPhysicalDeviceQueueFamilyProperties(_physicalDevice, &queueFamilyCount, queueFamilies.data());
+
+        return queueFamilies[queueFamilyIndices.graphicsFamily.value()].timestampValidBits;
+    }
+
+    void createProfiler() {
+        uint32_t validBits = timestampValidBits();
+
+        VkPhysicalDeviceProperties deviceProperties;
+        vkGetPhysicalDeviceProperties(_physicalDevice, &deviceProperties);
+        _timestampPeriod = deviceProperties.limits.timestampPeriod;
+        _timestampMask   = validBits >= 64 ? ~0ULL : ((1ULL << validBits) - 1);
+
+        // Some queues can't write timestamps at all, then we only report CPU times
+        bool gpuTiming = _options.benchFrames > 0 || !_options.tracePath.empty();
+        _profiler.create(_device, _framesInFlight, gpuTiming ? validBits : 0, _timestampPeriod, _options.tracePath);
+    }
+
+    void collectGpuFrameTime(uint32_t frame) {
+        uint64_t frameNumber;
+        double gpuMs;
+        if(_profiler.collect(frame, frameNumber, gpuMs) && _options.benchFrames > 0 && frameNumber >= BENCH_WARMUP_FRAMES) {
+            _gpuFrameTimes.push_back(gpuMs);
+        }
+    }
+
+    std::string deviceNameJson() {
+        VkPhysicalDeviceProperties deviceProperties;
+        vkGetPhysicalDeviceProperties(_physicalDevice, &deviceProperties);
+
+        std::string deviceName;
+        for(const char* c = deviceProperties.deviceName; *c; c++) {
+            if(*c == '"' || *c == '\\') {
+                deviceName += '\\';
+            }
+            deviceName += *c;
+        }
+        return "\"" + deviceName + "\"";
+    }
+
+    // Reports go to stdout unless --json names a file, diagnostics stay on stderr
+    void writeReport(const std::string& json) {
+        if(_options.jsonPath.empty()) {
+            std::cout << json;
+        }
+        else {
+            std::ofstream file(_options.jsonPath);
+            if(!file.is_open()) {
+                throw std::runtime_error("failed to open " + _options.jsonPath);
+            }
+            file << json;
+        }
+    }
+
+    void writeBenchReport() {
+        std::ostringstream json;
+        json << "{\n";
+        json << "  \"device\": " << deviceNameJson() << ",\n";
+        json << "  \"headless\": " << (_options.headless ? "true" : "false") << ",\n";
+        json << "  \"width\": " << _swapChainExtent.width << ",\n";
+        json << "  \"height\": " << _swapChainExtent.height << ",\n";
+        json << "  \"frames\": " << _cpuFrameTimes.size() << ",\n";
+        json << "  \"draws\": " << _drawList.size() << ",\n";
+        json << "  \"instances\": " << _instances.size() << ",\n";
+        json << "  \"vertex_format\": \"" << vertexFormatName(_options.vertexFormat) << (_options.positionOnly ? "+position" : "") << "\",\n";
+        json << "  \"vertex_bytes\": " << (_options.positionOnly ? PositionStreamLayout::stride : _mesh.vertexStride) << ",\n";
+        if(_options.cullObjectCount > 0) {
+            double visible = _cullFrames > 0 ? static_cast<double>(_cullVisibleTotal) / _cullFrames : 0.0;
+            json << "  \"cull_objects\": " << _options.cullObjectCount << ",\n";
+            json << "  \"cull_visible\": " << visible << ",\n";
+            json << "  \"cull_culled\": " << (_options.cullObjectCount - visible) << ",\n";
+        }
+        if(_statsFrames > 0) {
+            json << "  \"pipeline_stats\": {";
+            for(uint32_t i = 0; i < PIPELINE_STAT_COUNT; i++) {
+                json << (i > 0 ? ", " : "") << "\"" << PIPELINE_STAT_NAMES[i] << "\": " << static_cast<double>(_statsTotals[i]) / _statsFrames;
+            }
+            json << "},\n";
+        }
+        if(_overdrawFrames > 0) {
+            json << "  \"overdraw\": " << overdrawJson() << ",\n";
+        }
+        json << "  \"record_threads\": " << _recordWorkers.size() << ",\n";
+        json << "  \"record_ms\": " << frameTimeStatsJson(_recordTimes) << ",\n";
+        json << "  \"pipeline_cache\": \"" << (_pipelineCache.warm() ? "warm" : "cold") << "\",\n";
+        json << "  \"pipeline_create_ms\": " << _pipelineCreateMs << ",\n";
+        json << "  \"pipeline_variants\": " << _pipelines.size() << ",\n";
+        json << "  \"pipeline_requests\": " << _pipelineRequests << ",\n";
+        if(_drawPipelines.size() > 1) {
+            json << "  \"draw_variants\": " << _drawPipelines.size() << ",\n";
+            json << "  \"pipeline_fallback\": \"" << pipelineFallbackName(_options.pipelineFallback) << "\",\n";
+            json << "  \"pipeline_cache_control\": " << (_pipelineCacheControl ? "true" : "false") << ",\n";
+            json << "  \"pipeline_cache_probe_hits\": " << _pipelineCacheProbeHits << ",\n";
+            json << "  \"pipeline_background_creates\": " << _pipelineBackgroundCreates << ",\n";
+            json << "  \"pipeline_background_ms\": " << _pipelineBackgroundMs << ",\n";
+            json << "  \"pipeline_failed_variants\": " << _pipelinesFailed.size() << ",\n";
+            json << "  \"variant_wait_frames\": " << _variantWaitFrames << ",\n";
+        }
+        json << "  \"shader_compiles\": " << _shaders.compiles() << ",\n";
+        json << "  \"shader_cache_hits\": " << _shaders.cacheHits() << ",\n";
+        json << "  \"shader_compile_ms\": " << _shaders.compileMs() << ",\n";
+        json << "  \"init_threads\": " << _initThreads << ",\n";
+        json << "  \"init_ms\": " << _initMs << ",\n";
+        json << "  \"init_busy_ms\": " << _initBusyMs << ",\n";
+        json << "  \"mip_mode\": \"" << mipModeName(_mipMode) << "\",\n";
+        json << "  \"mip_levels\": " << _textureMipLevels << ",\n";
+        json << "  \"mip_ms\": " << _mipMs << ",\n";
+        json << "  \"texture_source\": \"" << _textureSource << "\",\n";
+        json << "  \"texture_format\": \"" << textureFormatName() << "\",\n";
+        json << "  \"texture_bytes\": " << _textureBytes << ",\n";
+        json << "  \"texture_load_ms\": " << _textureLoadMs << ",\n";
+        json << "  \"texture_upload\": \"" << (_textureDirect ? "direct" : "staging") << "\",\n";
+        if(!_streamTextures.empty()) {
+            double deficit = _streamDeficitFrames > 0 ? _streamDeficitTotal / _streamDeficitFrames : 0.0;
+            json << "  \"stream_textures\": " << _streamTextures.size() << ",\n";
+            json << "  \"stream_budget_bytes\": " << _streamBudget << ",\n";
+            json << "  \"stream_peak_bytes\": " << _streamPeak << ",\n";
+            json << "  \"stream_resident_bytes\": " << _streamAllocated << ",\n";
+            json << "  \"stream_uploads\": " << _streamUploads << ",\n";
+            json << "  \"stream_upload_bytes\": " << _streamUploadBytes << ",\n";
+            json << "  \"stream_evictions\": " << _streamEvictions << ",\n";
+            json << "  \"stream_deferred_uploads\": " << _streamDeferred << ",\n";
+            json << "  \"stream_missing_levels\": " << deficit << ",\n";
+        }
+        size_t hitches = std::count_if(_cpuFrameTimes.begin(), _cpuFrameTimes.end(),
+                                       [this](double ms) { return ms > _options.hitchMs; });
+        json << "  \"hitch_ms\": " << _options.hitchMs << ",\n";
+        json << "  \"hitches\": " << hitches << ",\n";
+        json << "  \"cpu_ms\": " << frameTimeStatsJson(_cpuFrameTimes) << ",\n";
+        json << "  \"frames_in_flight\": " << _framesInFlight << ",\n";
+        json << "  \"render_thread\": " << (_options.renderThread ? "true" : "false") << ",\n";
+        json << "  \"present_thread\": " << (_options.presentThread ? "true" : "false") << ",\n";
+        if(_options.renderThread) {
+            json << "  \"sim_hz\": " << _options.simHz << ",\n";
+        }
+        if(!_options.headless) {
+            json << "  \"present_mode\": \"" << presentModeName(_presentMode) << "\",\n";
+            json << "  \"swapchain_images\": " << _swapChainImages.size() << ",\n";
+            json << "  \"present_wait\": " << (_presentWait ? "true" : "false") << ",\n";
+        }
+        json << "  \"low_latency\": " << (_options.lowLatency ? "true" : "false") << ",\n";
+        json << "  \"input_to_submit_ms\": " << frameTimeStatsJson(_inputToSubmitTimes) << ",\n";
+        if(_presentWait) {
+            json << "  \"input_to_present_ms\": " << frameTimeStatsJson(_inputToPresentTimes) << ",\n";
+        }
+        json << "  \"sim_steps\": " << _simSteps << ",\n";
+        json << "  \"packets_skipped\": " << _packetsSkipped << ",\n";
+        json << "  \"sim_ms\": " << frameTimeStatsJson(_simTimes) << ",\n";
+        json << "  \"wait_ms\": " << frameTimeStatsJson(_waitTimes) << ",\n";
+        json << "  \"gpu_ms\": " << frameTimeStatsJson(_gpuFrameTimes) << "\n";
+        json << "}\n";
+
+        writeReport(json.str());
+    }
+
+    void createSyncObjects() {
+        _imageAvailableSemaphores.resize(_framesInFlight);
+        _renderFinishedSemaphores.resize(_framesInFlight);
+        _imageFrameValues.assign(_swapChainImages.size(), 0);
+
+        VkSemaphoreTypeCreateInfoKHR timelineInfo{};
+        timelineInfo.sType         = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO_KHR;
+        timelineInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE_KHR;
+        timelineInfo.initialValue  = 0;
+
+        VkSemaphoreCreateInfo timelineSemaphoreInfo{};
+        timelineSemaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+        timelineSemaphoreInfo.pNext = &timelineInfo;
+
+        if(vkCreateSemaphore(_device, &timelineSemaphoreInfo, nullptr, &_frameTimeline) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create frame timeline semaphore!");
+        }
+
+        VkSemaphoreCreateInfo semaphoreInfo{};
+        semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+
+        for(size_t i=0; i<_framesInFlight; i++) {
+            if(vkCreateSemaphore(_device, &semaphoreInfo, nullptr, &_imageAvailableSemaphores[i]) != VK_SUCCESS
+            || vkCreateSemaphore(_device, &semaphoreInfo, nullptr, &_renderFinishedSemaphores[i]) != VK_SUCCESS) {
+                throw std::runtime_error("failed to create synchronization objects for a frame!");
+            }
+        }
+
+    }
+
+    // Frames the GPU has finished, frame N is done once this is past N
+    uint64_t completedFrames() {
+        uint64_t value = 0;
+        if(_vkGetSemaphoreCounterValue(_device, _frameTimeline, &value) != VK_SUCCESS) {
+            throw std::runtime_error("failed to read frame timeline semaphore!");
+        }
+        return value;
+    }
+
+    // Blocks until the frame timeline reaches value, returns how long that took in ms
+    double waitForFrames(uint64_t value) {
+        VkSemaphoreWaitInfoKHR waitInfo{};
+        waitInfo.sType          = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO_KHR;
+        waitInfo.semaphoreCount = 1;
+        waitInfo.pSemaphores    = &_frameTimeline;
+        waitInfo.pValues        = &value;
+
+        auto start = std::chrono::high_resolution_clock::now();
+        if(_vkWaitSemaphores(_device, &waitInfo, UINT64_MAX) != VK_SUCCESS) {
+            throw std::runtime_error("failed to wait for frame timeline semaphore!");
+        }
+        std::chrono::duration<double, std::milli> waitTime = std::chrono::high_resolution_clock::now() - start;
+        return waitTime.count();
+    }
+
+    // Packets never carry a minimized window's zero size, the simulation waits that out in pollWindow()
+    void recreateSwapChain() {
+        // Presents still queued use the old swapchain, which can't be retired under them, and
+        // neither can waits for presents on it
+        if(_options.presentThread) {
+            _presenter.wait();
+        }
+        _presentWaiter.wait();
+
+        // No device wait: frames in flight keep using the old objects, which are destroyed after them
+        VkSwapchainKHR oldSwapChain = _swapChain;
+        std::vector<VkFramebuffer> oldFramebuffers = _swapChainFramebuffers;
+        std::vector<VkImageView> oldImageViews   = _swapChainImageViews;
+        VkFormat oldFormat = _swapChainImageFormat;
+
+        createSwapChain();
+
+        deferDestroy([=]() {
+            for(VkFramebuffer framebuffer : oldFramebuffers) {
+                vkDestroyFramebuffer(_device, framebuffer, nullptr);
+            }
+            for(VkImageView imageView : oldImageViews) {
+                vkDestroyImageView(_device, imageView, nullptr);
+            }
+            vkDestroySwapchainKHR(_device, oldSwapChain, nullptr);
+        });
+
+        createImageViews();
+
+        // The render pass and pipeline only depend on the format, which practically never changes
+        if(_swapChainImageFormat != oldFormat) {
+            // Every graphics variant was made for the old render pass, compute ones stay. Background
+            // creation uses the render pass too, so it has to be done first.
+            _pipelineCompiler.wait();
+            std::unique_lock<std::mutex> pipelinesLock(_pipelinesMutex);
+            _pipelinesPending.clear();
+            _pipelinesFailed.clear();
+            std::fill(_drawVariantPipelines.begin(), _drawVariantPipelines.end(), VK_NULL_HANDLE);
+
+            std::vector<VkPipeline> oldPipelines;
+            for(auto variant = _pipelines.begin(); variant != _pipelines.end(); ) {
+                if(variant->second.desc.compute) {
+                    ++variant;
+                    continue;
+                }
+                oldPipelines.push_back(variant->second.pipeline);
+                variant = _pipelines.erase(variant);
+            }
+            pipelinesLock.unlock();
+
+            VkRenderPass oldRenderPass     = _renderPass;
+            VkPipelineLayout oldLayout     = _pipelineLayout;
+            VkPipelineLayout oldStreamLayout = _streamPipelineLayout;
+            deferDestroy([=]() {
+                for(VkPipeline pipeline : oldPipelines) {
+                    vkDestroyPipeline(_device, pipeline, nullptr);
+                }
+                if(oldStreamLayout != VK_NULL_HANDLE) {
+                    vkDestroyPipelineLayout(_device, oldStreamLayout, nullptr);
+                }
+                vkDestroyPipelineLayout(_device, oldLayout, nullptr);
+                vkDestroyRenderPass(_device, oldRenderPass, nullptr);
+            });
+
+            createRenderPass();
+            createGraphicsPipeline();
+        }
+
+        createFramebuffers();
+        _imageFrameValues.assign(_swapChainImages.size(), 0);
+    }
+
+    // Frames in flight keep the old pipelines until they are done with them, so nothing waits on the
+    // device. A shader that doesn't compile leaves its pipelines as they were.
+    void reloadChangedShaders() {
+        std::vector<std::string> changed = _shaders.changedFiles();
+        if(changed.empty()) {
+            return;
+        }
+
+        // A background create that started before the change would add a variant built from the
+        // old code after the walk below, so those finish first. Nothing new gets queued meanwhile,
+        // only this thread requests pipelines.
+        _pipelineCompiler.wait();
+        std::lock_guard<std::mutex> lock(_pipelinesMutex);
+
+        // Variants that failed with the old code get requested again
+        for(auto failed = _pipelinesFailed.begin(); failed != _pipelinesFailed.end(); ) {
+            bool affected = std::any_of(changed.begin(), changed.end(), [&](const std::string& shader) {
+                return failed->second.usesShader(shader);
+            });
+            failed = affected ? _pipelinesFailed.erase(failed) : std::next(failed);
+        }
+
+        for(auto& [key, variant] : _pipelines) {
+            bool affected = std::any_of(changed.begin(), changed.end(), [&](const std::string& shader) {
+                return variant.desc.usesShader(shader);
+            });
+            if(!affected) {
+                continue;
+            }
+
+            VkPipeline pipeline;
+            try {
+                pipeline = variant.desc.compute ? createComputePipeline(variant.desc) : createPipeline(variant.desc);
+            }
+            catch(const std::exception& e) {
+                std::cerr << "shader reload: " << e.what() << "\n";
+                continue;
+            }
+
+            VkPipeline oldPipeline = variant.pipeline;
+            deferDestroy([=]() {
+                vkDestroyPipeline(_device, oldPipeline, nullptr);
+            });
+            variant.pipeline = pipeline;
+            for(auto& [member, memberKey] : _pipelineUsers) {
+                if(memberKey == key) {
+                    *member = pipeline;
+                }
+            }
+            _shaderReloads++;
+        }
+        std::cerr << "shader reload: " << changed.size() << " changed, " << _shaderReloads << " pipelines rebuilt so far\n";
+    }
+
+    void deferDestroy(std::function<void()> destroy) {
+        _deferredDestroys.emplace_back(_frameCount, std::move(destroy));
+    }
+
+    // Called at the start of a frame, or with all = true once the device is idle
+    void runDeferredDestroys(bool all) {
+        // Anything replaced while building frame N was last used by frame N - 1
+        uint64_t completed = all ? 0 : completedFrames();
+        while(!_deferredDestroys.empty()
+           && (all || _deferredDestroys.front().first <= completed)) {
+            _deferredDestroys.front().second();
+            _deferredDestroys.pop_front();
+        }
+    }
+
+    void createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer& buffer, Allocation& bufferAllocation) {
+        VkBufferCreateInfo bufferInfo{};
+        bufferInfo.sType       = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+        bufferInfo.size        = size;
+        bufferInfo.usage       = usage;
+        bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+        if(vkCreateBuffer(_device, &bufferInfo, nullptr, &buffer) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create buffer!");
+        }
+
+        VkMemoryRequirements memRequirements;
+        vkGetBufferMemoryRequirements(_device, buffer, &memRequirements);
+
+        bufferAllocation = _allocator.allocate(memRequirements, properties, ResourceKind::Linear);
+
+        vkBindBufferMemory(_device, buffer, bufferAllocation.memory, bufferAllocation.offset);
+
+    }
+
+    void destroyBuffer(VkBuffer buffer, Allocation& bufferAllocation) {
+        vkDestroyBuffer(_device, buffer, nullptr);
+        _allocator.free(bufferAllocation);
+    }
+
+    // Maps --mesh or falls back to the built-in quad, has to run before the pipelines are created
+    void loadMesh() {
+        _mesh = Mesh{};
+        auto loadStart = std::chrono::high_resolution_clock::now();
+
+        if(_options.meshPath.empty()) {
+            _mesh.vertexData   = vertices.data();
+            _mesh.vertexCount  = static_cast<uint32_t>(vertices.size());
+            _mesh.vertexStride = sizeof(Vertex);
+            _mesh.indexData    = indices.data();
+            _mesh.indexCount   = static_cast<uint32_t>(indices.size());
+            _mesh.indexType    = VK_INDEX_TYPE_UINT16;
+            _mesh.layout       = {{MESH_ATTRIBUTE_POSITION, MESH_FORMAT_FLOAT3, VertexFloatLayout::offset<0>(), 0},
+                                  {MESH_ATTRIBUTE_COLOR,    MESH_FORMAT_FLOAT3, VertexFloatLayout::offset<1>(), 0},
+                                  {MESH_ATTRIBUTE_TEXCOORD, MESH_FORMAT_FLOAT2, VertexFloatLayout::offset<2>(), 0}};
+
+            MeshSubmesh submesh{};
+            submesh.indexCount = _mesh.indexCount;
+            _mesh.submeshes.push_back(submesh);
+            _mesh.boundsMin = glm::vec3(-0.5f, -0.5f, 0.0f);
+            _mesh.boundsMax = glm::vec3(0.5f, 0.5f, 0.0f);
+        }
+        else {
+            _meshFile.open(_options.meshPath);
+            const MeshFileHeader& header = _meshFile.header();
+
+            _mesh.vertexData   = _meshFile.vertexData();
+            _mesh.vertexCount  = header.vertexCount;
+            _mesh.vertexStride = header.vertexStride;
+            _mesh.indexData    = _meshFile.indexData();
+            _mesh.indexCount   = header.indexCount;
+            _mesh.indexType    = header.indexSize == 4 ? VK_INDEX_TYPE_UINT32 : VK_INDEX_TYPE_UINT16;
+            _mesh.layout.assign(_meshFile.attributes(), _meshFile.attributes() + header.attributeCount);
+            _mesh.submeshes.assign(_meshFile.submeshes(), _meshFile.submeshes() + header.submeshCount);
+            _mesh.boundsMin    = glm::vec3(header.boundsMin[0], header.boundsMin[1], header.boundsMin[2]);
+            _mesh.boundsMax    = glm::vec3(header.boundsMax[0], header.boundsMax[1], header.boundsMax[2]);
+
+            if(!_mesh.findAttribute(MESH_ATTRIBUTE_POSITION) || !_mesh.findAttribute(MESH_ATTRIBUTE_COLOR) ||
+               !_mesh.findAttribute(MESH_ATTRIBUTE_TEXCOORD)) {
+                throw std::runtime_error("mesh " + _options.meshPath + " needs position, color and texcoord attributes!");
+            }
+
+            const MeshAttribute* position = _mesh.findAttribute(MESH_ATTRIBUTE_POSITION);
+            if(position->format == MESH_FORMAT_SNORM16X4) {
+                _mesh.decodeScale  = (_mesh.boundsMax - _mesh.boundsMin) * 0.5f;
+                _mesh.decodeOffset = (_mesh.boundsMin + _mesh.boundsMax) * 0.5f;
+            }
+            else if(position->format == MESH_FORMAT_OCT16 || position->format == MESH_FORMAT_UNORM8X4) {
+                throw std::runtime_error("mesh " + _options.meshPath + " has positions in a format meant for directions or colors!");
+            }
+        }
+
+        switch(_options.vertexFormat) {
+            case VertexFormat::Float:  repackMesh<VertexFloatLayout>(); break;
+            case VertexFormat::Packed: repackMesh<PackedVertexLayout>(); break;
+            case VertexFormat::Half:   repackMesh<HalfVertexLayout>(); break;
+        }
+
+        // Shader locations of the semantics, attributes the shaders don't read are left out
+        const uint32_t locations[] = {0, 1, 2};
+        const VkFormat formats[]   = {Float2::vkFormat, Float3::vkFormat, Float4::vkFormat, Snorm16x4::vkFormat,
+                                      Half4::vkFormat, Half2::vkFormat, Unorm8x4::vkFormat, Oct16::vkFormat};
+
+        for(const MeshAttribute& attribute : _mesh.layout) {
+            if(attribute.semantic > MESH_ATTRIBUTE_TEXCOORD) {
+                continue;
+            }
+
+            VkVertexInputAttributeDescription description{};
+            description.binding  = 0;
+            description.location = locations[attribute.semantic];
+            description.format   = formats[attribute.format];
+            description.offset   = attribute.offset;
+            _mesh.attributes.push_back(description);
+        }
+
+        // Center the mesh and give its bounding sphere the radius of the quad's
+        glm::vec3 extent = _mesh.boundsMax - _mesh.boundsMin;
+        float radius     = 0.5f * glm::length(extent);
+        glm::vec3 center = (_mesh.boundsMin + _mesh.boundsMax) * 0.5f;
+        float fitScale   = radius > 0.0f ? std::sqrt(0.5f) / radius : 1.0f;
+        _meshScale  = _mesh.decodeScale * fitScale;
+        _meshOffset = (_mesh.decodeOffset - center) * fitScale;
+
+        if(_options.positionOnly) {
+            createPositionStream();
+            _positionScale  = _positionScale * fitScale;
+            _positionOffset = (_positionOffset - center) * fitScale;
+            _meshFitTransform = glm::scale(glm::translate(glm::mat4(1.0f), _positionOffset), _positionScale);
+        }
+        else {
+            _meshFitTransform = glm::scale(glm::translate(glm::mat4(1.0f), _meshOffset), _meshScale);
+        }
+
+        std::chrono::duration<double, std::milli> loadTime = std::chrono::high_resolution_clock::now() - loadStart;
+        std::cerr << "mesh: " << (_options.meshPath.empty() ? "built-in quad" : _options.meshPath) << ", "
+                  << _mesh.vertexCount << " vertices, " << _mesh.indexCount / 3 << " triangles, "
+                  << _mesh.submeshes.size() << " submeshes, " << (_mesh.indexType == VK_INDEX_TYPE_UINT32 ? 32 : 16)
+                  << " bit indices, " << vertexFormatName(_options.vertexFormat) << " vertices of " << _mesh.vertexStride
+                  << " bytes, loaded in " << loadTime.count() << " ms\n";
+    }
+
+    // Rewrites position, color and texcoord of every vertex into Layout, snorm positions relative to the bounds
+    template<typename Layout>
+    void repackMesh() {
+        static_assert(Layout::attributeCount == 3, "position, color and texcoord");
+        using PositionFormat = typename Layout::template attribute<0>::format;
+        using ColorFormat    = typename Layout::template attribute<1>::format;
+        using TexCoordFormat = typename Layout::template attribute<2>::format;
+
+        const MeshAttribute* color    = _mesh.findAttribute(MESH_ATTRIBUTE_COLOR);
+        const MeshAttribute* texCoord = _mesh.findAttribute(MESH_ATTRIBUTE_TEXCOORD);
+        const MeshAttribute* position = _mesh.findAttribute(MESH_ATTRIBUTE_POSITION);
+        if(_mesh.vertexStride == Layout::stride && position->format == PositionFormat::meshFormat &&
+           color->format == ColorFormat::meshFormat && texCoord->format == TexCoordFormat::meshFormat) {
+            return;     // stored in the requested layout already
+        }
+
+        bool boundsRelative = PositionFormat::meshFormat == MESH_FORMAT_SNORM16X4;
+        glm::vec3 center     = (_mesh.boundsMin + _mesh.boundsMax) * 0.5f;
+        glm::vec3 halfExtent = (_mesh.boundsMax - _mesh.boundsMin) * 0.5f;
+        for(int axis = 0; axis < 3; axis++) {
+            halfExtent[axis] = std::max(halfExtent[axis], 1e-6f);     // flat meshes, the built-in quad has no depth
+        }
+
+        _meshVertexStorage.resize(size_t(_mesh.vertexCount) * Layout::stride);
+        const uint8_t* source = static_cast<const uint8_t*>(_mesh.vertexData);
+
+        for(uint32_t v = 0; v < _mesh.vertexCount; v++) {
+            const uint8_t* vertex = source + size_t(v) * _mesh.vertexStride;
+            uint8_t* packed = _meshVertexStorage.data() + size_t(v) * Layout::stride;
+
+            glm::vec3 p = _mesh.position(v);
+            if(boundsRelative) {
+                p = (p - center) / halfExtent;
+            }
+            float value[4] = {p.x, p.y, p.z, 1.0f};
+            Layout::template encode<0>(packed, value);
+
+            decodeMeshAttribute(color->format, vertex + color->offset, value);
+            Layout::template encode<1>(packed, value);
+
+            decodeMeshAttribute(texCoord->format, vertex + texCoord->offset, value);
+            Layout::template encode<2>(packed, value);
+        }
+
+        _mesh.vertexData   = _meshVertexStorage.data();
+        _mesh.vertexStride = Layout::stride;
+        _mesh.layout       = {{MESH_ATTRIBUTE_POSITION, PositionFormat::meshFormat, Layout::template offset<0>(), 0},
+                              {MESH_ATTRIBUTE_COLOR,    ColorFormat::meshFormat,    Layout::template offset<1>(), 0},
+                              {MESH_ATTRIBUTE_TEXCOORD, TexCoordFormat::meshFormat, Layout::template offset<2>(), 0}};
+        _mesh.decodeScale  = boundsRelative ? halfExtent : glm::vec3(1.0f);
+        _mesh.decodeOffset = boundsRelative ? center : glm::vec3(0.0f);
+    }
+
+    // Positions only, in a stream of their own so a pass that needs nothing else fetches 8 bytes a vertex
+    void createPositionStream() {
+        glm::vec3 center     = (_mesh.boundsMin + _mesh.boundsMax) * 0.5f;
+        glm::vec3 halfExtent = (_mesh.boundsMax - _mesh.boundsMin) * 0.5f;
+        for(int axis = 0; axis < 3; axis++) {
+            halfExtent[axis] = std::max(halfExtent[axis], 1e-6f);
+        }
+
+        _positionStorage.resize(size_t(_mesh.vertexCount) * PositionStreamLayout::stride);
+        for(uint32_t v = 0; v < _mesh.vertexCount; v++) {
+            glm::vec3 p = (_mesh.position(v) - center) / halfExtent;
+            float value[4] = {p.x, p.y, p.z, 1.0f};
+            PositionStreamLayout::encode<0>(_positionStorage.data() + size_t(v) * PositionStreamLayout::stride, value);
+        }
+
+        _positionScale  = halfExtent;
+        _positionOffset = center;
+    }
+
+    void createVertexBuffer(const Mesh& mesh) {
+        VkDeviceSize bufferSize = mesh.vertexDataSize();
+
+        createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+                     VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, _vertexBuffer, _vertexBufferAllocation);
+
+        _uploads.uploadBuffer(_vertexBuffer, 0, mesh.vertexData, bufferSize,
+                              VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT);
+
+        if(!_positionStorage.empty()) {
+            createBuffer(_positionStorage.size(), VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+                         VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, _positionBuffer, _positionBufferAllocation);
+
+            _uploads.uploadBuffer(_positionBuffer, 0, _positionStorage.data(), _positionStorage.size(),
+                                  VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT);
+        }
+    }
+
+    void createIndexBuffer(const Mesh& mesh) {
+        VkDeviceSize bufferSize = mesh.indexDataSize();
+
+        createBuffer(bufferSize, 
+                     VK_BUFFER_USAGE_TRANSFER_DST_BIT |
+                     VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
+                     VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, _indexBuffer, _indexBufferAllocation);
+
+        _uploads.uploadBuffer(_indexBuffer, 0, mesh.indexData, bufferSize,
+                              VK_ACCESS_INDEX_READ_BIT, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT);
+    }
+
+    // Instance transform with the vertex decode and mesh fit folded in: rotation about z and scale, placed at position
+    void writeInstanceTransform(InstanceData& data, const glm::vec3& position, float angle, float scale) const {
+        float c = std::cos(angle) * scale;
+        float s = std::sin(angle) * scale;
+        const glm::vec3& m = _meshScale;
+        const glm::vec3& o = _meshOffset;
+
+        data.transform[0] = glm::vec4(c * m.x, -s * m.y, 0.0f, position.x + c * o.x - s * o.y);
+        data.transform[1] = glm::vec4(s * m.x,  c * m.y, 0.0f, position.y + s * o.x + c * o.y);
+        data.transform[2] = glm::vec4(0.0f, 0.0f, scale * m.z, position.z + scale * o.z);
+    }
+
+    void createDescriptorCache() {
+        _descriptors.init(_device);
+        _frameDescriptors.resize(_framesInFlight);
+        for(DescriptorAllocator& allocator : _frameDescriptors) {
+            allocator.init(_device);
+        }
+    }
+
+    void createDescriptorSetLayout() {
+        VkDescriptorSetLayoutBinding uboLayoutBinding{};
+        uboLayoutBinding.binding         = 0;
+        uboLayoutBinding.descriptorType  = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+        uboLayoutBinding.descriptorCount = 1;
+
+        uboLayoutBinding.stageFlags         = VK_SHADER_STAGE_VERTEX_BIT;
+        uboLayoutBinding.pImmutableSamplers = nullptr;
+
+        VkDescriptorSetLayoutBinding samplerLayoutBinding{};
+        samplerLayoutBinding.binding            = 1;
+        samplerLayoutBinding.descriptorType     = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+        samplerLayoutBinding.descriptorCount    = 1;
+        samplerLayoutBinding.stageFlags         = VK_SHADER_STAGE_FRAGMENT_BIT;
+        samplerLayoutBinding.pImmutableSamplers = nullptr;
+
+        _descriptorSetLayout = _descriptors.layout({uboLayoutBinding, samplerLayoutBinding});
+
+        if(_options.streamTextureCount > 0) {
+            createStreamSetLayout();
+        }
+    }
+
+    // Set 1 of the streamed pipeline: every streamed texture and the frame's feedback buffer
+    void createStreamSetLayout() {
+        std::vector<VkDescriptorSetLayoutBinding> bindings(2);
+        bindings[0].binding         = 0;
+        bindings[0].descriptorType  = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+        bindings[0].descriptorCount = MAX_STREAM_TEXTURES;
+        bindings[0].stageFlags      = VK_SHADER_STAGE_FRAGMENT_BIT;
+        bindings[1].binding         = 1;
+        bindings[1].descriptorType  = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        bindings[1].descriptorCount = 1;
+        bindings[1].stageFlags      = VK_SHADER_STAGE_FRAGMENT_BIT;
+        _streamSetLayout = _descriptors.layout(bindings);
+    }
+
+    void createUniformBuffers() {
+        VkPhysicalDeviceProperties deviceProperties;
+        vkGetPhysicalDeviceProperties(_physicalDevice, &deviceProperties);
+
+        // Every draw pushes its own uniforms, size the slices for the whole draw list. The overdraw
+        // pass draws it a second time.
+        VkDeviceSize alignment = std::max<VkDeviceSize>(deviceProperties.limits.minUniformBufferOffsetAlignment, 1);
+        VkDeviceSize perDraw   = (sizeof(UniformBufferObject) + alignment - 1) / alignment * alignment;
+        VkDeviceSize passes    = _options.overdraw ? 2 : 1;
+
+        _uniformRing.init(_device, _allocator, alignment,
+                          std::max(UNIFORM_RING_FRAME_SIZE, perDraw * _drawList.size() * passes), _framesInFlight);
+    }
+
+    // Uniforms shared by every draw of the packet, the model matrix is combined with each draw's transform
+    void updateCamera(FramePacket& packet) {
+        static auto startTime = std::chrono::high_resolution_clock::now();
+
+        auto currentTime = std::chrono::high_resolution_clock::now();
+        float time = std::chrono::duration<float, std::chrono::seconds::period>(currentTime - startTime).count();
+        float aspect = packet.framebuffer.width / (float) packet.framebuffer.height;
+
+        UniformBufferObject ubo{};
+        ubo.model = glm::rotate(glm::mat4(1.0f), time * glm::radians(90.0f), glm::vec3(0.0f,0.0f,1.0f)) * _meshFitTransform;
+        ubo.view  = glm::lookAt(glm::vec3(2.0f,2.0f,2.0f), glm::vec3(0.0f,0.0f,0.0f), glm::vec3(0.0f,0.0f,1.0f));
+        ubo.proj  = glm::perspective(glm::radians(45.0f), aspect, 0.1f, 10.0f);
+
+        if(_options.streamTextureCount > 0) {
+            // Low over the instance grid, sweeping sideways while it moves along. Near textures want their
+            // finest levels, the ones further off less, and the ones left behind nothing at all.
+            glm::vec3 eye(0.3f * std::sin(time * 0.3f), std::fmod(time * 0.05f, 1.0f) - 0.6f, 0.05f);
+            ubo.view = glm::lookAt(eye, eye + glm::vec3(0.0f, 1.0f, -0.25f), glm::vec3(0.0f, 0.0f, 1.0f));
+            ubo.proj = glm::perspective(glm::radians(60.0f), aspect, 0.01f, 10.0f);
+        }
+
+        ubo.proj[1][1] *= -1;
+
+        packet.uniforms = ubo;
+        packet.time     = time;
+    }
+
+    void createDescriptorSets() {
+        // A single set covers every frame, the frame's slice of the ring is picked by the dynamic offset
+        std::vector<DescriptorWrite> writes = {
+            {0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, {}, {{_uniformRing.buffer(), 0, sizeof(UniformBufferObject)}}},
+            {1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, {{_textureSampler, _textureImageView, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL}}, {}},
+        };
+        _descriptorSet = _descriptors.immutableSet(_descriptorSetLayout, writes);
+    }
+
+    void createImage(uint32_t width, uint32_t height, VkFormat format, VkImageTiling tiling,
+                     VkImageUsageFlags usage, VkMemoryPropertyFlags properties, VkImage& image,
+                     Allocation& imageAllocation, uint32_t layers = 1, uint32_t mipLevels = 1,
+                     VkImageCreateFlags flags = 0, VkImageLayout initialLayout = VK_IMAGE_LAYOUT_UNDEFINED) {
+
+        VkImageCreateInfo imageInfo{};
+        imageInfo.sType     = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+        imageInfo.imageType = VK_IMAGE_TYPE_2D;
+        imageInfo.extent.width  = static_cast<uint32_t>(width);
+        imageInfo.extent.height = static_cast<uint32_t>(height);
+        imageInfo.extent.depth  = 1;
+        imageInfo.mipLevels     = mipLevels;
+        imageInfo.arrayLayers   = layers;
+        imageInfo.format        = format;
+        imageInfo.tiling        = tiling;
+        imageInfo.initialLayout = initialLayout;
+        imageInfo.usage         = usage;
+        imageInfo.sharingMode   = VK_SHARING_MODE_EXCLUSIVE;
+        imageInfo.samples       = VK_SAMPLE_COUNT_1_BIT;
+        imageInfo.flags         = flags;
+
+        if(vkCreateImage(_device, &imageInfo, nullptr, &image) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create image!");
+        }
+
+        VkMemoryRequirements memRequirements;
+        vkGetImageMemoryRequirements(_device, image, &memRequirements);
+
+        imageAllocation = _allocator.allocate(memRequirements, properties,
+                                              tiling == VK_IMAGE_TILING_OPTIMAL ? ResourceKind::Optimal
+                                                                                : ResourceKind::Linear);
+
+        vkBindImageMemory(_device, image, imageAllocation.memory, imageAllocation.offset);
+        
+    }
+
+    void destroyImage(VkImage image, Allocation& imageAllocation) {
+        vkDestroyImage(_device, image, nullptr);
+        _allocator.free(imageAllocation);
+    }
+
+    void createTextureImage() {
+        auto loadStart = std::chrono::high_resolution_clock::now();
+
+        if(openKtx2Texture()) {
+            createKtx2TextureImage();
+        }
+        else {
+            createDecodedTextureImage(_options.texturePath.empty() ? "../textures/texture.jpg" : _options.texturePath);
+        }
+
+        std::chrono::duration<double, std::milli> loadTime = std::chrono::high_resolution_clock::now() - loadStart;
+        _textureLoadMs = loadTime.count();
+        std::cerr << "texture: " << _textureSource << ", " << textureFormatName() << ", " << _textureMipLevels
+                  << " levels, " << _textureBytes / 1024 << " KiB staged in " << _textureLoadMs << " ms\n";
+    }
+
+    // --texture PATH.ktx2, or the first textures/texture.<variant>.ktx2 whose format the device samples.
+    // False means there is none and an image has to be decoded instead.
+    bool openKtx2Texture() {
+        const std::string& path = _options.texturePath;
+        std::vector<std::string> candidates;
+        if(!path.empty()) {
+            if(path.size() < 5 || path.compare(path.size() - 5, 5, ".ktx2") != 0) {
+                return false;
+            }
+            candidates.push_back(path);
+        }
+        else {
+            for(const char* variant : TEXTURE_VARIANTS) {
+                std::string candidate = std::string("../textures/texture.") + variant + ".ktx2";
+                if(std::ifstream(candidate).good()) {
+                    candidates.push_back(candidate);
+                }
+            }
+        }
+
+        for(const std::string& candidate : candidates) {
+            _textureFile.open(candidate);
+            if(textureFormatSupported(static_cast<VkFormat>(_textureFile.header().vkFormat))) {
+                _textureSource = candidate;
+                return true;
             }
+            std::cerr << "texture: " << candidate << " is " << _textureFile.format().name << ", which this device can't sample\n";
+            _textureFile.close();
+        }
+
+        if(!path.empty()) {
+            throw std::runtime_error("texture " + path + " is in a format this device can't sample!");
+        }
+        return false;
+    }
+
+    bool textureFormatSupported(VkFormat format) {
+        // Compressed families are only usable with their feature enabled, whatever the format properties say
+        if(format >= VK_FORMAT_BC1_RGB_UNORM_BLOCK && format <= VK_FORMAT_BC7_SRGB_BLOCK &&
+           !_enabledFeatures.textureCompressionBC) {
+            return false;
+        }
+        if(format >= VK_FORMAT_ETC2_R8G8B8_UNORM_BLOCK && format <= VK_FORMAT_EAC_R11G11_SNORM_BLOCK &&
+           !_enabledFeatures.textureCompressionETC2) {
+            return false;
+        }
+        if(format >= VK_FORMAT_ASTC_4x4_UNORM_BLOCK && format <= VK_FORMAT_ASTC_12x12_SRGB_BLOCK &&
+           !_enabledFeatures.textureCompressionASTC_LDR) {
+            return false;
+        }
+
+        VkFormatProperties properties;
+        vkGetPhysicalDeviceFormatProperties(_physicalDevice, format, &properties);
+        VkFormatFeatureFlags needed = VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
+        return (properties.optimalTilingFeatures & needed) == needed;
+    }
+
+    const char* textureFormatName() const {
+        const Ktx2FormatInfo* info = ktx2FormatInfo(_textureFormat);
+        return info ? info->name : "unknown";
+    }
+
+    // Every level and layer comes prebuilt from the file, staged straight out of the mapping
+    void createKtx2TextureImage() {
+        const Ktx2Header& header = _textureFile.header();
+        _textureFormat    = static_cast<VkFormat>(header.vkFormat);
+        _textureLayers    = _textureFile.layers();
+        _textureMipLevels = _textureFile.levels();
+        _mipMode          = MipMode::Off;
+
+        createImage(header.pixelWidth, header.pixelHeight, _textureFormat,
+                    VK_IMAGE_TILING_OPTIMAL,
+                    VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+                    VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                    _textureImage,
+                    _textureImageAllocation,
+                    _textureLayers,
+                    _textureMipLevels);
+
+        std::vector<UploadEngine::ImageLevel> levels(_textureMipLevels);
+        for(uint32_t level = 0; level < _textureMipLevels; level++) {
+            levels[level].data = _textureFile.levelData(level);
+            levels[level].size = _textureFile.levelSize(level);
+            _textureBytes += levels[level].size;
+        }
+
+        _uploads.uploadImage(_textureImage, header.pixelWidth, header.pixelHeight, levels, _textureLayers);
+    }
+
+    void createDecodedTextureImage(const std::string& path) {
+        int texWidth, texHeight, sourceChannels;
+        if(!stbi_info(path.c_str(), &texWidth, &texHeight, &sourceChannels)) {
+            throw std::runtime_error("failed to load texture image!");
+        }
+
+        uint32_t width  = static_cast<uint32_t>(texWidth);
+        uint32_t height = static_cast<uint32_t>(texHeight);
+        _textureMipLevels = _mipMode == MipMode::Off ? 1 : mipLevelCount(width, height);
+
+        // The compute path writes the levels through UNORM storage views, sRGB formats rarely support storage
+        MipMode mode = _mipMode;
+        if(mode == MipMode::Compute && _textureMipLevels > MIP_COMPUTE_MAX_LEVELS) {
+            mode = blitSupported(VK_FORMAT_R8G8B8A8_SRGB) ? MipMode::Blit : MipMode::Cpu;
+        }
+
+        VkImageUsageFlags usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+        if(mode == MipMode::Compute) {
+            usage |= VK_IMAGE_USAGE_STORAGE_BIT;
+        }
+        else if(mode == MipMode::Blit) {
+            usage |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+        }
+
+        // Sources without alpha stay RGB where the device takes RGB images for this use, a quarter less
+        // to decode, stage and sample. mipgen.comp stores rgba8, so the compute path always expands.
+        uint32_t channels = 4;
+        if(sourceChannels <= 3 && mode != MipMode::Compute &&
+           imageFormatSupported(VK_FORMAT_R8G8B8_SRGB, VK_IMAGE_TILING_OPTIMAL, usage, TEXTURE_LAYERS, _textureMipLevels) &&
+           (mode != MipMode::Blit || blitSupported(VK_FORMAT_R8G8B8_SRGB))) {
+            channels = 3;
+        }
+        _textureFormat = channels == 3 ? VK_FORMAT_R8G8B8_SRGB : VK_FORMAT_R8G8B8A8_SRGB;
+
+        // When every level comes from the host anyway and device local memory is host visible
+        // (integrated GPUs, resizable BAR) the texels go straight into a linear image
+        _textureDirect = !_options.textureStaging && (mode == MipMode::Cpu || mode == MipMode::Off) &&
+                         hostImageSupported(_textureFormat, TEXTURE_LAYERS, _textureMipLevels);
+
+        stbi_uc* pixels = stbi_load(path.c_str(), &texWidth, &texHeight, &sourceChannels, static_cast<int>(channels));
+        if(!pixels) {
+            throw std::runtime_error("failed to load texture image!");
+        }
 
+        if(_textureDirect) {
+            createImage(width, height, _textureFormat,
+                        VK_IMAGE_TILING_LINEAR,
+                        VK_IMAGE_USAGE_SAMPLED_BIT,
+                        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                        VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                        _textureImage,
+                        _textureImageAllocation,
+                        TEXTURE_LAYERS,
+                        _textureMipLevels,
+                        0,
+                        VK_IMAGE_LAYOUT_PREINITIALIZED);
+        }
+        else {
+            createImage(width, height, mode == MipMode::Compute ? VK_FORMAT_R8G8B8A8_UNORM : _textureFormat,
+                        VK_IMAGE_TILING_OPTIMAL,
+                        usage,
+                        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                        _textureImage,
+                        _textureImageAllocation,
+                        TEXTURE_LAYERS,
+                        _textureMipLevels,
+                        mode == MipMode::Compute ? VK_IMAGE_CREATE_MUTABLE_FORMAT_BIT : 0);
         }
-    }
 
-    void createCommandPool() {
-        QueueFamilyIndices queueFamilyIndices = findQueueFamilies(_physicalDevice);
+        size_t layerSize = size_t(width) * height * channels;
+        if(mode == MipMode::Cpu) {
+            // The chain is read back level by level, so it's built in ordinary memory and copied once
+            std::vector<stbi_uc> layers(layerSize * TEXTURE_LAYERS);
+            writeTextureLayers(pixels, width, height, channels, [&](uint32_t layer, uint32_t row) {
+                return &layers[layerSize * layer + size_t(row) * width * channels];
+            });
+            stbi_image_free(pixels);
+
+            auto buildStart = std::chrono::high_resolution_clock::now();
+            std::vector<stbi_uc> chain = buildMipChain(layers, width, height, TEXTURE_LAYERS, _textureMipLevels, channels);
+            std::chrono::duration<double, std::milli> buildTime = std::chrono::high_resolution_clock::now() - buildStart;
+            _mipMs = buildTime.count();
+            std::cerr << "mip chain: " << _textureMipLevels << " levels built on the CPU in " << _mipMs << " ms\n";
+
+            if(_textureDirect) {
+                writeHostImageLevels(chain.data(), width, height, channels);
+            }
+            else {
+                _uploads.uploadImage(_textureImage, width, height, chain.data(), chain.size(), TEXTURE_LAYERS, _textureMipLevels);
+            }
+            _textureBytes = chain.size();
+        }
+        else {
+            // Decoded rows go straight to their destination, the staging buffer or the image itself
+            auto fill = [&](uint8_t* staging) {
+                writeTextureLayers(pixels, width, height, channels, [&](uint32_t layer, uint32_t row) {
+                    return staging + layerSize * layer + size_t(row) * width * channels;
+                });
+            };
 
-        VkCommandPoolCreateInfo poolInfo{};
-        poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
-        poolInfo.queueFamilyIndex = queueFamilyIndices.graphicsFamily.value();
-        poolInfo.flags            = 0;
+            if(_textureDirect) {
+                VkSubresourceLayout layouts[TEXTURE_LAYERS];
+                for(uint32_t layer = 0; layer < TEXTURE_LAYERS; layer++) {
+                    layouts[layer] = hostImageLayout(0, layer);
+                }
+                uint8_t* image = static_cast<uint8_t*>(_textureImageAllocation.mapped);
+                writeTextureLayers(pixels, width, height, channels, [&](uint32_t layer, uint32_t row) {
+                    return image + layouts[layer].offset + row * layouts[layer].rowPitch;
+                });
+            }
+            else if(mode == MipMode::Compute) {
+                _uploads.uploadImageInPlace(_textureImage, width, height, channels, TEXTURE_LAYERS, fill,
+                                            VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_ACCESS_SHADER_READ_BIT,
+                                            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+            }
+            else if(mode == MipMode::Blit) {
+                _uploads.uploadImageInPlace(_textureImage, width, height, channels, TEXTURE_LAYERS, fill,
+                                            VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_ACCESS_TRANSFER_READ_BIT,
+                                            VK_PIPELINE_STAGE_TRANSFER_BIT);
+            }
+            else {
+                _uploads.uploadImageInPlace(_textureImage, width, height, channels, TEXTURE_LAYERS, fill);
+            }
+            stbi_image_free(pixels);
+            _textureBytes = layerSize * TEXTURE_LAYERS;
+        }
 
-        if(vkCreateCommandPool(_device, &poolInfo, nullptr, &_commandPool) != VK_SUCCESS) {
-            throw std::runtime_error("failed to create command pool!");
+        if(_textureDirect) {
+            _uploads.finishHostImage(_textureImage, TEXTURE_LAYERS, _textureMipLevels);
+        }
+        _textureSource = path;
+
+        if((mode == MipMode::Compute || mode == MipMode::Blit) && _textureMipLevels > 1) {
+            MipJob job;
+            job.image    = _textureImage;
+            job.width    = width;
+            job.height   = height;
+            job.layers   = TEXTURE_LAYERS;
+            job.levels   = _textureMipLevels;
+            job.uploadId = _uploads.recordingId();
+            if(mode == MipMode::Compute) {
+                createMipJobViews(job);
+            }
+            _mipJobs.push_back(std::move(job));
         }
+        _mipMode = mode;
     }
 
-    void createCommandBuffers() {
-        _commandBuffers.resize(_swapChainFramebuffers.size());
-
-        VkCommandBufferAllocateInfo allocInfo{};
-        allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-        allocInfo.commandPool         = _commandPool;
-        allocInfo.level               = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-        allocInfo.commandBufferCount  = (uint32_t) _commandBuffers.size();
+    // Instances pick a layer by index: the texture itself, two channel rotations and a grayscale copy.
+    // rowAddress(layer, row) says where each destination row goes, rows are written once in order.
+    static void writeTextureLayers(const stbi_uc* pixels, uint32_t width, uint32_t height, uint32_t channels,
+                                   const std::function<uint8_t*(uint32_t layer, uint32_t row)>& rowAddress) {
+        static_assert(TEXTURE_LAYERS == 4, "one destination row per layer below");
+
+        for(uint32_t y = 0; y < height; y++) {
+            const stbi_uc* src = pixels + size_t(y) * width * channels;
+            uint8_t* rows[TEXTURE_LAYERS] = {rowAddress(0, y), rowAddress(1, y), rowAddress(2, y), rowAddress(3, y)};
+
+            for(uint32_t x = 0; x < width; x++, src += channels) {
+                stbi_uc r = src[0], g = src[1], b = src[2];
+                stbi_uc gray = static_cast<stbi_uc>((r * 77 + g * 150 + b * 29) >> 8);
+
+                size_t i = size_t(x) * channels;
+                rows[0][i] = r;    rows[0][i + 1] = g;    rows[0][i + 2] = b;
+                rows[1][i] = g;    rows[1][i + 1] = b;    rows[1][i + 2] = r;
+                rows[2][i] = b;    rows[2][i + 1] = r;    rows[2][i + 2] = g;
+                rows[3][i] = gray; rows[3][i + 1] = gray; rows[3][i + 2] = gray;
+                if(channels == 4) {
+                    rows[0][i + 3] = rows[1][i + 3] = rows[2][i + 3] = rows[3][i + 3] = src[3];
+                }
+            }
+        }
+    }
 
-        if(vkAllocateCommandBuffers(_device, &allocInfo, _commandBuffers.data()) != VK_SUCCESS) {
-            throw std::runtime_error("failed to allocate command buffers!");
+    bool imageFormatSupported(VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage,
+                              uint32_t layers, uint32_t levels) {
+        VkImageFormatProperties properties;
+        if(vkGetPhysicalDeviceImageFormatProperties(_physicalDevice, format, VK_IMAGE_TYPE_2D, tiling, usage, 0,
+                                                    &properties) != VK_SUCCESS) {
+            return false;
         }
 
-        for(size_t i=0; i<_commandBuffers.size(); i++) {
-            VkCommandBufferBeginInfo beginInfo{};
-            beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-            beginInfo.flags = 0;
-            beginInfo.pInheritanceInfo = nullptr;
+        VkFormatProperties formatProperties;
+        vkGetPhysicalDeviceFormatProperties(_physicalDevice, format, &formatProperties);
+        VkFormatFeatureFlags features = tiling == VK_IMAGE_TILING_LINEAR ? formatProperties.linearTilingFeatures
+                                                                         : formatProperties.optimalTilingFeatures;
 
-            if(vkBeginCommandBuffer(_commandBuffers[i], &beginInfo) != VK_SUCCESS) {
-                throw std::runtime_error("failed to begin recording command buffer!");
-            }
+        return properties.maxArrayLayers >= layers && properties.maxMipLevels >= levels &&
+               (features & VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT);
+    }
 
-            VkRenderPassBeginInfo renderPassInfo{};
-            renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-            renderPassInfo.renderPass  = _renderPass;
-            renderPassInfo.framebuffer = _swapChainFramebuffers[i];
-            renderPassInfo.renderArea.offset = {0,0};
-            renderPassInfo.renderArea.extent = _swapChainExtent;
+    // Linear tiling often allows a single level and layer only, and samples slower than optimal
+    // tiling, but with host visible device local memory it saves the whole staging round trip
+    bool hostImageSupported(VkFormat format, uint32_t layers, uint32_t levels) {
+        const VkPhysicalDeviceMemoryProperties& memory = _allocator.memoryProperties();
+        VkMemoryPropertyFlags needed = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                                       VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+
+        bool hostVisibleDeviceLocal = false;
+        for(uint32_t i = 0; i < memory.memoryTypeCount; i++) {
+            hostVisibleDeviceLocal |= (memory.memoryTypes[i].propertyFlags & needed) == needed;
+        }
 
-            VkClearValue clearColor = {0.0f, 0.0f, 0.0f, 1.0f};
-            renderPassInfo.clearValueCount = 1;
-            renderPassInfo.pClearValues    = &clearColor;
+        return hostVisibleDeviceLocal &&
+               imageFormatSupported(format, VK_IMAGE_TILING_LINEAR, VK_IMAGE_USAGE_SAMPLED_BIT, layers, levels);
+    }
 
-            vkCmdBeginRenderPass(_commandBuffers[i], &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
-            vkCmdBindPipeline(_commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, _graphicsPipeline);
+    // Where the driver put one level of one layer of the linear texture image, offsets are from its memory
+    VkSubresourceLayout hostImageLayout(uint32_t level, uint32_t layer) {
+        VkImageSubresource subresource{};
+        subresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        subresource.mipLevel   = level;
+        subresource.arrayLayer = layer;
 
-            VkBuffer vertexBuffers[] = {_vertexBuffer};
-            VkDeviceSize offsets[]   = {0};
-            vkCmdBindVertexBuffers(_commandBuffers[i], 0, 1, vertexBuffers, offsets);
-            vkCmdBindIndexBuffer(_commandBuffers[i], _indexBuffer, 0, VK_INDEX_TYPE_UINT16);
-            vkCmdBindDescriptorSets(_commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, _pipelineLayout, 0, 1, &_descriptorSets[i], 0, nullptr);
-            vkCmdDrawIndexed(_commandBuffers[i], static_cast<uint32_t>(indices.size()), 1, 0, 0, 0);
-            vkCmdEndRenderPass(_commandBuffers[i]);
+        VkSubresourceLayout layout;
+        vkGetImageSubresourceLayout(_device, _textureImage, &subresource, &layout);
+        return layout;
+    }
 
-            if(vkEndCommandBuffer(_commandBuffers[i]) != VK_SUCCESS) {
-                throw std::runtime_error("failed to record command buffer");
+    // chain as buildMipChain lays it out
+    void writeHostImageLevels(const uint8_t* chain, uint32_t width, uint32_t height, uint32_t channels) {
+        for(uint32_t level = 0; level < _textureMipLevels; level++) {
+            uint32_t levelWidth  = std::max(width >> level, 1u);
+            uint32_t levelHeight = std::max(height >> level, 1u);
+            size_t rowSize = size_t(levelWidth) * channels;
+
+            for(uint32_t layer = 0; layer < TEXTURE_LAYERS; layer++) {
+                VkSubresourceLayout layout = hostImageLayout(level, layer);
+                uint8_t* image = static_cast<uint8_t*>(_textureImageAllocation.mapped) + layout.offset;
+                for(uint32_t row = 0; row < levelHeight; row++, chain += rowSize) {
+                    memcpy(image + row * layout.rowPitch, chain, rowSize);
+                }
             }
-
         }
     }
 
-    void createSyncObjects() {
-        _imageAvailableSemaphores.resize(MAX_FRAMES_IN_FLIGHT);
-        _renderFinishedSemaphores.resize(MAX_FRAMES_IN_FLIGHT);
-        _inFlightFences.resize(MAX_FRAMES_IN_FLIGHT);
-        _imagesInFlight.resize(_swapChainImages.size(), VK_NULL_HANDLE);
+    bool blitSupported(VkFormat format) {
+        VkFormatProperties properties;
+        vkGetPhysicalDeviceFormatProperties(_physicalDevice, format, &properties);
+        VkFormatFeatureFlags needed = VK_FORMAT_FEATURE_BLIT_SRC_BIT | VK_FORMAT_FEATURE_BLIT_DST_BIT |
+                                      VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
+        return (properties.optimalTilingFeatures & needed) == needed;
+    }
 
-        VkSemaphoreCreateInfo semaphoreInfo{};
-        semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+    // Resolves --mips against what the device can do and creates the compute path's pipeline
+    void createMipPipeline() {
+        _mipMode = _options.mipMode;
 
-        VkFenceCreateInfo fenceInfo{};
-        fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
-        fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
+        if(_mipMode == MipMode::Compute) {
+            VkFormatProperties properties;
+            vkGetPhysicalDeviceFormatProperties(_physicalDevice, VK_FORMAT_R8G8B8A8_UNORM, &properties);
+            if(!(properties.optimalTilingFeatures & VK_FORMAT_FEATURE_STORAGE_IMAGE_BIT)) {
+                std::cerr << "mip chain: no storage image support for R8G8B8A8_UNORM, falling back to blits\n";
+                _mipMode = MipMode::Blit;
+            }
+        }
+        if(_mipMode == MipMode::Blit && !blitSupported(VK_FORMAT_R8G8B8A8_SRGB)) {
+            std::cerr << "mip chain: R8G8B8A8_SRGB can't be blitted with linear filtering, building it on the CPU\n";
+            _mipMode = MipMode::Cpu;
+        }
 
+        if(_options.benchFrames > 0 && timestampValidBits() > 0 &&
+           (_mipMode == MipMode::Compute || _mipMode == MipMode::Blit)) {
+            VkQueryPoolCreateInfo queryPoolInfo{};
+            queryPoolInfo.sType      = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+            queryPoolInfo.queryType  = VK_QUERY_TYPE_TIMESTAMP;
+            queryPoolInfo.queryCount = 2;
 
-        for(size_t i=0; i<MAX_FRAMES_IN_FLIGHT; i++) {
-            if(vkCreateSemaphore(_device, &semaphoreInfo, nullptr, &_imageAvailableSemaphores[i]) != VK_SUCCESS
-            || vkCreateSemaphore(_device, &semaphoreInfo, nullptr, &_renderFinishedSemaphores[i]) != VK_SUCCESS
-            || vkCreateFence(_device, &fenceInfo, nullptr, &_inFlightFences[i]) != VK_SUCCESS) {
-                throw std::runtime_error("failed to create synchronization objects for a frame!");
+            if(vkCreateQueryPool(_device, &queryPoolInfo, nullptr, &_mipQueryPool) != VK_SUCCESS) {
+                throw std::runtime_error("failed to create mip timestamp query pool!");
             }
         }
 
-    }
+        if(_mipMode != MipMode::Compute) {
+            return;
+        }
 
-    void recreateSwapChain() {
+        std::vector<VkDescriptorSetLayoutBinding> bindings(3);
+        bindings[0].binding         = 0;
+        bindings[0].descriptorType  = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+        bindings[0].descriptorCount = 1;
+        bindings[0].stageFlags      = VK_SHADER_STAGE_COMPUTE_BIT;
+        bindings[1].binding         = 1;
+        bindings[1].descriptorType  = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+        bindings[1].descriptorCount = MIP_COMPUTE_MAX_LEVELS - 1;
+        bindings[1].stageFlags      = VK_SHADER_STAGE_COMPUTE_BIT;
+        bindings[2].binding         = 2;
+        bindings[2].descriptorType  = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        bindings[2].descriptorCount = 1;
+        bindings[2].stageFlags      = VK_SHADER_STAGE_COMPUTE_BIT;
+        _mipDescriptorSetLayout = _descriptors.layout(bindings);
+        for(DescriptorAllocator& allocator : _frameDescriptors) {
+            allocator.addLayout(_mipDescriptorSetLayout, bindings);
+        }
 
+        VkPushConstantRange pushConstantRange{};
+        pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+        pushConstantRange.offset     = 0;
+        pushConstantRange.size       = sizeof(MipParams);
 
-        int width = 0, height = 0;
-        glfwGetFramebufferSize(_window, &width, &height);
-        while(width == 0 || height == 0) {
-            glfwGetFramebufferSize(_window,&width,&height);
-            glfwWaitEvents();
+        VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+        pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+        pipelineLayoutInfo.setLayoutCount         = 1;
+        pipelineLayoutInfo.pSetLayouts            = &_mipDescriptorSetLayout;
+        pipelineLayoutInfo.pushConstantRangeCount = 1;
+        pipelineLayoutInfo.pPushConstantRanges    = &pushConstantRange;
+
+        if(vkCreatePipelineLayout(_device, &pipelineLayoutInfo, nullptr, &_mipPipelineLayout) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create mip pipeline layout!");
         }
 
+        PipelineDesc desc;
+        desc.stages  = {{"mipgen.comp"}};
+        desc.compute = true;
+        desc.layout  = _mipPipelineLayout;
+        usePipeline(_mipPipeline, desc);
 
-        vkDeviceWaitIdle(_device);
-        cleanupSwapChain();
+        // One counter per layer, zeroed before every dispatch
+        createBuffer(sizeof(uint32_t) * TEXTURE_LAYERS, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                     VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, _mipCounterBuffer, _mipCounterBufferAllocation);
+    }
 
-        createSwapChain();
-        createImageViews();
-        createRenderPass();
-        createGraphicsPipeline();
-        createFramebuffers();
-        createUniformBuffers();
-        createDescriptorPool();
-        createDescriptorSets();
-        createCommandBuffers();
+    VkImageView createMipView(VkImage image, VkFormat format, uint32_t level, uint32_t levelCount, uint32_t layers) {
+        VkImageViewCreateInfo viewInfo{};
+        viewInfo.sType    = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+        viewInfo.image    = image;
+        viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D_ARRAY;
+        viewInfo.format   = format;
+        viewInfo.subresourceRange.aspectMask     = VK_IMAGE_ASPECT_COLOR_BIT;
+        viewInfo.subresourceRange.baseMipLevel   = level;
+        viewInfo.subresourceRange.levelCount     = levelCount;
+        viewInfo.subresourceRange.baseArrayLayer = 0;
+        viewInfo.subresourceRange.layerCount     = layers;
+
+        VkImageView view;
+        if(vkCreateImageView(_device, &viewInfo, nullptr, &view) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create mip level view!");
+        }
+        return view;
     }
 
-    void createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer& buffer, VkDeviceMemory& bufferMemory) {
-        VkBufferCreateInfo bufferInfo{};
-        bufferInfo.sType       = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-        bufferInfo.size        = size;
-        bufferInfo.usage       = usage;
-        bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    void createMipJobViews(MipJob& job) {
+        if(job.layers > TEXTURE_LAYERS) {
+            throw std::runtime_error("mip counter buffer has too few layers!");
+        }
 
-        if(vkCreateBuffer(_device, &bufferInfo, nullptr, &buffer) != VK_SUCCESS) {
-            throw std::runtime_error("failed to create buffer!");
+        // Level 0 is sampled as sRGB so the shader filters in linear space, the rest are written as UNORM
+        job.views.push_back(createMipView(job.image, VK_FORMAT_R8G8B8A8_SRGB, 0, 1, job.layers));
+        for(uint32_t level = 1; level < job.levels; level++) {
+            job.views.push_back(createMipView(job.image, VK_FORMAT_R8G8B8A8_UNORM, level, 1, job.layers));
         }
+    }
 
-        VkMemoryRequirements memRequirements;
-        vkGetBufferMemoryRequirements(_device, buffer, &memRequirements);
+    // The set is only used by the dispatch recorded this frame, so it comes from the frame's allocator
+    VkDescriptorSet createMipJobSet(const MipJob& job) {
+        VkDescriptorSet descriptorSet = _frameDescriptors[currentFrame].allocate(_mipDescriptorSetLayout);
 
-        VkMemoryAllocateInfo allocInfo{};
-        allocInfo.sType           = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-        allocInfo.allocationSize  = memRequirements.size;
-        allocInfo.memoryTypeIndex = findMemoryType(memRequirements.memoryTypeBits, properties);
+        VkDescriptorImageInfo sourceInfo{};
+        sourceInfo.imageView   = job.views[0];
+        sourceInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
 
-        if(vkAllocateMemory(_device, &allocInfo, nullptr, &bufferMemory) != VK_SUCCESS) {
-            throw std::runtime_error("failed to allocate buffer memory!");
+        // Every array element needs a valid view, the ones past the last level repeat it
+        std::array<VkDescriptorImageInfo, MIP_COMPUTE_MAX_LEVELS - 1> levelInfos{};
+        for(uint32_t i = 0; i < levelInfos.size(); i++) {
+            levelInfos[i].imageView   = job.views[std::min(i + 1, job.levels - 1)];
+            levelInfos[i].imageLayout = VK_IMAGE_LAYOUT_GENERAL;
         }
 
-        vkBindBufferMemory(_device, buffer, bufferMemory, 0);
+        VkDescriptorBufferInfo counterInfo{};
+        counterInfo.buffer = _mipCounterBuffer;
+        counterInfo.offset = 0;
+        counterInfo.range  = VK_WHOLE_SIZE;
 
+        std::array<VkWriteDescriptorSet, 3> descriptorWrites{};
+        for(uint32_t i = 0; i < descriptorWrites.size(); i++) {
+            descriptorWrites[i].sType      = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+            descriptorWrites[i].dstSet     = descriptorSet;
+            descriptorWrites[i].dstBinding = i;
+        }
+        descriptorWrites[0].descriptorType  = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+        descriptorWrites[0].descriptorCount = 1;
+        descriptorWrites[0].pImageInfo      = &sourceInfo;
+        descriptorWrites[1].descriptorType  = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+        descriptorWrites[1].descriptorCount = static_cast<uint32_t>(levelInfos.size());
+        descriptorWrites[1].pImageInfo      = levelInfos.data();
+        descriptorWrites[2].descriptorType  = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        descriptorWrites[2].descriptorCount = 1;
+        descriptorWrites[2].pBufferInfo     = &counterInfo;
+
+        vkUpdateDescriptorSets(_device, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
+        return descriptorSet;
     }
 
-    void createVertexBuffer() {
-        VkDeviceSize bufferSize = sizeof(vertices[0]) * vertices.size();
+    void destroyMipJob(MipJob& job) {
+        for(VkImageView view : job.views) {
+            vkDestroyImageView(_device, view, nullptr);
+        }
+        job.views.clear();
+    }
 
-        VkBuffer stagingBuffer;
-        VkDeviceMemory stagingBufferMemory;
+    // Recorded right after the upload acquire, before anything samples the textures. Leaves every level
+    // in SHADER_READ_ONLY_OPTIMAL for the fragment shader.
+    void recordMipGeneration(VkCommandBuffer commandBuffer) {
+        uint64_t completed = completedFrames();
+        while(!_mipJobsInFlight.empty() && _mipJobsInFlight.front().recordedFrame < completed) {
+            destroyMipJob(_mipJobsInFlight.front());
+            _mipJobsInFlight.erase(_mipJobsInFlight.begin());
+        }
 
-        createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-                     VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
-                     VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingBufferMemory);
+        uint64_t acquiredId = _uploads.acquiredId();
+        auto ready = std::partition(_mipJobs.begin(), _mipJobs.end(),
+                                    [acquiredId](const MipJob& job) { return job.uploadId > acquiredId; });
+        if(ready == _mipJobs.end()) {
+            return;
+        }
 
-        void* data;
-        vkMapMemory(_device, stagingBufferMemory, 0, bufferSize, 0 ,&data);
-            memcpy(data, vertices.data(), (size_t) bufferSize);
-        vkUnmapMemory(_device, stagingBufferMemory);
+        bool timed = _mipQueryPool != VK_NULL_HANDLE && _mipTimingFrame < 0;
+        if(timed) {
+            vkCmdResetQueryPool(commandBuffer, _mipQueryPool, 0, 2);
+            vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, _mipQueryPool, 0);
+        }
 
-        createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
-                     VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, _vertexBuffer, _vertexBufferMemory);
+        for(auto job = ready; job != _mipJobs.end(); job++) {
+            if(_mipMode == MipMode::Compute) {
+                recordMipDispatch(commandBuffer, *job);
+            }
+            else {
+                recordMipBlits(commandBuffer, *job);
+            }
+            job->recordedFrame = _frameCount;
+            _mipJobsInFlight.push_back(std::move(*job));
+        }
+        _mipJobs.erase(ready, _mipJobs.end());
 
-        copyBuffer(stagingBuffer, _vertexBuffer, bufferSize);
+        if(timed) {
+            vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, _mipQueryPool, 1);
+            _mipTimingFrame = static_cast<int>(currentFrame);
+        }
+    }
 
-        vkDestroyBuffer(_device, stagingBuffer, nullptr);
-        vkFreeMemory(_device, stagingBufferMemory, nullptr);
+    void recordMipDispatch(VkCommandBuffer commandBuffer, const MipJob& job) {
+        VkImageMemoryBarrier imageBarrier{};
+        imageBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+        imageBarrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        imageBarrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+        imageBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        imageBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        imageBarrier.image = job.image;
+        imageBarrier.subresourceRange.aspectMask     = VK_IMAGE_ASPECT_COLOR_BIT;
+        imageBarrier.subresourceRange.baseMipLevel   = 1;
+        imageBarrier.subresourceRange.levelCount     = job.levels - 1;
+        imageBarrier.subresourceRange.baseArrayLayer = 0;
+        imageBarrier.subresourceRange.layerCount     = job.layers;
+        imageBarrier.srcAccessMask = 0;
+        imageBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+
+        // Zero the counters, the previous job's dispatch may still be using them
+        VkBufferMemoryBarrier counterBarrier{};
+        counterBarrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+        counterBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        counterBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        counterBarrier.buffer = _mipCounterBuffer;
+        counterBarrier.offset = 0;
+        counterBarrier.size   = VK_WHOLE_SIZE;
+        counterBarrier.srcAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+        counterBarrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
 
-    }
+        vkCmdPipelineBarrier(commandBuffer,
+                             VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                             0,
+                             0, nullptr,
+                             1, &counterBarrier,
+                             0, nullptr);
 
-    void copyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size) {
-        VkCommandBuffer commandBuffer = beginSingleTimeCommands()       ;
+        vkCmdFillBuffer(commandBuffer, _mipCounterBuffer, 0, VK_WHOLE_SIZE, 0);
 
-        VkBufferCopy copyRegion{};
-        copyRegion.size = size;
-        vkCmdCopyBuffer(commandBuffer, srcBuffer, dstBuffer, 1, &copyRegion);
+        counterBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        counterBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+
+        vkCmdPipelineBarrier(commandBuffer,
+                             VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                             0,
+                             0, nullptr,
+                             1, &counterBarrier,
+                             1, &imageBarrier);
+
+        MipParams params{};
+        params.width  = job.width;
+        params.height = job.height;
+        params.levels = job.levels - 1;
+        uint32_t groupsX = (job.width + MIP_TILE_SIZE - 1) / MIP_TILE_SIZE;
+        uint32_t groupsY = (job.height + MIP_TILE_SIZE - 1) / MIP_TILE_SIZE;
+        params.workGroupsPerLayer = groupsX * groupsY;
+
+        VkDescriptorSet descriptorSet = createMipJobSet(job);
+        vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, _mipPipeline);
+        vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, _mipPipelineLayout, 0, 1, &descriptorSet, 0, nullptr);
+        vkCmdPushConstants(commandBuffer, _mipPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(params), &params);
+        vkCmdDispatch(commandBuffer, groupsX, groupsY, job.layers);
+
+        imageBarrier.oldLayout     = VK_IMAGE_LAYOUT_GENERAL;
+        imageBarrier.newLayout     = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+        imageBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+        imageBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
 
-        endSingleTimeCommands(commandBuffer);
+        vkCmdPipelineBarrier(commandBuffer,
+                             VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+                             0,
+                             0, nullptr,
+                             0, nullptr,
+                             1, &imageBarrier);
     }
 
-    uint32_t findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties) {
-        VkPhysicalDeviceMemoryProperties memProperties;
-        vkGetPhysicalDeviceMemoryProperties(_physicalDevice, &memProperties);
+    // Level i - 1 is blitted into level i, each level goes TRANSFER_DST -> TRANSFER_SRC once it's written
+    void recordMipBlits(VkCommandBuffer commandBuffer, const MipJob& job) {
+        VkImageMemoryBarrier barrier{};
+        barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+        barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+        barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.image = job.image;
+        barrier.subresourceRange.aspectMask     = VK_IMAGE_ASPECT_COLOR_BIT;
+        barrier.subresourceRange.baseMipLevel   = 1;
+        barrier.subresourceRange.levelCount     = job.levels - 1;
+        barrier.subresourceRange.baseArrayLayer = 0;
+        barrier.subresourceRange.layerCount     = job.layers;
+        barrier.srcAccessMask = 0;
+        barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
 
-        for(uint32_t i = 0; i < memProperties.memoryTypeCount; i++) {
-            if(typeFilter & (1 << i) && (memProperties.memoryTypes[i].propertyFlags & properties) == properties) {
-                return i;
-            }
+        // Level 0 arrives in TRANSFER_SRC_OPTIMAL from the upload
+        vkCmdPipelineBarrier(commandBuffer,
+                             VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                             0,
+                             0, nullptr,
+                             0, nullptr,
+                             1, &barrier);
+
+        barrier.subresourceRange.levelCount = 1;
+
+        for(uint32_t level = 1; level < job.levels; level++) {
+            VkImageBlit blit{};
+            blit.srcSubresource.aspectMask     = VK_IMAGE_ASPECT_COLOR_BIT;
+            blit.srcSubresource.mipLevel       = level - 1;
+            blit.srcSubresource.baseArrayLayer = 0;
+            blit.srcSubresource.layerCount     = job.layers;
+            blit.srcOffsets[1] = {static_cast<int32_t>(std::max(job.width >> (level - 1), 1u)),
+                                  static_cast<int32_t>(std::max(job.height >> (level - 1), 1u)), 1};
+            blit.dstSubresource = blit.srcSubresource;
+            blit.dstSubresource.mipLevel = level;
+            blit.dstOffsets[1] = {static_cast<int32_t>(std::max(job.width >> level, 1u)),
+                                  static_cast<int32_t>(std::max(job.height >> level, 1u)), 1};
+
+            vkCmdBlitImage(commandBuffer,
+                           job.image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                           job.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                           1, &blit, VK_FILTER_LINEAR);
+
+            // The next blit reads what this one wrote
+            barrier.subresourceRange.baseMipLevel = level;
+            barrier.oldLayout     = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+            barrier.newLayout     = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+            barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+            barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+
+            vkCmdPipelineBarrier(commandBuffer,
+                                 VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                                 0,
+                                 0, nullptr,
+                                 0, nullptr,
+                                 1, &barrier);
         }
 
-        throw std::runtime_error("failed to find suitable memory type!");
+        barrier.subresourceRange.baseMipLevel = 0;
+        barrier.subresourceRange.levelCount   = job.levels;
+        barrier.oldLayout     = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+        barrier.newLayout     = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+        vkCmdPipelineBarrier(commandBuffer,
+                             VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+                             0,
+                             0, nullptr,
+                             0, nullptr,
+                             1, &barrier);
     }
 
-    void createIndexBuffer() {
-        VkDeviceSize bufferSize = sizeof(indices[0]) * indices.size();
+    void collectMipTime(uint32_t frame) {
+        if(_mipTimingFrame != static_cast<int>(frame)) {
+            return;
+        }
+        _mipTimingFrame = INT32_MAX;    // only the first chain is timed
 
-        VkBuffer stagingBuffer;
-        VkDeviceMemory stagingBufferMemory;
-        createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-                     VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
-                     VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingBufferMemory);
+        uint64_t timestamps[2];
+        VkResult result = vkGetQueryPoolResults(_device, _mipQueryPool, 0, 2, sizeof(timestamps), timestamps,
+                                                sizeof(uint64_t), VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT);
+        if(result != VK_SUCCESS) {
+            return;
+        }
 
-        void *data;
-        vkMapMemory(_device, stagingBufferMemory, 0, bufferSize, 0, &data);
-            memcpy(data, indices.data(), (size_t) bufferSize);
-        vkUnmapMemory(_device, stagingBufferMemory);
+        _mipMs = ((timestamps[1] - timestamps[0]) & _timestampMask) * _timestampPeriod / 1e6;
+        std::cerr << "mip chain: " << _textureMipLevels << " levels generated with " << mipModeName(_mipMode)
+                  << " in " << _mipMs << " ms GPU time\n";
+    }
 
-        createBuffer(bufferSize, 
-                     VK_BUFFER_USAGE_TRANSFER_DST_BIT |
-                     VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
-                     VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, _indexBuffer, _indexBufferMemory);
+    void createTextureImageView() {
+        VkImageViewCreateInfo viewInfo{};
+        viewInfo.sType    = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+        viewInfo.image    = _textureImage;
+        viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D_ARRAY;
+        viewInfo.format   = _textureFormat;
+        viewInfo.subresourceRange.aspectMask     = VK_IMAGE_ASPECT_COLOR_BIT;
+        viewInfo.subresourceRange.baseMipLevel   = 0;
+        viewInfo.subresourceRange.levelCount     = _textureMipLevels;
+        viewInfo.subresourceRange.baseArrayLayer = 0;
+        viewInfo.subresourceRange.layerCount     = _textureLayers;     // single layer files: instances clamp to layer 0
+
+        if(vkCreateImageView(_device, &viewInfo, nullptr, &_textureImageView) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create texture image view!");
+        }
+    }
 
-        copyBuffer(stagingBuffer, _indexBuffer, bufferSize);
+    void createTextureSampler() {
+        VkSamplerCreateInfo samplerInfo{};
+        samplerInfo.sType        = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+        samplerInfo.magFilter    = VK_FILTER_LINEAR;
+        samplerInfo.minFilter    = VK_FILTER_LINEAR;
+        samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+        samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+        samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+        samplerInfo.anisotropyEnable        = VK_FALSE;
+        samplerInfo.maxAnisotropy           = 1.0f;
+        samplerInfo.borderColor             = VK_BORDER_COLOR_INT_OPAQUE_BLACK;
+        samplerInfo.unnormalizedCoordinates = VK_FALSE;
+        samplerInfo.compareEnable           = VK_FALSE;
+        samplerInfo.compareOp               = VK_COMPARE_OP_ALWAYS;
+        samplerInfo.mipmapMode              = VK_SAMPLER_MIPMAP_MODE_LINEAR;
+        samplerInfo.mipLodBias              = 0.0f;
+        samplerInfo.minLod                  = 0.0f;
+        samplerInfo.maxLod                  = static_cast<float>(_textureMipLevels);
+
+        if(vkCreateSampler(_device, &samplerInfo, nullptr, &_textureSampler) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create texture sampler!");
+        }
+    }
 
-        vkDestroyBuffer(_device, stagingBuffer, nullptr);
-        vkFreeMemory(_device, stagingBufferMemory, nullptr);
-        
+    // Synthetic scene for --stream-textures: far more texture data than the budget allows. Every
+    // texture starts out with just its mip tail, finer levels come in once the feedback asks for them.
+    void createStreamedTextures() {
+        if(_options.streamTextureCount == 0) {
+            return;
+        }
 
-    }
+        _streamLevels    = mipLevelCount(STREAM_TEXTURE_SIZE, STREAM_TEXTURE_SIZE);
+        _streamTailLevel = 0;
+        while((STREAM_TEXTURE_SIZE >> _streamTailLevel) > STREAM_TAIL_SIZE) {
+            _streamTailLevel++;
+        }
+        _streamImageBytes.assign(_streamLevels, 0);
 
-    void createDescriptorSetLayout() {
-        VkDescriptorSetLayoutBinding uboLayoutBinding{};
-        uboLayoutBinding.binding         = 0;
-        uboLayoutBinding.descriptorType  = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-        uboLayoutBinding.descriptorCount = 1;
+        _streamTextures.resize(_options.streamTextureCount);
+        for(uint32_t i = 0; i < _streamTextures.size(); i++) {
+            StreamedTexture& texture = _streamTextures[i];
+            createStreamImage(i, _streamTailLevel, texture.tailImage, texture.tailAllocation, texture.tailView);
+            texture.residentLevel = _streamTailLevel;
+        }
 
-        uboLayoutBinding.stageFlags         = VK_SHADER_STAGE_VERTEX_BIT;
-        uboLayoutBinding.pImmutableSamplers = nullptr;
+        VkMemoryRequirements memRequirements;
+        vkGetImageMemoryRequirements(_device, _streamTextures[0].tailImage, &memRequirements);
+        uint32_t memoryType = _allocator.findMemoryType(memRequirements.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+        _streamHeap   = _allocator.memoryProperties().memoryTypes[memoryType].heapIndex;
+        _streamBudget = queryStreamBudget();
+
+        std::cerr << "texture streaming: " << _streamTextures.size() << " textures, " << _streamBudget / 1024 << " KiB budget ("
+                  << (_memoryBudgetSupported ? "VK_EXT_memory_budget" : "half the heap")
+                  << (_options.streamBudgetMB > 0 ? ", capped by --stream-budget" : "") << ")\n";
+        if(_streamAllocated > _streamBudget) {
+            std::cerr << "texture streaming: the mip tails alone take " << _streamAllocated / 1024 << " KiB, over budget\n";
+        }
 
-        VkDescriptorSetLayoutCreateInfo layoutInfo{};
-        layoutInfo.sType        = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
-        layoutInfo.bindingCount = 1;
-        layoutInfo.pBindings    = &uboLayoutBinding;
+        VkSamplerCreateInfo samplerInfo{};
+        samplerInfo.sType        = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+        samplerInfo.magFilter    = VK_FILTER_LINEAR;
+        samplerInfo.minFilter    = VK_FILTER_LINEAR;
+        samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+        samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+        samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+        samplerInfo.borderColor  = VK_BORDER_COLOR_INT_OPAQUE_BLACK;
+        samplerInfo.compareOp    = VK_COMPARE_OP_ALWAYS;
+        samplerInfo.mipmapMode   = VK_SAMPLER_MIPMAP_MODE_LINEAR;
+        samplerInfo.maxLod       = static_cast<float>(_streamLevels);
+
+        if(vkCreateSampler(_device, &samplerInfo, nullptr, &_streamSampler) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create streaming sampler!");
+        }
 
-        if(vkCreateDescriptorSetLayout(_device, &layoutInfo, nullptr, &_descriptorSetLayout) != VK_SUCCESS) {
-            throw std::runtime_error("failed to create descriptor set layout!");
+        // Host visible, the CPU reads each frame's feedback and resets it once that frame is done
+        VkDeviceSize feedbackSize = sizeof(uint32_t) * MAX_STREAM_TEXTURES;
+        _streamFeedbackBuffers.resize(_framesInFlight);
+        _streamFeedbackAllocations.resize(_framesInFlight);
+        _streamFeedbackPending.assign(_framesInFlight, false);
+        _streamDirty.resize(_framesInFlight);
+        for(size_t i = 0; i < _framesInFlight; i++) {
+            createBuffer(feedbackSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                         VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                         _streamFeedbackBuffers[i], _streamFeedbackAllocations[i]);
+            memset(_streamFeedbackAllocations[i].mapped, 0xff, static_cast<size_t>(feedbackSize));
         }
-    }
 
-    void createUniformBuffers() {
-        VkDeviceSize bufferSize = sizeof(UniformBufferObject);
+        // One set per frame in flight, a texture's descriptor can only change once its frame is done
+        _streamDescriptorSets.resize(_framesInFlight);
+        for(VkDescriptorSet& descriptorSet : _streamDescriptorSets) {
+            descriptorSet = _descriptors.allocate(_streamSetLayout);
+        }
 
-        _uniformBuffers.resize(_swapChainImages.size());
-        _uniformBuffersMemory.resize(_swapChainImages.size());
+        // Every array element has to be valid, the ones past the scene's textures repeat the first
+        std::vector<VkDescriptorImageInfo> imageInfos(MAX_STREAM_TEXTURES);
+        for(uint32_t i = 0; i < MAX_STREAM_TEXTURES; i++) {
+            imageInfos[i].imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+            imageInfos[i].imageView   = _streamTextures[i < _streamTextures.size() ? i : 0].tailView;
+            imageInfos[i].sampler     = _streamSampler;
+        }
 
-        for(size_t i=0; i<_swapChainImages.size(); i++) {
-            createBuffer(bufferSize, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, 
-                                     VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
-                                     VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-                                     _uniformBuffers[i],
-                                     _uniformBuffersMemory[i]);
+        for(size_t i = 0; i < _framesInFlight; i++) {
+            VkDescriptorBufferInfo bufferInfo{};
+            bufferInfo.buffer = _streamFeedbackBuffers[i];
+            bufferInfo.offset = 0;
+            bufferInfo.range  = feedbackSize;
+
+            std::array<VkWriteDescriptorSet, 2> descriptorWrites{};
+            descriptorWrites[0].sType            = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+            descriptorWrites[0].dstSet           = _streamDescriptorSets[i];
+            descriptorWrites[0].dstBinding       = 0;
+            descriptorWrites[0].dstArrayElement  = 0;
+            descriptorWrites[0].descriptorType   = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+            descriptorWrites[0].descriptorCount  = MAX_STREAM_TEXTURES;
+            descriptorWrites[0].pImageInfo       = imageInfos.data();
+
+            descriptorWrites[1].sType            = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+            descriptorWrites[1].dstSet           = _streamDescriptorSets[i];
+            descriptorWrites[1].dstBinding       = 1;
+            descriptorWrites[1].dstArrayElement  = 0;
+            descriptorWrites[1].descriptorType   = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+            descriptorWrites[1].descriptorCount  = 1;
+            descriptorWrites[1].pBufferInfo      = &bufferInfo;
+
+            vkUpdateDescriptorSets(_device, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
         }
     }
 
-    void updateUniformBuffer(uint32_t currentImage) {
-        static auto startTime = std::chrono::high_resolution_clock::now();
+    // Image with levels firstLevel and coarser of a streamed texture. Its upload is recorded, submitting it is
+    // up to the caller. The generated content stands in for reading the levels from disk. Returns the bytes staged.
+    VkDeviceSize createStreamImage(uint32_t index, uint32_t firstLevel, VkImage& image, Allocation& allocation, VkImageView& view) {
+        uint32_t size   = STREAM_TEXTURE_SIZE >> firstLevel;
+        uint32_t levels = _streamLevels - firstLevel;
+
+        createImage(size, size, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_TILING_OPTIMAL,
+                    VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+                    VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, image, allocation, 1, levels);
+
+        std::vector<uint8_t> data = generateStreamLevels(index, size, levels);
+        _uploads.uploadImage(image, size, size, data.data(), data.size(), 1, levels);
+
+        VkImageViewCreateInfo viewInfo{};
+        viewInfo.sType    = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+        viewInfo.image    = image;
+        viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+        viewInfo.format   = VK_FORMAT_R8G8B8A8_SRGB;
+        viewInfo.subresourceRange.aspectMask     = VK_IMAGE_ASPECT_COLOR_BIT;
+        viewInfo.subresourceRange.baseMipLevel   = 0;
+        viewInfo.subresourceRange.levelCount     = levels;
+        viewInfo.subresourceRange.baseArrayLayer = 0;
+        viewInfo.subresourceRange.layerCount     = 1;
+
+        if(vkCreateImageView(_device, &viewInfo, nullptr, &view) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create streamed texture view!");
+        }
 
-        auto currentTime = std::chrono::high_resolution_clock::now();
-        float time = std::chrono::duration<float, std::chrono::seconds::period>(currentTime - startTime).count();
+        _streamAllocated += DeviceAllocator::reservedSize(allocation);
+        _streamPeak = std::max(_streamPeak, _streamAllocated);
+        return data.size();
+    }
 
-        UniformBufferObject ubo{};
-        ubo.model = glm::rotate(glm::mat4(1.0f), time * glm::radians(90.0f), glm::vec3(0.0f,0.0f,1.0f));
-        ubo.view  = glm::lookAt(glm::vec3(2.0f,2.0f,2.0f), glm::vec3(0.0f,0.0f,0.0f), glm::vec3(0.0f,0.0f,1.0f));
-        ubo.proj  = glm::perspective(glm::radians(45.0f), _swapChainExtent.width / (float) _swapChainExtent.height, 0.1f, 10.0f);
+    // Checkerboard in a hue of its own, 16 squares across on every level. Levels where a square
+    // would be smaller than a texel get its average instead.
+    static std::vector<uint8_t> generateStreamLevels(uint32_t index, uint32_t size, uint32_t levels) {
+        // Golden ratio steps around the hue circle keep neighbouring textures apart
+        float hue = std::fmod(index * 0.618034f, 1.0f) * 6.0f;
+        float rgb[3];
+        for(uint32_t c = 0; c < 3; c++) {
+            float distance = std::fabs(std::fmod(hue + 4.0f * c, 6.0f) - 3.0f);
+            rgb[c] = std::min(std::max(distance - 1.0f, 0.0f), 1.0f);
+        }
 
-        ubo.proj[1][1] *= -1;
+        uint8_t light[4], dark[4], average[4];
+        for(uint32_t c = 0; c < 3; c++) {
+            light[c]   = static_cast<uint8_t>(64 + 191 * rgb[c]);
+            dark[c]    = static_cast<uint8_t>(16 + 64 * rgb[c]);
+            average[c] = static_cast<uint8_t>((light[c] + dark[c]) / 2);
+        }
+        light[3] = dark[3] = average[3] = 255;
 
-        void* data;
-        vkMapMemory(_device, _uniformBuffersMemory[currentImage], 0, sizeof(ubo), 0, &data);
-            memcpy(data, &ubo, sizeof(ubo));
-        vkUnmapMemory(_device, _uniformBuffersMemory[currentImage]);
+        size_t total = 0;
+        for(uint32_t level = 0; level < levels; level++) {
+            total += size_t(std::max(size >> level, 1u)) * std::max(size >> level, 1u) * 4;
+        }
 
+        std::vector<uint8_t> data(total);
+        uint8_t* out = data.data();
+        for(uint32_t level = 0; level < levels; level++) {
+            uint32_t levelSize = std::max(size >> level, 1u);
+            uint32_t square    = levelSize / 16;
+            for(uint32_t y = 0; y < levelSize; y++) {
+                for(uint32_t x = 0; x < levelSize; x++, out += 4) {
+                    const uint8_t* texel = square == 0 ? average : ((x / square + y / square) & 1) ? light : dark;
+                    memcpy(out, texel, 4);
+                }
+            }
+        }
+        return data;
     }
 
-    void createDescriptorPool() {
+    // Bytes a streamed texture image starting at firstLevel reserves, asked once per level from an image
+    // that never gets memory so the budget check is exact before anything is allocated
+    VkDeviceSize streamImageBytes(uint32_t firstLevel) {
+        if(_streamImageBytes[firstLevel] == 0) {
+            VkImageCreateInfo imageInfo{};
+            imageInfo.sType     = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+            imageInfo.imageType = VK_IMAGE_TYPE_2D;
+            imageInfo.extent.width  = STREAM_TEXTURE_SIZE >> firstLevel;
+            imageInfo.extent.height = STREAM_TEXTURE_SIZE >> firstLevel;
+            imageInfo.extent.depth  = 1;
+            imageInfo.mipLevels     = _streamLevels - firstLevel;
+            imageInfo.arrayLayers   = 1;
+            imageInfo.format        = VK_FORMAT_R8G8B8A8_SRGB;
+            imageInfo.tiling        = VK_IMAGE_TILING_OPTIMAL;
+            imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+            imageInfo.usage         = VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+            imageInfo.sharingMode   = VK_SHARING_MODE_EXCLUSIVE;
+            imageInfo.samples       = VK_SAMPLE_COUNT_1_BIT;
+
+            VkImage image;
+            if(vkCreateImage(_device, &imageInfo, nullptr, &image) != VK_SUCCESS) {
+                throw std::runtime_error("failed to create image!");
+            }
 
-        VkDescriptorPoolSize poolSize{};
-        poolSize.type            = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-        poolSize.descriptorCount = static_cast<uint32_t>(_swapChainImages.size());
+            VkMemoryRequirements memRequirements;
+            vkGetImageMemoryRequirements(_device, image, &memRequirements);
+            vkDestroyImage(_device, image, nullptr);
 
-        VkDescriptorPoolCreateInfo poolInfo{};
-        poolInfo.sType         = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
-        poolInfo.poolSizeCount = 1;
-        poolInfo.pPoolSizes    = &poolSize;
-        poolInfo.maxSets       = static_cast<uint32_t>(_swapChainImages.size());
-        poolInfo.flags         = 0;
+            _streamImageBytes[firstLevel] = _allocator.reservedSize(memRequirements, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+        }
+        return _streamImageBytes[firstLevel];
+    }
 
-        if(vkCreateDescriptorPool(_device, &poolInfo, nullptr, &_descriptorPool) != VK_SUCCESS) {
-            throw std::runtime_error("failed to create descriptor pool!");
+    // Bytes the streamed textures may occupy. VK_EXT_memory_budget says how much of the heap this
+    // process can use, whatever the rest of the renderer uses comes off that and a quarter stays
+    // free as headroom. --stream-budget caps it further, to try budgets smaller than the device's.
+    VkDeviceSize queryStreamBudget() {
+        VkDeviceSize available = _allocator.memoryProperties().memoryHeaps[_streamHeap].size / 2;
+
+        if(_memoryBudgetSupported) {
+            VkPhysicalDeviceMemoryBudgetPropertiesEXT budgetProperties{};
+            budgetProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT;
+
+            VkPhysicalDeviceMemoryProperties2 memoryProperties{};
+            memoryProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2;
+            memoryProperties.pNext = &budgetProperties;
+            _vkGetPhysicalDeviceMemoryProperties2(_physicalDevice, &memoryProperties);
+
+            // The streamed textures are part of the heap's usage, they are what the budget is for
+            VkDeviceSize usage  = budgetProperties.heapUsage[_streamHeap];
+            VkDeviceSize others = usage - std::min(usage, _streamAllocated);
+            VkDeviceSize budget = budgetProperties.heapBudget[_streamHeap];
+            available = budget > others ? (budget - others) / 4 * 3 : 0;
         }
 
+        if(_options.streamBudgetMB > 0) {
+            available = std::min(available, VkDeviceSize(_options.streamBudgetMB) * 1024 * 1024);
+        }
+        return available;
     }
 
-    void createDescriptorSets() {
-        std::vector<VkDescriptorSetLayout> layouts(_swapChainImages.size(), _descriptorSetLayout);
-        VkDescriptorSetAllocateInfo allocInfo{};
-        allocInfo.sType              = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
-        allocInfo.descriptorPool     = _descriptorPool;
-        allocInfo.descriptorSetCount = static_cast<uint32_t>(_swapChainImages.size());
-        allocInfo.pSetLayouts        = layouts.data();
-
-        _descriptorSets.resize(_swapChainImages.size());
-        if(vkAllocateDescriptorSets(_device, &allocInfo, _descriptorSets.data()) != VK_SUCCESS) {
-            throw std::runtime_error("failed to allocate descriptor sets!");
+    // Once per frame after its fence: read the frame's feedback, swap in finished uploads, then evict and
+    // upload within the budget. Textures seen most recently and furthest from what they asked for go first.
+    void updateStreaming(uint32_t frame) {
+        if(_streamTextures.empty()) {
+            return;
         }
 
-        for(size_t i=0; i<_swapChainImages.size(); i++) {
-            VkDescriptorBufferInfo bufferInfo{};
-            bufferInfo.buffer = _uniformBuffers[i];
-            bufferInfo.offset = 0;
-            bufferInfo.range  = sizeof(UniformBufferObject);
+        if(_frameCount % STREAM_BUDGET_INTERVAL == 0) {
+            _streamBudget = queryStreamBudget();
+        }
+        readStreamFeedback(frame);
 
-            VkWriteDescriptorSet descriptorWrite{};
-            descriptorWrite.sType            = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-            descriptorWrite.dstSet           = _descriptorSets[i];
-            descriptorWrite.dstBinding       = 0;
-            descriptorWrite.dstArrayElement  = 0;
-            descriptorWrite.descriptorType   = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-            descriptorWrite.descriptorCount  = 1;
-            descriptorWrite.pBufferInfo      = &bufferInfo;
-            descriptorWrite.pImageInfo       = nullptr;
-            descriptorWrite.pTexelBufferView = nullptr;
+        uint64_t acquiredId = _uploads.acquiredId();
+        for(uint32_t i = 0; i < _streamTextures.size(); i++) {
+            StreamedTexture& texture = _streamTextures[i];
+            if(texture.pendingImage == VK_NULL_HANDLE || acquiredId < texture.uploadId) {
+                continue;
+            }
 
-            vkUpdateDescriptorSets(_device, 1, &descriptorWrite, 0, nullptr);
+            if(texture.image != VK_NULL_HANDLE) {
+                releaseStreamImage(texture.image, texture.allocation, texture.view);
+            }
+            texture.image         = texture.pendingImage;
+            texture.allocation    = texture.pendingAllocation;
+            texture.view          = texture.pendingView;
+            texture.residentLevel = texture.pendingLevel;
+            texture.pendingImage  = VK_NULL_HANDLE;
+            texture.pendingAllocation = Allocation{};
+            texture.pendingView   = VK_NULL_HANDLE;
+            markStreamDirty(i);
         }
 
+        // The budget may have shrunk since the last frame
+        makeStreamRoom(0);
 
-    }
-
-    void createImage(uint32_t width, uint32_t height, VkFormat format, VkImageTiling tiling,
-                     VkImageUsageFlags usage, VkMemoryPropertyFlags properties, VkImage& image,
-                     VkDeviceMemory& imageMemory) {
+        std::vector<uint32_t> candidates;
+        for(uint32_t i = 0; i < _streamTextures.size(); i++) {
+            const StreamedTexture& texture = _streamTextures[i];
+            if(texture.pendingImage == VK_NULL_HANDLE && texture.requestedLevel < texture.residentLevel
+            && texture.lastUsedFrame + STREAM_REQUEST_FRAMES > _frameCount) {
+                candidates.push_back(i);
+            }
+        }
+        std::sort(candidates.begin(), candidates.end(), [&](uint32_t a, uint32_t b) {
+            const StreamedTexture& textureA = _streamTextures[a];
+            const StreamedTexture& textureB = _streamTextures[b];
+            if(textureA.lastUsedFrame != textureB.lastUsedFrame) {
+                return textureA.lastUsedFrame > textureB.lastUsedFrame;
+            }
+            return textureA.residentLevel - textureA.requestedLevel > textureB.residentLevel - textureB.requestedLevel;
+        });
+
+        VkDeviceSize uploaded = 0;
+        for(uint32_t i : candidates) {
+            StreamedTexture& texture = _streamTextures[i];
+            VkDeviceSize bytes = streamImageBytes(texture.requestedLevel);
+            if(uploaded + bytes > STREAM_UPLOAD_BYTES_PER_FRAME && uploaded > 0) {
+                break;
+            }
+            if(!makeStreamRoom(bytes)) {
+                _streamDeferred++;
+                break;
+            }
 
-        VkImageCreateInfo imageInfo{};
-        imageInfo.sType     = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
-        imageInfo.imageType = VK_IMAGE_TYPE_2D;
-        imageInfo.extent.width  = static_cast<uint32_t>(width);
-        imageInfo.extent.height = static_cast<uint32_t>(height);
-        imageInfo.extent.depth  = 1;
-        imageInfo.mipLevels     = 1;
-        imageInfo.arrayLayers   = 1;
-        imageInfo.format        = format;
-        imageInfo.tiling        = tiling;
-        imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-        imageInfo.usage         = usage;
-        imageInfo.sharingMode   = VK_SHARING_MODE_EXCLUSIVE;
-        imageInfo.samples       = VK_SAMPLE_COUNT_1_BIT;
-        imageInfo.flags         = 0;
+            texture.uploadId     = _uploads.recordingId();
+            texture.pendingLevel = texture.requestedLevel;
+            _streamUploadBytes += createStreamImage(i, texture.pendingLevel, texture.pendingImage,
+                                                    texture.pendingAllocation, texture.pendingView);
+            uploaded += bytes;
+            _streamUploads++;
+        }
+        if(uploaded > 0) {
+            std::unique_lock<std::mutex> queueLock = lockQueues();
+            _uploads.submit();
+        }
 
-        if(vkCreateImage(_device, &imageInfo, nullptr, &image) != VK_SUCCESS) {
-            throw std::runtime_error("failed to create image!");
+        // This frame's set isn't used by the GPU anymore
+        std::vector<VkDescriptorImageInfo> imageInfos(_streamDirty[frame].size());
+        std::vector<VkWriteDescriptorSet> descriptorWrites(_streamDirty[frame].size());
+        for(size_t i = 0; i < _streamDirty[frame].size(); i++) {
+            const StreamedTexture& texture = _streamTextures[_streamDirty[frame][i]];
+            imageInfos[i].imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+            imageInfos[i].imageView   = texture.image != VK_NULL_HANDLE ? texture.view : texture.tailView;
+            imageInfos[i].sampler     = _streamSampler;
+
+            descriptorWrites[i].sType            = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+            descriptorWrites[i].dstSet           = _streamDescriptorSets[frame];
+            descriptorWrites[i].dstBinding       = 0;
+            descriptorWrites[i].dstArrayElement  = _streamDirty[frame][i];
+            descriptorWrites[i].descriptorType   = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+            descriptorWrites[i].descriptorCount  = 1;
+            descriptorWrites[i].pImageInfo       = &imageInfos[i];
+        }
+        if(!descriptorWrites.empty()) {
+            vkUpdateDescriptorSets(_device, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
         }
+        _streamDirty[frame].clear();
+    }
 
-        VkMemoryRequirements memRequirements;
-        vkGetImageMemoryRequirements(_device, image, &memRequirements);
-        
-        VkMemoryAllocateInfo allocInfo{};
-        allocInfo.sType           = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-        allocInfo.allocationSize  = memRequirements.size;
-        allocInfo.memoryTypeIndex = findMemoryType(memRequirements.memoryTypeBits, properties);
+    void readStreamFeedback(uint32_t frame) {
+        if(!_streamFeedbackPending[frame]) {
+            return;
+        }
+        _streamFeedbackPending[frame] = false;
+
+        uint32_t* feedback = static_cast<uint32_t*>(_streamFeedbackAllocations[frame].mapped);
+        uint32_t seen    = 0;
+        uint32_t deficit = 0;
+        for(uint32_t i = 0; i < _streamTextures.size(); i++) {
+            if(feedback[i] == ~0u) {
+                continue;
+            }
 
-        if(vkAllocateMemory(_device, &allocInfo, nullptr, &imageMemory) != VK_SUCCESS) {
-            throw std::runtime_error("failed to allocate image memory!");
+            // Anything coarser than the tail is served by the tail
+            StreamedTexture& texture = _streamTextures[i];
+            texture.requestedLevel = std::min(feedback[i], _streamTailLevel);
+            texture.lastUsedFrame  = _frameCount;
+            deficit += texture.residentLevel - std::min(texture.residentLevel, texture.requestedLevel);
+            seen++;
         }
+        memset(feedback, 0xff, sizeof(uint32_t) * _streamTextures.size());
 
-        vkBindImageMemory(_device, image, imageMemory, 0);
-        
+        if(_options.benchFrames > 0 && _frameCount >= BENCH_WARMUP_FRAMES && seen > 0) {
+            _streamDeficitTotal += static_cast<double>(deficit) / seen;
+            _streamDeficitFrames++;
+        }
     }
 
-    VkCommandBuffer beginSingleTimeCommands() {
-        VkCommandBufferAllocateInfo allocInfo{};
-        allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-        allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-        allocInfo.commandPool        = _commandPool;
-        allocInfo.commandBufferCount = 1;
+    // Evicts the least recently used textures down to their tail until needed more bytes fit. Evicted images
+    // only count as free once their deferred destroy has run, an upload that needs them has to wait till then.
+    bool makeStreamRoom(VkDeviceSize needed) {
+        while(_streamAllocated + needed > _streamBudget) {
+            if(_streamAllocated - _streamReleasing + needed <= _streamBudget) {
+                return false;
+            }
 
-        VkCommandBuffer commandBuffer;
-        vkAllocateCommandBuffers(_device, &allocInfo, &commandBuffer);
+            // Only textures the latest feedback didn't see, and none with an upload in flight
+            StreamedTexture* victim = nullptr;
+            for(StreamedTexture& texture : _streamTextures) {
+                if(texture.image != VK_NULL_HANDLE && texture.pendingImage == VK_NULL_HANDLE
+                && texture.lastUsedFrame < _frameCount
+                && (victim == nullptr || texture.lastUsedFrame < victim->lastUsedFrame)) {
+                    victim = &texture;
+                }
+            }
+            if(victim == nullptr) {
+                return false;
+            }
 
-        VkCommandBufferBeginInfo beginInfo{};
-        beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-        beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+            releaseStreamImage(victim->image, victim->allocation, victim->view);
+            victim->image         = VK_NULL_HANDLE;
+            victim->view          = VK_NULL_HANDLE;
+            victim->residentLevel = _streamTailLevel;
+            markStreamDirty(static_cast<uint32_t>(victim - _streamTextures.data()));
+            _streamEvictions++;
+        }
+        return true;
+    }
 
-        vkBeginCommandBuffer(commandBuffer, &beginInfo);
+    // Frames still in flight may sample the image, it goes once they are done
+    void releaseStreamImage(VkImage image, Allocation allocation, VkImageView view) {
+        VkDeviceSize bytes = DeviceAllocator::reservedSize(allocation);
+        _streamReleasing += bytes;
+        deferDestroy([=]() mutable {
+            vkDestroyImageView(_device, view, nullptr);
+            destroyImage(image, allocation);
+            _streamAllocated -= bytes;
+            _streamReleasing -= bytes;
+        });
+    }
 
-        return commandBuffer;
+    void markStreamDirty(uint32_t index) {
+        for(std::vector<uint32_t>& dirty : _streamDirty) {
+            dirty.push_back(index);
+        }
     }
 
-    void endSingleTimeCommands(VkCommandBuffer commandBuffer) {
-        vkEndCommandBuffer(commandBuffer);
+    void dumpStreamStats(std::ostream& out) {
+        if(_streamTextures.empty()) {
+            return;
+        }
 
-        VkSubmitInfo submitInfo{};
-        submitInfo.sType              = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-        submitInfo.commandBufferCount = 1;
-        submitInfo.pCommandBuffers    = &commandBuffer;
+        out << "texture streaming: " << _streamUploads << " uploads / " << _streamUploadBytes / 1024 << " KiB, "
+            << _streamEvictions << " evictions, " << _streamDeferred << " uploads waiting for memory, peak "
+            << _streamPeak / 1024 << " KiB of " << _streamBudget / 1024 << " KiB budget, staging peak "
+            << _allocator.stagingPeak() / 1024 << " KiB in " << _allocator.stagingBlockPeak() << " blocks\n";
+    }
 
-        vkQueueSubmit(_graphicsQueue, 1, &submitInfo, VK_NULL_HANDLE);
-        vkQueueWaitIdle(_graphicsQueue);
+    // Every step names the steps whose results it uses. Only the device chain up front is
+    // strictly sequential, after that mesh and texture loading, the uploads and the pipelines
+    // all overlap. Steps touching the same object either depend on each other or go through
+    // something that is thread safe (the allocator, the upload engine, the pipeline cache).
+    void initVulkan() {
+        JobGraph graph;
+        typedef JobGraph::JobId Job;
+
+        Job instance       = graph.add("createInstance", [this]() { createInstance(); });
+        Job debug          = graph.add("setupDebugMessenger", [this]() { setupDebugMessenger(); }, {instance});
+        Job surface        = graph.add("createSurface", [this]() { createSurface(); }, {instance});
+        Job physicalDevice = graph.add("pickPhysicalDevice", [this]() { pickPhysicalDevice(); }, {surface, debug});
+        Job device         = graph.add("createLogicalDevice", [this]() { createLogicalDevice(); }, {physicalDevice});
+        Job allocator      = graph.add("createAllocator", [this]() { createAllocator(); }, {device});
+        Job swapChain      = graph.add("createSwapChain", [this]() { createSwapChain(); }, {allocator});
+        Job imageViews     = graph.add("createImageViews", [this]() { createImageViews(); }, {swapChain});
+        Job renderPass     = graph.add("createRenderPass", [this]() { createRenderPass(); }, {swapChain});
+        Job descriptors    = graph.add("createDescriptorCache", [this]() { createDescriptorCache(); }, {device});
+        Job setLayout      = graph.add("createDescriptorSetLayout", [this]() { createDescriptorSetLayout(); }, {descriptors});
+        Job pipelineCache  = graph.add("createPipelineCache", [this]() { createPipelineCache(); }, {device});
+
+        // CPU only, these start right away
+        Job mesh      = graph.add("loadMesh", [this]() { loadMesh(); });
+        Job shaders   = graph.add("createShaderLibrary", [this]() {
+            _shaders.create("../shaders", _options.shaderCacheDir, _options.watchShaders);
+        });
+
+        // Every shader compiles on its own ahead of the pipelines using it, unused ones do nothing
+        auto compile = [&](const char* job, const char* name, bool used, std::vector<std::string> defines = {}) {
+            return graph.add(job, [this, name, used, defines]() {
+                if(used) {
+                    _shaders.load(name, defines);
+                }
+            }, {shaders});
+        };
+        bool streaming = _options.streamTextureCount > 0;
+        Job shaderVert    = compile("shader.vert", "shader.vert", true);
+        Job shaderFrag    = compile("shader.frag", "shader.frag", true);
+        Job instancedVert = compile("instanced.vert", "instanced.vert", true);
+        Job instancedFrag = compile("instanced.frag", "instanced.frag", true);
+        Job streamedFrag  = compile("streamed.frag", "streamed.frag", streaming, streamShaderDefines());
+        Job positionVert  = compile("shader.vert POSITION_ONLY", "shader.vert", _options.positionOnly, {"POSITION_ONLY"});
+        Job positionFrag  = compile("shader.frag POSITION_ONLY", "shader.frag", _options.positionOnly, {"POSITION_ONLY"});
+        Job cullComp      = compile("cull.comp", "cull.comp", _options.cullObjectCount > 0);
+        Job mipgenComp    = compile("mipgen.comp", "mipgen.comp", _options.mipMode == MipMode::Compute);
+        Job overdrawFrag  = compile("shader.frag OVERDRAW", "shader.frag", _options.overdraw, {"OVERDRAW"});
+        Job overdrawComp  = compile("overdraw.comp", "overdraw.comp", _options.overdraw, overdrawShaderDefines());
+        Job drawList  = graph.add("createDrawList", [this]() { createDrawList(); });
+        Job instances = graph.add("createInstances", [this]() { createInstances(_options.instanceCount); });
+
+        Job overdrawTarget = graph.add("createOverdrawTarget", [this]() { createOverdrawTarget(); }, {swapChain});
+        Job pipeline     = graph.add("createGraphicsPipeline", [this]() { createGraphicsPipeline(); },
+                                     {renderPass, setLayout, pipelineCache, mesh, shaderVert, shaderFrag,
+                                      instancedVert, instancedFrag, streamedFrag, positionVert, positionFrag,
+                                      overdrawTarget, overdrawFrag});
+        Job framebuffers = graph.add("createFramebuffers", [this]() { createFramebuffers(); }, {renderPass, imageViews});
+        Job commandPool  = graph.add("createCommandPool", [this]() { createCommandPool(); }, {device});
+        Job cullPipeline = graph.add("createCullPipeline", [this]() { createCullPipeline(); }, {pipelineCache, descriptors, cullComp});
+        Job profiler     = graph.add("createProfiler", [this]() { createProfiler(); }, {device});
+        Job statsQueries = graph.add("createPipelineStatsQueries", [this]() { createPipelineStatsQueries(); }, {device});
+        Job overdrawReduce = graph.add("createOverdrawReduction", [this]() { createOverdrawReduction(); },
+                                       {pipelineCache, descriptors, overdrawTarget, overdrawComp});
+
+        Job uploads      = graph.add("createUploadEngine", [this]() { createUploadEngine(); }, {allocator});
+        Job mipPipeline  = graph.add("createMipPipeline", [this]() { createMipPipeline(); }, {pipelineCache, descriptors, allocator, mipgenComp});
+        Job texture      = graph.add("createTextureImage", [this]() { createTextureImage(); }, {uploads, mipPipeline});
+        Job textureView  = graph.add("createTextureImageView", [this]() { createTextureImageView(); }, {texture});
+        Job sampler      = graph.add("createTextureSampler", [this]() { createTextureSampler(); }, {texture});
+        Job vertexBuffer = graph.add("createVertexBuffer", [this]() { createVertexBuffer(_mesh); }, {uploads, mesh});
+        Job indexBuffer  = graph.add("createIndexBuffer", [this]() { createIndexBuffer(_mesh); }, {uploads, mesh});
+        Job cullScene    = graph.add("createCullScene", [this]() { createCullScene(); }, {uploads, mesh});
+        Job streamed     = graph.add("createStreamedTextures", [this]() { createStreamedTextures(); }, {uploads, setLayout});
+
+        Job submitUploads = graph.add("submitUploads", [this]() {
+            _sceneUploadId = _uploads.submit();
+
+            // Staging holds its own copy now, the mappings aren't needed anymore
+            _meshFile.close();
+            _textureFile.close();
+            _meshVertexStorage = {};
+            _positionStorage   = {};
+            _mesh.vertexData = nullptr;
+            _mesh.indexData  = nullptr;
+        }, {texture, vertexBuffer, indexBuffer, cullScene, streamed});
+
+        // The rest is cheap and wires everything together, it keeps its original order
+        Job uniformBuffers = graph.add("createUniformBuffers", [this]() { createUniformBuffers(); },
+                                       {submitUploads, textureView, sampler, pipeline, framebuffers, commandPool,
+                                        drawList, instances, cullPipeline, profiler,
+                                        statsQueries, overdrawReduce});
+        Job descriptorSets = graph.add("createDescriptorSets", [this]() { createDescriptorSets(); }, {uniformBuffers});
+        Job cullSets       = graph.add("createCullDescriptorSets", [this]() { createCullDescriptorSets(); }, {descriptorSets});
+        Job commandBuffers = graph.add("createCommandBuffers", [this]() { createCommandBuffers(); }, {cullSets});
+        graph.add("createSyncObjects", [this]() { createSyncObjects(); }, {commandBuffers});
+
+        uint32_t helperCount = _options.initThreads >= 0
+                             ? static_cast<uint32_t>(_options.initThreads)
+                             : std::min(std::max(1u, std::thread::hardware_concurrency()), MAX_INIT_THREADS) - 1;
+        graph.run(helperCount);
+
+        _initMs      = graph.wallMs();
+        _initBusyMs  = graph.busyMs();
+        _initThreads = helperCount + 1;
+        graph.printTimeline(std::cerr);
+        std::cerr << "shaders: " << _shaders.compiles() << " compiled in " << _shaders.compileMs() << " ms, "
+                  << _shaders.cacheHits() << " from the cache\n";
+        std::cerr << "pipelines: " << _pipelines.size() << " variants for " << _pipelineRequests << " requests\n";
+    }
+
+    // Simulation side of the window: events and the framebuffer size. A minimized window has
+    // nothing to render to, the simulation sleeps until it comes back.
+    VkExtent2D pollWindow() {
+        if(_options.headless) {
+            return {_options.width, _options.height};
+        }
 
-        vkFreeCommandBuffers(_device, _commandPool, 1, &commandBuffer);
+        glfwPollEvents();
+        int width = 0, height = 0;
+        glfwGetFramebufferSize(_window, &width, &height);
+        while((width == 0 || height == 0) && !glfwWindowShouldClose(_window)) {
+            glfwWaitEvents();
+            glfwGetFramebufferSize(_window, &width, &height);
+        }
 
+        if(width > 0 && height > 0) {
+            _windowExtent = {static_cast<uint32_t>(width), static_cast<uint32_t>(height)};
+        }
+        return _windowExtent;
     }
 
-    void transitionImageLayout(VkImage image, VkFormat format, 
-                               VkImageLayout oldLayout,
-                               VkImageLayout newLayout) {
-
-        VkCommandBuffer commandBuffer = beginSingleTimeCommands();
+    // One simulation step: input, camera, draw list and instances into the next packet
+    void simulate() {
+        FrameProfiler::CpuScope scope(_profiler, "simulate");
+        auto simStart = std::chrono::high_resolution_clock::now();
+
+        FramePacket& packet = _packets.back();
+        packet.step        = ++_simSteps;
+        packet.framebuffer = pollWindow();
+        packet.inputTime   = std::chrono::high_resolution_clock::now();
+        updateCamera(packet);
+        packet.drawList    = _drawList;
+        updateInstanceData(packet);
+
+        {
+            // Only orders the publish against the render thread deciding to sleep
+            std::lock_guard<std::mutex> lock(_packetMutex);
+            _packets.publish();
+        }
+        _packetPublished.notify_one();
 
-        VkImageMemoryBarrier barrier{};
-        barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-        barrier.oldLayout = oldLayout;
-        barrier.newLayout = newLayout;
-        barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-        barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        // The first benchFrames steps after the warm-up, an unthrottled simulation would take many more
+        std::chrono::duration<double, std::milli> simTime = std::chrono::high_resolution_clock::now() - simStart;
+        if(_options.benchFrames > 0 && _simSteps > BENCH_WARMUP_FRAMES && _simTimes.size() < _options.benchFrames) {
+            _simTimes.push_back(simTime.count());
+        }
+    }
 
-        barrier.image = image;
-        barrier.subresourceRange.aspectMask     = VK_IMAGE_ASPECT_COLOR_BIT;
-        barrier.subresourceRange.baseMipLevel   = 0;
-        barrier.subresourceRange.levelCount     = 1;
-        barrier.subresourceRange.baseArrayLayer = 0;
-        barrier.subresourceRange.layerCount     = 1;
-        barrier.srcAccessMask = 0;
-        barrier.dstAccessMask = 0;
+    // Render thread: blocks until there is a packet it hasn't drawn, false once asked to stop
+    bool waitForPacket() {
+        std::unique_lock<std::mutex> lock(_packetMutex);
+        _packetPublished.wait(lock, [this]() { return _stopRendering || _packets.update(); });
+        return !_stopRendering;
+    }
 
+    void renderLoop() {
+        try {
+            while(!benchFinished() && waitForPacket()) {
+                drawFrame();
+            }
+        } catch(...) {
+            _renderError = std::current_exception();
+        }
+        _renderDone = true;
+    }
 
-        VkPipelineStageFlags sourceStage;
-        VkPipelineStageFlags destinationStage;
+    // Simulation on this thread at --sim-hz, recording and submitting on a render thread. The
+    // simulation never waits for the renderer, the renderer draws the newest packet there is.
+    void runRenderThread() {
+        if(_options.presentThread) {
+            _presenter.start(1);
+        }
+        std::thread renderThread(&HelloTriangleApplication::renderLoop, this);
 
-        if(oldLayout == VK_IMAGE_LAYOUT_UNDEFINED && newLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL) {
-            barrier.srcAccessMask = 0;
-            barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        auto nextStep = std::chrono::steady_clock::now();
+        while(!_renderDone && !windowClosed()) {
+            simulate();
+            if(_options.simHz == 0) {
+                continue;
+            }
 
-            sourceStage       = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
-            destinationStage  = VK_PIPELINE_STAGE_TRANSFER_BIT;
+            // A step that ran late doesn't make the next ones hurry
+            nextStep = std::max(nextStep + std::chrono::microseconds(1000000 / _options.simHz), std::chrono::steady_clock::now());
+            std::this_thread::sleep_until(nextStep);
         }
-        else if(oldLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL && newLayout == VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL) {
-            barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-            barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
 
-            sourceStage      = VK_PIPELINE_STAGE_TRANSFER_BIT;
-            destinationStage = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
-        }
-        else {
-            throw std::invalid_argument("unsupported layout transition!");
+        {
+            std::lock_guard<std::mutex> lock(_packetMutex);
+            _stopRendering = true;
         }
+        _packetPublished.notify_one();
+        renderThread.join();
+        _presenter.stop();
 
+        if(_renderError) {
+            std::rethrow_exception(_renderError);
+        }
+    }
 
-        vkCmdPipelineBarrier(commandBuffer,
-                            sourceStage , destinationStage,
-                            0,
-                            0, nullptr,
-                            0, nullptr,
-                            1, &barrier);
+    bool windowClosed() {
+        return !_options.headless && glfwWindowShouldClose(_window);
+    }
 
-        endSingleTimeCommands(commandBuffer);                          
+    // The present thread and _presentWaiter call into the queues and the swapchain from threads of their own
+    bool queuesShared() const {
+        return _options.presentThread || _presentWaiterRunning;
+    }
 
+    // With nobody to share the queues and swapchain with, the lock stays unlocked
+    std::unique_lock<std::mutex> lockQueues() {
+        std::unique_lock<std::mutex> lock(_queueMutex, std::defer_lock);
+        if(queuesShared()) {
+            lock.lock();
+        }
+        return lock;
     }
 
-    void copyBufferToImage(VkBuffer buffer, VkImage image, uint32_t width, uint32_t height) {
-        VkCommandBuffer commandBuffer = beginSingleTimeCommands();
+    // Other threads use the swapchain too, so acquire polls rather than block while holding it
+    VkResult acquireNextImage(uint32_t& imageIndex) {
+        if(!queuesShared()) {
+            return vkAcquireNextImageKHR(_device, _swapChain, UINT64_MAX, _imageAvailableSemaphores[currentFrame], VK_NULL_HANDLE, &imageIndex);
+        }
+
+        while(true) {
+            VkResult result;
+            {
+                std::unique_lock<std::mutex> queueLock = lockQueues();
+                result = vkAcquireNextImageKHR(_device, _swapChain, 0, _imageAvailableSemaphores[currentFrame], VK_NULL_HANDLE, &imageIndex);
+            }
+            if(result != VK_NOT_READY && result != VK_TIMEOUT) {
+                return result;
+            }
+            std::this_thread::sleep_for(std::chrono::microseconds(ACQUIRE_POLL_US));
+        }
+    }
 
-        VkBufferImageCopy region{};
-        region.bufferOffset      = 0;
-        region.bufferRowLength   = 0;
-        region.bufferImageHeight = 0;
+    VkResult present(VkSwapchainKHR swapChain, VkSemaphore waitSemaphore, uint32_t imageIndex, uint64_t presentId) {
+        VkPresentIdKHR presentIdInfo{};
+        presentIdInfo.sType          = VK_STRUCTURE_TYPE_PRESENT_ID_KHR;
+        presentIdInfo.swapchainCount = 1;
+        presentIdInfo.pPresentIds    = &presentId;
 
-        region.imageSubresource.aspectMask     = VK_IMAGE_ASPECT_COLOR_BIT;
-        region.imageSubresource.mipLevel       = 0;
-        region.imageSubresource.baseArrayLayer = 0;
-        region.imageSubresource.layerCount     = 1;
+        VkPresentInfoKHR presentInfo{};
+        presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
+        presentInfo.pNext = _presentWait ? &presentIdInfo : nullptr;
+        presentInfo.waitSemaphoreCount = 1;
+        presentInfo.pWaitSemaphores    = &waitSemaphore;
 
-        region.imageOffset = {0,0,0};
-        region.imageExtent = {width, height, 1};
+        presentInfo.swapchainCount  = 1;
+        presentInfo.pSwapchains     = &swapChain;
+        presentInfo.pImageIndices   = &imageIndex;
+        presentInfo.pResults        = nullptr;
 
-        vkCmdCopyBufferToImage(commandBuffer,
-                               buffer,
-                               image,
-                               VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-                               1,
-                               &region);
+        FrameProfiler::CpuScope scope(_profiler, "present");
+        std::unique_lock<std::mutex> queueLock = lockQueues();
+        return vkQueuePresentKHR(_presentQueue, &presentInfo);
+    }
 
-        endSingleTimeCommands(commandBuffer);        
+    // Presents on the present thread, whatever blocking that does happens there. Out of date
+    // swapchains are recreated by the render thread before its next acquire.
+    void queuePresent(uint32_t imageIndex, uint64_t presentId) {
+        VkSwapchainKHR swapChain   = _swapChain;
+        VkSemaphore renderFinished = _renderFinishedSemaphores[currentFrame];
+        _presenter.push([this, swapChain, renderFinished, imageIndex, presentId]() {
+            VkResult result = present(swapChain, renderFinished, imageIndex, presentId);
+            if(result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR) {
+                _swapChainStale = true;
+            }
+            else if(result != VK_SUCCESS) {
+                _presentFailed = true;
+            }
 
+            {
+                std::lock_guard<std::mutex> lock(_presentMutex);
+                _framesPresented++;
+            }
+            _presentDone.notify_all();
+        });
     }
 
+    // --low-latency: a frame only starts once the one before it is on screen, or without
+    // VK_KHR_present_wait done on the GPU. Input is then sampled as late as the display allows
+    // and no frame waits in a queue. Returns how long that took in ms.
+    double waitForLatencyTarget() {
+        if(!_options.lowLatency || _frameCount == 0) {
+            return 0.0;
+        }
 
+        FrameProfiler::CpuScope scope(_profiler, "wait for latency target");
+        if(!_presentWait) {
+            return waitForFrames(_frameCount);
+        }
 
-    void createTextureImage() {
-        int texWidth, texHeight, texChannels;
+        // The last present went to a swapchain since recreated, its id will never show up on this one
+        if(_lastPresentSwapChain != _swapChain) {
+            return 0.0;
+        }
 
-        stbi_uc* pixels = stbi_load("../textures/texture.jpg", &texWidth, &texHeight, &texChannels, STBI_rgb_alpha);
-        VkDeviceSize imageSize = texWidth * texHeight * 4;
+        // Timeouts are fine, the frame starts late rather than never
+        auto start = std::chrono::high_resolution_clock::now();
+        waitForPresent(_swapChain, _frameCount);
+        std::chrono::duration<double, std::milli> waitTime = std::chrono::high_resolution_clock::now() - start;
+        return waitTime.count();
+    }
 
-        if(!pixels) {
-            throw std::runtime_error("failed to load texture image!");
+    // Waits up to PRESENT_WAIT_TIMEOUT_NS for presentId to reach the screen. While the swapchain is shared
+    // it polls under the queue lock, like acquire, so acquires and presents are never blocked behind the wait.
+    VkResult waitForPresent(VkSwapchainKHR swapChain, uint64_t presentId) {
+        if(!queuesShared()) {
+            return _vkWaitForPresent(_device, swapChain, presentId, PRESENT_WAIT_TIMEOUT_NS);
         }
 
-        VkBuffer stagingBuffer;
-        VkDeviceMemory stagingBufferMemory;
+        auto deadline = std::chrono::high_resolution_clock::now() + std::chrono::nanoseconds(PRESENT_WAIT_TIMEOUT_NS);
+        while(true) {
+            VkResult result;
+            {
+                std::unique_lock<std::mutex> queueLock = lockQueues();
+                result = _vkWaitForPresent(_device, swapChain, presentId, 0);
+            }
+            if(result != VK_TIMEOUT || std::chrono::high_resolution_clock::now() >= deadline) {
+                return result;
+            }
+            std::this_thread::sleep_for(std::chrono::microseconds(ACQUIRE_POLL_US));
+        }
+    }
 
+    // Input to photon of one bench frame, measured on _presentWaiter so nobody else blocks for it
+    void timePresent(uint64_t presentId, std::chrono::high_resolution_clock::time_point inputTime) {
+        VkSwapchainKHR swapChain = _swapChain;
+        _presentWaiter.push([this, swapChain, presentId, inputTime]() {
+            if(waitForPresent(swapChain, presentId) != VK_SUCCESS) {
+                return;
+            }
+            std::chrono::duration<double, std::milli> latency = std::chrono::high_resolution_clock::now() - inputTime;
+            _inputToPresentTimes.push_back(latency.count());
+        });
+    }
 
-        createBuffer(imageSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-                                VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
-                                VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingBufferMemory);
+    // Blocks until count frames have been handed to vkQueuePresentKHR, returns how long that took in ms
+    double waitForPresents(uint64_t count) {
+        auto start = std::chrono::high_resolution_clock::now();
+        std::unique_lock<std::mutex> lock(_presentMutex);
+        _presentDone.wait(lock, [this, count]() { return _framesPresented >= count; });
+        std::chrono::duration<double, std::milli> waitTime = std::chrono::high_resolution_clock::now() - start;
+        return waitTime.count();
+    }
 
+    void drawFrame() {
+        FrameProfiler::CpuScope frameScope(_profiler, "drawFrame");
+
+        // The frame that used this slot last has to be done before its resources are touched
+        currentFrame = _frameCount % _framesInFlight;
+        double waitMs = _pacingWaitMs;
+        _pacingWaitMs = 0.0;
+        if(_frameCount >= _framesInFlight) {
+            FrameProfiler::CpuScope scope(_profiler, "wait for frame");
+            waitMs += waitForFrames(_frameCount + 1 - _framesInFlight);
+        }
 
-        void *data;
-        vkMapMemory(_device, stagingBufferMemory, 0, imageSize, 0, &data);
-            memcpy(data, pixels, static_cast<size_t>(imageSize));
-        vkUnmapMemory(_device, stagingBufferMemory);
+        // Its render finished semaphore is signaled again below, the present waiting on it has to be queued first
+        if(_options.presentThread && _frameCount >= _framesInFlight) {
+            FrameProfiler::CpuScope scope(_profiler, "wait for present");
+            waitMs += waitForPresents(_frameCount + 1 - _framesInFlight);
+        }
 
-        stbi_image_free(pixels);
+        // The simulation runs on its own, a packet newer than the one that woke this thread may be there by now
+        if(_options.renderThread && _options.lowLatency) {
+            waitMs += waitForLatencyTarget();
+            _packets.update();
+        }
 
-        createImage(texWidth, texHeight, VK_FORMAT_R8G8B8A8_SRGB, 
-                                         VK_IMAGE_TILING_OPTIMAL,
-                                         VK_IMAGE_USAGE_TRANSFER_DST_BIT | 
-                                         VK_IMAGE_USAGE_SAMPLED_BIT, 
-                                         VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 
-                                         _textureImage, 
-                                         _textureImageMemory);
+        const FramePacket& packet = _packets.front();
+        _packetsSkipped   += packet.step - _lastPacketStep - 1;
+        _lastPacketStep    = packet.step;
+        _framePacket       = &packet;
+        _frameUniforms     = packet.uniforms;
+        _framebufferExtent = packet.framebuffer;
+        collectGpuFrameTime(static_cast<uint32_t>(currentFrame));
+        runDeferredDestroys(false);
+        reloadChangedShaders();
+        updateDrawVariants();
 
-        transitionImageLayout(_textureImage, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_LAYOUT_UNDEFINED,
-                                                                      VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
-        copyBufferToImage(stagingBuffer, _textureImage, static_cast<uint32_t>(texWidth),
-                                                        static_cast<uint32_t>(texHeight));
-        transitionImageLayout(_textureImage, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-                              VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+        uint32_t imageIndex;
+        if(_options.headless) {
+            imageIndex = _offscreenImageIndex;
+            _offscreenImageIndex = (_offscreenImageIndex + 1) % OFFSCREEN_IMAGE_COUNT;
+        }
+        else {
+            if(_options.presentThread) {
+                if(_presentFailed) {
+                    throw std::runtime_error("failed to present swap chain image!");
+                }
+                if(_swapChainStale.exchange(false) | framebufferResized.exchange(false)) {
+                    recreateSwapChain();
+                }
+            }
 
-        vkDestroyBuffer(_device, stagingBuffer, nullptr);
-        vkFreeMemory(_device, stagingBufferMemory, nullptr);
+            FrameProfiler::CpuScope scope(_profiler, "acquire");
+            VkResult result = acquireNextImage(imageIndex);
+            if(result == VK_ERROR_OUT_OF_DATE_KHR) {
+                recreateSwapChain();
+                return;
+            }
+            else if(result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR) {
+                throw std::runtime_error("failed to acquire swap chain image!");
+            }
+        }
 
-        
+        if(_imageFrameValues[imageIndex] != 0) {
+            FrameProfiler::CpuScope scope(_profiler, "wait for image");
+            waitMs += waitForFrames(_imageFrameValues[imageIndex]);
+        }
 
-    }
+        // Time spent blocked on the GPU or the presentation engine doesn't count as CPU frame time
+        auto waitEnd = std::chrono::high_resolution_clock::now();
 
-    void initVulkan() {
-        createInstance();
-        setupDebugMessenger();
-        createSurface();
-        pickPhysicalDevice();
-        createLogicalDevice();
-        createSwapChain();
-        createImageViews();
-        createRenderPass();
-        createDescriptorSetLayout();
-        createGraphicsPipeline();
-        createFramebuffers();
-        createCommandPool();
-        createTextureImage();
-        createVertexBuffer();
-        createIndexBuffer();
-        createUniformBuffers();
-        createDescriptorPool();
-        createDescriptorSets();
-        createCommandBuffers();
-        createSyncObjects();
-    }
+        uint64_t signalValue = static_cast<uint64_t>(_frameCount) + 1;
+        _imageFrameValues[imageIndex] = signalValue;
 
-    void drawFrame() {
-        vkWaitForFences(_device, 1, &_inFlightFences[currentFrame], VK_TRUE, UINT64_MAX);
+        collectCullStats(static_cast<uint32_t>(currentFrame));
+        collectPipelineStats(static_cast<uint32_t>(currentFrame));
+        collectOverdraw(static_cast<uint32_t>(currentFrame));
+        collectMipTime(static_cast<uint32_t>(currentFrame));
 
-        uint32_t imageIndex;
-        vkAcquireNextImageKHR(_device, _swapChain, UINT64_MAX, _imageAvailableSemaphores[currentFrame], VK_NULL_HANDLE, &imageIndex);
+        // The timeline wait above guarantees the GPU is done with this frame's ring slice and command buffer
+        _uniformRing.beginFrame(static_cast<uint32_t>(currentFrame));
+        _frameDescriptors[currentFrame].reset();
+        _uploads.retireFrame(static_cast<uint32_t>(currentFrame));
+        updateInstances(static_cast<uint32_t>(currentFrame));
+        updateStreaming(static_cast<uint32_t>(currentFrame));
 
-        if(_imagesInFlight[imageIndex] != VK_NULL_HANDLE) {
-            vkWaitForFences(_device, 1, &_imagesInFlight[imageIndex], VK_TRUE, UINT64_MAX);
+        FrameCommands& frame = _frameCommands[currentFrame];
+        vkResetCommandPool(_device, frame.pool, 0);
+        for(VkCommandPool workerPool : frame.workerPools) {
+            vkResetCommandPool(_device, workerPool, 0);
         }
 
-        _imagesInFlight[imageIndex] = _inFlightFences[currentFrame];
-
-        updateUniformBuffer(imageIndex);
+        auto recordStart = std::chrono::high_resolution_clock::now();
+        {
+            FrameProfiler::CpuScope scope(_profiler, "record");
+            recordCommandBuffer(frame, imageIndex);
+        }
+        std::chrono::duration<double, std::milli> recordTime = std::chrono::high_resolution_clock::now() - recordStart;
 
         VkSubmitInfo submitInfo{};
         submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
 
-        VkSemaphore waitSemaphores[] = {_imageAvailableSemaphores[currentFrame]};
-        VkPipelineStageFlags waitStages[] = {VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT};
-        submitInfo.waitSemaphoreCount = 1;
-        submitInfo.pWaitSemaphores    = waitSemaphores;
-        submitInfo.pWaitDstStageMask  = waitStages;
+        std::vector<VkSemaphore> waitSemaphores = _uploadWaitSemaphores;
+        std::vector<VkPipelineStageFlags> waitStages = _uploadWaitStages;
+        if(!_options.headless) {
+            waitSemaphores.push_back(_imageAvailableSemaphores[currentFrame]);
+            waitStages.push_back(VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT);
+        }
+        submitInfo.waitSemaphoreCount = static_cast<uint32_t>(waitSemaphores.size());
+        submitInfo.pWaitSemaphores    = waitSemaphores.data();
+        submitInfo.pWaitDstStageMask  = waitStages.data();
         submitInfo.commandBufferCount = 1;
-        submitInfo.pCommandBuffers    = &_commandBuffers[imageIndex];
+        submitInfo.pCommandBuffers    = &frame.primary;
 
-        VkSemaphore signalSemaphores[] = {_renderFinishedSemaphores[currentFrame]};
-        submitInfo.signalSemaphoreCount = 1;
+        // Binary semaphores ignore their value, only the timeline's counts
+        std::vector<uint64_t> waitValues(waitSemaphores.size(), 0);
+        VkSemaphore signalSemaphores[] = {_frameTimeline, _renderFinishedSemaphores[currentFrame]};
+        uint64_t signalValues[]        = {signalValue, 0};
+        submitInfo.signalSemaphoreCount = _options.headless ? 1 : 2;
         submitInfo.pSignalSemaphores    = signalSemaphores;
 
-        vkResetFences(_device, 1, &_inFlightFences[currentFrame]);
+        VkTimelineSemaphoreSubmitInfoKHR timelineInfo{};
+        timelineInfo.sType                     = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO_KHR;
+        timelineInfo.waitSemaphoreValueCount   = static_cast<uint32_t>(waitValues.size());
+        timelineInfo.pWaitSemaphoreValues      = waitValues.data();
+        timelineInfo.signalSemaphoreValueCount = submitInfo.signalSemaphoreCount;
+        timelineInfo.pSignalSemaphoreValues    = signalValues;
+        submitInfo.pNext = &timelineInfo;
+
+        {
+            FrameProfiler::CpuScope scope(_profiler, "submit");
+            std::unique_lock<std::mutex> queueLock = lockQueues();
+            if(vkQueueSubmit(_graphicsQueue, 1, &submitInfo, VK_NULL_HANDLE) != VK_SUCCESS) {
+                throw std::runtime_error("failed to submit draw command buffer!");
+            }
+        }
+
+        auto submitEnd = std::chrono::high_resolution_clock::now();
+        _profiler.submitted(static_cast<uint32_t>(currentFrame), _frameCount);
+
+        if(_options.benchFrames > 0 && _frameCount >= BENCH_WARMUP_FRAMES) {
+            std::chrono::duration<double, std::milli> cpuTime = submitEnd - waitEnd;
+            _cpuFrameTimes.push_back(cpuTime.count());
+            _recordTimes.push_back(recordTime.count());
+            _waitTimes.push_back(waitMs);
 
-        if(vkQueueSubmit(_graphicsQueue, 1, &submitInfo, _inFlightFences[currentFrame]) != VK_SUCCESS) {
-            throw std::runtime_error("failed to submit draw command buffer!");
+            std::chrono::duration<double, std::milli> inputToSubmit = submitEnd - packet.inputTime;
+            _inputToSubmitTimes.push_back(inputToSubmit.count());
         }
+        bool timed = _options.benchFrames > 0 && _frameCount >= BENCH_WARMUP_FRAMES;
+        _frameCount++;
 
-        VkPresentInfoKHR presentInfo{};
-        presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
-        presentInfo.waitSemaphoreCount = 1;
-        presentInfo.pWaitSemaphores    = signalSemaphores;
+        if(_options.headless) {
+            return;
+        }
 
-        VkSwapchainKHR swapChains[] = {_swapChain};
-        presentInfo.swapchainCount  = 1;
-        presentInfo.pSwapchains     = swapChains;
-        presentInfo.pImageIndices   = &imageIndex;
-        presentInfo.pResults        = nullptr;
+        // Frame N is present id N + 1, 0 would mean none
+        uint64_t presentId = _frameCount;
+        _lastPresentSwapChain = _swapChain;
+        if(timed && _presentWait) {
+            timePresent(presentId, packet.inputTime);
+        }
 
-        VkResult result = vkQueuePresentKHR(_presentQueue, &presentInfo);
+        if(_options.presentThread) {
+            queuePresent(imageIndex, presentId);
+            return;
+        }
 
+        VkResult result = present(_swapChain, _renderFinishedSemaphores[currentFrame], imageIndex, presentId);
         if(result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR || framebufferResized) {
             framebufferResized = false;
             recreateSwapChain();
-            return;
         }
         else if(result != VK_SUCCESS) {
-            throw std::runtime_error("failed to acquire swap chain image!");
+            throw std::runtime_error("failed to present swap chain image!");
         }
+    }
 
-        currentFrame = (currentFrame + 1) % MAX_FRAMES_IN_FLIGHT;
+    bool benchFinished() {
+        return _options.benchFrames > 0 && _frameCount >= _options.benchFrames + BENCH_WARMUP_FRAMES;
     }
 
-    void mainLoop() {
+    // Average wall time per frame with count instances, 0 if the window was closed meanwhile
+    double measureInstanceFrameMs(uint32_t count) {
+        createInstances(count);
 
-        while(!glfwWindowShouldClose(_window)) {
-            glfwPollEvents();
+        auto frameStart = std::chrono::high_resolution_clock::now();
+        for(uint32_t i = 0; i < BENCH_WARMUP_FRAMES + INSTANCE_STRESS_FRAMES; i++) {
+            if(i == BENCH_WARMUP_FRAMES) {
+                // Frames are fence paced, so once the queue drained wall time tracks GPU throughput too
+                vkQueueWaitIdle(_graphicsQueue);
+                frameStart = std::chrono::high_resolution_clock::now();
+            }
+            simulate();
+            if(windowClosed()) {
+                return 0.0;
+            }
+            _packets.update();
             drawFrame();
         }
+        vkQueueWaitIdle(_graphicsQueue);
+
+        std::chrono::duration<double, std::milli> elapsed = std::chrono::high_resolution_clock::now() - frameStart;
+        double frameMs = elapsed.count() / INSTANCE_STRESS_FRAMES;
+        std::cerr << "instance stress: " << count << " instances, " << frameMs << " ms/frame\n";
+        return frameMs;
+    }
+
+    // Doubles the instance count until a frame misses the target, then bisects the last step
+    void runInstanceStress() {
+        double targetMs = _options.instanceStressMs;
+        uint32_t best = 0, over = 0;
+        double bestMs = 0.0;
+
+        for(uint32_t count = INSTANCE_STRESS_START; count <= INSTANCE_STRESS_MAX; count *= 2) {
+            double frameMs = measureInstanceFrameMs(count);
+            if(frameMs == 0.0) {
+                return;
+            }
+            if(frameMs > targetMs) {
+                over = count;
+                break;
+            }
+            best   = count;
+            bestMs = frameMs;
+        }
+
+        // Stop once the bracket is within 1/16th of the count, each step costs a full measurement
+        while(over != 0 && over - best > std::max(best, INSTANCE_STRESS_START) / 16) {
+            uint32_t count = best + (over - best) / 2;
+            double frameMs = measureInstanceFrameMs(count);
+            if(frameMs == 0.0) {
+                return;
+            }
+            if(frameMs > targetMs) {
+                over = count;
+            }
+            else {
+                best   = count;
+                bestMs = frameMs;
+            }
+        }
+
+        std::ostringstream json;
+        json << "{\n";
+        json << "  \"device\": " << deviceNameJson() << ",\n";
+        json << "  \"headless\": " << (_options.headless ? "true" : "false") << ",\n";
+        json << "  \"width\": " << _swapChainExtent.width << ",\n";
+        json << "  \"height\": " << _swapChainExtent.height << ",\n";
+        json << "  \"target_ms\": " << targetMs << ",\n";
+        json << "  \"instances\": " << best << ",\n";
+        json << "  \"frame_ms\": " << bestMs << ",\n";
+        json << "  \"instances_per_sec\": " << (bestMs > 0.0 ? best * 1000.0 / bestMs : 0.0) << "\n";
+        json << "}\n";
+
+        writeReport(json.str());
+    }
+
+    void mainLoop() {
+        if(_presentWait && _options.benchFrames > 0) {
+            _presentWaiterRunning = true;
+            _presentWaiter.start(1);
+        }
+
+        if(_options.instanceStressMs > 0.0) {
+            runInstanceStress();
+        }
+        else if(_options.renderThread) {
+            runRenderThread();
+        }
+        else {
+            while(!windowClosed() && !benchFinished()) {
+                _pacingWaitMs = waitForLatencyTarget();
+                simulate();
+                _packets.update();
+                drawFrame();
+            }
+        }
+        _presentWaiter.stop();
+        _presentWaiterRunning = false;
 
         vkDeviceWaitIdle(_device);
+
+        for(uint32_t i=0; i<_framesInFlight; i++) {
+            collectGpuFrameTime(i);
+        }
+        if(_options.benchFrames > 0) {
+            for(uint32_t i=0; i<_framesInFlight; i++) {
+                collectCullStats(i);
+                collectPipelineStats(i);
+                collectOverdraw(i);
+            }
+            writeBenchReport();
+        }
+        _profiler.writeTrace();
     }
 
     void cleanupSwapChain() {
@@ -1606,65 +8512,432 @@ private:
             vkDestroyFramebuffer(_device,_swapChainFramebuffers[i],nullptr);
         }
 
-        vkFreeCommandBuffers(_device,_commandPool,static_cast<uint32_t>(_commandBuffers.size()),_commandBuffers.data());
-        vkDestroyPipeline(_device,_graphicsPipeline,nullptr);
-        vkDestroyPipelineLayout(_device,_pipelineLayout,nullptr);
-        vkDestroyRenderPass(_device,_renderPass,nullptr);
-
         for(size_t i = 0; i<_swapChainImageViews.size(); i++) {
             vkDestroyImageView(_device,_swapChainImageViews[i],nullptr);
         }
 
-        vkDestroySwapchainKHR(_device,_swapChain,nullptr);
-
-        for(size_t i=0; i< _swapChainImages.size(); i++) {
-            vkDestroyBuffer(_device, _uniformBuffers[i], nullptr);
-            vkFreeMemory(_device, _uniformBuffersMemory[i], nullptr);
+        if(_options.headless) {
+            for(size_t i=0; i<_swapChainImages.size(); i++) {
+                destroyImage(_swapChainImages[i], _offscreenImagesAllocation[i]);
+            }
+        }
+        else {
+            vkDestroySwapchainKHR(_device,_swapChain,nullptr);
         }
-
-        vkDestroyDescriptorPool(_device, _descriptorPool, nullptr);
     }
 
     void cleanup() {
 
+        runDeferredDestroys(true);
         cleanupSwapChain();
 
-        vkDestroyImage(_device, _textureImage, nullptr);
-        vkFreeMemory(_device, _textureImageMemory, nullptr);
+        _pipelineCompiler.stop();
+        _profiler.destroy();
+        for(auto& [key, variant] : _pipelines) {
+            vkDestroyPipeline(_device, variant.pipeline, nullptr);
+        }
+        vkDestroyPipelineLayout(_device,_pipelineLayout,nullptr);
+        if(_cullPipeline != VK_NULL_HANDLE) {
+            vkDestroyPipelineLayout(_device, _cullPipelineLayout, nullptr);
+        }
+        vkDestroyRenderPass(_device,_renderPass,nullptr);
+
+        vkDestroySampler(_device, _textureSampler, nullptr);
+        vkDestroyImageView(_device, _textureImageView, nullptr);
+        destroyImage(_textureImage, _textureImageAllocation);
+
+        dumpStreamStats(std::cerr);
+        for(StreamedTexture& texture : _streamTextures) {
+            vkDestroyImageView(_device, texture.tailView, nullptr);
+            destroyImage(texture.tailImage, texture.tailAllocation);
+            if(texture.image != VK_NULL_HANDLE) {
+                vkDestroyImageView(_device, texture.view, nullptr);
+                destroyImage(texture.image, texture.allocation);
+            }
+            if(texture.pendingImage != VK_NULL_HANDLE) {
+                vkDestroyImageView(_device, texture.pendingView, nullptr);
+                destroyImage(texture.pendingImage, texture.pendingAllocation);
+            }
+        }
+        for(size_t i=0; i<_streamFeedbackBuffers.size(); i++) {
+            destroyBuffer(_streamFeedbackBuffers[i], _streamFeedbackAllocations[i]);
+        }
+        if(_streamPipelineLayout != VK_NULL_HANDLE) {
+            vkDestroyPipelineLayout(_device, _streamPipelineLayout, nullptr);
+        }
+        if(_streamSampler != VK_NULL_HANDLE) {
+            vkDestroySampler(_device, _streamSampler, nullptr);
+        }
+
+        for(MipJob& job : _mipJobs) {
+            destroyMipJob(job);
+        }
+        for(MipJob& job : _mipJobsInFlight) {
+            destroyMipJob(job);
+        }
+        if(_mipPipeline != VK_NULL_HANDLE) {
+            vkDestroyPipelineLayout(_device, _mipPipelineLayout, nullptr);
+            destroyBuffer(_mipCounterBuffer, _mipCounterBufferAllocation);
+        }
+        if(_mipQueryPool != VK_NULL_HANDLE) {
+            vkDestroyQueryPool(_device, _mipQueryPool, nullptr);
+        }
+
+        for(size_t i=0; i<_instanceBuffers.size(); i++) {
+            if(_instanceBuffers[i] != VK_NULL_HANDLE) {
+                destroyBuffer(_instanceBuffers[i], _instanceBuffersAllocation[i]);
+            }
+        }
+
+        dumpCullStats(std::cerr);
+        dumpFrameAnalysis(std::cerr);
+        if(_statsQueryPool != VK_NULL_HANDLE) {
+            vkDestroyQueryPool(_device, _statsQueryPool, nullptr);
+        }
+        if(_overdrawImage != VK_NULL_HANDLE) {
+            vkDestroyFramebuffer(_device, _overdrawFramebuffer, nullptr);
+            vkDestroyRenderPass(_device, _overdrawRenderPass, nullptr);
+            vkDestroyImageView(_device, _overdrawImageView, nullptr);
+            destroyImage(_overdrawImage, _overdrawImageAllocation);
+            for(size_t i=0; i<_overdrawHistogramBuffers.size(); i++) {
+                destroyBuffer(_overdrawHistogramBuffers[i], _overdrawHistogramAllocations[i]);
+            }
+            vkDestroyPipelineLayout(_device, _overdrawPipelineLayout, nullptr);
+        }
+        for(size_t i=0; i<_cullCommandBuffers.size(); i++) {
+            destroyBuffer(_cullCommandBuffers[i], _cullCommandBuffersAllocation[i]);
+            destroyBuffer(_cullCountBuffers[i], _cullCountBuffersAllocation[i]);
+        }
+        if(_cullObjectBuffer != VK_NULL_HANDLE) {
+            destroyBuffer(_cullObjectBuffer, _cullObjectBufferAllocation);
+            destroyBuffer(_cullBoundsBuffer, _cullBoundsBufferAllocation);
+        }
+
+        _uniformRing.dumpStats(std::cerr);
+        _uploads.dumpStats(std::cerr);
+        _uploads.destroy();
+        _uniformRing.destroy(_allocator);
 
-        vkDestroyDescriptorSetLayout(_device, _descriptorSetLayout, nullptr);
+        _descriptors.dumpStats(std::cerr);
+        _descriptors.destroy();
+        for(DescriptorAllocator& allocator : _frameDescriptors) {
+            if(allocator.poolCount() > 0) {
+                allocator.dumpStats(std::cerr, "frame descriptors");
+            }
+            allocator.destroy();
+        }
 
-        vkDestroyBuffer(_device, _indexBuffer, nullptr);
-        vkFreeMemory(_device, _indexBufferMemory, nullptr);
+        _pipelineCache.save();
+        _pipelineCache.destroy();
 
-        vkDestroyBuffer(_device, _vertexBuffer, nullptr);
-        vkFreeMemory(_device, _vertexBufferMemory, nullptr);
+        destroyBuffer(_indexBuffer, _indexBufferAllocation);
+        destroyBuffer(_vertexBuffer, _vertexBufferAllocation);
+        if(_positionBuffer != VK_NULL_HANDLE) {
+            destroyBuffer(_positionBuffer, _positionBufferAllocation);
+        }
 
-        for(size_t i=0; i<MAX_FRAMES_IN_FLIGHT; i++) {
+        for(size_t i=0; i<_framesInFlight; i++) {
             vkDestroySemaphore(_device, _renderFinishedSemaphores[i], nullptr);
             vkDestroySemaphore(_device, _imageAvailableSemaphores[i], nullptr);
-            vkDestroyFence(_device, _inFlightFences[i], nullptr);
         }
+        vkDestroySemaphore(_device, _frameTimeline, nullptr);
+
+        _recordWorkers.stop();
+        for(FrameCommands& frame : _frameCommands) {
+            vkDestroyCommandPool(_device, frame.pool, nullptr);
+            for(VkCommandPool workerPool : frame.workerPools) {
+                vkDestroyCommandPool(_device, workerPool, nullptr);
+            }
+        }
+
+        _allocator.dumpStats(std::cerr);
+        _allocator.destroy();
 
-        vkDestroyCommandPool(_device, _commandPool, nullptr);
         vkDestroyDevice(_device, nullptr);
         
         if(enableValidationLayers) {
             DestroyDebugUtilsMessengerEXT(_instance, _debugMessenger, nullptr);
         }
 
-        vkDestroySurfaceKHR(_instance, _surface, nullptr);
+        if(!_options.headless) {
+            vkDestroySurfaceKHR(_instance, _surface, nullptr);
+        }
         vkDestroyInstance(_instance, nullptr);
 
-        glfwDestroyWindow(_window);
-        glfwTerminate();
+        if(!_options.headless) {
+            glfwDestroyWindow(_window);
+            glfwTerminate();
+        }
     }
 };
 
-int main() {
-    HelloTriangleApplication app;
+static void printUsage(const char* program) {
+    std::cerr << "usage: " << program << " [--headless] [--frames N] [--size WxH] [--device NAME] [--json PATH] [--trace PATH] [--pipeline-stats] [--overdraw] [--pipeline-cache PATH] [--shader-cache DIR] [--watch-shaders] [--draws N] [--variants N] [--pipeline-fallback generic|skip|sync] [--hitch-ms MS] [--frames-in-flight N] [--render-thread] [--present-thread] [--sim-hz N] [--present-mode M] [--swapchain-images N] [--low-latency] [--threads N] [--instances N] [--instance-stress MS] [--gpu-cull N] [--mesh PATH] [--vertex-format float|packed|half] [--position-only] [--untextured] [--mips compute|blit|cpu|off] [--texture PATH] [--texture-staging] [--init-threads N] [--stream-textures N] [--stream-budget MB]\n"
+              << "  --headless     render into offscreen images, no window needed\n"
+              << "  --frames N     render N frames (after " << BENCH_WARMUP_FRAMES << " warm-up frames) and report frame times\n"
+              << "  --size WxH     offscreen image size in headless mode\n"
+              << "  --device NAME  use the first device whose name contains NAME, e.g. llvmpipe\n"
+              << "  --json PATH    write the frame time report to PATH instead of stdout\n"
+              << "  --trace PATH   write CPU and GPU scopes of every frame to PATH for chrome://tracing or Perfetto\n"
+              << "  --pipeline-stats  count vertex, clipping and fragment work of the render pass per frame\n"
+              << "  --overdraw     draw the draw list a second time into an additive target and report how often pixels are drawn\n"
+              << "  --pipeline-cache PATH  load/save the pipeline cache at PATH, \"\" to disable (default pipeline_cache.bin)\n"
+              << "  --shader-cache DIR  keep compiled SPIR-V in DIR, \"\" to always compile (default shader_cache)\n"
+              << "  --watch-shaders  rebuild the pipelines using a shader whenever it is saved\n"
+              << "  --draws N      draw N quads per frame, each with its own uniforms\n"
+              << "  --variants N   spread the quads over N pipeline variants, one more enters the scene every " << VARIANT_APPEAR_FRAMES << " frames\n"
+              << "  --pipeline-fallback F  while a variant is created in the background draw its quads with the base pipeline (generic),\n"
+              << "                 not at all (skip), or create it on the spot like before (sync)\n"
+              << "  --hitch-ms MS  CPU frame time that counts as a hitch in the report (default " << DEFAULT_HITCH_MS << ")\n"
+              << "  --frames-in-flight N  let the CPU run up to N frames ahead of the GPU, 1 to " << MAX_FRAMES_IN_FLIGHT << " (default " << DEFAULT_FRAMES_IN_FLIGHT << ")\n"
+              << "  --render-thread  simulate on the main thread and record and submit on a render thread, fed through frame packets\n"
+              << "  --present-thread  also call vkQueuePresentKHR on a thread of its own (implies --render-thread)\n"
+              << "  --sim-hz N     simulation steps per second with a render thread, 0 for as many as it manages (default " << DEFAULT_SIM_HZ << ")\n"
+              << "  --present-mode M  fifo, fifo-relaxed, mailbox (default, fifo where unsupported) or immediate\n"
+              << "  --swapchain-images N  ask for N swapchain images instead of the surface's minimum + 1\n"
+              << "  --low-latency  start each frame only once the previous one is on screen (VK_KHR_present_wait) or done on the GPU\n"
+              << "  --threads N    record secondary command buffers on N threads, 0 records inline (default: one per core)\n"
+              << "  --instances N  draw N textured quads with a single instanced draw instead of the draw list\n"
+              << "  --instance-stress MS  find the largest instance count that renders within MS per frame\n"
+              << "  --gpu-cull N   frustum cull N static objects in a compute pass and draw the survivors indirectly\n"
+              << "  --mesh PATH    draw a .vmesh (see tools/meshconv) instead of the built-in quad\n"
+              << "  --vertex-format F  repack vertices to float (32 bytes), packed (snorm16/unorm8/half, 16 bytes) or half (16 bytes)\n"
+              << "  --position-only  draw list fetches an 8 byte position stream and nothing else, like a depth pass\n"
+              << "  --untextured   instanced and culled scenes use a variant without texture sampling\n"
+              << "  --mips M       build the texture's mip chain with a compute pass (default), blits, on the CPU, or not at all\n"
+              << "  --texture PATH  load a .ktx2 (see tools/texconv) with its prebuilt levels, or decode any other image\n"
+              << "  --texture-staging  always upload decoded textures through staging, even where the host could write them directly\n"
+              << "  --init-threads N  helper threads for the startup steps, 0 runs them all on the main thread (default: one per core, up to 7)\n"
+              << "  --stream-textures N  fly over N quads with a streamed 1024x1024 texture each (up to 256), finer levels load on demand\n"
+              << "  --stream-budget MB  keep the streamed textures within MB, below what VK_EXT_memory_budget would allow\n";
+}
+
+static AppOptions parseOptions(int argc, char** argv) {
+    AppOptions options;
+
+    for(int i=1; i<argc; i++) {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+
+        if(arg == "--headless") {
+            options.headless = true;
+        }
+        else if(arg == "--frames" && hasValue) {
+            options.benchFrames = static_cast<uint32_t>(std::stoul(argv[++i]));
+        }
+        else if(arg == "--size" && hasValue) {
+            std::string size = argv[++i];
+            size_t x = size.find('x');
+            if(x == std::string::npos) {
+                throw std::invalid_argument("--size expects WxH, got " + size);
+            }
+            options.width  = static_cast<uint32_t>(std::stoul(size.substr(0, x)));
+            options.height = static_cast<uint32_t>(std::stoul(size.substr(x + 1)));
+        }
+        else if(arg == "--device" && hasValue) {
+            options.deviceFilter = argv[++i];
+        }
+        else if(arg == "--json" && hasValue) {
+            options.jsonPath = argv[++i];
+        }
+        else if(arg == "--trace" && hasValue) {
+            options.tracePath = argv[++i];
+        }
+        else if(arg == "--pipeline-stats") {
+            options.pipelineStats = true;
+        }
+        else if(arg == "--overdraw") {
+            options.overdraw = true;
+        }
+        else if(arg == "--pipeline-cache" && hasValue) {
+            options.pipelineCachePath = argv[++i];
+        }
+        else if(arg == "--shader-cache" && hasValue) {
+            options.shaderCacheDir = argv[++i];
+        }
+        else if(arg == "--watch-shaders") {
+            options.watchShaders = true;
+        }
+        else if(arg == "--draws" && hasValue) {
+            options.drawCount = static_cast<uint32_t>(std::max(1ul, std::stoul(argv[++i])));
+        }
+        else if(arg == "--threads" && hasValue) {
+            options.recordThreads = std::stoi(argv[++i]);
+        }
+        else if(arg == "--instances" && hasValue) {
+            options.instanceCount = static_cast<uint32_t>(std::stoul(argv[++i]));
+        }
+        else if(arg == "--instance-stress" && hasValue) {
+            options.instanceStressMs = std::stod(argv[++i]);
+        }
+        else if(arg == "--gpu-cull" && hasValue) {
+            options.cullObjectCount = static_cast<uint32_t>(std::stoul(argv[++i]));
+        }
+        else if(arg == "--mesh" && hasValue) {
+            options.meshPath = argv[++i];
+        }
+        else if(arg == "--vertex-format" && hasValue) {
+            std::string format = argv[++i];
+            if(format == "float") {
+                options.vertexFormat = VertexFormat::Float;
+            }
+            else if(format == "packed") {
+                options.vertexFormat = VertexFormat::Packed;
+            }
+            else if(format == "half") {
+                options.vertexFormat = VertexFormat::Half;
+            }
+            else {
+                throw std::invalid_argument("--vertex-format expects float, packed or half, got " + format);
+            }
+        }
+        else if(arg == "--position-only") {
+            options.positionOnly = true;
+        }
+        else if(arg == "--untextured") {
+            options.untextured = true;
+        }
+        else if(arg == "--texture" && hasValue) {
+            options.texturePath = argv[++i];
+        }
+        else if(arg == "--texture-staging") {
+            options.textureStaging = true;
+        }
+        else if(arg == "--init-threads" && hasValue) {
+            options.initThreads = std::stoi(argv[++i]);
+        }
+        else if(arg == "--stream-textures" && hasValue) {
+            options.streamTextureCount = static_cast<uint32_t>(std::stoul(argv[++i]));
+            if(options.streamTextureCount > MAX_STREAM_TEXTURES) {
+                throw std::invalid_argument("--stream-textures supports up to " + std::to_string(MAX_STREAM_TEXTURES) + " textures");
+            }
+        }
+        else if(arg == "--stream-budget" && hasValue) {
+            options.streamBudgetMB = static_cast<uint32_t>(std::stoul(argv[++i]));
+        }
+        else if(arg == "--variants" && hasValue) {
+            options.drawVariants = static_cast<uint32_t>(std::stoul(argv[++i]));
+            if(options.drawVariants < 1 || options.drawVariants > MAX_DRAW_VARIANTS) {
+                throw std::invalid_argument("--variants expects 1 to " + std::to_string(MAX_DRAW_VARIANTS));
+            }
+        }
+        else if(arg == "--pipeline-fallback" && hasValue) {
+            std::string fallback = argv[++i];
+            if(fallback == "generic") {
+                options.pipelineFallback = PipelineFallback::Generic;
+            }
+            else if(fallback == "skip") {
+                options.pipelineFallback = PipelineFallback::Skip;
+            }
+            else if(fallback == "sync") {
+                options.pipelineFallback = PipelineFallback::Sync;
+            }
+            else {
+                throw std::invalid_argument("--pipeline-fallback expects generic, skip or sync, got " + fallback);
+            }
+        }
+        else if(arg == "--hitch-ms" && hasValue) {
+            options.hitchMs = std::stod(argv[++i]);
+        }
+        else if(arg == "--render-thread") {
+            options.renderThread = true;
+        }
+        else if(arg == "--present-thread") {
+            options.renderThread  = true;
+            options.presentThread = true;
+        }
+        else if(arg == "--sim-hz" && hasValue) {
+            options.simHz = static_cast<uint32_t>(std::stoul(argv[++i]));
+        }
+        else if(arg == "--present-mode" && hasValue) {
+            std::string mode = argv[++i];
+            if(mode == "fifo") {
+                options.presentMode = VK_PRESENT_MODE_FIFO_KHR;
+            }
+            else if(mode == "fifo-relaxed") {
+                options.presentMode = VK_PRESENT_MODE_FIFO_RELAXED_KHR;
+            }
+            else if(mode == "mailbox") {
+                options.presentMode = VK_PRESENT_MODE_MAILBOX_KHR;
+            }
+            else if(mode == "immediate") {
+                options.presentMode = VK_PRESENT_MODE_IMMEDIATE_KHR;
+            }
+            else {
+                throw std::invalid_argument("--present-mode expects fifo, fifo-relaxed, mailbox or immediate, got " + mode);
+            }
+        }
+        else if(arg == "--swapchain-images" && hasValue) {
+            options.swapchainImages = static_cast<uint32_t>(std::stoul(argv[++i]));
+        }
+        else if(arg == "--low-latency") {
+            options.lowLatency = true;
+        }
+        else if(arg == "--frames-in-flight" && hasValue) {
+            options.framesInFlight = static_cast<uint32_t>(std::stoul(argv[++i]));
+            if(options.framesInFlight < 1 || options.framesInFlight > MAX_FRAMES_IN_FLIGHT) {
+                throw std::invalid_argument("--frames-in-flight expects 1 to " + std::to_string(MAX_FRAMES_IN_FLIGHT));
+            }
+        }
+        else if(arg == "--mips" && hasValue) {
+            std::string mode = argv[++i];
+            if(mode == "compute") {
+                options.mipMode = MipMode::Compute;
+            }
+            else if(mode == "blit") {
+                options.mipMode = MipMode::Blit;
+            }
+            else if(mode == "cpu") {
+                options.mipMode = MipMode::Cpu;
+            }
+            else if(mode == "off") {
+                options.mipMode = MipMode::Off;
+            }
+            else {
+                throw std::invalid_argument("--mips expects compute, blit, cpu or off, got " + mode);
+            }
+        }
+        else {
+            printUsage(argv[0]);
+            throw std::invalid_argument("unknown argument " + arg);
+        }
+    }
+
+    // The streaming scene is an instance grid with one texture per instance
+    if(options.streamTextureCount > 0) {
+        if(options.cullObjectCount > 0 || options.instanceStressMs > 0.0) {
+            throw std::invalid_argument("--stream-textures can't be combined with --gpu-cull or --instance-stress");
+        }
+        options.instanceCount = std::max(options.instanceCount, options.streamTextureCount);
+    }
+
+    // Variants are a draw list feature, the position-only draw list has just the one
+    if(options.drawVariants > 1 && (options.instanceCount > 0 || options.cullObjectCount > 0 || options.positionOnly)) {
+        throw std::invalid_argument("--variants only applies to the draw list, not to --instances, --gpu-cull or --position-only");
+    }
+
+    if(options.overdraw && (options.instanceCount > 0 || options.cullObjectCount > 0 || options.streamTextureCount > 0)) {
+        throw std::invalid_argument("--overdraw analyzes the draw list, not --instances, --gpu-cull or --stream-textures");
+    }
+
+    if(options.presentThread && options.headless) {
+        throw std::invalid_argument("--present-thread needs a window to present to");
+    }
+    if(options.renderThread && options.instanceStressMs > 0.0) {
+        throw std::invalid_argument("--instance-stress changes the scene between frames, it runs without --render-thread");
+    }
+
+    // Headless runs always end, so they always report. The instance stress run ends on its own.
+    if(options.headless && options.benchFrames == 0 && options.instanceStressMs <= 0.0) {
+        options.benchFrames = DEFAULT_BENCH_FRAMES;
+    }
+
+    return options;
+}
 
+int main(int argc, char** argv) {
     try {
+        HelloTriangleApplication app(parseOptions(argc, argv));
         app.run();
     } catch(const std::exception& e) {
         std::cerr << e.what() << std::endl;
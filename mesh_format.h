@@ -0,0 +1,97 @@
+#pragma once
+
+// .vmesh, the binary mesh container written by tools/meshconv and mmap'd by the renderer
+//
+//   MeshFileHeader
+//   MeshAttribute  x attributeCount     vertex layout of the interleaved vertex stream
+//   MeshSubmesh    x submeshCount       index ranges with their bounds
+//   vertex data                         vertexCount * vertexStride bytes
+//   index data                          indexCount * indexSize bytes, 16 or 32 bit
+//
+// All offsets are from the start of the file, the vertex and index data start on MESH_DATA_ALIGNMENT.
+// Fields are little endian. Bump MESH_FILE_VERSION on any layout change, readers reject other versions.
+// Adding an attribute format is not a layout change, readers reject formats they don't know.
+//
+// SNORM16X4 positions are relative to the mesh's bounding box: position = center + value * halfExtent.
+
+#include <cstdint>
+
+const uint32_t MESH_FILE_MAGIC     = 0x48534d56;    // "VMSH"
+const uint32_t MESH_FILE_VERSION   = 1;
+const uint32_t MESH_DATA_ALIGNMENT = 16;
+
+enum MeshAttributeSemantic : uint32_t {
+    MESH_ATTRIBUTE_POSITION = 0,
+    MESH_ATTRIBUTE_COLOR    = 1,
+    MESH_ATTRIBUTE_TEXCOORD = 2,
+    MESH_ATTRIBUTE_NORMAL   = 3,
+};
+
+enum MeshAttributeFormat : uint32_t {
+    MESH_FORMAT_FLOAT2 = 0,
+    MESH_FORMAT_FLOAT3 = 1,
+    MESH_FORMAT_FLOAT4 = 2,
+    MESH_FORMAT_SNORM16X4 = 3,      // w is unused
+    MESH_FORMAT_HALF4     = 4,      // w is unused
+    MESH_FORMAT_HALF2     = 5,
+    MESH_FORMAT_UNORM8X4  = 6,
+    MESH_FORMAT_OCT16     = 7,      // octahedral unit vector as two snorm16s
+};
+
+struct MeshAttribute {
+    uint32_t semantic;          // MeshAttributeSemantic
+    uint32_t format;            // MeshAttributeFormat
+    uint32_t offset;            // within a vertex
+    uint32_t reserved;
+};
+
+struct MeshSubmesh {
+    uint32_t firstIndex;
+    uint32_t indexCount;
+    int32_t vertexOffset;       // added to every index of the submesh
+    uint32_t reserved;
+    float boundsMin[3];
+    float boundsMax[3];
+};
+
+struct MeshFileHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t headerSize;        // sizeof(MeshFileHeader) of the writer
+    uint32_t vertexStride;
+    uint32_t vertexCount;
+    uint32_t indexCount;
+    uint32_t indexSize;         // 2 or 4, 4 only when a 16 bit index can't address every vertex
+    uint32_t attributeCount;
+    uint32_t submeshCount;
+    uint32_t reserved;
+    uint64_t attributesOffset;
+    uint64_t submeshesOffset;
+    uint64_t vertexDataOffset;
+    uint64_t indexDataOffset;
+    float boundsMin[3];         // of the whole mesh
+    float boundsMax[3];
+};
+
+static_assert(sizeof(MeshAttribute) == 16, "MeshAttribute layout is part of the file format");
+static_assert(sizeof(MeshSubmesh) == 40, "MeshSubmesh layout is part of the file format");
+static_assert(sizeof(MeshFileHeader) == 96, "MeshFileHeader layout is part of the file format");
+
+inline uint32_t meshAttributeFormatSize(uint32_t format) {
+    switch(format) {
+        case MESH_FORMAT_FLOAT2: return 8;
+        case MESH_FORMAT_FLOAT3: return 12;
+        case MESH_FORMAT_FLOAT4: return 16;
+        case MESH_FORMAT_SNORM16X4: return 8;
+        case MESH_FORMAT_HALF4:     return 8;
+        case MESH_FORMAT_HALF2:     return 4;
+        case MESH_FORMAT_UNORM8X4:  return 4;
+        case MESH_FORMAT_OCT16:     return 4;
+        default:                 return 0;
+    }
+}
+
+// 0xffff stays free so 16 bit meshes can use primitive restart later on
+inline uint32_t meshIndexSizeFor(uint32_t vertexCount) {
+    return vertexCount < 0xffff ? 2 : 4;
+}
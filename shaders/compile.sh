@@ -1,4 +1,13 @@
 #!/bin/sh
 
 glslc shader.vert -o vert.spv
-glslc shader.frag -o frag.spv
\ No newline at end of file
+glslc shader.frag -o frag.spv
+glslc instanced.vert -o instanced_vert.spv
+glslc instanced.frag -o instanced_frag.spv
+glslc cull.comp -o cull_comp.spv
+glslc -DPOSITION_ONLY shader.vert -o position_vert.spv
+glslc -DPOSITION_ONLY shader.frag -o position_frag.spv
+glslc mipgen.comp -o mipgen_comp.spv
+glslc streamed.frag -o streamed_frag.spv
+glslc -DOVERDRAW shader.frag -o overdraw_frag.spv
+glslc overdraw.comp -o overdraw_comp.spv
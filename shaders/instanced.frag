@@ -0,0 +1,20 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+// Off in the untextured variant, the sampling is compiled out
+layout(constant_id = 0) const bool TEXTURED = true;
+
+layout(binding = 1) uniform sampler2DArray texSampler;
+
+layout(location = 0) in vec3 fragColor;
+layout(location = 1) in vec3 fragTexCoord;
+
+layout(location = 0) out vec4 outColor;
+
+void main() {
+    vec3 color = fragColor;
+    if(TEXTURED) {
+        color *= texture(texSampler, fragTexCoord).rgb;
+    }
+    outColor = vec4(color, 1.0);
+}
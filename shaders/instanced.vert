@@ -0,0 +1,34 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+layout(binding = 0) uniform UniformBufferObject {
+    mat4 model;
+    mat4 view;
+    mat4 proj;
+} ubo;
+
+// Per vertex
+layout(location = 0) in vec3 inPosition;
+layout(location = 1) in vec3 inColor;
+layout(location = 2) in vec2 inTexCoord;
+
+// Per instance, the transform is the top three rows of the instance's model matrix
+layout(location = 3) in vec4 inTransformRow0;
+layout(location = 4) in vec4 inTransformRow1;
+layout(location = 5) in vec4 inTransformRow2;
+layout(location = 6) in vec4 inInstanceColor;
+layout(location = 7) in uint inTextureIndex;
+
+layout(location = 0) out vec3 fragColor;
+layout(location = 1) out vec3 fragTexCoord;
+
+void main() {
+    vec4 position = vec4(inPosition, 1.0);
+    vec3 world = vec3(dot(inTransformRow0, position),
+                      dot(inTransformRow1, position),
+                      dot(inTransformRow2, position));
+
+    gl_Position  = ubo.proj * ubo.view * ubo.model * vec4(world, 1.0);
+    fragColor    = inColor * inInstanceColor.rgb;
+    fragTexCoord = vec3(inTexCoord, float(inTextureIndex));
+}
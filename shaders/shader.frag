@@ -1,10 +1,29 @@
 #version 450
 #extension GL_ARB_separate_shader_objects : enable
 
+#if !defined(POSITION_ONLY) && !defined(OVERDRAW)
 layout(location = 0) in vec3 fragColor;
+#endif
 
 layout(location = 0) out vec4 outColor;
 
+// Draw list pipeline variant, the ones past 0 tint the color so each is a pipeline of its own
+layout(constant_id = 0) const uint VARIANT = 0;
+
+vec3 variantTint(uint variant) {
+    float hue = fract(float(variant) * 0.618034);
+    return clamp(abs(fract(hue + vec3(0.0, 2.0, 1.0) / 3.0) * 6.0 - 3.0) - 1.0, 0.0, 1.0);
+}
+
 void main() {
-    outColor = vec4(fragColor, 1.0);
-}
\ No newline at end of file
+#if defined(OVERDRAW)
+    // One per layer, the overdraw target's additive blending counts them
+    outColor = vec4(1.0);
+#elif defined(POSITION_ONLY)
+    // Stands in for a depth-only pass, there's no depth attachment to write to
+    outColor = vec4(vec3(gl_FragCoord.z), 1.0);
+#else
+    vec3 color = VARIANT == 0 ? fragColor : mix(fragColor, variantTint(VARIANT), 0.5);
+    outColor = vec4(color, 1.0);
+#endif
+}
@@ -1,18 +1,26 @@
 #version 450
 #extension GL_ARB_separate_shader_objects : enable
 
+// POSITION_ONLY: the variant reading nothing but an 8 byte position stream, like a depth pass would
+
 layout(binding = 0) uniform UniformBufferObject {
     mat4 model;
     mat4 view;
     mat4 proj;
 } ubo;
 
-layout(location = 0) in vec2 inPosition;
+// With POSITION_ONLY snorm16 relative to the mesh bounds, ubo.model decodes it
+layout(location = 0) in vec3 inPosition;
+
+#ifndef POSITION_ONLY
 layout(location = 1) in vec3 inColor;
 
 layout(location = 0) out vec3 fragColor;
+#endif
 
 void main() {
-    gl_Position = ubo.proj * ubo.view * ubo.model * vec4(inPosition, 0.0, 1.0);
+    gl_Position = ubo.proj * ubo.view * ubo.model * vec4(inPosition, 1.0);
+#ifndef POSITION_ONLY
     fragColor = inColor;
-}
\ No newline at end of file
+#endif
+}
@@ -0,0 +1,43 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+// Streamed textures, one per instance and every instance drawn on its own, so the texture index
+// is dynamically uniform. Each view starts at the finest level that is resident, so sampling
+// simply falls back to a coarser level until the finer ones have been streamed in.
+// The renderer passes both sizes as defines, the defaults are for compiling it offline.
+#ifndef MAX_STREAM_TEXTURES
+#define MAX_STREAM_TEXTURES 256
+#endif
+#ifndef STREAM_TEXTURE_SIZE
+#define STREAM_TEXTURE_SIZE 1024.0
+#endif
+
+layout(set = 1, binding = 0) uniform sampler2D textures[MAX_STREAM_TEXTURES];
+
+// Finest level of the full texture each one was sampled at this frame, 0xffffffff if it wasn't,
+// read back and reset by the CPU
+layout(std430, set = 1, binding = 1) buffer Feedback {
+    uint requestedLevel[];
+};
+
+layout(location = 0) in vec3 fragColor;
+layout(location = 1) in vec3 fragTexCoord;
+
+layout(location = 0) out vec4 outColor;
+
+void main() {
+    uint index = uint(fragTexCoord.z + 0.5);
+
+    // The level hardware would pick for the full texture, the views' own sizes depend on residency
+    vec2 texel = fragTexCoord.xy * STREAM_TEXTURE_SIZE;
+    vec2 dx = dFdx(texel);
+    vec2 dy = dFdy(texel);
+    float level = 0.5 * log2(max(dot(dx, dx), dot(dy, dy)));
+
+    // One pixel in 8x8 is plenty and keeps the atomics off the critical path
+    if(((uint(gl_FragCoord.x) | uint(gl_FragCoord.y)) & 7u) == 0u) {
+        atomicMin(requestedLevel[index], uint(max(level, 0.0)));
+    }
+
+    outColor = vec4(fragColor * texture(textures[index], fragTexCoord.xy).rgb, 1.0);
+}
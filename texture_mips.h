@@ -0,0 +1,68 @@
+#pragma once
+
+// CPU mip chain of RGBA8 or RGB8 sRGB images, used by the renderer's --mips cpu path and by tools/texconv
+
+#include <cstdint>
+#include <cmath>
+#include <vector>
+#include <algorithm>
+
+inline uint32_t mipLevelCount(uint32_t width, uint32_t height) {
+    uint32_t levels = 1;
+    while((std::max(width, height) >> levels) > 0) {
+        levels++;
+    }
+    return levels;
+}
+
+// Box filtered chain in linear space, level after level with the layers of each level packed.
+// channels is 4 (alpha averaged as is) or 3.
+inline std::vector<uint8_t> buildMipChain(const std::vector<uint8_t>& base, uint32_t width, uint32_t height,
+                                          uint32_t layers, uint32_t levels, uint32_t channels = 4) {
+    float toLinear[256];
+    for(int i = 0; i < 256; i++) {
+        float c = i / 255.0f;
+        toLinear[i] = c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+    }
+    std::vector<uint8_t> toSrgb(4096);
+    for(size_t i = 0; i < toSrgb.size(); i++) {
+        float c = i / float(toSrgb.size() - 1);
+        c = c <= 0.0031308f ? c * 12.92f : 1.055f * std::pow(c, 1.0f / 2.4f) - 0.055f;
+        toSrgb[i] = static_cast<uint8_t>(std::lround(c * 255.0f));
+    }
+
+    std::vector<uint8_t> chain(base);
+    size_t source = 0;
+    for(uint32_t level = 1; level < levels; level++) {
+        uint32_t srcWidth  = std::max(width >> (level - 1), 1u), srcHeight = std::max(height >> (level - 1), 1u);
+        uint32_t dstWidth  = std::max(width >> level, 1u),       dstHeight = std::max(height >> level, 1u);
+        size_t destination = chain.size();
+        chain.resize(destination + size_t(dstWidth) * dstHeight * channels * layers);
+
+        for(uint32_t layer = 0; layer < layers; layer++) {
+            const uint8_t* src = chain.data() + source + size_t(srcWidth) * srcHeight * channels * layer;
+            uint8_t* dst       = chain.data() + destination + size_t(dstWidth) * dstHeight * channels * layer;
+
+            for(uint32_t y = 0; y < dstHeight; y++) {
+                // Odd sizes repeat their last row and column, like shaders/mipgen.comp
+                uint32_t y0 = std::min(2 * y, srcHeight - 1), y1 = std::min(2 * y + 1, srcHeight - 1);
+                for(uint32_t x = 0; x < dstWidth; x++) {
+                    uint32_t x0 = std::min(2 * x, srcWidth - 1), x1 = std::min(2 * x + 1, srcWidth - 1);
+                    const uint8_t* texels[4] = {&src[(y0 * srcWidth + x0) * channels], &src[(y0 * srcWidth + x1) * channels],
+                                                &src[(y1 * srcWidth + x0) * channels], &src[(y1 * srcWidth + x1) * channels]};
+                    uint8_t* out = &dst[(y * dstWidth + x) * channels];
+                    for(int c = 0; c < 3; c++) {
+                        float sum = toLinear[texels[0][c]] + toLinear[texels[1][c]] + toLinear[texels[2][c]] + toLinear[texels[3][c]];
+                        out[c] = toSrgb[static_cast<size_t>(sum * 0.25f * (toSrgb.size() - 1) + 0.5f)];
+                    }
+                    if(channels == 4) {
+                        out[3] = static_cast<uint8_t>((texels[0][3] + texels[1][3] + texels[2][3] + texels[3][3] + 2) / 4);
+                    }
+                }
+            }
+        }
+        source = destination;
+    }
+
+    return chain;
+}
@@ -0,0 +1,809 @@
+// Offline converter from Wavefront OBJ or glTF 2.0 (.gltf/.glb) to the .vmesh container in mesh_format.h
+//
+//   meshconv [--packed] input.obj|input.gltf|input.glb|--sphere SEGMENTS output.vmesh
+//
+// Every vertex is written as position (float3), color (float3) and texcoord (float2), the layout of the
+// renderer's Vertex struct. --packed writes the renderer's PackedVertexLayout instead: position snorm16x4
+// relative to the bounds, color unorm8x4 and texcoord half2, 16 bytes instead of 32.
+// Colors come from COLOR_0, else from the normal, else white. OBJ groups/materials and glTF primitives
+// become submeshes. glTF node transforms are not applied. --sphere generates a UV sphere for benchmarks.
+
+#include "mesh_format.h"
+#include "vertex_packing.h"
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <vector>
+#include <string>
+#include <unordered_map>
+#include <algorithm>
+#include <limits>
+#include <chrono>
+
+struct MeshVertex {
+    float position[3];
+    float color[3];
+    float texCoord[2];
+};
+
+struct MeshData {
+    std::vector<MeshVertex> vertices;
+    std::vector<uint32_t> indices;
+    std::vector<MeshSubmesh> submeshes;
+};
+
+static std::vector<char> readFile(const std::string& filename) {
+    std::ifstream file(filename, std::ios::ate | std::ios::binary);
+
+    if(!file.is_open()) {
+        throw std::runtime_error("failed to open " + filename);
+    }
+
+    size_t fileSize = (size_t) file.tellg();
+    std::vector<char> buffer(fileSize);
+
+    file.seekg(0);
+    file.read(buffer.data(), fileSize);
+
+    return buffer;
+}
+
+static bool endsWith(const std::string& s, const std::string& suffix) {
+    return s.size() >= suffix.size() && s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+static void beginSubmesh(MeshData& mesh) {
+    if(!mesh.submeshes.empty() && mesh.submeshes.back().indexCount == 0) {
+        return;
+    }
+    MeshSubmesh submesh{};
+    submesh.firstIndex = static_cast<uint32_t>(mesh.indices.size());
+    mesh.submeshes.push_back(submesh);
+}
+
+static void endSubmesh(MeshData& mesh) {
+    mesh.submeshes.back().indexCount = static_cast<uint32_t>(mesh.indices.size()) - mesh.submeshes.back().firstIndex;
+}
+
+// ---- OBJ ---- //
+
+struct ObjIndex {
+    int position, texCoord, normal;
+
+    bool operator==(const ObjIndex& other) const {
+        return position == other.position && texCoord == other.texCoord && normal == other.normal;
+    }
+};
+
+struct ObjIndexHash {
+    size_t operator()(const ObjIndex& index) const {
+        return (static_cast<size_t>(index.position) * 73856093) ^
+               (static_cast<size_t>(index.texCoord) * 19349663) ^
+               (static_cast<size_t>(index.normal) * 83492791);
+    }
+};
+
+// "7", "7/3", "7//2" or "7/3/2", 1 based or negative (relative to the end), 0 means absent
+static ObjIndex parseObjIndex(const std::string& token, size_t positions, size_t texCoords, size_t normals) {
+    int values[3] = {0, 0, 0};
+    size_t start = 0;
+    for(int i = 0; i < 3 && start <= token.size(); i++) {
+        size_t slash = token.find('/', start);
+        std::string part = token.substr(start, slash == std::string::npos ? std::string::npos : slash - start);
+        if(!part.empty()) {
+            values[i] = std::stoi(part);
+        }
+        if(slash == std::string::npos) {
+            break;
+        }
+        start = slash + 1;
+    }
+
+    size_t counts[3] = {positions, texCoords, normals};
+    for(int i = 0; i < 3; i++) {
+        if(values[i] < 0) {
+            values[i] = static_cast<int>(counts[i]) + values[i] + 1;
+        }
+        if(values[i] < 0 || values[i] > static_cast<int>(counts[i])) {
+            throw std::runtime_error("OBJ face index out of range: " + token);
+        }
+    }
+
+    return {values[0], values[1], values[2]};
+}
+
+static MeshData loadObj(const std::string& path) {
+    std::ifstream file(path);
+    if(!file.is_open()) {
+        throw std::runtime_error("failed to open " + path);
+    }
+
+    std::vector<float> positions, texCoords, normals;
+    std::unordered_map<ObjIndex, uint32_t, ObjIndexHash> uniqueVertices;
+    std::vector<uint32_t> face;
+
+    MeshData mesh;
+    beginSubmesh(mesh);
+
+    std::string line;
+    while(std::getline(file, line)) {
+        std::istringstream in(line);
+        std::string keyword;
+        in >> keyword;
+
+        if(keyword == "v") {
+            float x = 0, y = 0, z = 0;
+            in >> x >> y >> z;
+            positions.insert(positions.end(), {x, y, z});
+        }
+        else if(keyword == "vt") {
+            float u = 0, v = 0;
+            in >> u >> v;
+            texCoords.insert(texCoords.end(), {u, v});
+        }
+        else if(keyword == "vn") {
+            float x = 0, y = 0, z = 0;
+            in >> x >> y >> z;
+            normals.insert(normals.end(), {x, y, z});
+        }
+        else if(keyword == "o" || keyword == "g" || keyword == "usemtl") {
+            endSubmesh(mesh);
+            beginSubmesh(mesh);
+        }
+        else if(keyword == "f") {
+            face.clear();
+            std::string token;
+            while(in >> token) {
+                ObjIndex index = parseObjIndex(token, positions.size() / 3, texCoords.size() / 2, normals.size() / 3);
+                if(index.position == 0) {
+                    throw std::runtime_error("OBJ face without a position: " + line);
+                }
+
+                auto found = uniqueVertices.find(index);
+                if(found != uniqueVertices.end()) {
+                    face.push_back(found->second);
+                    continue;
+                }
+
+                MeshVertex vertex{};
+                std::memcpy(vertex.position, &positions[3 * (index.position - 1)], sizeof(vertex.position));
+                if(index.texCoord != 0) {
+                    // OBJ puts v = 0 at the bottom, Vulkan samples with v = 0 at the top
+                    vertex.texCoord[0] = texCoords[2 * (index.texCoord - 1)];
+                    vertex.texCoord[1] = 1.0f - texCoords[2 * (index.texCoord - 1) + 1];
+                }
+                for(int i = 0; i < 3; i++) {
+                    vertex.color[i] = index.normal != 0 ? normals[3 * (index.normal - 1) + i] * 0.5f + 0.5f : 1.0f;
+                }
+
+                uint32_t vertexIndex = static_cast<uint32_t>(mesh.vertices.size());
+                uniqueVertices.emplace(index, vertexIndex);
+                mesh.vertices.push_back(vertex);
+                face.push_back(vertexIndex);
+            }
+
+            // Polygons are triangulated as a fan
+            for(size_t i = 2; i < face.size(); i++) {
+                mesh.indices.insert(mesh.indices.end(), {face[0], face[i - 1], face[i]});
+            }
+        }
+    }
+    endSubmesh(mesh);
+
+    return mesh;
+}
+
+// ---- glTF ---- //
+
+// Just enough JSON for glTF, numbers are kept as doubles
+struct Json {
+    enum Type { Null, Bool, Number, String, Array, Object } type = Null;
+    bool boolean = false;
+    double number = 0.0;
+    std::string string;
+    std::vector<Json> array;
+    std::vector<std::pair<std::string, Json>> object;
+
+    const Json* find(const std::string& key) const {
+        for(const auto& member : object) {
+            if(member.first == key) {
+                return &member.second;
+            }
+        }
+        return nullptr;
+    }
+
+    const Json& operator[](const std::string& key) const {
+        const Json* value = find(key);
+        if(!value) {
+            throw std::runtime_error("glTF: missing \"" + key + "\"");
+        }
+        return *value;
+    }
+
+    const Json& operator[](size_t index) const {
+        if(type != Array || index >= array.size()) {
+            throw std::runtime_error("glTF: index out of range");
+        }
+        return array[index];
+    }
+
+    size_t asIndex() const {
+        return static_cast<size_t>(number);
+    }
+
+    size_t value(const std::string& key, size_t fallback) const {
+        const Json* member = find(key);
+        return member ? member->asIndex() : fallback;
+    }
+};
+
+class JsonParser {
+public:
+    JsonParser(const char* begin, const char* end) : _cursor(begin), _end(end) {}
+
+    Json parse() {
+        Json value = parseValue();
+        skipWhitespace();
+        if(_cursor != _end && *_cursor != '\0') {
+            throw std::runtime_error("glTF: trailing characters after the JSON document");
+        }
+        return value;
+    }
+
+private:
+    const char* _cursor;
+    const char* _end;
+
+    void skipWhitespace() {
+        while(_cursor != _end && (*_cursor == ' ' || *_cursor == '\t' || *_cursor == '\n' || *_cursor == '\r')) {
+            _cursor++;
+        }
+    }
+
+    char peek() {
+        skipWhitespace();
+        if(_cursor == _end) {
+            throw std::runtime_error("glTF: unexpected end of JSON");
+        }
+        return *_cursor;
+    }
+
+    void expect(char c) {
+        if(peek() != c) {
+            throw std::runtime_error(std::string("glTF: expected '") + c + "' in JSON");
+        }
+        _cursor++;
+    }
+
+    bool consume(const char* literal) {
+        size_t length = std::strlen(literal);
+        if(static_cast<size_t>(_end - _cursor) >= length && std::strncmp(_cursor, literal, length) == 0) {
+            _cursor += length;
+            return true;
+        }
+        return false;
+    }
+
+    Json parseValue() {
+        Json value;
+        char c = peek();
+
+        if(c == '{') {
+            value.type = Json::Object;
+            _cursor++;
+            if(peek() == '}') {
+                _cursor++;
+                return value;
+            }
+            do {
+                std::string key = parseString();
+                expect(':');
+                value.object.emplace_back(std::move(key), parseValue());
+            } while(peek() == ',' && _cursor++);
+            expect('}');
+        }
+        else if(c == '[') {
+            value.type = Json::Array;
+            _cursor++;
+            if(peek() == ']') {
+                _cursor++;
+                return value;
+            }
+            do {
+                value.array.push_back(parseValue());
+            } while(peek() == ',' && _cursor++);
+            expect(']');
+        }
+        else if(c == '"') {
+            value.type   = Json::String;
+            value.string = parseString();
+        }
+        else if(consume("true")) {
+            value.type    = Json::Bool;
+            value.boolean = true;
+        }
+        else if(consume("false")) {
+            value.type = Json::Bool;
+        }
+        else if(consume("null")) {
+            value.type = Json::Null;
+        }
+        else {
+            char* numberEnd = nullptr;
+            value.type   = Json::Number;
+            value.number = std::strtod(_cursor, &numberEnd);
+            if(numberEnd == _cursor) {
+                throw std::runtime_error("glTF: invalid JSON value");
+            }
+            _cursor = numberEnd;
+        }
+
+        return value;
+    }
+
+    // Escapes are kept verbatim apart from \" and \\, glTF keys and URIs don't need more
+    std::string parseString() {
+        expect('"');
+        std::string result;
+        while(_cursor != _end && *_cursor != '"') {
+            if(*_cursor == '\\' && _cursor + 1 != _end) {
+                _cursor++;
+                if(*_cursor != '"' && *_cursor != '\\' && *_cursor != '/') {
+                    result += '\\';
+                }
+            }
+            result += *_cursor++;
+        }
+        expect('"');
+        return result;
+    }
+};
+
+struct Gltf {
+    Json json;
+    std::vector<std::vector<char>> buffers;
+};
+
+static Gltf loadGltfDocument(const std::string& path) {
+    std::vector<char> file = readFile(path);
+    std::string directory = path.substr(0, path.find_last_of('/') + 1);
+
+    Gltf gltf;
+    std::vector<char> binaryChunk;
+
+    const uint32_t GLB_MAGIC      = 0x46546c67;     // "glTF"
+    const uint32_t GLB_CHUNK_JSON = 0x4e4f534a;
+    const uint32_t GLB_CHUNK_BIN  = 0x004e4942;
+
+    uint32_t magic = 0;
+    if(file.size() >= 12) {
+        std::memcpy(&magic, file.data(), sizeof(magic));
+    }
+
+    if(magic == GLB_MAGIC) {
+        size_t offset = 12;
+        bool haveJson = false;
+        while(offset + 8 <= file.size()) {
+            uint32_t chunkLength, chunkType;
+            std::memcpy(&chunkLength, &file[offset], 4);
+            std::memcpy(&chunkType, &file[offset + 4], 4);
+            offset += 8;
+            if(offset + chunkLength > file.size()) {
+                throw std::runtime_error("glTF: truncated GLB chunk");
+            }
+
+            if(chunkType == GLB_CHUNK_JSON) {
+                gltf.json = JsonParser(&file[offset], &file[offset] + chunkLength).parse();
+                haveJson  = true;
+            }
+            else if(chunkType == GLB_CHUNK_BIN) {
+                binaryChunk.assign(&file[offset], &file[offset] + chunkLength);
+            }
+            offset += (chunkLength + 3) & ~3u;
+        }
+        if(!haveJson) {
+            throw std::runtime_error("glTF: GLB without a JSON chunk");
+        }
+    }
+    else {
+        gltf.json = JsonParser(file.data(), file.data() + file.size()).parse();
+    }
+
+    if(const Json* buffers = gltf.json.find("buffers")) {
+        for(const Json& buffer : buffers->array) {
+            const Json* uri = buffer.find("uri");
+            if(!uri) {
+                gltf.buffers.push_back(std::move(binaryChunk));
+            }
+            else if(uri->string.compare(0, 5, "data:") == 0) {
+                throw std::runtime_error("glTF: embedded data URIs are not supported, export with a separate .bin or as .glb");
+            }
+            else {
+                gltf.buffers.push_back(readFile(directory + uri->string));
+            }
+        }
+    }
+
+    return gltf;
+}
+
+static uint32_t gltfComponentCount(const std::string& type) {
+    if(type == "SCALAR") return 1;
+    if(type == "VEC2")   return 2;
+    if(type == "VEC3")   return 3;
+    if(type == "VEC4")   return 4;
+    throw std::runtime_error("glTF: unsupported accessor type " + type);
+}
+
+static uint32_t gltfComponentSize(size_t componentType) {
+    switch(componentType) {
+        case 5120: case 5121: return 1;     // BYTE, UNSIGNED_BYTE
+        case 5122: case 5123: return 2;     // SHORT, UNSIGNED_SHORT
+        case 5125: case 5126: return 4;     // UNSIGNED_INT, FLOAT
+        default: throw std::runtime_error("glTF: unsupported component type");
+    }
+}
+
+// Reads an accessor as doubles, normalized integer types are mapped to [0, 1]
+static std::vector<double> readGltfAccessor(const Gltf& gltf, size_t accessorIndex, uint32_t& components) {
+    const Json& accessor   = gltf.json["accessors"][accessorIndex];
+    const Json& bufferView = gltf.json["bufferViews"][accessor["bufferView"].asIndex()];
+    const std::vector<char>& buffer = gltf.buffers.at(bufferView["buffer"].asIndex());
+
+    size_t count         = accessor["count"].asIndex();
+    size_t componentType = accessor["componentType"].asIndex();
+    uint32_t componentSize = gltfComponentSize(componentType);
+    components = gltfComponentCount(accessor["type"].string);
+
+    const Json* normalizedValue = accessor.find("normalized");
+    bool normalized = normalizedValue && normalizedValue->boolean;
+
+    size_t stride = bufferView.value("byteStride", componentSize * components);
+    size_t offset = bufferView.value("byteOffset", 0) + accessor.value("byteOffset", 0);
+    if(count > 0 && offset + (count - 1) * stride + componentSize * components > buffer.size()) {
+        throw std::runtime_error("glTF: accessor reads past the end of its buffer");
+    }
+
+    std::vector<double> values(count * components);
+    for(size_t i = 0; i < count; i++) {
+        const char* element = buffer.data() + offset + i * stride;
+        for(uint32_t c = 0; c < components; c++) {
+            const char* data = element + c * componentSize;
+            double value = 0.0;
+            switch(componentType) {
+                case 5120: { int8_t v;   std::memcpy(&v, data, 1); value = normalized ? std::max(v / 127.0, -1.0) : v; break; }
+                case 5121: { uint8_t v;  std::memcpy(&v, data, 1); value = normalized ? v / 255.0 : v; break; }
+                case 5122: { int16_t v;  std::memcpy(&v, data, 2); value = normalized ? std::max(v / 32767.0, -1.0) : v; break; }
+                case 5123: { uint16_t v; std::memcpy(&v, data, 2); value = normalized ? v / 65535.0 : v; break; }
+                case 5125: { uint32_t v; std::memcpy(&v, data, 4); value = v; break; }
+                case 5126: { float v;    std::memcpy(&v, data, 4); value = v; break; }
+            }
+            values[i * components + c] = value;
+        }
+    }
+
+    return values;
+}
+
+static MeshData loadGltf(const std::string& path) {
+    Gltf gltf = loadGltfDocument(path);
+    MeshData mesh;
+
+    const Json* meshes = gltf.json.find("meshes");
+    if(!meshes) {
+        throw std::runtime_error("glTF: no meshes in " + path);
+    }
+
+    for(const Json& gltfMesh : meshes->array) {
+        for(const Json& primitive : gltfMesh["primitives"].array) {
+            if(primitive.value("mode", 4) != 4) {
+                std::cerr << "skipping a primitive that isn't a triangle list\n";
+                continue;
+            }
+
+            const Json& attributes = primitive["attributes"];
+            uint32_t components;
+            std::vector<double> positions = readGltfAccessor(gltf, attributes["POSITION"].asIndex(), components);
+            if(components != 3) {
+                throw std::runtime_error("glTF: POSITION must be VEC3");
+            }
+            size_t vertexCount = positions.size() / 3;
+
+            std::vector<double> colors, normals, texCoords;
+            uint32_t colorComponents = 0, normalComponents = 0, texCoordComponents = 0;
+            if(const Json* color = attributes.find("COLOR_0")) {
+                colors = readGltfAccessor(gltf, color->asIndex(), colorComponents);
+            }
+            if(const Json* normal = attributes.find("NORMAL")) {
+                normals = readGltfAccessor(gltf, normal->asIndex(), normalComponents);
+            }
+            if(const Json* texCoord = attributes.find("TEXCOORD_0")) {
+                texCoords = readGltfAccessor(gltf, texCoord->asIndex(), texCoordComponents);
+            }
+
+            uint32_t baseVertex = static_cast<uint32_t>(mesh.vertices.size());
+            for(size_t i = 0; i < vertexCount; i++) {
+                MeshVertex vertex{};
+                for(int c = 0; c < 3; c++) {
+                    vertex.position[c] = static_cast<float>(positions[i * 3 + c]);
+                    if(!colors.empty()) {
+                        vertex.color[c] = static_cast<float>(colors[i * colorComponents + c]);
+                    }
+                    else if(!normals.empty()) {
+                        vertex.color[c] = static_cast<float>(normals[i * normalComponents + c] * 0.5 + 0.5);
+                    }
+                    else {
+                        vertex.color[c] = 1.0f;
+                    }
+                }
+                if(!texCoords.empty()) {
+                    vertex.texCoord[0] = static_cast<float>(texCoords[i * texCoordComponents]);
+                    vertex.texCoord[1] = static_cast<float>(texCoords[i * texCoordComponents + 1]);
+                }
+                mesh.vertices.push_back(vertex);
+            }
+
+            // Indices are stored absolute, the submesh's vertexOffset stays 0
+            beginSubmesh(mesh);
+            if(const Json* indices = primitive.find("indices")) {
+                uint32_t indexComponents;
+                for(double index : readGltfAccessor(gltf, indices->asIndex(), indexComponents)) {
+                    if(index >= vertexCount) {
+                        throw std::runtime_error("glTF: index out of range");
+                    }
+                    mesh.indices.push_back(baseVertex + static_cast<uint32_t>(index));
+                }
+            }
+            else {
+                for(size_t i = 0; i < vertexCount; i++) {
+                    mesh.indices.push_back(baseVertex + static_cast<uint32_t>(i));
+                }
+            }
+            endSubmesh(mesh);
+        }
+    }
+
+    return mesh;
+}
+
+// ---- Generated meshes ---- //
+
+// UV sphere of radius 1 with segments around and segments / 2 rings, colored by its normal
+static MeshData generateSphere(uint32_t segments) {
+    if(segments < 3 || segments > 16384) {
+        throw std::runtime_error("--sphere expects 3 to 16384 segments");
+    }
+
+    MeshData mesh;
+    uint32_t rings = std::max(2u, segments / 2);
+    const float pi = 3.14159265358979f;
+
+    for(uint32_t ring = 0; ring <= rings; ring++) {
+        float v = static_cast<float>(ring) / rings;
+        float theta = v * pi;
+        for(uint32_t segment = 0; segment <= segments; segment++) {
+            float u = static_cast<float>(segment) / segments;
+            float phi = u * 2.0f * pi;
+
+            float normal[3] = {std::sin(theta) * std::cos(phi), std::sin(theta) * std::sin(phi), std::cos(theta)};
+            MeshVertex vertex{};
+            for(int i = 0; i < 3; i++) {
+                vertex.position[i] = normal[i];
+                vertex.color[i]    = normal[i] * 0.5f + 0.5f;
+            }
+            vertex.texCoord[0] = u;
+            vertex.texCoord[1] = v;
+            mesh.vertices.push_back(vertex);
+        }
+    }
+
+    beginSubmesh(mesh);
+    uint32_t rowLength = segments + 1;
+    for(uint32_t ring = 0; ring < rings; ring++) {
+        for(uint32_t segment = 0; segment < segments; segment++) {
+            uint32_t a = ring * rowLength + segment;
+            uint32_t b = a + rowLength;
+            mesh.indices.insert(mesh.indices.end(), {a, b, a + 1, a + 1, b, b + 1});
+        }
+    }
+    endSubmesh(mesh);
+
+    return mesh;
+}
+
+// ---- .vmesh writer ---- //
+
+static void growBounds(float boundsMin[3], float boundsMax[3], const float position[3]) {
+    for(int i = 0; i < 3; i++) {
+        boundsMin[i] = std::min(boundsMin[i], position[i]);
+        boundsMax[i] = std::max(boundsMax[i], position[i]);
+    }
+}
+
+static void writePadding(std::ofstream& out, uint64_t& offset) {
+    static const char zeros[MESH_DATA_ALIGNMENT] = {};
+    uint64_t aligned = (offset + MESH_DATA_ALIGNMENT - 1) & ~static_cast<uint64_t>(MESH_DATA_ALIGNMENT - 1);
+    out.write(zeros, aligned - offset);
+    offset = aligned;
+}
+
+// Vertices in the renderer's PackedVertexLayout, 16 bytes each
+static const MeshAttribute packedAttributes[3] = {
+    {MESH_ATTRIBUTE_POSITION, MESH_FORMAT_SNORM16X4, 0,  0},
+    {MESH_ATTRIBUTE_COLOR,    MESH_FORMAT_UNORM8X4,  8,  0},
+    {MESH_ATTRIBUTE_TEXCOORD, MESH_FORMAT_HALF2,     12, 0},
+};
+const uint32_t PACKED_VERTEX_STRIDE = 16;
+
+static std::vector<uint8_t> packVertices(const MeshData& mesh, const float boundsMin[3], const float boundsMax[3]) {
+    float center[3], halfExtent[3];
+    for(int i = 0; i < 3; i++) {
+        center[i]     = (boundsMin[i] + boundsMax[i]) * 0.5f;
+        halfExtent[i] = std::max((boundsMax[i] - boundsMin[i]) * 0.5f, 1e-6f);
+    }
+
+    std::vector<uint8_t> packed(mesh.vertices.size() * PACKED_VERTEX_STRIDE);
+    for(size_t v = 0; v < mesh.vertices.size(); v++) {
+        const MeshVertex& vertex = mesh.vertices[v];
+        uint8_t* out = packed.data() + v * PACKED_VERTEX_STRIDE;
+
+        float position[3];
+        for(int i = 0; i < 3; i++) {
+            position[i] = (vertex.position[i] - center[i]) / halfExtent[i];
+        }
+        encodeMeshAttribute(packedAttributes[0].format, position, out + packedAttributes[0].offset);
+        encodeMeshAttribute(packedAttributes[1].format, vertex.color, out + packedAttributes[1].offset);
+        encodeMeshAttribute(packedAttributes[2].format, vertex.texCoord, out + packedAttributes[2].offset);
+    }
+
+    return packed;
+}
+
+static void writeMesh(MeshData& mesh, const std::string& path, bool packed) {
+    // Empty groups in the source leave empty submeshes behind
+    mesh.submeshes.erase(std::remove_if(mesh.submeshes.begin(), mesh.submeshes.end(),
+                                        [](const MeshSubmesh& submesh) { return submesh.indexCount == 0; }),
+                         mesh.submeshes.end());
+    if(mesh.indices.empty()) {
+        throw std::runtime_error("no triangles to write");
+    }
+    if(mesh.vertices.size() > std::numeric_limits<uint32_t>::max()) {
+        throw std::runtime_error("too many vertices for 32 bit indices");
+    }
+
+    MeshFileHeader header{};
+    header.magic          = MESH_FILE_MAGIC;
+    header.version        = MESH_FILE_VERSION;
+    header.headerSize     = sizeof(MeshFileHeader);
+    header.vertexStride   = packed ? PACKED_VERTEX_STRIDE : sizeof(MeshVertex);
+    header.vertexCount    = static_cast<uint32_t>(mesh.vertices.size());
+    header.indexCount     = static_cast<uint32_t>(mesh.indices.size());
+    header.indexSize      = meshIndexSizeFor(header.vertexCount);
+    header.attributeCount = 3;
+    header.submeshCount   = static_cast<uint32_t>(mesh.submeshes.size());
+
+    MeshAttribute attributes[3] = {
+        {MESH_ATTRIBUTE_POSITION, MESH_FORMAT_FLOAT3, offsetof(MeshVertex, position), 0},
+        {MESH_ATTRIBUTE_COLOR,    MESH_FORMAT_FLOAT3, offsetof(MeshVertex, color),    0},
+        {MESH_ATTRIBUTE_TEXCOORD, MESH_FORMAT_FLOAT2, offsetof(MeshVertex, texCoord), 0},
+    };
+    if(packed) {
+        std::copy(packedAttributes, packedAttributes + 3, attributes);
+    }
+
+    const float infinity = std::numeric_limits<float>::infinity();
+    for(int i = 0; i < 3; i++) {
+        header.boundsMin[i] = infinity;
+        header.boundsMax[i] = -infinity;
+    }
+    for(MeshSubmesh& submesh : mesh.submeshes) {
+        for(int i = 0; i < 3; i++) {
+            submesh.boundsMin[i] = infinity;
+            submesh.boundsMax[i] = -infinity;
+        }
+        for(uint32_t i = submesh.firstIndex; i < submesh.firstIndex + submesh.indexCount; i++) {
+            growBounds(submesh.boundsMin, submesh.boundsMax, mesh.vertices[mesh.indices[i]].position);
+        }
+        growBounds(header.boundsMin, header.boundsMax, submesh.boundsMin);
+        growBounds(header.boundsMin, header.boundsMax, submesh.boundsMax);
+    }
+
+    std::vector<uint8_t> vertexData;
+    if(packed) {
+        vertexData = packVertices(mesh, header.boundsMin, header.boundsMax);
+    }
+    else {
+        const uint8_t* vertices = reinterpret_cast<const uint8_t*>(mesh.vertices.data());
+        vertexData.assign(vertices, vertices + sizeof(MeshVertex) * mesh.vertices.size());
+    }
+
+    uint64_t offset = sizeof(header);
+    header.attributesOffset = offset;
+    offset += sizeof(attributes);
+    header.submeshesOffset = offset;
+    offset += sizeof(MeshSubmesh) * mesh.submeshes.size();
+
+    auto align = [](uint64_t value) {
+        return (value + MESH_DATA_ALIGNMENT - 1) & ~static_cast<uint64_t>(MESH_DATA_ALIGNMENT - 1);
+    };
+    header.vertexDataOffset = align(offset);
+    header.indexDataOffset  = align(header.vertexDataOffset + vertexData.size());
+
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    if(!out.is_open()) {
+        throw std::runtime_error("failed to open " + path + " for writing");
+    }
+
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    out.write(reinterpret_cast<const char*>(attributes), sizeof(attributes));
+    out.write(reinterpret_cast<const char*>(mesh.submeshes.data()), sizeof(MeshSubmesh) * mesh.submeshes.size());
+    writePadding(out, offset);
+
+    out.write(reinterpret_cast<const char*>(vertexData.data()), vertexData.size());
+    offset += vertexData.size();
+    writePadding(out, offset);
+
+    if(header.indexSize == 2) {
+        std::vector<uint16_t> indices(mesh.indices.begin(), mesh.indices.end());
+        out.write(reinterpret_cast<const char*>(indices.data()), sizeof(uint16_t) * indices.size());
+    }
+    else {
+        out.write(reinterpret_cast<const char*>(mesh.indices.data()), sizeof(uint32_t) * mesh.indices.size());
+    }
+
+    if(!out) {
+        throw std::runtime_error("failed to write " + path);
+    }
+
+    std::cerr << path << ": " << header.vertexCount << " vertices, " << header.indexCount / 3 << " triangles, "
+              << header.submeshCount << " submeshes, " << header.indexSize * 8 << " bit indices, "
+              << header.vertexStride << " byte vertices\n";
+}
+
+int main(int argc, char** argv) {
+    std::vector<std::string> args(argv + 1, argv + argc);
+    bool packed = !args.empty() && args[0] == "--packed";
+    if(packed) {
+        args.erase(args.begin());
+    }
+    bool sphere = !args.empty() && args[0] == "--sphere";
+    if(args.size() != (sphere ? 3u : 2u)) {
+        std::cerr << "usage: " << argv[0] << " [--packed] input.obj|input.gltf|input.glb|--sphere SEGMENTS output.vmesh\n";
+        return EXIT_FAILURE;
+    }
+
+    try {
+        std::string input = args[sphere ? 1 : 0];
+        auto start = std::chrono::high_resolution_clock::now();
+
+        MeshData mesh;
+        if(sphere) {
+            mesh = generateSphere(static_cast<uint32_t>(std::stoul(input)));
+        }
+        else if(endsWith(input, ".obj")) {
+            mesh = loadObj(input);
+        }
+        else if(endsWith(input, ".gltf") || endsWith(input, ".glb")) {
+            mesh = loadGltf(input);
+        }
+        else {
+            throw std::runtime_error("unknown input format " + input + ", expected .obj, .gltf or .glb");
+        }
+
+        writeMesh(mesh, args.back(), packed);
+
+        std::chrono::duration<double, std::milli> elapsed = std::chrono::high_resolution_clock::now() - start;
+        std::cerr << "converted in " << elapsed.count() << " ms\n";
+    } catch(const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,752 @@
+// Offline converter from JPEG/PNG (anything stb_image reads) to the KTX2 container in ktx2_format.h
+//
+//   texconv [--format bc7|bc1|rgba8] [--variants] input.jpg [more layers...] output.ktx2
+//
+// Builds the whole mip chain with texture_mips.h, the same sRGB correct box filter as the renderer's
+// --mips cpu, and block compresses every level on all cores. bc7 (the default) writes BC7 mode 6 only:
+// one subset, RGBA endpoints with p-bits and 4 bit indices. bc1 writes opaque four color BC1.
+// Endpoints come from the principal axis of each block and are refined once by least squares, index
+// selection runs four pixels at a time with SSE2 when the compiler targets it.
+// Every input becomes one array layer, --variants instead builds the renderer's four layers (the image,
+// two channel rotations and grayscale) from a single input. Prints the level 0 PSNR of the result.
+
+#include "ktx2_format.h"
+#include "texture_mips.h"
+
+#define STB_IMAGE_IMPLEMENTATION
+#include <stb_image.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include <iostream>
+#include <fstream>
+#include <stdexcept>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <cfloat>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <functional>
+#include <chrono>
+
+// BC7 4 bit index weights out of 64
+const int BC7_WEIGHTS[16] = {0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64};
+
+// One 4x4 block as floats, channel major so four pixels fill an SSE register
+struct Block {
+    float channels[4][16];
+};
+
+struct Bc7Mode6 {
+    uint8_t color[2][4];        // 7 bits per channel
+    uint8_t pbit[2];
+    uint8_t indices[16];
+};
+
+static bool endsWith(const std::string& s, const std::string& suffix) {
+    return s.size() >= suffix.size() && s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+// Edge blocks of levels smaller than 4x4 or not a multiple of 4 repeat the last row and column
+static void extractBlock(const uint8_t* image, uint32_t width, uint32_t height, uint32_t blockX, uint32_t blockY,
+                         Block& block) {
+    for(uint32_t y = 0; y < 4; y++) {
+        for(uint32_t x = 0; x < 4; x++) {
+            uint32_t sx = std::min(blockX * 4 + x, width - 1);
+            uint32_t sy = std::min(blockY * 4 + y, height - 1);
+            const uint8_t* texel = image + (size_t(sy) * width + sx) * 4;
+            for(int c = 0; c < 4; c++) {
+                block.channels[c][y * 4 + x] = texel[c];
+            }
+        }
+    }
+}
+
+// Closest palette entry for every pixel, returns the summed squared error
+#ifdef __SSE2__
+static float selectIndices(const Block& block, const float palette[][4], int count, uint8_t indices[16]) {
+    __m128 total = _mm_setzero_ps();
+    for(int group = 0; group < 16; group += 4) {
+        __m128 r = _mm_loadu_ps(&block.channels[0][group]);
+        __m128 g = _mm_loadu_ps(&block.channels[1][group]);
+        __m128 b = _mm_loadu_ps(&block.channels[2][group]);
+        __m128 a = _mm_loadu_ps(&block.channels[3][group]);
+
+        __m128 best = _mm_set1_ps(FLT_MAX);
+        __m128i bestIndex = _mm_setzero_si128();
+        for(int i = 0; i < count; i++) {
+            __m128 dr = _mm_sub_ps(r, _mm_set1_ps(palette[i][0]));
+            __m128 dg = _mm_sub_ps(g, _mm_set1_ps(palette[i][1]));
+            __m128 db = _mm_sub_ps(b, _mm_set1_ps(palette[i][2]));
+            __m128 da = _mm_sub_ps(a, _mm_set1_ps(palette[i][3]));
+            __m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dr, dr), _mm_mul_ps(dg, dg)),
+                                         _mm_add_ps(_mm_mul_ps(db, db), _mm_mul_ps(da, da)));
+
+            __m128i closer = _mm_castps_si128(_mm_cmplt_ps(distance, best));
+            best      = _mm_min_ps(distance, best);
+            bestIndex = _mm_or_si128(_mm_and_si128(closer, _mm_set1_epi32(i)), _mm_andnot_si128(closer, bestIndex));
+        }
+        total = _mm_add_ps(total, best);
+
+        alignas(16) int32_t lanes[4];
+        _mm_store_si128(reinterpret_cast<__m128i*>(lanes), bestIndex);
+        for(int k = 0; k < 4; k++) {
+            indices[group + k] = static_cast<uint8_t>(lanes[k]);
+        }
+    }
+
+    alignas(16) float sums[4];
+    _mm_store_ps(sums, total);
+    return sums[0] + sums[1] + sums[2] + sums[3];
+}
+#else
+static float selectIndices(const Block& block, const float palette[][4], int count, uint8_t indices[16]) {
+    float total = 0.0f;
+    for(int p = 0; p < 16; p++) {
+        float best = FLT_MAX;
+        for(int i = 0; i < count; i++) {
+            float distance = 0.0f;
+            for(int c = 0; c < 4; c++) {
+                float d = block.channels[c][p] - palette[i][c];
+                distance += d * d;
+            }
+            if(distance < best) {
+                best = distance;
+                indices[p] = static_cast<uint8_t>(i);
+            }
+        }
+        total += best;
+    }
+    return total;
+}
+#endif
+
+// Endpoints at the extremes of the block's projection on its principal axis, found by power iteration
+static void fitEndpoints(const Block& block, int channels, float endpoints[2][4]) {
+    float mean[4] = {};
+    for(int c = 0; c < channels; c++) {
+        for(int p = 0; p < 16; p++) {
+            mean[c] += block.channels[c][p];
+        }
+        mean[c] /= 16.0f;
+    }
+
+    float covariance[4][4] = {};
+    for(int p = 0; p < 16; p++) {
+        for(int i = 0; i < channels; i++) {
+            for(int j = 0; j < channels; j++) {
+                covariance[i][j] += (block.channels[i][p] - mean[i]) * (block.channels[j][p] - mean[j]);
+            }
+        }
+    }
+
+    float axis[4] = {1.0f, 1.0f, 1.0f, 1.0f};
+    for(int iteration = 0; iteration < 8; iteration++) {
+        float next[4] = {};
+        float largest = 0.0f;
+        for(int i = 0; i < channels; i++) {
+            for(int j = 0; j < channels; j++) {
+                next[i] += covariance[i][j] * axis[j];
+            }
+            largest = std::max(largest, std::fabs(next[i]));
+        }
+        if(largest < 1e-6f) {
+            break;      // flat block, any axis does
+        }
+        for(int i = 0; i < channels; i++) {
+            axis[i] = next[i] / largest;
+        }
+    }
+
+    float length = 0.0f;
+    for(int c = 0; c < channels; c++) {
+        length += axis[c] * axis[c];
+    }
+    length = std::sqrt(length);
+
+    float minT = 0.0f, maxT = 0.0f;
+    for(int p = 0; p < 16; p++) {
+        float t = 0.0f;
+        for(int c = 0; c < channels; c++) {
+            t += (block.channels[c][p] - mean[c]) * axis[c] / length;
+        }
+        minT = std::min(minT, t);
+        maxT = std::max(maxT, t);
+    }
+
+    for(int c = 0; c < 4; c++) {
+        float direction = c < channels ? axis[c] / length : 0.0f;
+        float center    = c < channels ? mean[c] : 255.0f;
+        endpoints[0][c] = std::min(std::max(center + minT * direction, 0.0f), 255.0f);
+        endpoints[1][c] = std::min(std::max(center + maxT * direction, 0.0f), 255.0f);
+    }
+}
+
+// Least squares endpoints for fixed indices, weights in [0, 1]. False when the indices don't span a line.
+static bool refitEndpoints(const Block& block, int channels, const uint8_t indices[16], const float* weights,
+                           float endpoints[2][4]) {
+    float aa = 0.0f, ab = 0.0f, bb = 0.0f;
+    float ax[4] = {}, bx[4] = {};
+    for(int p = 0; p < 16; p++) {
+        float b = weights[indices[p]];
+        float a = 1.0f - b;
+        aa += a * a;
+        ab += a * b;
+        bb += b * b;
+        for(int c = 0; c < channels; c++) {
+            ax[c] += a * block.channels[c][p];
+            bx[c] += b * block.channels[c][p];
+        }
+    }
+
+    float determinant = aa * bb - ab * ab;
+    if(std::fabs(determinant) < 1e-6f) {
+        return false;
+    }
+
+    for(int c = 0; c < channels; c++) {
+        endpoints[0][c] = std::min(std::max((bb * ax[c] - ab * bx[c]) / determinant, 0.0f), 255.0f);
+        endpoints[1][c] = std::min(std::max((aa * bx[c] - ab * ax[c]) / determinant, 0.0f), 255.0f);
+    }
+    return true;
+}
+
+// Mode 6 endpoints are 7 bits per channel plus one p-bit shared by the endpoint's channels
+static void quantizeBc7Endpoint(const float endpoint[4], uint8_t color[4], uint8_t& pbit) {
+    float bestError = FLT_MAX;
+    for(int p = 0; p < 2; p++) {
+        uint8_t candidate[4];
+        float error = 0.0f;
+        for(int c = 0; c < 4; c++) {
+            long q = std::lround((endpoint[c] - p) / 2.0f);
+            candidate[c] = static_cast<uint8_t>(std::min(std::max(q, 0l), 127l));
+            float d = float((candidate[c] << 1) | p) - endpoint[c];
+            error += d * d;
+        }
+        if(error < bestError) {
+            bestError = error;
+            std::memcpy(color, candidate, 4);
+            pbit = static_cast<uint8_t>(p);
+        }
+    }
+}
+
+static void bc7Palette(const Bc7Mode6& mode6, float palette[16][4]) {
+    for(int i = 0; i < 16; i++) {
+        for(int c = 0; c < 4; c++) {
+            int e0 = (mode6.color[0][c] << 1) | mode6.pbit[0];
+            int e1 = (mode6.color[1][c] << 1) | mode6.pbit[1];
+            palette[i][c] = float(((64 - BC7_WEIGHTS[i]) * e0 + BC7_WEIGHTS[i] * e1 + 32) >> 6);
+        }
+    }
+}
+
+static void putBits(uint8_t* out, uint32_t& position, uint32_t value, uint32_t count) {
+    for(uint32_t i = 0; i < count; i++, position++) {
+        if((value >> i) & 1) {
+            out[position / 8] |= static_cast<uint8_t>(1u << (position % 8));
+        }
+    }
+}
+
+static uint32_t getBits(const uint8_t* in, uint32_t& position, uint32_t count) {
+    uint32_t value = 0;
+    for(uint32_t i = 0; i < count; i++, position++) {
+        value |= ((in[position / 8] >> (position % 8)) & 1u) << i;
+    }
+    return value;
+}
+
+static void packBc7Mode6(Bc7Mode6 mode6, uint8_t out[16]) {
+    // The anchor index has an implicit 0 top bit, flipping the endpoints mirrors the indices
+    if(mode6.indices[0] & 8) {
+        for(int c = 0; c < 4; c++) {
+            std::swap(mode6.color[0][c], mode6.color[1][c]);
+        }
+        std::swap(mode6.pbit[0], mode6.pbit[1]);
+        for(int p = 0; p < 16; p++) {
+            mode6.indices[p] = static_cast<uint8_t>(15 - mode6.indices[p]);
+        }
+    }
+
+    std::memset(out, 0, 16);
+    uint32_t position = 0;
+    putBits(out, position, 1u << 6, 7);
+    for(int c = 0; c < 4; c++) {
+        putBits(out, position, mode6.color[0][c], 7);
+        putBits(out, position, mode6.color[1][c], 7);
+    }
+    putBits(out, position, mode6.pbit[0], 1);
+    putBits(out, position, mode6.pbit[1], 1);
+    putBits(out, position, mode6.indices[0], 3);
+    for(int p = 1; p < 16; p++) {
+        putBits(out, position, mode6.indices[p], 4);
+    }
+}
+
+static void encodeBc7Block(const Block& block, uint8_t out[16]) {
+    float weights[16];
+    for(int i = 0; i < 16; i++) {
+        weights[i] = BC7_WEIGHTS[i] / 64.0f;
+    }
+
+    float endpoints[2][4];
+    fitEndpoints(block, 4, endpoints);
+
+    Bc7Mode6 best{};
+    float bestError = FLT_MAX;
+    for(int pass = 0; pass < 2; pass++) {
+        Bc7Mode6 candidate{};
+        quantizeBc7Endpoint(endpoints[0], candidate.color[0], candidate.pbit[0]);
+        quantizeBc7Endpoint(endpoints[1], candidate.color[1], candidate.pbit[1]);
+
+        float palette[16][4];
+        bc7Palette(candidate, palette);
+        float error = selectIndices(block, palette, 16, candidate.indices);
+        if(error < bestError) {
+            bestError = error;
+            best = candidate;
+        }
+        if(pass == 0 && !refitEndpoints(block, 4, candidate.indices, weights, endpoints)) {
+            break;
+        }
+    }
+
+    packBc7Mode6(best, out);
+}
+
+static void decodeBc7Block(const uint8_t in[16], uint8_t pixels[16][4]) {
+    Bc7Mode6 mode6{};
+    uint32_t position = 7;      // mode 6 is all this writes
+    for(int c = 0; c < 4; c++) {
+        mode6.color[0][c] = static_cast<uint8_t>(getBits(in, position, 7));
+        mode6.color[1][c] = static_cast<uint8_t>(getBits(in, position, 7));
+    }
+    mode6.pbit[0] = static_cast<uint8_t>(getBits(in, position, 1));
+    mode6.pbit[1] = static_cast<uint8_t>(getBits(in, position, 1));
+    mode6.indices[0] = static_cast<uint8_t>(getBits(in, position, 3));
+    for(int p = 1; p < 16; p++) {
+        mode6.indices[p] = static_cast<uint8_t>(getBits(in, position, 4));
+    }
+
+    float palette[16][4];
+    bc7Palette(mode6, palette);
+    for(int p = 0; p < 16; p++) {
+        for(int c = 0; c < 4; c++) {
+            pixels[p][c] = static_cast<uint8_t>(palette[mode6.indices[p]][c]);
+        }
+    }
+}
+
+static uint16_t packRgb565(const float color[4]) {
+    uint32_t r = static_cast<uint32_t>(std::lround(color[0] * 31.0f / 255.0f));
+    uint32_t g = static_cast<uint32_t>(std::lround(color[1] * 63.0f / 255.0f));
+    uint32_t b = static_cast<uint32_t>(std::lround(color[2] * 31.0f / 255.0f));
+    return static_cast<uint16_t>((r << 11) | (g << 5) | b);
+}
+
+static void unpackRgb565(uint16_t packed, float color[4]) {
+    uint32_t r = (packed >> 11) & 31, g = (packed >> 5) & 63, b = packed & 31;
+    color[0] = float((r << 3) | (r >> 2));
+    color[1] = float((g << 2) | (g >> 4));
+    color[2] = float((b << 3) | (b >> 2));
+    color[3] = 255.0f;
+}
+
+// Four color mode needs color0 > color1, entries 2 and 3 sit at 1/3 and 2/3
+static int bc1Palette(uint16_t color0, uint16_t color1, float palette[4][4]) {
+    unpackRgb565(color0, palette[0]);
+    unpackRgb565(color1, palette[1]);
+    for(int c = 0; c < 4; c++) {
+        palette[2][c] = (2.0f * palette[0][c] + palette[1][c]) / 3.0f;
+        palette[3][c] = (palette[0][c] + 2.0f * palette[1][c]) / 3.0f;
+    }
+    return color0 > color1 ? 4 : 1;
+}
+
+static void encodeBc1Block(const Block& block, uint8_t out[8]) {
+    const float weights[4] = {0.0f, 1.0f, 1.0f / 3.0f, 2.0f / 3.0f};
+
+    // Alpha is ignored, every palette entry matches the block's so it doesn't sway the indices
+    Block opaque = block;
+    std::fill(opaque.channels[3], opaque.channels[3] + 16, 255.0f);
+
+    float endpoints[2][4];
+    fitEndpoints(opaque, 3, endpoints);
+
+    uint16_t bestColors[2] = {0, 0};
+    uint8_t bestIndices[16] = {};
+    float bestError = FLT_MAX;
+    for(int pass = 0; pass < 2; pass++) {
+        uint16_t color0 = packRgb565(endpoints[0]);
+        uint16_t color1 = packRgb565(endpoints[1]);
+        if(color0 < color1) {
+            std::swap(color0, color1);
+            std::swap(endpoints[0], endpoints[1]);
+        }
+
+        float palette[4][4];
+        uint8_t indices[16];
+        float error = selectIndices(opaque, palette, bc1Palette(color0, color1, palette), indices);
+        if(error < bestError) {
+            bestError = error;
+            bestColors[0] = color0;
+            bestColors[1] = color1;
+            std::memcpy(bestIndices, indices, sizeof(indices));
+        }
+        if(pass == 0 && (color0 == color1 || !refitEndpoints(opaque, 3, indices, weights, endpoints))) {
+            break;
+        }
+    }
+
+    uint32_t packedIndices = 0;
+    for(int p = 0; p < 16; p++) {
+        packedIndices |= uint32_t(bestIndices[p]) << (p * 2);
+    }
+    std::memcpy(out, bestColors, 4);
+    std::memcpy(out + 4, &packedIndices, 4);
+}
+
+static void decodeBc1Block(const uint8_t in[8], uint8_t pixels[16][4]) {
+    uint16_t colors[2];
+    uint32_t packedIndices;
+    std::memcpy(colors, in, 4);
+    std::memcpy(&packedIndices, in + 4, 4);
+
+    float palette[4][4];
+    bc1Palette(colors[0], colors[1], palette);
+    if(colors[0] <= colors[1]) {
+        // Three color mode, only written for flat blocks where index 0 is all that's used
+        for(int c = 0; c < 4; c++) {
+            palette[2][c] = (palette[0][c] + palette[1][c]) / 2.0f;
+            palette[3][c] = 0.0f;
+        }
+    }
+    for(int p = 0; p < 16; p++) {
+        for(int c = 0; c < 4; c++) {
+            pixels[p][c] = static_cast<uint8_t>(std::lround(palette[(packedIndices >> (p * 2)) & 3][c]));
+        }
+    }
+}
+
+static void parallelFor(uint32_t count, const std::function<void(uint32_t)>& body) {
+    std::atomic<uint32_t> next{0};
+    uint32_t threadCount = std::max(1u, std::min(std::thread::hardware_concurrency(), count));
+
+    std::vector<std::thread> threads;
+    for(uint32_t t = 0; t < threadCount; t++) {
+        threads.emplace_back([&]() {
+            for(uint32_t i = next++; i < count; i = next++) {
+                body(i);
+            }
+        });
+    }
+    for(std::thread& thread : threads) {
+        thread.join();
+    }
+}
+
+struct Texture {
+    uint32_t width = 0;
+    uint32_t height = 0;
+    uint32_t layers = 0;
+    std::vector<uint8_t> pixels;    // RGBA8, layers packed
+};
+
+static Texture loadLayers(const std::vector<std::string>& inputs, bool variants) {
+    Texture texture;
+    for(const std::string& input : inputs) {
+        int width, height, channels;
+        stbi_uc* pixels = stbi_load(input.c_str(), &width, &height, &channels, STBI_rgb_alpha);
+        if(!pixels) {
+            throw std::runtime_error("failed to load " + input + ": " + stbi_failure_reason());
+        }
+        if(texture.layers > 0 && (uint32_t(width) != texture.width || uint32_t(height) != texture.height)) {
+            stbi_image_free(pixels);
+            throw std::runtime_error(input + " is not the size of the first layer");
+        }
+        texture.width  = static_cast<uint32_t>(width);
+        texture.height = static_cast<uint32_t>(height);
+        texture.layers++;
+        texture.pixels.insert(texture.pixels.end(), pixels, pixels + size_t(width) * height * 4);
+        stbi_image_free(pixels);
+    }
+
+    if(variants) {
+        // Same layers as the renderer's createTextureImage builds from texture.jpg
+        size_t layerSize = size_t(texture.width) * texture.height * 4;
+        texture.pixels.resize(layerSize * 4);
+        for(size_t i = 0; i < layerSize; i += 4) {
+            uint8_t r = texture.pixels[i], g = texture.pixels[i + 1], b = texture.pixels[i + 2], a = texture.pixels[i + 3];
+            uint8_t gray = static_cast<uint8_t>((r * 77 + g * 150 + b * 29) >> 8);
+
+            uint8_t* texel = &texture.pixels[i + layerSize];
+            texel[0] = g;    texel[1] = b;    texel[2] = r;    texel[3] = a;
+            texel += layerSize;
+            texel[0] = b;    texel[1] = r;    texel[2] = g;    texel[3] = a;
+            texel += layerSize;
+            texel[0] = gray; texel[1] = gray; texel[2] = gray; texel[3] = a;
+        }
+        texture.layers = 4;
+    }
+    return texture;
+}
+
+// Compresses each level of chain, layers packed within a level like the KTX2 level data
+static std::vector<std::vector<uint8_t>> encodeLevels(const std::vector<uint8_t>& chain, const Ktx2FormatInfo& format,
+                                                      uint32_t width, uint32_t height, uint32_t layers, uint32_t levels) {
+    struct Row {
+        uint32_t level;
+        uint32_t layer;
+        uint32_t blockY;
+    };
+
+    std::vector<std::vector<uint8_t>> encoded(levels);
+    std::vector<const uint8_t*> source(levels);
+    std::vector<Row> rows;
+    size_t offset = 0;
+    for(uint32_t level = 0; level < levels; level++) {
+        uint32_t levelWidth  = std::max(width >> level, 1u);
+        uint32_t levelHeight = std::max(height >> level, 1u);
+        source[level] = chain.data() + offset;
+        offset += size_t(levelWidth) * levelHeight * 4 * layers;
+
+        encoded[level].resize(ktx2LayerSize(format, levelWidth, levelHeight) * layers);
+        for(uint32_t layer = 0; layer < layers; layer++) {
+            for(uint32_t blockY = 0; blockY < (levelHeight + 3) / 4; blockY++) {
+                rows.push_back({level, layer, blockY});
+            }
+        }
+    }
+
+    if(format.blockWidth == 1) {
+        for(uint32_t level = 0; level < levels; level++) {
+            std::memcpy(encoded[level].data(), source[level], encoded[level].size());
+        }
+        return encoded;
+    }
+
+    parallelFor(static_cast<uint32_t>(rows.size()), [&](uint32_t i) {
+        const Row& row = rows[i];
+        uint32_t levelWidth  = std::max(width >> row.level, 1u);
+        uint32_t levelHeight = std::max(height >> row.level, 1u);
+        uint32_t blocksX     = (levelWidth + 3) / 4;
+        uint64_t layerSize   = ktx2LayerSize(format, levelWidth, levelHeight);
+
+        const uint8_t* image = source[row.level] + size_t(levelWidth) * levelHeight * 4 * row.layer;
+        uint8_t* out = encoded[row.level].data() + layerSize * row.layer + size_t(row.blockY) * blocksX * format.blockBytes;
+        for(uint32_t blockX = 0; blockX < blocksX; blockX++, out += format.blockBytes) {
+            Block block;
+            extractBlock(image, levelWidth, levelHeight, blockX, row.blockY, block);
+            if(format.blockBytes == 16) {
+                encodeBc7Block(block, out);
+            }
+            else {
+                encodeBc1Block(block, out);
+            }
+        }
+    });
+    return encoded;
+}
+
+// RGB PSNR of level 0, every layer
+static double levelZeroPsnr(const std::vector<uint8_t>& original, const std::vector<uint8_t>& encoded,
+                            const Ktx2FormatInfo& format, uint32_t width, uint32_t height, uint32_t layers) {
+    if(format.blockWidth == 1) {
+        return INFINITY;
+    }
+
+    uint32_t blocksX = (width + 3) / 4, blocksY = (height + 3) / 4;
+    double squaredError = 0.0;
+    const uint8_t* block = encoded.data();
+    for(uint32_t layer = 0; layer < layers; layer++) {
+        const uint8_t* image = original.data() + size_t(width) * height * 4 * layer;
+        for(uint32_t by = 0; by < blocksY; by++) {
+            for(uint32_t bx = 0; bx < blocksX; bx++, block += format.blockBytes) {
+                uint8_t pixels[16][4];
+                if(format.blockBytes == 16) {
+                    decodeBc7Block(block, pixels);
+                }
+                else {
+                    decodeBc1Block(block, pixels);
+                }
+                for(uint32_t p = 0; p < 16; p++) {
+                    uint32_t x = bx * 4 + p % 4, y = by * 4 + p / 4;
+                    if(x >= width || y >= height) {
+                        continue;
+                    }
+                    for(int c = 0; c < 3; c++) {
+                        double d = double(pixels[p][c]) - image[(size_t(y) * width + x) * 4 + c];
+                        squaredError += d * d;
+                    }
+                }
+            }
+        }
+    }
+
+    double mse = squaredError / (double(width) * height * layers * 3);
+    return mse > 0.0 ? 10.0 * std::log10(255.0 * 255.0 / mse) : INFINITY;
+}
+
+static void writeU32(std::vector<uint8_t>& out, uint32_t value) {
+    out.insert(out.end(), reinterpret_cast<uint8_t*>(&value), reinterpret_cast<uint8_t*>(&value) + 4);
+}
+
+// Basic data format descriptor: one sample covering the block for compressed formats, four for RGBA8
+static std::vector<uint8_t> buildDfd(const Ktx2FormatInfo& format) {
+    const uint32_t transferLinear = 1, transferSrgb = 2, primariesBt709 = 1;
+    const uint32_t channelAlpha = 15, qualifierLinear = 0x10;
+
+    uint32_t samples = format.blockWidth == 1 ? 4 : 1;
+    std::vector<uint8_t> dfd;
+    writeU32(dfd, 4 + 24 + 16 * samples);
+    writeU32(dfd, 0);                                           // Khronos vendor, basic descriptor type
+    writeU32(dfd, 2 | ((24 + 16 * samples) << 16));             // version 2, block size
+    writeU32(dfd, format.dfdColorModel | (primariesBt709 << 8) |
+                  ((format.srgb ? transferSrgb : transferLinear) << 16));
+    writeU32(dfd, (format.blockWidth - 1) | ((format.blockHeight - 1) << 8));
+    writeU32(dfd, format.blockBytes);
+    writeU32(dfd, 0);
+
+    if(samples == 1) {
+        writeU32(dfd, (format.blockBytes * 8 - 1) << 16);
+        writeU32(dfd, 0);
+        writeU32(dfd, 0);
+        writeU32(dfd, 0xffffffff);
+    }
+    else {
+        for(uint32_t c = 0; c < 4; c++) {
+            uint32_t channel = c == 3 ? channelAlpha | (format.srgb ? qualifierLinear : 0) : c;
+            writeU32(dfd, (c * 8) | (7 << 16) | (channel << 24));
+            writeU32(dfd, 0);
+            writeU32(dfd, 0);
+            writeU32(dfd, 255);
+        }
+    }
+    return dfd;
+}
+
+static void writeKtx2(const std::string& path, const Ktx2FormatInfo& format, uint32_t width, uint32_t height,
+                      uint32_t layers, const std::vector<std::vector<uint8_t>>& levels) {
+    uint32_t levelCount = static_cast<uint32_t>(levels.size());
+
+    std::vector<uint8_t> dfd = buildDfd(format);
+
+    const char key[] = "KTXwriter", value[] = "texconv";
+    std::vector<uint8_t> kvd;
+    writeU32(kvd, sizeof(key) + sizeof(value));
+    kvd.insert(kvd.end(), key, key + sizeof(key));
+    kvd.insert(kvd.end(), value, value + sizeof(value));
+    kvd.resize((kvd.size() + 3) & ~size_t(3));
+
+    Ktx2Header header{};
+    std::memcpy(header.identifier, KTX2_IDENTIFIER, sizeof(KTX2_IDENTIFIER));
+    header.vkFormat      = format.vkFormat;
+    header.typeSize      = 1;
+    header.pixelWidth    = width;
+    header.pixelHeight   = height;
+    header.pixelDepth    = 0;
+    header.layerCount    = layers > 1 ? layers : 0;
+    header.faceCount     = 1;
+    header.levelCount    = levelCount;
+    header.dfdByteOffset = static_cast<uint32_t>(sizeof(Ktx2Header) + sizeof(Ktx2LevelIndex) * levelCount);
+    header.dfdByteLength = static_cast<uint32_t>(dfd.size());
+    header.kvdByteOffset = header.dfdByteOffset + header.dfdByteLength;
+    header.kvdByteLength = static_cast<uint32_t>(kvd.size());
+
+    // Levels go smallest first, each aligned to the lcm of the block size and 4
+    uint64_t alignment = format.blockBytes % 4 == 0 ? format.blockBytes : format.blockBytes * 4;
+    std::vector<Ktx2LevelIndex> index(levelCount);
+    uint64_t offset = header.kvdByteOffset + header.kvdByteLength;
+    for(uint32_t level = levelCount; level-- > 0;) {
+        offset = (offset + alignment - 1) / alignment * alignment;
+        index[level].byteOffset             = offset;
+        index[level].byteLength             = levels[level].size();
+        index[level].uncompressedByteLength = levels[level].size();
+        offset += levels[level].size();
+    }
+
+    std::vector<uint8_t> file(offset, 0);
+    std::memcpy(file.data(), &header, sizeof(header));
+    std::memcpy(file.data() + sizeof(header), index.data(), sizeof(Ktx2LevelIndex) * levelCount);
+    std::memcpy(file.data() + header.dfdByteOffset, dfd.data(), dfd.size());
+    std::memcpy(file.data() + header.kvdByteOffset, kvd.data(), kvd.size());
+    for(uint32_t level = 0; level < levelCount; level++) {
+        std::memcpy(file.data() + index[level].byteOffset, levels[level].data(), levels[level].size());
+    }
+
+    std::ofstream out(path, std::ios::binary);
+    if(!out.write(reinterpret_cast<const char*>(file.data()), file.size())) {
+        throw std::runtime_error("failed to write " + path);
+    }
+}
+
+int main(int argc, char** argv) {
+    std::vector<std::string> args(argv + 1, argv + argc);
+    std::string formatName = "bc7";
+    bool variants = false;
+    while(!args.empty() && args[0].compare(0, 2, "--") == 0) {
+        if(args[0] == "--format" && args.size() > 1) {
+            formatName = args[1];
+            args.erase(args.begin(), args.begin() + 2);
+        }
+        else if(args[0] == "--variants") {
+            variants = true;
+            args.erase(args.begin());
+        }
+        else {
+            break;
+        }
+    }
+
+    bool knownFormat = formatName == "bc7" || formatName == "bc1" || formatName == "rgba8";
+    if(args.size() < 2 || (variants && args.size() != 2) || !knownFormat || !endsWith(args.back(), ".ktx2")) {
+        std::cerr << "usage: " << argv[0] << " [--format bc7|bc1|rgba8] [--variants] input.jpg [more layers...] output.ktx2\n";
+        return EXIT_FAILURE;
+    }
+
+    try {
+        // Color textures, always the sRGB variant of the format
+        const Ktx2FormatInfo* format = nullptr;
+        for(const Ktx2FormatInfo& info : KTX2_FORMATS) {
+            if(info.srgb && formatName == info.name) {
+                format = &info;
+            }
+        }
+
+        auto start = std::chrono::high_resolution_clock::now();
+
+        Texture texture = loadLayers(std::vector<std::string>(args.begin(), args.end() - 1), variants);
+        uint32_t levels = mipLevelCount(texture.width, texture.height);
+        std::vector<uint8_t> chain = buildMipChain(texture.pixels, texture.width, texture.height, texture.layers, levels);
+
+        auto encodeStart = std::chrono::high_resolution_clock::now();
+        std::vector<std::vector<uint8_t>> encoded = encodeLevels(chain, *format, texture.width, texture.height,
+                                                                 texture.layers, levels);
+        std::chrono::duration<double, std::milli> encodeTime = std::chrono::high_resolution_clock::now() - encodeStart;
+
+        writeKtx2(args.back(), *format, texture.width, texture.height, texture.layers, encoded);
+
+        size_t bytes = 0;
+        for(const std::vector<uint8_t>& level : encoded) {
+            bytes += level.size();
+        }
+        std::chrono::duration<double, std::milli> elapsed = std::chrono::high_resolution_clock::now() - start;
+        std::cerr << texture.width << "x" << texture.height << "x" << texture.layers << ", " << levels << " levels, "
+                  << format->name << ": " << bytes / 1024 << " KiB, level 0 PSNR "
+                  << levelZeroPsnr(texture.pixels, encoded[0], *format, texture.width, texture.height, texture.layers)
+                  << " dB, encoded in " << encodeTime.count() << " ms on " << std::thread::hardware_concurrency()
+                  << " threads, converted in " << elapsed.count() << " ms\n";
+    } catch(const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,99 @@
+#pragma once
+
+// Vertex layouts described as a type list, everything Vulkan needs is derived at compile time:
+//
+//   using PackedVertexLayout = VertexLayout<Attribute<0, Snorm16x4>, Attribute<1, Unorm8x4>, Attribute<2, Half2>>;
+//   PackedVertexLayout::stride                        16
+//   PackedVertexLayout::offset<1>()                   8
+//   PackedVertexLayout::bindingDescription(0)         VkVertexInputBindingDescription
+//   PackedVertexLayout::attributeDescriptions(0)      std::array<VkVertexInputAttributeDescription, 3>
+//   PackedVertexLayout::encode<0>(vertex, floats)     packs one attribute of one vertex
+//
+// Attributes are tightly packed in list order, every format is a multiple of 4 bytes.
+
+#include "vertex_packing.h"
+
+#include <array>
+#include <tuple>
+#include <cstddef>
+
+// Each format knows its VkFormat, its size and its MeshAttributeFormat so it can be packed with
+// encodeMeshAttribute. Formats without a mesh equivalent can't be encoded, only described.
+struct Float2    { static constexpr VkFormat vkFormat = VK_FORMAT_R32G32_SFLOAT;       static constexpr uint32_t size = 8;  static constexpr uint32_t meshFormat = MESH_FORMAT_FLOAT2; };
+struct Float3    { static constexpr VkFormat vkFormat = VK_FORMAT_R32G32B32_SFLOAT;    static constexpr uint32_t size = 12; static constexpr uint32_t meshFormat = MESH_FORMAT_FLOAT3; };
+struct Float4    { static constexpr VkFormat vkFormat = VK_FORMAT_R32G32B32A32_SFLOAT; static constexpr uint32_t size = 16; static constexpr uint32_t meshFormat = MESH_FORMAT_FLOAT4; };
+struct Snorm16x4 { static constexpr VkFormat vkFormat = VK_FORMAT_R16G16B16A16_SNORM;  static constexpr uint32_t size = 8;  static constexpr uint32_t meshFormat = MESH_FORMAT_SNORM16X4; };
+struct Half4     { static constexpr VkFormat vkFormat = VK_FORMAT_R16G16B16A16_SFLOAT; static constexpr uint32_t size = 8;  static constexpr uint32_t meshFormat = MESH_FORMAT_HALF4; };
+struct Half2     { static constexpr VkFormat vkFormat = VK_FORMAT_R16G16_SFLOAT;       static constexpr uint32_t size = 4;  static constexpr uint32_t meshFormat = MESH_FORMAT_HALF2; };
+struct Unorm8x4  { static constexpr VkFormat vkFormat = VK_FORMAT_R8G8B8A8_UNORM;      static constexpr uint32_t size = 4;  static constexpr uint32_t meshFormat = MESH_FORMAT_UNORM8X4; };
+struct Oct16     { static constexpr VkFormat vkFormat = VK_FORMAT_R16G16_SNORM;        static constexpr uint32_t size = 4;  static constexpr uint32_t meshFormat = MESH_FORMAT_OCT16; };
+struct Uint32    { static constexpr VkFormat vkFormat = VK_FORMAT_R32_UINT;            static constexpr uint32_t size = 4;  static constexpr uint32_t meshFormat = ~0u; };
+
+template<uint32_t Location, typename Format>
+struct Attribute {
+    static constexpr uint32_t location = Location;
+    using format = Format;
+
+    static_assert(Format::size % 4 == 0, "attributes have to stay 4 byte aligned");
+};
+
+template<typename... Attributes>
+struct VertexLayout {
+    static constexpr size_t attributeCount = sizeof...(Attributes);
+    static_assert(attributeCount > 0, "a vertex layout needs at least one attribute");
+
+    template<size_t I>
+    using attribute = typename std::tuple_element<I, std::tuple<Attributes...>>::type;
+
+    static constexpr std::array<uint32_t, attributeCount> offsets() {
+        std::array<uint32_t, attributeCount> result{};
+        const uint32_t sizes[] = {Attributes::format::size...};
+        uint32_t offset = 0;
+        for(size_t i = 0; i < attributeCount; i++) {
+            result[i] = offset;
+            offset += sizes[i];
+        }
+        return result;
+    }
+
+    static constexpr uint32_t stride = (0 + ... + Attributes::format::size);
+
+    template<size_t I>
+    static constexpr uint32_t offset() {
+        return offsets()[I];
+    }
+
+    static VkVertexInputBindingDescription bindingDescription(uint32_t binding,
+                                                              VkVertexInputRate inputRate = VK_VERTEX_INPUT_RATE_VERTEX) {
+
+        VkVertexInputBindingDescription bindingDescription{};
+        bindingDescription.binding   = binding;
+        bindingDescription.stride    = stride;
+        bindingDescription.inputRate = inputRate;
+
+        return bindingDescription;
+    }
+
+    static std::array<VkVertexInputAttributeDescription, attributeCount> attributeDescriptions(uint32_t binding) {
+        std::array<VkVertexInputAttributeDescription, attributeCount> attributeDescriptions{};
+        const uint32_t locations[] = {Attributes::location...};
+        const VkFormat formats[]   = {Attributes::format::vkFormat...};
+        constexpr auto attributeOffsets = offsets();
+
+        for(size_t i = 0; i < attributeCount; i++) {
+            attributeDescriptions[i].binding  = binding;
+            attributeDescriptions[i].location = locations[i];
+            attributeDescriptions[i].format   = formats[i];
+            attributeDescriptions[i].offset   = attributeOffsets[i];
+        }
+
+        return attributeDescriptions;
+    }
+
+    template<size_t I>
+    static void encode(uint8_t* vertex, const float* value) {
+        using Format = typename attribute<I>::format;
+        static_assert(Format::meshFormat != ~0u, "this format has no encoder");
+        encodeMeshAttribute(Format::meshFormat, value, vertex + offset<I>());
+    }
+};
@@ -0,0 +1,195 @@
+#pragma once
+
+// Scalar encoders/decoders behind the packed vertex formats, shared by the renderer and tools/meshconv.
+// No Vulkan in here, vertex_layout.h maps the formats to VkFormats.
+
+#include "mesh_format.h"
+
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+
+inline int16_t packSnorm16(float value) {
+    return static_cast<int16_t>(std::lround(std::min(std::max(value, -1.0f), 1.0f) * 32767.0f));
+}
+
+inline float unpackSnorm16(int16_t value) {
+    return std::max(value / 32767.0f, -1.0f);
+}
+
+inline uint8_t packUnorm8(float value) {
+    return static_cast<uint8_t>(std::lround(std::min(std::max(value, 0.0f), 1.0f) * 255.0f));
+}
+
+// IEEE 754 binary16, round to nearest even, overflow goes to infinity and tiny values to subnormals
+inline uint16_t packHalf(float value) {
+    uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+
+    uint32_t sign     = (bits >> 16) & 0x8000;
+    uint32_t exponent = (bits >> 23) & 0xff;
+    uint32_t mantissa = bits & 0x7fffff;
+
+    if(exponent == 0xff) {
+        return static_cast<uint16_t>(sign | 0x7c00 | (mantissa ? 0x200 : 0));
+    }
+
+    int32_t halfExponent = static_cast<int32_t>(exponent) - 127 + 15;
+    if(halfExponent >= 0x1f) {
+        return static_cast<uint16_t>(sign | 0x7c00);
+    }
+    if(halfExponent <= 0) {
+        if(halfExponent < -10) {
+            return static_cast<uint16_t>(sign);
+        }
+        mantissa |= 0x800000;
+        uint32_t shift = static_cast<uint32_t>(14 - halfExponent);
+        uint32_t half  = mantissa >> shift;
+        uint32_t rest  = mantissa & ((1u << shift) - 1);
+        uint32_t halfway = 1u << (shift - 1);
+        if(rest > halfway || (rest == halfway && (half & 1))) {
+            half++;
+        }
+        return static_cast<uint16_t>(sign | half);
+    }
+
+    uint32_t half = sign | (static_cast<uint32_t>(halfExponent) << 10) | (mantissa >> 13);
+    uint32_t rest = mantissa & 0x1fff;
+    if(rest > 0x1000 || (rest == 0x1000 && (half & 1))) {
+        half++;     // may carry into the exponent, which is still the right answer
+    }
+    return static_cast<uint16_t>(half);
+}
+
+inline float unpackHalf(uint16_t half) {
+    uint32_t sign     = (half & 0x8000u) << 16;
+    uint32_t exponent = (half >> 10) & 0x1f;
+    uint32_t mantissa = half & 0x3ff;
+
+    uint32_t bits;
+    if(exponent == 0x1f) {
+        bits = sign | 0x7f800000 | (mantissa << 13);
+    }
+    else if(exponent != 0) {
+        bits = sign | ((exponent + 127 - 15) << 23) | (mantissa << 13);
+    }
+    else if(mantissa == 0) {
+        bits = sign;
+    }
+    else {
+        // Subnormal half, normalize it for the float
+        exponent = 127 - 15 + 1;
+        while((mantissa & 0x400) == 0) {
+            mantissa <<= 1;
+            exponent--;
+        }
+        bits = sign | (exponent << 23) | ((mantissa & 0x3ff) << 13);
+    }
+
+    float value;
+    std::memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+// Unit vector to two snorm16s on the octahedron folded into a square, decode with
+// n = vec3(e, 1 - |e.x| - |e.y|); if(n.z < 0) n.xy = (1 - |n.yx|) * sign(n.xy); normalize(n)
+inline void packOctahedral(const float normal[3], int16_t out[2]) {
+    float l1 = std::fabs(normal[0]) + std::fabs(normal[1]) + std::fabs(normal[2]);
+    float x = l1 > 0.0f ? normal[0] / l1 : 0.0f;
+    float y = l1 > 0.0f ? normal[1] / l1 : 0.0f;
+
+    if(normal[2] < 0.0f) {
+        float foldedX = (1.0f - std::fabs(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+        float foldedY = (1.0f - std::fabs(x)) * (y >= 0.0f ? 1.0f : -1.0f);
+        x = foldedX;
+        y = foldedY;
+    }
+
+    out[0] = packSnorm16(x);
+    out[1] = packSnorm16(y);
+}
+
+// Writes one attribute from up to four floats, SNORM16X4 positions must already be in [-1, 1]
+inline void encodeMeshAttribute(uint32_t format, const float* value, uint8_t* out) {
+    switch(format) {
+        case MESH_FORMAT_FLOAT2:
+            std::memcpy(out, value, 8);
+            break;
+        case MESH_FORMAT_FLOAT3:
+            std::memcpy(out, value, 12);
+            break;
+        case MESH_FORMAT_FLOAT4:
+            std::memcpy(out, value, 16);
+            break;
+        case MESH_FORMAT_SNORM16X4: {
+            int16_t packed[4] = {packSnorm16(value[0]), packSnorm16(value[1]), packSnorm16(value[2]), 32767};
+            std::memcpy(out, packed, sizeof(packed));
+            break;
+        }
+        case MESH_FORMAT_HALF4: {
+            uint16_t packed[4] = {packHalf(value[0]), packHalf(value[1]), packHalf(value[2]), packHalf(1.0f)};
+            std::memcpy(out, packed, sizeof(packed));
+            break;
+        }
+        case MESH_FORMAT_HALF2: {
+            uint16_t packed[2] = {packHalf(value[0]), packHalf(value[1])};
+            std::memcpy(out, packed, sizeof(packed));
+            break;
+        }
+        case MESH_FORMAT_UNORM8X4: {
+            uint8_t packed[4] = {packUnorm8(value[0]), packUnorm8(value[1]), packUnorm8(value[2]), 255};
+            std::memcpy(out, packed, sizeof(packed));
+            break;
+        }
+        case MESH_FORMAT_OCT16: {
+            int16_t packed[2];
+            packOctahedral(value, packed);
+            std::memcpy(out, packed, sizeof(packed));
+            break;
+        }
+    }
+}
+
+// Reads one attribute back as four floats, what the vertex shader would see. OCT16 stays encoded.
+inline void decodeMeshAttribute(uint32_t format, const uint8_t* data, float out[4]) {
+    out[0] = out[1] = out[2] = 0.0f;
+    out[3] = 1.0f;
+
+    switch(format) {
+        case MESH_FORMAT_FLOAT2:
+            std::memcpy(out, data, 8);
+            break;
+        case MESH_FORMAT_FLOAT3:
+            std::memcpy(out, data, 12);
+            break;
+        case MESH_FORMAT_FLOAT4:
+            std::memcpy(out, data, 16);
+            break;
+        case MESH_FORMAT_SNORM16X4:
+        case MESH_FORMAT_OCT16: {
+            int16_t packed[4];
+            uint32_t count = format == MESH_FORMAT_OCT16 ? 2 : 4;
+            std::memcpy(packed, data, count * sizeof(int16_t));
+            for(uint32_t i = 0; i < count; i++) {
+                out[i] = unpackSnorm16(packed[i]);
+            }
+            break;
+        }
+        case MESH_FORMAT_HALF4:
+        case MESH_FORMAT_HALF2: {
+            uint16_t packed[4];
+            uint32_t count = format == MESH_FORMAT_HALF2 ? 2 : 4;
+            std::memcpy(packed, data, count * sizeof(uint16_t));
+            for(uint32_t i = 0; i < count; i++) {
+                out[i] = unpackHalf(packed[i]);
+            }
+            break;
+        }
+        case MESH_FORMAT_UNORM8X4:
+            for(uint32_t i = 0; i < 4; i++) {
+                out[i] = data[i] / 255.0f;
+            }
+            break;
+    }
+}